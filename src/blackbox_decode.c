@@ -39,10 +39,29 @@
 #include "units.h"
 #include "stats.h"
 #include "semver.h"
+#include "outputstream.h"
+#include "formatpool.h"
+#include "logcache.h"
+#include "zonemap.h"
+#include "expression.h"
+#include "fft.h"
+#include "decodesink.h"
+#include "segments.h"
+#include "spectrum.h"
+#include "stepresponse.h"
+#include "ndjson.h"
 
 
 #define MIN_GPS_SATELLITES 5
 
+// Number of main log rows batched up into each block that is handed to the CSV formatting threads
+#define CSV_ROWS_PER_BLOCK 256
+
+typedef enum {
+    OUTPUT_FORMAT_CSV,
+    OUTPUT_FORMAT_NDJSON
+} OutputFormat;
+
 typedef struct decodeOptions_t {
     int help, raw, limits, debug, toStdout;
     int logNumber;
@@ -51,12 +70,29 @@ typedef struct decodeOptions_t {
     int includeIMUDegrees;
     int simulateCurrentMeter;
     int mergeGPS;
+    int useCache;
+    int zoneMap;
+    int segments;
+    int statsJson;
+    int spectrum;
+    int spectrumWindow;
+    int stepResponse;
+    int compressionLevel;
+    int threads;
+    int context;
     const char *outputPrefix;
     const char *outputDir;
+    const char *emit;
+    const char *query;
+    const char *where;
+    const char *segmentFields;
+    const char *spectrumFields;
+    OutputFormat format;
 
     bool overrideSimCurrentMeterOffset, overrideSimCurrentMeterScale;
     int16_t simCurrentMeterOffset, simCurrentMeterScale;
     float altOffset;
+    double magneticDeclination;
 
     Unit unitGPSSpeed, unitFrameTime, unitVbat, unitAmperage, unitHeight, unitAcceleration, unitRotation, unitFlags, unitDegrees;
 } decodeOptions_t;
@@ -69,7 +105,17 @@ decodeOptions_t options = {
     .saveHeaders = false,
     .simulateCurrentMeter = false,
     .mergeGPS = 0,
+    .useCache = 0,
+    .zoneMap = 0,
+    .statsJson = 0,
+    .spectrum = 0,
+    .spectrumWindow = 1024,
+    .stepResponse = 0,
+    .compressionLevel = OUTPUT_STREAM_COMPRESSION_NONE,
+    .threads = 1,
+    .context = 0,
     .altOffset = 0,
+    .magneticDeclination = 0,
 
     .overrideSimCurrentMeterOffset = false,
     .overrideSimCurrentMeterScale = false,
@@ -78,6 +124,12 @@ decodeOptions_t options = {
 
     .outputPrefix = NULL,
     .outputDir = NULL,
+    .emit = NULL,
+    .query = NULL,
+    .where = NULL,
+    .segmentFields = "rcCommand[3],motor[*],vbatLatest,amperageLatest",
+    .spectrumFields = "gyroADC[*],axisD[*],motor[*]",
+    .format = OUTPUT_FORMAT_CSV,
 
     .unitGPSSpeed = UNIT_METERS_PER_SECOND,
     .unitFrameTime = UNIT_MICROSECONDS,
@@ -104,20 +156,33 @@ static GPSFieldType gpsFieldTypes[FLIGHT_LOG_MAX_FIELDS];
 static int64_t lastFrameTime;
 static uint32_t lastFrameIteration;
 
-static FILE *csvFile = 0, *eventFile = 0, *gpsCsvFile = 0, *headersFile = 0;
+static outputStream_t *eventFile = 0, *gpsCsvFile = 0, *headersFile = 0;
 static char *eventFilename = 0, *gpsCsvFilename = 0;
+static outputStreamStatistics_t outputStats;
+
+// Set once any output file couldn't be written in full, so the decoder can exit with an error at the end
+static bool outputFailed;
 static gpxWriter_t *gpx = 0;
 
-// Computed states:
-static currentMeterState_t currentMeterMeasured;
-static currentMeterState_t currentMeterVirtual;
-static attitude_t attitude;
+static outputNaming_t outputNaming;
+
+static simulationState_t simulation;
+
+/*
+ * GPS merging has always fed the simulations each frame's own time, and the other outputs the time of the frame before,
+ * so the merged CSV runs simulations of its own. That way what one output writes doesn't depend on the others.
+ */
+static simulationState_t mergeSimulation;
 
 static Unit mainFieldUnit[FLIGHT_LOG_MAX_FIELDS];
 static Unit gpsGFieldUnit[FLIGHT_LOG_MAX_FIELDS];
 static Unit slowFieldUnit[FLIGHT_LOG_MAX_FIELDS];
 
 static int64_t bufferedSlowFrame[FLIGHT_LOG_MAX_FIELDS];
+
+static decodeSinkContext_t sinkContext;
+
+// State for merging GPS data into the main CSV:
 static int64_t bufferedMainFrame[FLIGHT_LOG_MAX_FIELDS];
 static bool haveBufferedMainFrame;
 
@@ -126,10 +191,89 @@ static uint32_t bufferedFrameIteration;
 
 static int64_t bufferedGPSFrame[FLIGHT_LOG_MAX_FIELDS];
 
+// The slow frame and computed states that go along with the buffered main frame:
+static int64_t bufferedMergeSlowFrame[FLIGHT_LOG_MAX_FIELDS];
+static simulationState_t bufferedMergeSimulation;
+
 static seriesStats_t looptimeStats;
+static quantileSketch_t looptimeQuantiles;
+
+// The distributions of the looptime and of every main field, collected only when something is going to report them:
+static bool trackFieldDistributions;
+static int fieldDistributionCount;
+static seriesStats_t fieldStats[FLIGHT_LOG_MAX_FIELDS];
+static quantileSketch_t fieldQuantiles[FLIGHT_LOG_MAX_FIELDS];
+
+// A main frame that didn't match --where, kept in case it's needed as context before a frame that does:
+typedef struct filterContextFrame_t {
+    bool frameValid, haveFrame;
+    uint8_t frameType;
+    int frameOffset, frameSize;
+
+    // The shared state that the sinks read, as it was when this frame arrived
+    int64_t frameTime;
+    uint32_t frameIteration;
+    simulationState_t simulation, mergeSimulation;
+    int64_t slowFrame[FLIGHT_LOG_MAX_FIELDS];
+
+    int64_t frame[FLIGHT_LOG_MAX_FIELDS];
+} filterContextFrame_t;
+
+typedef struct rowFilter_t {
+    expression_t *expression;
+
+    // A ring of the last (up to options.context) frames that weren't written
+    filterContextFrame_t *skipped;
+    int skippedStart, skippedCount;
+
+    // How many more frames to write as context after the last match
+    int contextRemaining;
+
+    // False if the most recent main frame was filtered out
+    bool lastFrameWritten;
+
+    int64_t framesMatched, framesSeen;
+} rowFilter_t;
+
+static rowFilter_t rowFilter;
+
+/*
+ * A main CSV row, captured along with the computed state that was current when it was logged, so that it can be
+ * formatted later on a worker thread.
+ */
+typedef struct csvRow_t {
+    simulationState_t simulation;
+    int64_t frameTime;
+
+    // The main frame fields, followed by the slow frame fields, then the GPS fields (when merging GPS)
+    int64_t fields[];
+} csvRow_t;
+
+typedef struct csvRowBlock_t {
+    int rowCount;
+
+    // CSV_ROWS_PER_BLOCK rows of the writer's rowSize bytes each
+    int64_t rows[];
+} csvRowBlock_t;
+
+/**
+ * A main CSV output file. Its rows are either formatted directly or handed off to a pool of formatting threads.
+ */
+typedef struct csvWriter_t {
+    flightLog_t *log;
+    outputStream_t *file;
+
+    // Set if each row has the GPS fields appended to it (--merge-gps)
+    bool includeGPS;
+
+    formatPool_t *pool;
+    csvRowBlock_t *block; // The block we're currently adding rows to, if any
+    size_t rowSize;
+} csvWriter_t;
+
+static csvWriter_t mainCsv, mergedCsv;
 
-#define ADJUSTMENT_FUNCTION_COUNT 21
-static char *INFLIGHT_ADJUSTMENT_FUNCTIONS[ADJUSTMENT_FUNCTION_COUNT] = {
+const char *const INFLIGHT_ADJUSTMENT_FUNCTIONS[] = {
         "NONE",
         "RC_RATE",
         "RC_EXPO",
@@ -152,14 +296,16 @@ static char *INFLIGHT_ADJUSTMENT_FUNCTIONS[ADJUSTMENT_FUNCTION_COUNT] = {
         "ROLL_I",
         "ROLL_D"};
 
-static void fprintfMilliampsInUnit(FILE *file, int32_t milliamps, Unit unit)
+const int INFLIGHT_ADJUSTMENT_FUNCTION_COUNT = ARRAY_LENGTH(INFLIGHT_ADJUSTMENT_FUNCTIONS);
+
+void fprintfMilliampsInUnit(outputStream_t *file, int32_t milliamps, Unit unit)
 {
     switch (unit) {
         case UNIT_AMPS:
-            fprintf(file, "%.3f", milliamps / 1000.0);
+            outputStreamPrintf(file, "%.3f", milliamps / 1000.0);
         break;
         case UNIT_MILLIAMPS:
-            fprintf(file, "%d", milliamps);
+            outputStreamPrintf(file, "%d", milliamps);
         break;
         default:
             fprintf(stderr, "Bad amperage unit %d\n", (int) unit);
@@ -168,17 +314,17 @@ static void fprintfMilliampsInUnit(FILE *file, int32_t milliamps, Unit unit)
     }
 }
 
-static void fprintfMicrosecondsInUnit(FILE *file, int64_t microseconds, Unit unit)
+void fprintfMicrosecondsInUnit(outputStream_t *file, int64_t microseconds, Unit unit)
 {
     switch (unit) {
         case UNIT_MICROSECONDS:
-            fprintf(file, "%" PRId64, microseconds);
+            outputStreamPrintf(file, "%" PRId64, microseconds);
         break;
         case UNIT_MILLISECONDS:
-            fprintf(file, "%.3f", microseconds / 1000.0);
+            outputStreamPrintf(file, "%.3f", microseconds / 1000.0);
         break;
         case UNIT_SECONDS:
-            fprintf(file, "%.6f", microseconds / 1000000.0);
+            outputStreamPrintf(file, "%.6f", microseconds / 1000000.0);
         break;
         default:
             fprintf(stderr, "Bad time unit %d\n", (int) unit);
@@ -187,7 +333,7 @@ static void fprintfMicrosecondsInUnit(FILE *file, int64_t microseconds, Unit uni
     }
 }
 
-static bool fprintfMainFieldInUnit(flightLog_t *log, FILE *file, int fieldIndex, int64_t fieldValue, Unit unit)
+bool fprintfMainFieldInUnit(flightLog_t *log, outputStream_t *file, int fieldIndex, int64_t fieldValue, Unit unit)
 {
     /* Convert the fieldValue to the given unit based on the original unit of the field (that we decide on by looking
      * for a well-known field that corresponds to the given fieldIndex.)
@@ -195,65 +341,65 @@ static bool fprintfMainFieldInUnit(flightLog_t *log, FILE *file, int fieldIndex,
     switch (unit) {
         case UNIT_MILLIVOLTS:
             // Betaflight already does the ADC conversion
-            fprintf(file, "%3u", (int32_t) fieldValue * 100);
+            outputStreamPrintf(file, "%3u", (int32_t) fieldValue * 100);
             return true;
         case UNIT_VOLTS:
             // Betaflight already does the ADC conversion
             // vbat scaling changed in firmware 4.3.0 - use different scaling for older versions
             if (semver_gte_string(log->private->fcVersion, "4.3.0")) {
-                fprintf(file, "%.2f", (double) fieldValue / 100);
+                outputStreamPrintf(file, "%.2f", (double) fieldValue / 100);
             } else {
-                fprintf(file, "%.1f", (double) fieldValue / 10);
+                outputStreamPrintf(file, "%.1f", (double) fieldValue / 10);
             }
             return true;
         case UNIT_MILLIAMPS:
             // Betaflight already does the ADC conversion
-            fprintf(file, "%3u", (int32_t) fieldValue * 10);
+            outputStreamPrintf(file, "%3u", (int32_t) fieldValue * 10);
             return true;
         case UNIT_AMPS:
             // Betaflight already does the ADC conversion
-            fprintf(file, "%.2f", (double) fieldValue / 100);
+            outputStreamPrintf(file, "%.2f", (double) fieldValue / 100);
             return true;
         break;
         case UNIT_CENTIMETERS:
             if (fieldIndex == log->mainFieldIndexes.BaroAlt) {
-                fprintf(file, "%" PRId64, fieldValue);
+                outputStreamPrintf(file, "%" PRId64, fieldValue);
                 return true;
             }
         break;
         case UNIT_METERS:
             if (fieldIndex == log->mainFieldIndexes.BaroAlt) {
-                fprintf(file, "%.2f", (double) fieldValue / 100);
+                outputStreamPrintf(file, "%.2f", (double) fieldValue / 100);
                 return true;
             }
         break;
         case UNIT_FEET:
             if (fieldIndex == log->mainFieldIndexes.BaroAlt) {
-                fprintf(file, "%.2f", (double) fieldValue / 100 * FEET_PER_METER);
+                outputStreamPrintf(file, "%.2f", (double) fieldValue / 100 * FEET_PER_METER);
                 return true;
             }
         break;
         case UNIT_DEGREES_PER_SECOND:
             if (fieldIndex >= log->mainFieldIndexes.gyroADC[0] && fieldIndex <= log->mainFieldIndexes.gyroADC[2]) {
-                fprintf(file, "%.2f", flightlogGyroToRadiansPerSecond(log, fieldValue) * (180 / M_PI));
+                outputStreamPrintf(file, "%.2f", flightlogGyroToRadiansPerSecond(log, fieldValue) * (180 / M_PI));
                 return true;
             }
         break;
         case UNIT_RADIANS_PER_SECOND:
             if (fieldIndex >= log->mainFieldIndexes.gyroADC[0] && fieldIndex <= log->mainFieldIndexes.gyroADC[2]) {
-                fprintf(file, "%.2f", flightlogGyroToRadiansPerSecond(log, fieldValue));
+                outputStreamPrintf(file, "%.2f", flightlogGyroToRadiansPerSecond(log, fieldValue));
                 return true;
             }
         break;
         case UNIT_METERS_PER_SECOND_SQUARED:
             if (fieldIndex >= log->mainFieldIndexes.accSmooth[0] && fieldIndex <= log->mainFieldIndexes.accSmooth[2]) {
-                fprintf(file, "%.2f", flightlogAccelerationRawToGs(log, fieldValue) * ACCELERATION_DUE_TO_GRAVITY);
+                outputStreamPrintf(file, "%.2f", flightlogAccelerationRawToGs(log, fieldValue) * ACCELERATION_DUE_TO_GRAVITY);
                 return true;
             }
         break;
         case UNIT_GS:
             if (fieldIndex >= log->mainFieldIndexes.accSmooth[0] && fieldIndex <= log->mainFieldIndexes.accSmooth[2]) {
-                fprintf(file, "%.2f", flightlogAccelerationRawToGs(log, fieldValue));
+                outputStreamPrintf(file, "%.2f", flightlogAccelerationRawToGs(log, fieldValue));
                 return true;
             }
         break;
@@ -267,9 +413,9 @@ static bool fprintfMainFieldInUnit(flightLog_t *log, FILE *file, int fieldIndex,
         break;
         case UNIT_RAW:
             if (log->frameDefs['I'].fieldSigned[fieldIndex] || options.raw) {
-                fprintf(file, "%3d", (int32_t) fieldValue);
+                outputStreamPrintf(file, "%3d", (int32_t) fieldValue);
             } else {
-                fprintf(file, "%3u", (uint32_t) fieldValue);
+                outputStreamPrintf(file, "%3u", (uint32_t) fieldValue);
             }
             return true;
         break;
@@ -281,14 +427,16 @@ static bool fprintfMainFieldInUnit(flightLog_t *log, FILE *file, int fieldIndex,
     return false;
 }
 
-void onEvent(flightLog_t *log, flightLogEvent_t *event)
+static void eventsSinkOnEvent(flightLog_t *log, flightLogEvent_t *event)
 {
+    int adjustmentFunction;
+
     (void) log;
 
     // Open the event log if it wasn't open already
     if (!eventFile) {
         if (eventFilename) {
-            eventFile = fopen(eventFilename, "wb");
+            eventFile = outputStreamOpen(eventFilename, options.compressionLevel);
 
             if (!eventFile) {
                 fprintf(stderr, "Failed to create event log file %s\n", eventFilename);
@@ -302,27 +450,38 @@ void onEvent(flightLog_t *log, flightLogEvent_t *event)
 
     switch (event->event) {
         case FLIGHT_LOG_EVENT_SYNC_BEEP:
-            fprintf(eventFile, "{\"name\":\"Sync beep\", \"time\":%" PRId64 "}\n", event->data.syncBeep.time);
+            outputStreamPrintf(eventFile, "{\"name\":\"Sync beep\", \"time\":%" PRId64 "}\n", event->data.syncBeep.time);
         break;
         case FLIGHT_LOG_EVENT_INFLIGHT_ADJUSTMENT:
-            fprintf(eventFile, "{\"name\":\"Inflight adjustment\", \"time\":%" PRId64 ", \"data\":{\"adjustmentFunction\":\"%s\",\"value\":", lastFrameTime,
-                    INFLIGHT_ADJUSTMENT_FUNCTIONS[event->data.inflightAdjustment.adjustmentFunction & 127]);
+            adjustmentFunction = event->data.inflightAdjustment.adjustmentFunction & 127;
+
+            outputStreamPrintf(eventFile, "{\"name\":\"Inflight adjustment\", \"time\":%" PRId64 ", \"data\":{\"adjustmentFunction\":", lastFrameTime);
+
+            // Functions that are newer than this decoder (or corrupt) are written as their number
+            if (adjustmentFunction < INFLIGHT_ADJUSTMENT_FUNCTION_COUNT) {
+                outputStreamPrintf(eventFile, "\"%s\"", INFLIGHT_ADJUSTMENT_FUNCTIONS[adjustmentFunction]);
+            } else {
+                outputStreamPrintf(eventFile, "%d", adjustmentFunction);
+            }
+
+            outputStreamPrintf(eventFile, ",\"value\":");
+
             if (event->data.inflightAdjustment.adjustmentFunction > 127) {
-                fprintf(eventFile, "%g", event->data.inflightAdjustment.newFloatValue);
+                outputStreamPrintf(eventFile, "%g", event->data.inflightAdjustment.newFloatValue);
             } else {
-                fprintf(eventFile, "%d", event->data.inflightAdjustment.newValue);
+                outputStreamPrintf(eventFile, "%d", event->data.inflightAdjustment.newValue);
             }
-            fprintf(eventFile, "}}\n");
+            outputStreamPrintf(eventFile, "}}\n");
         break;
         case FLIGHT_LOG_EVENT_LOGGING_RESUME:
-            fprintf(eventFile, "{\"name\":\"Logging resume\", \"time\":%" PRId64 ", \"data\":{\"logIteration\":%d}}\n", event->data.loggingResume.currentTime,
+            outputStreamPrintf(eventFile, "{\"name\":\"Logging resume\", \"time\":%" PRId64 ", \"data\":{\"logIteration\":%d}}\n", event->data.loggingResume.currentTime,
                     event->data.loggingResume.logIteration);
         break;
         case FLIGHT_LOG_EVENT_LOG_END:
-            fprintf(eventFile, "{\"name\":\"Log clean end\", \"time\":%" PRId64 "}\n", lastFrameTime);
+            outputStreamPrintf(eventFile, "{\"name\":\"Log clean end\", \"time\":%" PRId64 "}\n", lastFrameTime);
         break;
         default:
-            fprintf(eventFile, "{\"name\":\"Unknown event\", \"time\":%" PRId64 ", \"data\":{\"eventID\":%d}}\n", lastFrameTime, event->event);
+            outputStreamPrintf(eventFile, "{\"name\":\"Unknown event\", \"time\":%" PRId64 ", \"data\":{\"eventID\":%d}}\n", lastFrameTime, event->event);
         break;
     }
 }
@@ -331,7 +490,7 @@ void onEvent(flightLog_t *log, flightLogEvent_t *event)
  * Print out a comma separated list of field names for the given frame (and field units if not raw),
  * minus the "time" field if `skipTime` is set.
  */
-void outputFieldNamesHeader(FILE *file, flightLogFrameDef_t *frame, Unit *fieldUnit, bool skipTime)
+void outputFieldNamesHeader(outputStream_t *file, flightLogFrameDef_t *frame, Unit *fieldUnit, bool skipTime)
 {
     bool needComma = false;
 
@@ -340,15 +499,15 @@ void outputFieldNamesHeader(FILE *file, flightLogFrameDef_t *frame, Unit *fieldU
             continue;
 
         if (needComma) {
-            fprintf(file, ", ");
+            outputStreamPrintf(file, ", ");
         } else {
             needComma = true;
         }
 
-        fprintf(file, "%s", frame->fieldName[i]);
+        outputStreamPrintf(file, "%s", frame->fieldName[i]);
 
         if (fieldUnit && fieldUnit[i] != UNIT_RAW) {
-            fprintf(file, " (%s)", UNIT_NAME[fieldUnit[i]]);
+            outputStreamPrintf(file, " (%s)", UNIT_NAME[fieldUnit[i]]);
         }
     }
 }
@@ -359,20 +518,20 @@ void outputFieldNamesHeader(FILE *file, flightLogFrameDef_t *frame, Unit *fieldU
 void createGPSCSVFile(flightLog_t *log)
 {
     if (!gpsCsvFile && gpsCsvFilename) {
-        gpsCsvFile = fopen(gpsCsvFilename, "wb");
+        gpsCsvFile = outputStreamOpen(gpsCsvFilename, options.compressionLevel);
 
         if (gpsCsvFile) {
             // Since the GPS frame itself may or may not include a timestamp field, skip it and print our own:
-            fprintf(gpsCsvFile, "time (%s), ", UNIT_NAME[options.unitFrameTime]);
+            outputStreamPrintf(gpsCsvFile, "time (%s), ", UNIT_NAME[options.unitFrameTime]);
 
             outputFieldNamesHeader(gpsCsvFile, &log->frameDefs['G'], gpsGFieldUnit, true);
 
-            fprintf(gpsCsvFile, "\n");
+            outputStreamPrintf(gpsCsvFile, "\n");
         }
     }
 }
 
-static void updateSimulations(flightLog_t *log, int64_t *frame, int64_t currentTime)
+static void updateSimulations(simulationState_t *state, flightLog_t *log, int64_t *frame, int64_t currentTime)
 {
     int16_t gyroADC[3];
     int16_t accSmooth[3];
@@ -396,13 +555,13 @@ static void updateSimulations(flightLog_t *log, int64_t *frame, int64_t currentT
             }
         }
 
-        updateEstimatedAttitude(gyroADC, accSmooth, hasMag && !options.imuIgnoreMag ? magADC : NULL,
-            currentTime, log->sysConfig.acc_1G, log->sysConfig.gyroScale, &attitude);
+        imuUpdateAttitude(&state->imu, gyroADC, accSmooth, hasMag && !options.imuIgnoreMag ? magADC : NULL,
+            currentTime, log->sysConfig.acc_1G, log->sysConfig.gyroScale, &state->attitude);
     }
 
     if (hasAmperageADC) {
         currentMeterUpdateMeasured(
-            &currentMeterMeasured,
+            &state->currentMeterMeasured,
             flightLogAmperageADCToMilliamps(log, frame[log->mainFieldIndexes.amperageLatest]),
             currentTime
         );
@@ -412,7 +571,7 @@ static void updateSimulations(flightLog_t *log, int64_t *frame, int64_t currentT
         int16_t throttle = frame[log->mainFieldIndexes.rcCommand[3]];
 
         currentMeterUpdateVirtual(
-            &currentMeterVirtual,
+            &state->currentMeterVirtual,
             options.overrideSimCurrentMeterOffset ? options.simCurrentMeterOffset : log->sysConfig.currentMeterOffset,
             options.overrideSimCurrentMeterScale ? options.simCurrentMeterScale : log->sysConfig.currentMeterScale,
             throttle,
@@ -422,55 +581,63 @@ static void updateSimulations(flightLog_t *log, int64_t *frame, int64_t currentT
 }
 
 /**
- * Print the GPS fields from the given GPS frame as comma-separated values (the GPS frame time is not printed).
+ * Print the value of the given GPS field in the display format for its type.
  */
-void outputGPSFields(flightLog_t *log, FILE *file, int64_t *frame)
+void outputGPSField(outputStream_t *file, int fieldIndex, int64_t value)
 {
     char negSign[] = "-";
     char noSign[] = "";
 
-    int i;
     int32_t degrees;
     uint32_t fracDegrees;
+
+    switch (gpsFieldTypes[fieldIndex]) {
+        case GPS_FIELD_TYPE_COORDINATE_DEGREES_TIMES_10000000:
+            degrees = value / 10000000;
+            fracDegrees = llabs(value) % 10000000;
+
+            char *sign = ((value < 0) && (degrees == 0)) ? negSign : noSign;
+            outputStreamPrintf(file, "%s%d.%07u", sign, degrees, fracDegrees);
+        break;
+        case GPS_FIELD_TYPE_DEGREES_TIMES_10:
+            outputStreamPrintf(file, "%" PRId64 ".%01u", value / 10, (unsigned) (llabs(value) % 10));
+        break;
+        case GPS_FIELD_TYPE_METERS_PER_SECOND_TIMES_100:
+            if (options.unitGPSSpeed == UNIT_RAW) {
+                outputStreamPrintf(file, "%" PRId64, value);
+            } else if (options.unitGPSSpeed == UNIT_METERS_PER_SECOND) {
+                outputStreamPrintf(file, "%" PRId64 ".%02u", value / 100, (unsigned) (llabs(value) % 100));
+            } else {
+                outputStreamPrintf(file, "%.2f", convertMetersPerSecondToUnit(value / 100.0, options.unitGPSSpeed));
+            }
+        break;
+        case GPS_FIELD_TYPE_METERS:
+            outputStreamPrintf(file, "%" PRId64, value);
+        break;
+        case GPS_FIELD_TYPE_INTEGER:
+        default:
+            outputStreamPrintf(file, "%" PRId64, value);
+    }
+}
+
+/**
+ * Print the GPS fields from the given GPS frame as comma-separated values (the GPS frame time is not printed).
+ */
+void outputGPSFields(flightLog_t *log, outputStream_t *file, int64_t *frame)
+{
     bool needComma = false;
 
-    for (i = 0; i < log->frameDefs['G'].fieldCount; i++) {
+    for (int i = 0; i < log->frameDefs['G'].fieldCount; i++) {
         //We've already printed the time:
         if (i == log->gpsFieldIndexes.time)
             continue;
 
         if (needComma)
-            fprintf(file, ", ");
+            outputStreamPrintf(file, ", ");
         else
             needComma = true;
 
-        switch (gpsFieldTypes[i]) {
-            case GPS_FIELD_TYPE_COORDINATE_DEGREES_TIMES_10000000:
-                degrees = frame[i] / 10000000;
-                fracDegrees = llabs(frame[i]) % 10000000;
-
-                char *sign = ((frame[i] < 0) && (degrees == 0)) ? negSign : noSign;
-                fprintf(file, "%s%d.%07u", sign, degrees, fracDegrees);
-            break;
-            case GPS_FIELD_TYPE_DEGREES_TIMES_10:
-                fprintf(file, "%" PRId64 ".%01u", frame[i] / 10, (unsigned) (llabs(frame[i]) % 10));
-            break;
-            case GPS_FIELD_TYPE_METERS_PER_SECOND_TIMES_100:
-                if (options.unitGPSSpeed == UNIT_RAW) {
-                    fprintf(file, "%" PRId64, frame[i]);
-                } else if (options.unitGPSSpeed == UNIT_METERS_PER_SECOND) {
-                    fprintf(file, "%" PRId64 ".%02u", frame[i] / 100, (unsigned) (llabs(frame[i]) % 100));
-                } else {
-                    fprintf(file, "%.2f", convertMetersPerSecondToUnit(frame[i] / 100.0, options.unitGPSSpeed));
-                }
-            break;
-            case GPS_FIELD_TYPE_METERS:
-                fprintf(file, "%" PRId64, frame[i]);
-            break;
-            case GPS_FIELD_TYPE_INTEGER:
-            default:
-                fprintf(file, "%" PRId64, frame[i]);
-        }
+        outputGPSField(file, i, frame[i]);
     }
 }
 
@@ -489,38 +656,7 @@ float getAltitude(flightLog_t *log, int64_t *frame)
             + options.altOffset; //Change [cm] to [m] for gpx format
 }
 
-void outputGPSFrame(flightLog_t *log, int64_t *frame)
-{
-    int64_t gpsFrameTime;
-
-    // If we're not logging every loop iteration, we include a timestamp field in the GPS frame:
-    if (log->gpsFieldIndexes.time != -1) {
-        gpsFrameTime = frame[log->gpsFieldIndexes.time];
-    } else {
-        // Otherwise this GPS frame was recorded at the same time as the main stream frame we read before the GPS frame:
-        gpsFrameTime = lastFrameTime;
-    }
-
-    bool haveRequiredFields = log->gpsFieldIndexes.GPS_coord[0] != -1 && log->gpsFieldIndexes.GPS_coord[1] != -1 && log->gpsFieldIndexes.GPS_altitude != -1;
-    bool haveRequiredPrecision = log->gpsFieldIndexes.GPS_numSat == -1 || frame[log->gpsFieldIndexes.GPS_numSat] >= MIN_GPS_SATELLITES;
-
-    if (haveRequiredFields && haveRequiredPrecision) {
-        gpxWriterAddPoint(gpx, log->dateTime, gpsFrameTime, frame[log->gpsFieldIndexes.GPS_coord[0]], frame[log->gpsFieldIndexes.GPS_coord[1]], getAltitude(log, frame));
-    }
-
-    createGPSCSVFile(log);
-
-    if (gpsCsvFile) {
-        fprintfMicrosecondsInUnit(gpsCsvFile, gpsFrameTime, options.unitFrameTime);
-        fprintf(gpsCsvFile, ", ");
-
-        outputGPSFields(log, gpsCsvFile, frame);
-
-        fprintf(gpsCsvFile, "\n");
-    }
-}
-
-void outputSlowFrameFields(flightLog_t *log, int64_t *frame)
+void outputSlowFrameFields(flightLog_t *log, outputStream_t *file, int64_t *frame)
 {
     enum {
         BUFFER_LEN = 1024
@@ -531,7 +667,7 @@ void outputSlowFrameFields(flightLog_t *log, int64_t *frame)
 
     for (int i = 0; i < log->frameDefs['S'].fieldCount; i++) {
         if (needComma) {
-            fprintf(csvFile, ", ");
+            outputStreamPrintf(file, ", ");
         } else {
             needComma = true;
         }
@@ -545,14 +681,14 @@ void outputSlowFrameFields(flightLog_t *log, int64_t *frame)
                 flightlogFlightStateToString(frame[i], buffer, BUFFER_LEN);
             }
 
-            fprintf(csvFile, "%s", buffer);
+            outputStreamPrintf(file, "%s", buffer);
         } else if (i == log->slowFieldIndexes.failsafePhase && options.unitFlags == UNIT_FLAGS) {
             flightlogFailsafePhaseToString(frame[i], buffer, BUFFER_LEN);
 
-            fprintf(csvFile, "%s", buffer);
+            outputStreamPrintf(file, "%s", buffer);
         } else {
             //Print raw
-            fprintf(csvFile, "%" PRIu64, (uint64_t) frame[i]);
+            outputStreamPrintf(file, "%" PRIu64, (uint64_t) frame[i]);
         }
     }
 }
@@ -561,15 +697,17 @@ void outputSlowFrameFields(flightLog_t *log, int64_t *frame)
  * Print out the fields from the main log stream in comma separated format.
  *
  * Provide (uint32_t) -1 for the frameTime in order to mark the frame time as unknown.
+ *
+ * The slow frame fields and the computed states are printed from `slowFrame` and `state`.
  */
-void outputMainFrameFields(flightLog_t *log, int64_t frameTime, int64_t *frame)
+void outputMainFrameFields(flightLog_t *log, outputStream_t *file, int64_t frameTime, int64_t *frame, int64_t *slowFrame, simulationState_t *state)
 {
     int i;
     bool needComma = false;
 
     for (i = 0; i < log->frameDefs['I'].fieldCount; i++) {
         if (needComma) {
-            fprintf(csvFile, ", ");
+            outputStreamPrintf(file, ", ");
         } else {
             needComma = true;
         }
@@ -577,214 +715,39 @@ void outputMainFrameFields(flightLog_t *log, int64_t frameTime, int64_t *frame)
         if (i == FLIGHT_LOG_FIELD_INDEX_TIME) {
             // Use the time the caller provided instead of the time in the frame
             if (frameTime == -1) {
-                fprintf(csvFile, "X");
-            } else if (!fprintfMainFieldInUnit(log, csvFile, i, frameTime, mainFieldUnit[i])) {
+                outputStreamPrintf(file, "X");
+            } else if (!fprintfMainFieldInUnit(log, file, i, frameTime, mainFieldUnit[i])) {
                 fprintf(stderr, "Bad unit for field %d\n", i);
                 exit(-1);
             }
-        } else if (!fprintfMainFieldInUnit(log, csvFile, i, frame[i], mainFieldUnit[i])) {
+        } else if (!fprintfMainFieldInUnit(log, file, i, frame[i], mainFieldUnit[i])) {
             fprintf(stderr, "Bad unit for field %d\n", i);
             exit(-1);
         }
     }
 
     if (options.simulateIMU) {
-        fprintf(csvFile, ", %.2f, %.2f, %.2f", attitude.roll * 180 / M_PI, attitude.pitch * 180 / M_PI, attitude.heading * 180 / M_PI);
+        outputStreamPrintf(file, ", %.2f, %.2f, %.2f", state->attitude.roll * 180 / M_PI, state->attitude.pitch * 180 / M_PI, state->attitude.heading * 180 / M_PI);
     }
 
     if (log->mainFieldIndexes.amperageLatest != -1) {
         // Integrate the ADC's current measurements to get cumulative energy usage
-        fprintf(csvFile, ", %d", (int) round(currentMeterMeasured.energyMilliampHours));
+        outputStreamPrintf(file, ", %d", (int) round(state->currentMeterMeasured.energyMilliampHours));
     }
 
     if (options.simulateCurrentMeter) {
-        fprintf(csvFile, ", ");
+        outputStreamPrintf(file, ", ");
 
-        fprintfMilliampsInUnit(csvFile, currentMeterVirtual.currentMilliamps, options.unitAmperage);
+        fprintfMilliampsInUnit(file, state->currentMeterVirtual.currentMilliamps, options.unitAmperage);
 
-        fprintf(csvFile, ", %d", (int) round(currentMeterVirtual.energyMilliampHours));
+        outputStreamPrintf(file, ", %d", (int) round(state->currentMeterVirtual.energyMilliampHours));
     }
 
     // Do we have a slow frame to print out too?
     if (log->frameDefs['S'].fieldCount > 0) {
-        fprintf(csvFile, ", ");
-
-        outputSlowFrameFields(log, bufferedSlowFrame);
-    }
-}
-
-void outputMergeFrame(flightLog_t *log)
-{
-    outputMainFrameFields(log, bufferedFrameTime, bufferedMainFrame);
-    fprintf(csvFile, ", ");
-    outputGPSFields(log, csvFile, bufferedGPSFrame);
-    fprintf(csvFile, "\n");
-
-    haveBufferedMainFrame = false;
-}
-
-void updateFrameStatistics(flightLog_t *log, int64_t *frame)
-{
-    (void) log;
-
-    if (lastFrameIteration != (uint32_t) -1 && (uint32_t) frame[FLIGHT_LOG_FIELD_INDEX_ITERATION] > lastFrameIteration) {
-        uint32_t looptime = (frame[FLIGHT_LOG_FIELD_INDEX_TIME] - lastFrameTime) / (frame[FLIGHT_LOG_FIELD_INDEX_ITERATION] - lastFrameIteration);
-
-        seriesStats_append(&looptimeStats, looptime);
-    }
-}
-
-/**
- * This is called when outputting the log in GPS merge mode. When we parse a main frame, we don't know if a GPS frame
- * exists at the same frame time yet, so we we buffer up the main frame data to print later until we know for sure.
- *
- * We also keep a copy of the GPS frame data so we can print it out multiple times if multiple main frames arrive
- * between GPS updates.
- */
-void onFrameReadyMerge(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int fieldCount, int frameOffset, int frameSize)
-{
-    int64_t gpsFrameTime;
-
-    (void) frameOffset;
-    (void) frameSize;
-
-    switch (frameType) {
-        case 'G':
-            if (frameValid) {
-                if (log->gpsFieldIndexes.time == -1 || (int64_t) frame[log->gpsFieldIndexes.time] == lastFrameTime) {
-                    //This GPS frame was logged in the same iteration as the main frame that preceded it
-                    gpsFrameTime = lastFrameTime;
-                } else {
-                    gpsFrameTime = frame[log->gpsFieldIndexes.time];
-
-                    /*
-                     * This GPS frame happened some time after the main frame that preceded it, so print out that main
-                     * frame with its older timestamp first if we didn't print it already.
-                     */
-                    if (haveBufferedMainFrame) {
-                        outputMergeFrame(log);
-                    }
-                }
-
-                /*
-                 * Copy this GPS data for later since we may need to duplicate it if there is another main frame before
-                 * we get another GPS update.
-                 */
-                memcpy(bufferedGPSFrame, frame, sizeof(*bufferedGPSFrame) * fieldCount);
-                bufferedFrameTime = gpsFrameTime;
+        outputStreamPrintf(file, ", ");
 
-                outputMergeFrame(log);
-
-                // We need at least lat/lon/altitude from the log to write a useful GPX track
-                bool haveRequiredFields = log->gpsFieldIndexes.GPS_coord[0] != -1 && log->gpsFieldIndexes.GPS_coord[1] != -1 && log->gpsFieldIndexes.GPS_altitude != -1;
-                bool haveRequiredPrecision = log->gpsFieldIndexes.GPS_numSat == -1 || frame[log->gpsFieldIndexes.GPS_numSat] >= MIN_GPS_SATELLITES;
-
-                if (haveRequiredFields && haveRequiredPrecision) {
-                    gpxWriterAddPoint(gpx, log->dateTime, gpsFrameTime, frame[log->gpsFieldIndexes.GPS_coord[0]], frame[log->gpsFieldIndexes.GPS_coord[1]], getAltitude(log, frame));
-                }
-            }
-        break;
-        case 'S':
-            if (frameValid) {
-                if (haveBufferedMainFrame) {
-                    outputMergeFrame(log);
-                }
-
-                memcpy(bufferedSlowFrame, frame, sizeof(bufferedSlowFrame));
-            }
-        break;
-        case 'P':
-        case 'I':
-            if (frameValid || (frame && options.raw)) {
-                if (haveBufferedMainFrame) {
-                    outputMergeFrame(log);
-                }
-
-                if (frameValid) {
-                    updateFrameStatistics(log, frame);
-
-                    lastFrameIteration = (uint32_t) frame[FLIGHT_LOG_FIELD_INDEX_ITERATION];
-                    lastFrameTime = frame[FLIGHT_LOG_FIELD_INDEX_TIME];
-
-                    updateSimulations(log, frame, lastFrameTime);
-
-                    /*
-                     * Store this frame to print out later since we don't know if a GPS frame follows it yet.
-                     */
-                    memcpy(bufferedMainFrame, frame, sizeof(*bufferedMainFrame) * fieldCount);
-
-                    haveBufferedMainFrame = true;
-
-                    bufferedFrameIteration = lastFrameIteration;
-                    bufferedFrameTime = lastFrameTime;
-                } else {
-                    haveBufferedMainFrame = false;
-
-                    bufferedFrameIteration = -1;
-                    bufferedFrameTime = -1;
-                }
-            }
-        break;
-    }
-}
-
-void onFrameReady(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int fieldCount, int frameOffset, int frameSize)
-{
-    if (options.mergeGPS && log->frameDefs['G'].fieldCount > 0) {
-        //Use the alternate frame processing routine which merges main stream data and GPS data together
-        onFrameReadyMerge(log, frameValid, frame, frameType, fieldCount, frameOffset, frameSize);
-        return;
-    }
-
-    switch (frameType) {
-        case 'G':
-            if (frameValid) {
-                outputGPSFrame(log, frame);
-            }
-        break;
-        case 'S':
-            if (frameValid) {
-                memcpy(bufferedSlowFrame, frame, sizeof(bufferedSlowFrame));
-
-                if (options.debug) {
-                    fprintf(csvFile, "S frame: ");
-                    outputSlowFrameFields(log, bufferedSlowFrame);
-                    fprintf(csvFile, "\n");
-                }
-            }
-        break;
-        case 'P':
-        case 'I':
-            if (frameValid || (frame && options.raw)) {
-                if (frameValid) {
-                    updateFrameStatistics(log, frame);
-
-                    updateSimulations(log, frame, lastFrameTime);
-
-                    lastFrameIteration = (uint32_t) frame[FLIGHT_LOG_FIELD_INDEX_ITERATION];
-                    lastFrameTime = frame[FLIGHT_LOG_FIELD_INDEX_TIME];
-                }
-
-                outputMainFrameFields(log, frameValid ? frame[FLIGHT_LOG_FIELD_INDEX_TIME] : -1, frame);
-
-                if (options.debug) {
-                    fprintf(csvFile, ", %c, offset %d, size %d\n", (char) frameType, frameOffset, frameSize);
-                } else {
-                    fprintf(csvFile, "\n");
-                }
-            } else if (options.debug) {
-                // Print to stdout so that these messages line up with our other output on stdout (stderr isn't synchronised to it)
-                if (frame) {
-                    /*
-                     * We'll assume that the frame's iteration count is still fairly sensible (if an earlier frame was corrupt,
-                     * the frame index will be smaller than it should be)
-                     */
-                    fprintf(csvFile, "%c Frame unusuable due to prior corruption, offset %d, size %d\n", (char) frameType, frameOffset, frameSize);
-                } else {
-                    fprintf(csvFile, "Failed to decode %c frame, offset %d, size %d\n", (char) frameType, frameOffset, frameSize);
-                }
-            }
-        break;
+        outputSlowFrameFields(log, file, slowFrame);
     }
 }
 
@@ -881,68 +844,6 @@ void applyFieldUnits(flightLog_t *log)
     }
 }
 
-void writeMainCSVHeader(flightLog_t *log)
-{
-    int i;
-
-    for (i = 0; i < log->frameDefs['I'].fieldCount; i++) {
-        if (i > 0)
-            fprintf(csvFile, ", ");
-
-        fprintf(csvFile, "%s", log->frameDefs['I'].fieldName[i]);
-
-        if (mainFieldUnit[i] != UNIT_RAW) {
-            fprintf(csvFile, " (%s)", UNIT_NAME[mainFieldUnit[i]]);
-        }
-    }
-
-    if (options.simulateIMU) {
-        if (options.includeIMUDegrees){
-            fprintf(csvFile, ", roll (%s), pitch (%s), heading (%s)", UNIT_NAME[options.unitDegrees], UNIT_NAME[options.unitDegrees], UNIT_NAME[options.unitDegrees]);
-        } else {
-            fprintf(csvFile, ", roll, pitch, heading");
-        }
-    }
-
-    if (log->mainFieldIndexes.amperageLatest != -1) {
-        fprintf(csvFile, ", energyCumulative (mAh)");
-    }
-
-    if (options.simulateCurrentMeter) {
-        fprintf(csvFile, ", currentVirtual (%s), energyCumulativeVirtual (mAh)", UNIT_NAME[options.unitAmperage]);
-    }
-
-    if (log->frameDefs['S'].fieldCount > 0) {
-        fprintf(csvFile, ", ");
-
-        outputFieldNamesHeader(csvFile, &log->frameDefs['S'], slowFieldUnit, false);
-    }
-
-    if (options.mergeGPS && log->frameDefs['G'].fieldCount > 0) {
-        fprintf(csvFile, ", ");
-
-        outputFieldNamesHeader(csvFile, &log->frameDefs['G'], gpsGFieldUnit, true);
-    }
-
-    fprintf(csvFile, "\n");
-}
-
-void onMetadataReady(flightLog_t *log)
-{
-    if (log->frameDefs['I'].fieldCount == 0) {
-        fprintf(stderr, "No fields found in log, is it missing its header?\n");
-        return;
-    } else if (options.simulateIMU && (log->mainFieldIndexes.accSmooth[0] == -1 || log->mainFieldIndexes.gyroADC[0] == -1)){
-        fprintf(stderr, "Can't simulate the IMU because accelerometer or gyroscope data is missing\n");
-        options.simulateIMU = false;
-    }
-
-    identifyGPSFields(log);
-    applyFieldUnits(log);
-
-    writeMainCSVHeader(log);
-}
-
 void printStats(flightLog_t *log, int logIndex, bool raw, bool limits)
 {
     flightLogStatistics_t *stats = &log->stats;
@@ -997,6 +898,11 @@ void printStats(flightLog_t *log, int logIndex, bool raw, bool limits)
     if (seriesStats_getCount(&looptimeStats) > 0) {
         fprintf(stderr, "Looptime %14d avg %14.1f std dev (%.1f%%)\n", (int) seriesStats_getMean(&looptimeStats),
             seriesStats_getStandardDeviation(&looptimeStats), seriesStats_getStandardDeviation(&looptimeStats) / seriesStats_getMean(&looptimeStats) * 100);
+
+        if (limits) {
+            fprintf(stderr, "Looptime p50 %.0f, p99 %.0f, p99.9 %.0f\n", quantileSketch_getQuantile(&looptimeQuantiles, 0.5),
+                quantileSketch_getQuantile(&looptimeQuantiles, 0.99), quantileSketch_getQuantile(&looptimeQuantiles, 0.999));
+        }
     }
 
     for (i = 0; i < (int) sizeof(frameTypes); i++) {
@@ -1046,33 +952,46 @@ void printStats(flightLog_t *log, int logIndex, bool raw, bool limits)
     }
 
     if (limits) {
-        fprintf(stderr, "\n\n    Field name          Min          Max        Range\n");
-        fprintf(stderr,     "-----------------------------------------------------\n");
+        fprintf(stderr, "\n\n    Field name          Min          Max        Range          p50          p99        p99.9\n");
+        fprintf(stderr,     "-----------------------------------------------------------------------------------------\n");
 
         for (i = 0; i < log->frameDefs['I'].fieldCount; i++) {
-            fprintf(stderr, "%14s %12" PRId64 " %12" PRId64 " %12" PRId64 "\n",
+            fprintf(stderr, "%14s %12" PRId64 " %12" PRId64 " %12" PRId64,
                 log->frameDefs['I'].fieldName[i],
                 stats->field[i].min,
                 stats->field[i].max,
                 stats->field[i].max - stats->field[i].min
             );
+
+            if (i < fieldDistributionCount) {
+                fprintf(stderr, " %12.1f %12.1f %12.1f",
+                    quantileSketch_getQuantile(&fieldQuantiles[i], 0.5),
+                    quantileSketch_getQuantile(&fieldQuantiles[i], 0.99),
+                    quantileSketch_getQuantile(&fieldQuantiles[i], 0.999)
+                );
+            }
+
+            fprintf(stderr, "\n");
         }
     }
 
     fprintf(stderr, "\n");
 }
 
+static void resetIMUSimulation(imuState_t *imu)
+{
+    // The decoder has always carried the gravity estimate over from the end of the previous log in the file
+    t_fp_vector EstG = imu->EstG;
+
+    imuStateInit(imu);
+    imu->EstG = EstG;
+    imuStateSetMagneticDeclination(imu, options.magneticDeclination);
+}
+
 void resetParseState() {
     if (options.simulateIMU) {
-        imuInit();
-    }
-
-    if (options.mergeGPS) {
-        haveBufferedMainFrame = false;
-        bufferedFrameTime = -1;
-        bufferedFrameIteration = (uint32_t) -1;
-        memset(bufferedGPSFrame, 0, sizeof(bufferedGPSFrame));
-        memset(bufferedMainFrame, 0, sizeof(bufferedMainFrame));
+        resetIMUSimulation(&simulation.imu);
+        resetIMUSimulation(&mergeSimulation.imu);
     }
 
     memset(bufferedSlowFrame, 0, sizeof(bufferedSlowFrame));
@@ -1081,78 +1000,1280 @@ void resetParseState() {
     lastFrameTime = -1;
 
     seriesStats_init(&looptimeStats);
-}
 
-void writeLogHeaderLine(const char *lineStart, const char *lineEnd) {
-    if (lineEnd - lineStart < 3) {
-        return;
+    if (looptimeQuantiles.centroids) {
+        quantileSketch_reset(&looptimeQuantiles);
+    } else {
+        quantileSketch_init(&looptimeQuantiles, QUANTILE_SKETCH_DEFAULT_COMPRESSION);
     }
 
-    if (*lineStart != 'H') {
-        return;
-    }
+    fieldDistributionCount = 0;
+}
 
-    if (*(lineStart + 1) != ' ') {
-        return;
+/**
+ * Start collecting the distribution of every main field, if that's needed (called once the field definitions are
+ * available).
+ */
+static void fieldDistributionsBegin(flightLog_t *log)
+{
+    if (!trackFieldDistributions)
+        return;
+
+    fieldDistributionCount = log->frameDefs['I'].fieldCount;
+
+    for (int i = 0; i < fieldDistributionCount; i++) {
+        seriesStats_init(&fieldStats[i]);
+
+        if (fieldQuantiles[i].centroids) {
+            quantileSketch_reset(&fieldQuantiles[i]);
+        } else {
+            quantileSketch_init(&fieldQuantiles[i], QUANTILE_SKETCH_DEFAULT_COMPRESSION);
+        }
+    }
+}
+
+void writeLogHeaderLine(const char *lineStart, const char *lineEnd) {
+    if (lineEnd - lineStart < 3) {
+        return;
+    }
+
+    if (*lineStart != 'H') {
+        return;
+    }
+
+    if (*(lineStart + 1) != ' ') {
+        return;
+    }
+    const char *separatorPos = memchr(lineStart, ':', lineEnd - lineStart);
+    if (separatorPos == NULL) {
+        return;
+    }
+
+    outputStreamPrintf(headersFile, "%.*s,\"%.*s\"\n", (int) (separatorPos - lineStart - 2), lineStart+2, (int) (lineEnd - separatorPos -1), separatorPos + 1);
+}
+
+/**
+ * Write the header lines of the given log to the headers CSV. The log must have been parsed already, since the
+ * parser records where its headers end.
+ */
+void writeLogHeaders(flightLog_t *log, int logIndex) {
+    const char *headerPos = log->logBegin[logIndex];
+    const char *headerEnd = log->logHeaderEnd[logIndex];
+
+    if (headerPos == NULL || headerEnd == NULL) {
+        fprintf(stderr, "Header log with index %i could not be found\n", logIndex);
+        return;
+    }
+
+    outputStreamPrintf(headersFile, "fieldname, fieldvalue\n");
+
+    while (headerPos < headerEnd) {
+        const char *nextLine = memchr(headerPos, '\n', headerEnd - headerPos);
+
+        if (nextLine == NULL) {
+            break;
+        }
+
+        writeLogHeaderLine(headerPos, nextLine);
+        headerPos = nextLine + 1;
+    }
+}
+
+/**
+ * Build the name of an output file for the current log, like "LOG00001.01.csv" for the extension ".csv". If
+ * `compressible` is set and we're compressing our output, ".gz" is appended. The caller must free the result.
+ */
+char* createOutputFilename(const char *extension, bool compressible)
+{
+    const char *compressedSuffix = compressible && options.compressionLevel != OUTPUT_STREAM_COMPRESSION_NONE ? ".gz" : "";
+    int outputDirLen = options.outputDir ? strlen(options.outputDir) : 0;
+    int filenameLen = outputDirLen + outputNaming.pathSeparatorLen + outputNaming.baseNamePrefixLen + strlen(".00") + strlen(extension) + strlen(compressedSuffix) + 1;
+    char *filename = malloc(filenameLen * sizeof(char));
+
+    snprintf(filename, filenameLen, "%s%s%.*s.%02d%s%s",
+            options.outputDir ? options.outputDir : "",
+            outputNaming.pathSeparatorLen ? "/" : "",
+            outputNaming.baseNamePrefixLen, outputNaming.baseNamePrefix,
+            outputNaming.logIndex + 1, extension, compressedSuffix);
+
+    return filename;
+}
+
+static csvRow_t* csvBlockGetRow(csvWriter_t *writer, csvRowBlock_t *block, int rowIndex)
+{
+    return (csvRow_t *) ((char *) block->rows + rowIndex * writer->rowSize);
+}
+
+/**
+ * Format a block of main CSV rows, called from the CSV formatting threads.
+ */
+static void formatCSVRowBlock(void *context, void *data, outputStream_t *output)
+{
+    csvWriter_t *writer = (csvWriter_t *) context;
+    flightLog_t *log = writer->log;
+    csvRowBlock_t *block = (csvRowBlock_t *) data;
+
+    int mainFieldCount = log->frameDefs['I'].fieldCount;
+    int slowFieldCount = log->frameDefs['S'].fieldCount;
+
+    for (int i = 0; i < block->rowCount; i++) {
+        csvRow_t *row = csvBlockGetRow(writer, block, i);
+
+        outputMainFrameFields(log, output, row->frameTime, row->fields, row->fields + mainFieldCount, &row->simulation);
+
+        if (writer->includeGPS) {
+            outputStreamPrintf(output, ", ");
+            outputGPSFields(log, output, row->fields + mainFieldCount + slowFieldCount);
+        }
+
+        outputStreamPrintf(output, "\n");
+    }
+}
+
+/**
+ * Print a complete row to the CSV file (with the GPS fields from `gpsFrame` appended if the writer includes GPS). If
+ * we have CSV formatting threads, the row is queued up to be formatted by them instead.
+ */
+void outputMainRow(csvWriter_t *writer, int64_t frameTime, int64_t *frame, int64_t *slowFrame, simulationState_t *state, int64_t *gpsFrame)
+{
+    flightLog_t *log = writer->log;
+    int mainFieldCount = log->frameDefs['I'].fieldCount;
+    int slowFieldCount = log->frameDefs['S'].fieldCount;
+    csvRow_t *row;
+
+    if (!writer->pool) {
+        outputMainFrameFields(log, writer->file, frameTime, frame, slowFrame, state);
+
+        if (writer->includeGPS) {
+            outputStreamPrintf(writer->file, ", ");
+            outputGPSFields(log, writer->file, gpsFrame);
+        }
+
+        outputStreamPrintf(writer->file, "\n");
+        return;
+    }
+
+    if (!writer->block) {
+        writer->block = (csvRowBlock_t *) formatPoolAcquire(writer->pool);
+        writer->block->rowCount = 0;
+    }
+
+    row = csvBlockGetRow(writer, writer->block, writer->block->rowCount);
+
+    row->simulation = *state;
+    row->frameTime = frameTime;
+
+    memcpy(row->fields, frame, sizeof(*frame) * mainFieldCount);
+    memcpy(row->fields + mainFieldCount, slowFrame, sizeof(*slowFrame) * slowFieldCount);
+
+    if (writer->includeGPS) {
+        memcpy(row->fields + mainFieldCount + slowFieldCount, gpsFrame, sizeof(*gpsFrame) * log->frameDefs['G'].fieldCount);
+    }
+
+    writer->block->rowCount++;
+
+    if (writer->block->rowCount == CSV_ROWS_PER_BLOCK) {
+        formatPoolSubmit(writer->pool);
+        writer->block = NULL;
+    }
+}
+
+void writeMainCSVHeader(flightLog_t *log, outputStream_t *file, bool includeGPS)
+{
+    int i;
+
+    for (i = 0; i < log->frameDefs['I'].fieldCount; i++) {
+        if (i > 0)
+            outputStreamPrintf(file, ", ");
+
+        outputStreamPrintf(file, "%s", log->frameDefs['I'].fieldName[i]);
+
+        if (mainFieldUnit[i] != UNIT_RAW) {
+            outputStreamPrintf(file, " (%s)", UNIT_NAME[mainFieldUnit[i]]);
+        }
+    }
+
+    if (options.simulateIMU) {
+        if (options.includeIMUDegrees){
+            outputStreamPrintf(file, ", roll (%s), pitch (%s), heading (%s)", UNIT_NAME[options.unitDegrees], UNIT_NAME[options.unitDegrees], UNIT_NAME[options.unitDegrees]);
+        } else {
+            outputStreamPrintf(file, ", roll, pitch, heading");
+        }
+    }
+
+    if (log->mainFieldIndexes.amperageLatest != -1) {
+        outputStreamPrintf(file, ", energyCumulative (mAh)");
+    }
+
+    if (options.simulateCurrentMeter) {
+        outputStreamPrintf(file, ", currentVirtual (%s), energyCumulativeVirtual (mAh)", UNIT_NAME[options.unitAmperage]);
+    }
+
+    if (log->frameDefs['S'].fieldCount > 0) {
+        outputStreamPrintf(file, ", ");
+
+        outputFieldNamesHeader(file, &log->frameDefs['S'], slowFieldUnit, false);
+    }
+
+    if (includeGPS) {
+        outputStreamPrintf(file, ", ");
+
+        outputFieldNamesHeader(file, &log->frameDefs['G'], gpsGFieldUnit, true);
+    }
+
+    outputStreamPrintf(file, "\n");
+}
+
+/**
+ * Create the CSV file for the current log (or use stdout if the user asked for that). Returns false on failure.
+ */
+bool csvWriterOpen(csvWriter_t *writer, const char *extension)
+{
+    char *csvFilename;
+
+    memset(writer, 0, sizeof(*writer));
+
+    if (options.toStdout) {
+        writer->file = outputStreamCreate(stdout, false, options.compressionLevel);
+        return true;
+    }
+
+    csvFilename = createOutputFilename(extension, true);
+
+    writer->file = outputStreamOpen(csvFilename, options.compressionLevel);
+
+    if (!writer->file) {
+        fprintf(stderr, "Failed to create output file %s\n", csvFilename);
+
+        free(csvFilename);
+        return false;
+    }
+
+    fprintf(stderr, "Decoding log '%s' to '%s'...\n", outputNaming.logFilename, csvFilename);
+    free(csvFilename);
+
+    return true;
+}
+
+/**
+ * Write the CSV header and start up the CSV formatting threads (if the user asked for them).
+ */
+void csvWriterBegin(csvWriter_t *writer, flightLog_t *log, bool includeGPS)
+{
+    int rowFieldCount;
+
+    writer->log = log;
+    writer->includeGPS = includeGPS;
+
+    writeMainCSVHeader(log, writer->file, includeGPS);
+
+    // Debugging output is interleaved with the rows, so it's always printed in order on this thread instead
+    if (options.threads <= 1 || options.debug) {
+        return;
+    }
+
+    rowFieldCount = log->frameDefs['I'].fieldCount + log->frameDefs['S'].fieldCount + (includeGPS ? log->frameDefs['G'].fieldCount : 0);
+    writer->rowSize = sizeof(csvRow_t) + rowFieldCount * sizeof(int64_t);
+
+    writer->pool = formatPoolCreate(options.threads, sizeof(csvRowBlock_t) + CSV_ROWS_PER_BLOCK * writer->rowSize, formatCSVRowBlock, NULL,
+        writer, writer->file);
+}
+
+/**
+ * Wait for all the queued rows to be formatted and written, shut down the formatting threads and close the file.
+ */
+void csvWriterEnd(csvWriter_t *writer)
+{
+    if (writer->pool) {
+        if (writer->block) {
+            formatPoolSubmit(writer->pool);
+            writer->block = NULL;
+        }
+
+        formatPoolDestroy(writer->pool);
+        writer->pool = NULL;
+    }
+
+    outputStreamClose(writer->file, &outputStats);
+    writer->file = NULL;
+}
+
+/**
+ * Handle a main frame for a plain (unmerged) CSV file.
+ */
+void csvWriterOnMainFrame(csvWriter_t *writer, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    outputStream_t *file = writer->file;
+
+    if (frameValid || (frame && options.raw)) {
+        if (options.debug) {
+            outputMainFrameFields(writer->log, file, frameValid ? frame[FLIGHT_LOG_FIELD_INDEX_TIME] : -1, frame, bufferedSlowFrame, &simulation);
+            outputStreamPrintf(file, ", %c, offset %d, size %d\n", (char) frameType, frameOffset, frameSize);
+        } else {
+            outputMainRow(writer, frameValid ? frame[FLIGHT_LOG_FIELD_INDEX_TIME] : -1, frame, bufferedSlowFrame, &simulation, NULL);
+        }
+    } else if (options.debug) {
+        // Print to stdout so that these messages line up with our other output on stdout (stderr isn't synchronised to it)
+        if (frame) {
+            /*
+             * We'll assume that the frame's iteration count is still fairly sensible (if an earlier frame was corrupt,
+             * the frame index will be smaller than it should be)
+             */
+            outputStreamPrintf(file, "%c Frame unusuable due to prior corruption, offset %d, size %d\n", (char) frameType, frameOffset, frameSize);
+        } else {
+            outputStreamPrintf(file, "Failed to decode %c frame, offset %d, size %d\n", (char) frameType, frameOffset, frameSize);
+        }
+    }
+}
+
+void csvWriterOnSlowFrame(csvWriter_t *writer, int64_t *frame)
+{
+    if (options.debug) {
+        outputStreamPrintf(writer->file, "S frame: ");
+        outputSlowFrameFields(writer->log, writer->file, frame);
+        outputStreamPrintf(writer->file, "\n");
+    }
+}
+
+void updateFrameStatistics(flightLog_t *log, int64_t *frame)
+{
+    (void) log;
+
+    if (lastFrameIteration != (uint32_t) -1 && (uint32_t) frame[FLIGHT_LOG_FIELD_INDEX_ITERATION] > lastFrameIteration) {
+        uint32_t looptime = (frame[FLIGHT_LOG_FIELD_INDEX_TIME] - lastFrameTime) / (frame[FLIGHT_LOG_FIELD_INDEX_ITERATION] - lastFrameIteration);
+
+        seriesStats_append(&looptimeStats, looptime);
+
+        if (trackFieldDistributions) {
+            quantileSketch_append(&looptimeQuantiles, looptime);
+        }
+    }
+
+    for (int i = 0; i < fieldDistributionCount; i++) {
+        seriesStats_append(&fieldStats[i], frame[i]);
+        quantileSketch_append(&fieldQuantiles[i], frame[i]);
+    }
+}
+
+/**
+ * Get the time a GPS frame was recorded at.
+ */
+int64_t getGPSFrameTime(flightLog_t *log, int64_t *frame)
+{
+    // If we're not logging every loop iteration, we include a timestamp field in the GPS frame:
+    if (log->gpsFieldIndexes.time != -1) {
+        return frame[log->gpsFieldIndexes.time];
+    }
+
+    // Otherwise this GPS frame was recorded at the same time as the main stream frame we read before the GPS frame:
+    return lastFrameTime;
+}
+
+/**
+ * Check if the field name matches the pattern, where the pattern can contain a "[*]" wildcard that stands in for any
+ * array index, like "motor[*]".
+ */
+static bool fieldNameMatches(const char *pattern, int patternLen, const char *name)
+{
+    const char *wildcard = strstr(pattern, "[*]");
+
+    if (wildcard && wildcard < pattern + patternLen) {
+        int prefixLen = wildcard - pattern + 1; // Including the '['
+        int suffixLen = patternLen - prefixLen - 1;
+        int nameLen = strlen(name);
+        int digits = nameLen - prefixLen - suffixLen;
+
+        if (digits < 1 || strncmp(name, pattern, prefixLen) != 0 || strncmp(name + nameLen - suffixLen, wildcard + 2, suffixLen) != 0)
+            return false;
+
+        for (int i = 0; i < digits; i++) {
+            if (name[prefixLen + i] < '0' || name[prefixLen + i] > '9')
+                return false;
+        }
+
+        return true;
+    }
+
+    return (int) strlen(name) == patternLen && strncmp(name, pattern, patternLen) == 0;
+}
+
+/**
+ * Find the main fields named in the comma-separated list `patterns` (which can use [*] wildcards) and store their
+ * indexes in `fields`, in the log's field order. Returns the number of fields found.
+ */
+int selectMainFields(flightLog_t *log, const char *patterns, int *fields)
+{
+    flightLogFrameDef_t *mainDef = &log->frameDefs['I'];
+    int fieldCount = 0;
+
+    for (int i = 0; i < mainDef->fieldCount; i++) {
+        const char *name = patterns;
+
+        while (*name) {
+            const char *nameEnd = strchr(name, ',');
+            int nameLen = nameEnd ? nameEnd - name : (int) strlen(name);
+
+            if (fieldNameMatches(name, nameLen, mainDef->fieldName[i])) {
+                fields[fieldCount++] = i;
+                break;
+            }
+
+            name += nameLen;
+
+            if (*name == ',') {
+                name++;
+            }
+        }
+    }
+
+    return fieldCount;
+}
+
+/*
+ * "csv" sink: the main CSV file, with GPS data written separately.
+ */
+
+static bool csvSinkOpen(flightLog_t *log)
+{
+    (void) log;
+
+    return csvWriterOpen(&mainCsv, ".csv");
+}
+
+static void csvSinkBeginLog(flightLog_t *log)
+{
+    csvWriterBegin(&mainCsv, log, false);
+}
+
+static void csvSinkOnMainFrame(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    (void) log;
+
+    csvWriterOnMainFrame(&mainCsv, frameValid, frame, frameType, frameOffset, frameSize);
+}
+
+static void csvSinkOnSlowFrame(flightLog_t *log, int64_t *frame)
+{
+    (void) log;
+
+    csvWriterOnSlowFrame(&mainCsv, frame);
+}
+
+static void csvSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    (void) log;
+    (void) logIndex;
+    (void) success;
+
+    csvWriterEnd(&mainCsv);
+}
+
+/*
+ * "merged-csv" sink: the main CSV file with the most recent GPS data appended to every row.
+ *
+ * When we parse a main frame, we don't know if a GPS frame exists at the same frame time yet, so we we buffer up the
+ * main frame data to print later until we know for sure.
+ *
+ * We also keep a copy of the GPS frame data so we can print it out multiple times if multiple main frames arrive
+ * between GPS updates.
+ */
+
+static void outputMergeFrame()
+{
+    outputMainRow(&mergedCsv, bufferedFrameTime, bufferedMainFrame, bufferedMergeSlowFrame, &bufferedMergeSimulation, bufferedGPSFrame);
+
+    haveBufferedMainFrame = false;
+}
+
+static bool mergedCsvSinkOpen(flightLog_t *log);
+
+static void mergedCsvSinkBeginLog(flightLog_t *log)
+{
+    haveBufferedMainFrame = false;
+    bufferedFrameTime = -1;
+    bufferedFrameIteration = (uint32_t) -1;
+    memset(bufferedGPSFrame, 0, sizeof(bufferedGPSFrame));
+    memset(bufferedMainFrame, 0, sizeof(bufferedMainFrame));
+    memcpy(bufferedMergeSlowFrame, bufferedSlowFrame, sizeof(bufferedMergeSlowFrame));
+    bufferedMergeSimulation = mergeSimulation;
+
+    // If there's no GPS in this log, there's nothing to merge, so this will just be a plain CSV file
+    csvWriterBegin(&mergedCsv, log, log->frameDefs['G'].fieldCount > 0);
+}
+
+static void mergedCsvSinkOnGPSFrame(flightLog_t *log, int64_t *frame)
+{
+    if (!rowFilter.lastFrameWritten) {
+        // --where filtered out the main frame that this GPS frame goes with, so it doesn't get a row of its own
+        if (haveBufferedMainFrame) {
+            outputMergeFrame();
+        }
+
+        memcpy(bufferedGPSFrame, frame, sizeof(*bufferedGPSFrame) * log->frameDefs['G'].fieldCount);
+        return;
+    }
+
+    if (log->gpsFieldIndexes.time == -1 || (int64_t) frame[log->gpsFieldIndexes.time] == lastFrameTime) {
+        //This GPS frame was logged in the same iteration as the main frame that preceded it
+        bufferedFrameTime = lastFrameTime;
+    } else {
+        /*
+         * This GPS frame happened some time after the main frame that preceded it, so print out that main
+         * frame with its older timestamp first if we didn't print it already.
+         */
+        if (haveBufferedMainFrame) {
+            outputMergeFrame();
+        }
+
+        bufferedFrameTime = frame[log->gpsFieldIndexes.time];
+    }
+
+    /*
+     * Copy this GPS data for later since we may need to duplicate it if there is another main frame before
+     * we get another GPS update.
+     */
+    memcpy(bufferedGPSFrame, frame, sizeof(*bufferedGPSFrame) * log->frameDefs['G'].fieldCount);
+
+    outputMergeFrame();
+}
+
+static void mergedCsvSinkOnSlowFrame(flightLog_t *log, int64_t *frame)
+{
+    (void) log;
+
+    if (!mergedCsv.includeGPS) {
+        csvWriterOnSlowFrame(&mergedCsv, frame);
+        return;
+    }
+
+    if (haveBufferedMainFrame) {
+        outputMergeFrame();
+    }
+
+    memcpy(bufferedMergeSlowFrame, frame, sizeof(bufferedMergeSlowFrame));
+}
+
+static void mergedCsvSinkOnMainFrame(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    if (!mergedCsv.includeGPS) {
+        csvWriterOnMainFrame(&mergedCsv, frameValid, frame, frameType, frameOffset, frameSize);
+        return;
+    }
+
+    if (frameValid || (frame && options.raw)) {
+        if (haveBufferedMainFrame) {
+            outputMergeFrame();
+        }
+
+        if (frameValid) {
+            /*
+             * Store this frame to print out later since we don't know if a GPS frame follows it yet.
+             */
+            memcpy(bufferedMainFrame, frame, sizeof(*bufferedMainFrame) * log->frameDefs['I'].fieldCount);
+            bufferedMergeSimulation = mergeSimulation;
+
+            haveBufferedMainFrame = true;
+
+            bufferedFrameIteration = lastFrameIteration;
+            bufferedFrameTime = lastFrameTime;
+        } else {
+            haveBufferedMainFrame = false;
+
+            bufferedFrameIteration = -1;
+            bufferedFrameTime = -1;
+        }
+    }
+}
+
+static void mergedCsvSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    (void) log;
+    (void) logIndex;
+    (void) success;
+
+    if (mergedCsv.includeGPS && haveBufferedMainFrame) {
+        // Print out last log entry that wasn't already printed
+        outputMergeFrame();
+    }
+
+    csvWriterEnd(&mergedCsv);
+}
+
+/*
+ * "gps-csv" sink: GPS frames in their own CSV file.
+ */
+
+static bool gpsCsvSinkOpen(flightLog_t *log)
+{
+    (void) log;
+
+    gpsCsvFile = NULL;
+    gpsCsvFilename = options.toStdout ? NULL : createOutputFilename(".gps.csv", true);
+
+    return true;
+}
+
+static void gpsCsvSinkOnGPSFrame(flightLog_t *log, int64_t *frame)
+{
+    createGPSCSVFile(log);
+
+    if (gpsCsvFile) {
+        fprintfMicrosecondsInUnit(gpsCsvFile, getGPSFrameTime(log, frame), options.unitFrameTime);
+        outputStreamPrintf(gpsCsvFile, ", ");
+
+        outputGPSFields(log, gpsCsvFile, frame);
+
+        outputStreamPrintf(gpsCsvFile, "\n");
+    }
+}
+
+static void gpsCsvSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    (void) log;
+    (void) logIndex;
+    (void) success;
+
+    free(gpsCsvFilename);
+    gpsCsvFilename = NULL;
+
+    outputStreamClose(gpsCsvFile, &outputStats);
+    gpsCsvFile = NULL;
+}
+
+/*
+ * "gpx" sink: a GPX track of the GPS positions.
+ */
+
+static bool gpxSinkOpen(flightLog_t *log)
+{
+    (void) log;
+
+    if (options.toStdout) {
+        gpx = NULL;
+    } else {
+        char *gpxFilename = createOutputFilename(".gps.gpx", false);
+
+        gpx = gpxWriterCreate(gpxFilename);
+        free(gpxFilename);
+    }
+
+    return true;
+}
+
+static void gpxSinkOnGPSFrame(flightLog_t *log, int64_t *frame)
+{
+    // We need at least lat/lon/altitude from the log to write a useful GPX track
+    bool haveRequiredFields = log->gpsFieldIndexes.GPS_coord[0] != -1 && log->gpsFieldIndexes.GPS_coord[1] != -1 && log->gpsFieldIndexes.GPS_altitude != -1;
+    bool haveRequiredPrecision = log->gpsFieldIndexes.GPS_numSat == -1 || frame[log->gpsFieldIndexes.GPS_numSat] >= MIN_GPS_SATELLITES;
+
+    if (haveRequiredFields && haveRequiredPrecision) {
+        gpxWriterAddPoint(gpx, log->dateTime, getGPSFrameTime(log, frame), frame[log->gpsFieldIndexes.GPS_coord[0]], frame[log->gpsFieldIndexes.GPS_coord[1]], getAltitude(log, frame));
+    }
+}
+
+static void gpxSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    (void) log;
+    (void) logIndex;
+    (void) success;
+
+    gpxWriterDestroy(gpx);
+    gpx = NULL;
+}
+
+/*
+ * "events" sink: the log's events as JSON, one per line.
+ */
+
+static bool eventsSinkOpen(flightLog_t *log)
+{
+    (void) log;
+
+    eventFile = NULL;
+    eventFilename = options.toStdout ? NULL : createOutputFilename(".event", true);
+
+    return true;
+}
+
+static void eventsSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    (void) log;
+    (void) logIndex;
+    (void) success;
+
+    free(eventFilename);
+    eventFilename = NULL;
+
+    outputStreamClose(eventFile, &outputStats);
+    eventFile = NULL;
+}
+
+/*
+ * "headers" sink: the log's header fields as a CSV file.
+ */
+
+static bool headersSinkOpen(flightLog_t *log)
+{
+    char *headersFilename;
+
+    (void) log;
+
+    headersFile = NULL;
+
+    if (!options.toStdout) {
+        headersFilename = createOutputFilename(".headers.csv", true);
+
+        headersFile = outputStreamOpen(headersFilename, options.compressionLevel);
+        if (!headersFile) {
+            fprintf(stderr, "Failed to headers create output file %s\n", headersFilename);
+        }
+        free(headersFilename);
+    }
+
+    return true;
+}
+
+static void headersSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    (void) success;
+
+    if (headersFile != NULL) {
+        writeLogHeaders(log, logIndex);
+        outputStreamClose(headersFile, &outputStats);
+        headersFile = NULL;
+    }
+}
+
+/*
+ * "zonemap" sink: the zone map (block-level field ranges) that --query uses to skip over parts of the log, written to
+ * a .bbzones file next to the log.
+ */
+
+static zoneMap_t *zoneMapBuilder;
+
+static void zoneMapSinkBeginLog(flightLog_t *log)
+{
+    zoneMapBuilder = zoneMapCreate(log->frameDefs['I'].fieldCount);
+}
+
+static void zoneMapSinkOnMainFrame(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    (void) log;
+    (void) frameSize;
+
+    if (zoneMapBuilder) {
+        zoneMapAddMainFrame(zoneMapBuilder, frameValid, frame, frameType, frameOffset);
+    }
+}
+
+static void zoneMapSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    if (zoneMapBuilder && success) {
+        char *filename = zoneMapFilename(outputNaming.logFilename, logIndex);
+
+        zoneMapFinish(zoneMapBuilder, log, logIndex);
+
+        if (!zoneMapSave(zoneMapBuilder, log, logIndex, filename)) {
+            fprintf(stderr, "Failed to write zone map file %s\n", filename);
+        }
+
+        free(filename);
+    }
+
+    zoneMapDestroy(zoneMapBuilder);
+    zoneMapBuilder = NULL;
+}
+
+/*
+ * "stats" sink: the statistics summary printed to stderr.
+ */
+
+static void statsSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    if (success)
+        printStats(log, logIndex, options.raw, options.limits);
+}
+
+/*
+ * "stats-json" sink: a machine-readable version of the statistics, with the distribution of the looptime and of every
+ * main field. Each distribution includes its quantile sketch's centroids, so the distributions from several logs (or
+ * from parts of one log) can be merged later on to get the quantiles of the combination.
+ */
+
+/**
+ * Write a number for JSON, which has no representation of infinities or NaN, so those become null.
+ */
+static void writeJSONNumber(outputStream_t *file, double value)
+{
+    if (isfinite(value)) {
+        outputStreamPrintf(file, "%.10g", value);
+    } else {
+        writeJSONLiteral(file, "null");
+    }
+}
+
+static void writeJSONDistribution(outputStream_t *file, seriesStats_t *stats, quantileSketch_t *quantiles)
+{
+    const double percentiles[] = {50, 90, 99, 99.9};
+    const quantileCentroid_t *centroids;
+    int centroidCount = quantileSketch_getCentroids(quantiles, &centroids);
+
+    outputStreamPrintf(file, "{\"count\":%d,\"mean\":", seriesStats_getCount(stats));
+    writeJSONNumber(file, seriesStats_getCount(stats) > 0 ? seriesStats_getMean(stats) : NAN);
+    writeJSONLiteral(file, ",\"stddev\":");
+    writeJSONNumber(file, seriesStats_getCount(stats) > 0 ? seriesStats_getStandardDeviation(stats) : NAN);
+    writeJSONLiteral(file, ",\"min\":");
+    writeJSONNumber(file, quantileSketch_getQuantile(quantiles, 0));
+    writeJSONLiteral(file, ",\"max\":");
+    writeJSONNumber(file, quantileSketch_getQuantile(quantiles, 1));
+
+    for (int i = 0; i < (int) ARRAY_LENGTH(percentiles); i++) {
+        outputStreamPrintf(file, ",\"p%g\":", percentiles[i]);
+        writeJSONNumber(file, quantileSketch_getQuantile(quantiles, percentiles[i] / 100));
+    }
+
+    outputStreamPrintf(file, ",\"compression\":%g,\"centroids\":[", quantiles->compression);
+
+    for (int i = 0; i < centroidCount; i++) {
+        outputStreamPrintf(file, "%s[%.10g,%.10g]", i > 0 ? "," : "", centroids[i].mean, centroids[i].weight);
+    }
+
+    writeJSONLiteral(file, "]}");
+}
+
+static void statsJsonSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    flightLogStatistics_t *stats = &log->stats;
+    outputStream_t *file;
+    char *filename = NULL;
+    jsonKey_t key;
+
+    if (!success)
+        return;
+
+    if (options.toStdout) {
+        file = outputStreamCreate(stdout, false, options.compressionLevel);
+    } else {
+        filename = createOutputFilename(".stats.json", true);
+        file = outputStreamOpen(filename, options.compressionLevel);
+
+        if (!file) {
+            fprintf(stderr, "Failed to create statistics file %s\n", filename);
+            free(filename);
+            return;
+        }
+    }
+
+    outputStreamPrintf(file, "{\"log\":%d,\"frames\":{", logIndex + 1);
+
+    for (int i = 0, written = 0; i < 256; i++) {
+        if (stats->frame[i].validCount) {
+            outputStreamPrintf(file, "%s\"%c\":%u", written++ ? "," : "", (char) i, stats->frame[i].validCount);
+        }
     }
-    const char *separatorPos = strchr(lineStart, ':');
-    if (separatorPos == NULL || separatorPos > lineEnd) {
+
+    writeJSONLiteral(file, "},\"corruptFrames\":");
+    outputStreamWriteInt(file, stats->totalCorruptFrames);
+    writeJSONLiteral(file, ",\"looptime\":");
+    writeJSONDistribution(file, &looptimeStats, &looptimeQuantiles);
+    writeJSONLiteral(file, ",\"fields\":{");
+
+    for (int i = 0; i < fieldDistributionCount; i++) {
+        createJSONKey(&key, log->frameDefs['I'].fieldName[i]);
+
+        // Skip the key's leading comma on the first field
+        outputStreamWrite(file, key.text + (i == 0), key.length - (i == 0));
+        writeJSONDistribution(file, &fieldStats[i], &fieldQuantiles[i]);
+
+        free(key.text);
+    }
+
+    writeJSONLiteral(file, "}}\n");
+
+    outputStreamClose(file, &outputStats);
+
+    if (filename) {
+        fprintf(stderr, "Statistics written to '%s'\n", filename);
+        free(filename);
+    }
+}
+
+static decodeSink_t csvSink = {
+    .name = "csv", .writesRows = true,
+    .open = csvSinkOpen, .beginLog = csvSinkBeginLog,
+    .onMainFrame = csvSinkOnMainFrame, .onSlowFrame = csvSinkOnSlowFrame,
+    .endLog = csvSinkEndLog
+};
+
+static decodeSink_t mergedCsvSink = {
+    .name = "merged-csv", .writesRows = true,
+    .open = mergedCsvSinkOpen, .beginLog = mergedCsvSinkBeginLog,
+    .onMainFrame = mergedCsvSinkOnMainFrame, .onGPSFrame = mergedCsvSinkOnGPSFrame, .onSlowFrame = mergedCsvSinkOnSlowFrame,
+    .endLog = mergedCsvSinkEndLog
+};
+
+static decodeSink_t gpsCsvSink = {
+    .name = "gps-csv",
+    .open = gpsCsvSinkOpen,
+    .onGPSFrame = gpsCsvSinkOnGPSFrame,
+    .endLog = gpsCsvSinkEndLog
+};
+
+static decodeSink_t gpxSink = {
+    .name = "gpx",
+    .open = gpxSinkOpen,
+    .onGPSFrame = gpxSinkOnGPSFrame,
+    .endLog = gpxSinkEndLog
+};
+
+static decodeSink_t eventsSink = {
+    .name = "events",
+    .open = eventsSinkOpen,
+    .onEvent = eventsSinkOnEvent,
+    .endLog = eventsSinkEndLog
+};
+
+static decodeSink_t headersSink = {
+    .name = "headers",
+    .open = headersSinkOpen,
+    .endLog = headersSinkEndLog
+};
+
+static decodeSink_t zoneMapSink = {
+    .name = "zonemap",
+    .beginLog = zoneMapSinkBeginLog,
+    .onMainFrame = zoneMapSinkOnMainFrame,
+    .endLog = zoneMapSinkEndLog
+};
+
+static decodeSink_t statsSink = {
+    .name = "stats",
+    .endLog = statsSinkEndLog
+};
+
+static decodeSink_t statsJsonSink = {
+    .name = "stats-json",
+    .endLog = statsJsonSinkEndLog
+};
+
+// All the available sinks, in the order that they'll be called:
+static decodeSink_t *sinks[] = {
+    &csvSink, &mergedCsvSink, &ndjsonSink, &gpsCsvSink, &gpxSink, &eventsSink, &headersSink, &zoneMapSink, &segmentsSink, &spectrumSink,
+    &stepResponseSink, &statsSink, &statsJsonSink
+};
+
+#define SINK_COUNT ((int) (sizeof(sinks) / sizeof(sinks[0])))
+
+static bool mergedCsvSinkOpen(flightLog_t *log)
+{
+    (void) log;
+
+    // If we're making the plain CSV too, we need a different name for this one
+    return csvWriterOpen(&mergedCsv, csvSink.enabled ? ".merged.csv" : ".csv");
+}
+
+static void sendMainFrameToSinks(flightLog_t *log, bool rowSinks, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    for (int i = 0; i < SINK_COUNT; i++) {
+        if (sinks[i]->enabled && sinks[i]->onMainFrame && sinks[i]->writesRows == rowSinks) {
+            sinks[i]->onMainFrame(log, frameValid, frame, frameType, frameOffset, frameSize);
+        }
+    }
+}
+
+/**
+ * Prepare the --where filter for a new log, whose field definitions have just been read.
+ */
+static void rowFilterBegin(flightLog_t *log)
+{
+    char error[256];
+
+    rowFilter.skippedStart = 0;
+    rowFilter.skippedCount = 0;
+    rowFilter.contextRemaining = 0;
+    rowFilter.lastFrameWritten = true;
+    rowFilter.framesMatched = 0;
+    rowFilter.framesSeen = 0;
+
+    if (!options.where)
+        return;
+
+    rowFilter.expression = expressionCompile(options.where, (const char *const *) log->frameDefs['I'].fieldName,
+        log->frameDefs['I'].fieldCount, error, sizeof(error));
+
+    if (!rowFilter.expression) {
+        fprintf(stderr, "Bad --where expression: %s\n", error);
+        exit(-1);
+    }
+
+    if (options.context > 0 && !rowFilter.skipped) {
+        rowFilter.skipped = (filterContextFrame_t *) malloc(options.context * sizeof(*rowFilter.skipped));
+    }
+}
+
+/**
+ * Hang on to a frame that was filtered out, in case it turns out to be context for a match.
+ */
+static void rowFilterSkip(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    filterContextFrame_t *skipped;
+
+    rowFilter.lastFrameWritten = false;
+
+    if (options.context == 0)
+        return;
+
+    if (rowFilter.skippedCount == options.context) {
+        // Overwrite the oldest one
+        skipped = &rowFilter.skipped[rowFilter.skippedStart];
+        rowFilter.skippedStart = (rowFilter.skippedStart + 1) % options.context;
+    } else {
+        skipped = &rowFilter.skipped[(rowFilter.skippedStart + rowFilter.skippedCount) % options.context];
+        rowFilter.skippedCount++;
+    }
+
+    skipped->frameValid = frameValid;
+    skipped->haveFrame = frame != NULL;
+    skipped->frameType = frameType;
+    skipped->frameOffset = frameOffset;
+    skipped->frameSize = frameSize;
+    skipped->frameTime = lastFrameTime;
+    skipped->frameIteration = lastFrameIteration;
+    skipped->simulation = simulation;
+    skipped->mergeSimulation = mergeSimulation;
+
+    memcpy(skipped->slowFrame, bufferedSlowFrame, log->frameDefs['S'].fieldCount * sizeof(*bufferedSlowFrame));
+
+    if (frame) {
+        memcpy(skipped->frame, frame, log->frameDefs['I'].fieldCount * sizeof(*frame));
+    }
+}
+
+/**
+ * Write out the skipped frames that come just before a match, with the shared state that the sinks read put back the
+ * way it was when each frame arrived.
+ */
+static void rowFilterWriteSkipped(flightLog_t *log)
+{
+    int slowFieldCount = log->frameDefs['S'].fieldCount;
+    int64_t savedSlowFrame[FLIGHT_LOG_MAX_FIELDS];
+    simulationState_t savedSimulation = simulation, savedMergeSimulation = mergeSimulation;
+    int64_t savedFrameTime = lastFrameTime;
+    uint32_t savedFrameIteration = lastFrameIteration;
+
+    if (rowFilter.skippedCount == 0)
+        return;
+
+    memcpy(savedSlowFrame, bufferedSlowFrame, slowFieldCount * sizeof(*bufferedSlowFrame));
+
+    for (int i = 0; i < rowFilter.skippedCount; i++) {
+        filterContextFrame_t *skipped = &rowFilter.skipped[(rowFilter.skippedStart + i) % options.context];
+
+        simulation = skipped->simulation;
+        mergeSimulation = skipped->mergeSimulation;
+        lastFrameTime = skipped->frameTime;
+        lastFrameIteration = skipped->frameIteration;
+        memcpy(bufferedSlowFrame, skipped->slowFrame, slowFieldCount * sizeof(*bufferedSlowFrame));
+
+        sendMainFrameToSinks(log, true, skipped->frameValid, skipped->haveFrame ? skipped->frame : NULL, skipped->frameType,
+            skipped->frameOffset, skipped->frameSize);
+    }
+
+    simulation = savedSimulation;
+    mergeSimulation = savedMergeSimulation;
+    lastFrameTime = savedFrameTime;
+    lastFrameIteration = savedFrameIteration;
+    memcpy(bufferedSlowFrame, savedSlowFrame, slowFieldCount * sizeof(*bufferedSlowFrame));
+
+    rowFilter.skippedStart = 0;
+    rowFilter.skippedCount = 0;
+}
+
+/**
+ * Pass the main frame on to the row-writing sinks if it matches --where (or is context for a match).
+ */
+static void rowFilterOnMainFrame(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    if (frameValid) {
+        rowFilter.framesSeen++;
+
+        if (expressionMatches(rowFilter.expression, frame)) {
+            rowFilter.framesMatched++;
+
+            rowFilterWriteSkipped(log);
+
+            rowFilter.contextRemaining = options.context;
+            rowFilter.lastFrameWritten = true;
+
+            sendMainFrameToSinks(log, true, frameValid, frame, frameType, frameOffset, frameSize);
+            return;
+        }
+    }
+
+    if (rowFilter.contextRemaining > 0) {
+        rowFilter.contextRemaining--;
+        rowFilter.lastFrameWritten = true;
+
+        sendMainFrameToSinks(log, true, frameValid, frame, frameType, frameOffset, frameSize);
+    } else {
+        rowFilterSkip(log, frameValid, frame, frameType, frameOffset, frameSize);
+    }
+}
+
+static void rowFilterEnd()
+{
+    if (rowFilter.expression) {
+        fprintf(stderr, "%" PRId64 " of %" PRId64 " main frames matched --where\n", rowFilter.framesMatched, rowFilter.framesSeen);
+    }
+
+    expressionDestroy(rowFilter.expression);
+    rowFilter.expression = NULL;
+}
+
+void onMetadataReady(flightLog_t *log)
+{
+    if (log->frameDefs['I'].fieldCount == 0) {
+        fprintf(stderr, "No fields found in log, is it missing its header?\n");
         return;
+    } else if (options.simulateIMU && (log->mainFieldIndexes.accSmooth[0] == -1 || log->mainFieldIndexes.gyroADC[0] == -1)){
+        fprintf(stderr, "Can't simulate the IMU because accelerometer or gyroscope data is missing\n");
+        options.simulateIMU = false;
+    }
+
+    identifyGPSFields(log);
+    applyFieldUnits(log);
+
+    rowFilterBegin(log);
+    fieldDistributionsBegin(log);
+
+    for (int i = 0; i < SINK_COUNT; i++) {
+        if (sinks[i]->enabled && sinks[i]->beginLog) {
+            sinks[i]->beginLog(log);
+        }
+    }
+}
+
+/**
+ * Update the states that are computed from the frames (which all the sinks share) and pass the frame along to every
+ * sink.
+ */
+void onFrameReady(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int fieldCount, int frameOffset, int frameSize)
+{
+    (void) fieldCount;
+
+    switch (frameType) {
+        case 'G':
+            if (frameValid) {
+                for (int i = 0; i < SINK_COUNT; i++) {
+                    if (sinks[i]->enabled && sinks[i]->onGPSFrame) {
+                        sinks[i]->onGPSFrame(log, frame);
+                    }
+                }
+            }
+        break;
+        case 'S':
+            if (frameValid) {
+                for (int i = 0; i < SINK_COUNT; i++) {
+                    if (sinks[i]->enabled && sinks[i]->onSlowFrame) {
+                        sinks[i]->onSlowFrame(log, frame);
+                    }
+                }
+
+                memcpy(bufferedSlowFrame, frame, sizeof(bufferedSlowFrame));
+            }
+        break;
+        case 'P':
+        case 'I':
+            if (frameValid) {
+                updateFrameStatistics(log, frame);
+
+                lastFrameIteration = (uint32_t) frame[FLIGHT_LOG_FIELD_INDEX_ITERATION];
+
+                updateSimulations(&simulation, log, frame, lastFrameTime);
+
+                if (mergedCsvSink.enabled && mergedCsv.includeGPS) {
+                    updateSimulations(&mergeSimulation, log, frame, frame[FLIGHT_LOG_FIELD_INDEX_TIME]);
+                }
+
+                lastFrameTime = frame[FLIGHT_LOG_FIELD_INDEX_TIME];
+            }
+
+            if (rowFilter.expression) {
+                rowFilterOnMainFrame(log, frameValid, frame, frameType, frameOffset, frameSize);
+            } else {
+                sendMainFrameToSinks(log, true, frameValid, frame, frameType, frameOffset, frameSize);
+            }
+
+            sendMainFrameToSinks(log, false, frameValid, frame, frameType, frameOffset, frameSize);
+        break;
     }
+}
 
-    fprintf(headersFile, "%.*s,\"%.*s\"\n", (int) (separatorPos - lineStart - 2), lineStart+2, (int) (lineEnd - separatorPos -1), separatorPos + 1);
+void onEvent(flightLog_t *log, flightLogEvent_t *event)
+{
+    for (int i = 0; i < SINK_COUNT; i++) {
+        if (sinks[i]->enabled && sinks[i]->onEvent) {
+            sinks[i]->onEvent(log, event);
+        }
+    }
 }
 
-void writeLogHeaders(flightLog_t *log, int logIndex) {
-    const char *headers = log->logBegin[logIndex];
+/**
+ * Enable the sinks named in the comma-separated list `names`. Exits with an error if a name isn't recognised.
+ */
+void enableSinks(const char *names)
+{
+    const char *name = names;
+
+    while (*name) {
+        const char *nameEnd = strchr(name, ',');
+        int nameLen = nameEnd ? nameEnd - name : (int) strlen(name);
+        bool found = false;
+
+        for (int i = 0; i < SINK_COUNT; i++) {
+            if ((int) strlen(sinks[i]->name) == nameLen && strncmp(sinks[i]->name, name, nameLen) == 0) {
+                sinks[i]->enabled = true;
+                found = true;
+                break;
+            }
+        }
 
-    if (headers == NULL) {
-        fprintf(stderr, "Header log with index %i could not be found\n", logIndex);
-        return;
-    }
+        if (!found) {
+            fprintf(stderr, "Unknown output type '%.*s', choose from:", nameLen, name);
 
-    const char *headerPos = headers;
-    const char *headerEnd = headerPos + strlen(headers);
+            for (int i = 0; i < SINK_COUNT; i++) {
+                fprintf(stderr, " %s", sinks[i]->name);
+            }
 
-    fprintf(headersFile, "fieldname, fieldvalue\n");
+            fprintf(stderr, "\n");
+            exit(-1);
+        }
 
-    while (headerPos < headerEnd) {
-        char *next_line = strchr(headerPos + 1, '\n');
-        if (next_line != NULL && next_line < headerEnd) {
-            writeLogHeaderLine(headerPos, next_line);
-            headerPos = next_line + 1;
-        } else {
-            break;
+        name += nameLen;
+
+        if (*name == ',') {
+            name++;
         }
     }
 }
 
 int decodeFlightLog(flightLog_t *log, const char *filename, int logIndex)
 {
-    // Organise output files/streams
-    gpx = NULL;
-
-    gpsCsvFile = NULL;
-    gpsCsvFilename = NULL;
+    int openedSinks;
 
-    eventFile = NULL;
-    eventFilename = NULL;
+    outputNaming.logFilename = filename;
+    outputNaming.logIndex = logIndex;
 
-    if (options.toStdout) {
-        csvFile = stdout;
-    } else {
-        char *csvFilename = 0, *gpxFilename = 0, *headersFilename = 0;
-        int filenameLen;
+    memset(&outputStats, 0, sizeof(outputStats));
 
+    if (!options.toStdout) {
         const char *outputPrefix = 0;
         int outputPrefixLen;
-        const char *baseNamePrefix = 0;
-        int baseNamePrefixLen;
 
         if (options.outputPrefix) {
             const char *logNameEnd = options.outputPrefix + strlen(options.outputPrefix);
             extractBaseNamePrefix(options.outputPrefix, logNameEnd, options.outputDir != NULL,
-                                 &baseNamePrefix, &baseNamePrefixLen,
+                                 &outputNaming.baseNamePrefix, &outputNaming.baseNamePrefixLen,
                                  &outputPrefix, &outputPrefixLen);
         } else {
             const char *fileExtensionPeriod = strrchr(filename, '.');
@@ -1163,7 +2284,7 @@ int decodeFlightLog(flightLog_t *log, const char *filename, int logIndex)
                 logNameEnd = filename + strlen(filename);
             }
             extractBaseNamePrefix(filename, logNameEnd, options.outputDir != NULL,
-                                 &baseNamePrefix, &baseNamePrefixLen,
+                                 &outputNaming.baseNamePrefix, &outputNaming.baseNamePrefixLen,
                                  &outputPrefix, &outputPrefixLen);
         }
         // Validate output directory if specified
@@ -1180,132 +2301,321 @@ int decodeFlightLog(flightLog_t *log, const char *filename, int logIndex)
             }
         }
 
-        // Calculate filename length including output directory if specified
         int outputDirLen = options.outputDir ? strlen(options.outputDir) : 0;
-        int pathSeparatorLen = (options.outputDir && options.outputDir[outputDirLen-1] != '/') ? 1 : 0;
+        outputNaming.pathSeparatorLen = (options.outputDir && options.outputDir[outputDirLen-1] != '/') ? 1 : 0;
+    }
 
-        filenameLen = outputDirLen + pathSeparatorLen + baseNamePrefixLen + strlen(".00.csv") + 1;
-        csvFilename = malloc(filenameLen * sizeof(char));
+    // Organise output files/streams
+    for (openedSinks = 0; openedSinks < SINK_COUNT; openedSinks++) {
+        decodeSink_t *sink = sinks[openedSinks];
+
+        if (sink->enabled && sink->open && !sink->open(log)) {
+            // Close whatever the earlier sinks opened
+            for (int i = 0; i < openedSinks; i++) {
+                if (sinks[i]->enabled && sinks[i]->endLog) {
+                    sinks[i]->endLog(log, logIndex, false);
+                }
+            }
 
-        if (options.outputDir) {
-            snprintf(csvFilename, filenameLen, "%s%s%.*s.%02d.csv", 
-                    options.outputDir, 
-                    pathSeparatorLen ? "/" : "",
-                    baseNamePrefixLen, baseNamePrefix, 
-                    logIndex + 1);
-        } else {
-            snprintf(csvFilename, filenameLen, "%.*s.%02d.csv", baseNamePrefixLen, baseNamePrefix, logIndex + 1);
+            return -1;
         }
+    }
 
-        filenameLen = outputDirLen + pathSeparatorLen + baseNamePrefixLen + strlen(".00.gps.gpx") + 1;
-        gpxFilename = malloc(filenameLen * sizeof(char));
+    resetParseState();
 
-        if (options.outputDir) {
-            snprintf(gpxFilename, filenameLen, "%s%s%.*s.%02d.gps.gpx", 
-                    options.outputDir,
-                    pathSeparatorLen ? "/" : "",
-                    baseNamePrefixLen, baseNamePrefix, 
-                    logIndex + 1);
-        } else {
-            snprintf(gpxFilename, filenameLen, "%.*s.%02d.gps.gpx", baseNamePrefixLen, baseNamePrefix, logIndex + 1);
-        }
+    if ((log->private->stream->mapping.stats.st_mode & S_IFMT) == S_IFCHR) { //prime data buffer with data
+        fillSerialBuffer(log->private->stream, FLIGHT_LOG_MAX_FRAME_SERIAL_BUFFER_LENGTH, NULL);
+    }
 
-        filenameLen = outputDirLen + pathSeparatorLen + baseNamePrefixLen + strlen(".00.gps.csv") + 1;
-        gpsCsvFilename = malloc(filenameLen * sizeof(char));
+    int success;
 
-        if (options.outputDir) {
-            snprintf(gpsCsvFilename, filenameLen, "%s%s%.*s.%02d.gps.csv", 
-                    options.outputDir,
-                    pathSeparatorLen ? "/" : "",
-                    baseNamePrefixLen, baseNamePrefix, 
-                    logIndex + 1);
-        } else {
-            snprintf(gpsCsvFilename, filenameLen, "%.*s.%02d.gps.csv", baseNamePrefixLen, baseNamePrefix, logIndex + 1);
-        }
+    if (options.useCache) {
+        logCacheStatistics_t cacheStats;
 
-        filenameLen = outputDirLen + pathSeparatorLen + baseNamePrefixLen + strlen(".00.event") + 1;
-        eventFilename = malloc(filenameLen * sizeof(char));
+        success = flightLogParseCached(log, filename, logIndex, onMetadataReady, onFrameReady, onEvent, options.raw, &cacheStats);
 
-        if (options.outputDir) {
-            snprintf(eventFilename, filenameLen, "%s%s%.*s.%02d.event", 
-                    options.outputDir,
-                    pathSeparatorLen ? "/" : "",
-                    baseNamePrefixLen, baseNamePrefix, 
-                    logIndex + 1);
-        } else {
-            snprintf(eventFilename, filenameLen, "%.*s.%02d.event", baseNamePrefixLen, baseNamePrefix, logIndex + 1);
+        fprintf(stderr, "%s: first frame after %.1f ms, finished after %.1f ms\n",
+            cacheStats.hit ? "Read log from cache" : cacheStats.written ? "Decoded log and wrote cache" : "Decoded log (cache not written)",
+            cacheStats.firstFrameMicros / 1000.0, cacheStats.totalMicros / 1000.0);
+    } else {
+        success = flightLogParse(log, logIndex, onMetadataReady, onFrameReady, onEvent, options.raw);
+    }
+
+    for (int i = 0; i < SINK_COUNT; i++) {
+        if (sinks[i]->enabled && sinks[i]->endLog) {
+            sinks[i]->endLog(log, logIndex, success);
         }
+    }
 
-        if (options.saveHeaders) {
-            filenameLen = outputDirLen + pathSeparatorLen + baseNamePrefixLen + strlen(".00.headers.csv") + 1;
-            headersFilename = malloc(filenameLen * sizeof(char));
+    rowFilterEnd();
 
-            if (options.outputDir) {
-                snprintf(headersFilename, filenameLen, "%s%s%.*s.%02d.headers.csv", 
-                        options.outputDir,
-                        pathSeparatorLen ? "/" : "",
-                        baseNamePrefixLen, baseNamePrefix, 
-                        logIndex + 1);
-            } else {
-                snprintf(headersFilename, filenameLen, "%.*s.%02d.headers.csv", baseNamePrefixLen, baseNamePrefix, logIndex + 1);
-            }
+    if (outputStats.streamsFailed > 0) {
+        outputFailed = true;
+    }
+
+    if (options.debug) {
+        fprintf(stderr, "Output: %u buffers, %" PRIu64 " bytes written, decoder blocked %u times for %.1f ms, writer idle for %.1f ms\n",
+            outputStats.buffersWritten, outputStats.bytesWritten, outputStats.producerBlockedCount,
+            outputStats.producerBlockedMicros / 1000.0, outputStats.writerIdleMicros / 1000.0);
+    }
+
+    return success ? 0 : -1;
+}
+
+/*
+ * Query mode (--query): find the runs of main frames which match a condition like "motor[*] > 1900", using the log's
+ * zone map to skip the parts of the log that can't contain a match.
+ */
+
+typedef struct queryState_t {
+    // The query matches a frame if any one of these conditions matches it
+    zoneMapCondition_t conditions[FLIGHT_LOG_MAX_FIELDS];
+    int conditionCount;
+
+    // When the log doesn't have a zone map yet, it's built as we scan the log
+    zoneMap_t *building;
+
+    int logIndex;
 
-            headersFile = fopen(headersFilename, "wb");
-            if (!headersFile) {
-                fprintf(stderr, "Failed to headers create output file %s\n", headersFilename);
+    // The run of matching frames we're in the middle of, if any
+    bool inRun;
+    int64_t runStartTime, runEndTime;
+    uint32_t runStartIteration, runEndIteration;
+    int64_t runFrames;
+
+    int64_t framesSearched, framesMatched;
+    int runCount;
+} queryState_t;
+
+static queryState_t query;
+
+/**
+ * Parse the query (a main field name, a comparison operator and an integer) into conditions on the fields of the
+ * log. Exits with an error if the query can't be understood.
+ */
+static void parseQuery(flightLog_t *log, const char *text)
+{
+    static const struct {
+        const char *symbol;
+        zoneMapComparison_e comparison;
+    } operators[] = {
+        // Longer operators must come first so that "<=" isn't taken as "<"
+        {"<=", ZONE_MAP_COMPARE_LE}, {">=", ZONE_MAP_COMPARE_GE}, {"==", ZONE_MAP_COMPARE_EQ}, {"!=", ZONE_MAP_COMPARE_NE},
+        {"<", ZONE_MAP_COMPARE_LT}, {">", ZONE_MAP_COMPARE_GT}, {"=", ZONE_MAP_COMPARE_EQ}
+    };
+
+    flightLogFrameDef_t *frameDef = &log->frameDefs['I'];
+    const char *operatorStart = strpbrk(text, "<>=!");
+    const char *nameStart = text, *nameEnd = operatorStart, *valueStart;
+    zoneMapComparison_e comparison = ZONE_MAP_COMPARE_EQ;
+    int64_t value;
+    char *valueEnd;
+    bool foundOperator = false;
+
+    if (operatorStart) {
+        for (unsigned int i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+            if (strncmp(operatorStart, operators[i].symbol, strlen(operators[i].symbol)) == 0) {
+                comparison = operators[i].comparison;
+                valueStart = operatorStart + strlen(operators[i].symbol);
+                foundOperator = true;
+                break;
             }
-            free(headersFilename);
         }
+    }
+
+    if (!foundOperator) {
+        fprintf(stderr, "Bad query '%s', it should look like \"<field> <operator> <value>\", e.g. \"motor[*] > 1900\"\n", text);
+        exit(-1);
+    }
 
-        csvFile = fopen(csvFilename, "wb");
+    while (*nameStart == ' ')
+        nameStart++;
+    while (nameEnd > nameStart && nameEnd[-1] == ' ')
+        nameEnd--;
 
-        if (!csvFile) {
-            fprintf(stderr, "Failed to create output file %s\n", csvFilename);
+    errno = 0;
+    value = strtoll(valueStart, &valueEnd, 10);
 
-            free(csvFilename);
-            return -1;
+    while (*valueEnd == ' ')
+        valueEnd++;
+
+    if (valueEnd == valueStart || *valueEnd != '\0' || errno == ERANGE) {
+        fprintf(stderr, "Bad value in query '%s' (it should be an integer)\n", text);
+        exit(-1);
+    }
+
+    query.conditionCount = 0;
+
+    for (int i = 0; i < frameDef->fieldCount; i++) {
+        if (fieldNameMatches(nameStart, nameEnd - nameStart, frameDef->fieldName[i])) {
+            zoneMapCondition_t *condition = &query.conditions[query.conditionCount++];
+
+            condition->fieldIndex = i;
+            condition->comparison = comparison;
+            condition->value = value;
         }
+    }
 
-        fprintf(stderr, "Decoding log '%s' to '%s'...\n", filename, csvFilename);
-        free(csvFilename);
+    if (query.conditionCount == 0) {
+        fprintf(stderr, "The log doesn't have a main field called '%.*s'\n", (int) (nameEnd - nameStart), nameStart);
+        exit(-1);
+    }
+}
 
-        gpx = gpxWriterCreate(gpxFilename);
-        free(gpxFilename);
+static void queryEndRun()
+{
+    if (query.inRun) {
+        fprintf(stdout, "%d,%" PRId64 ",%" PRId64 ",%u,%u,%" PRId64 "\n", query.logIndex + 1, query.runStartTime, query.runEndTime,
+            query.runStartIteration, query.runEndIteration, query.runFrames);
+
+        query.inRun = false;
+        query.runCount++;
     }
+}
 
-    resetParseState();
+static void queryOnFrameReady(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int fieldCount, int frameOffset, int frameSize)
+{
+    bool matches = false;
 
-    if ((log->private->stream->mapping.stats.st_mode & S_IFMT) == S_IFCHR) { //prime data buffer with data
-        fillSerialBuffer(log->private->stream, FLIGHT_LOG_MAX_FRAME_SERIAL_BUFFER_LENGTH, NULL);
+    (void) log;
+    (void) fieldCount;
+    (void) frameSize;
+
+    if (frameType != 'I' && frameType != 'P')
+        return;
+
+    if (query.building) {
+        zoneMapAddMainFrame(query.building, frameValid, frame, frameType, frameOffset);
+    }
+
+    if (!frameValid || !frame) {
+        // A gap in the log ends the run
+        queryEndRun();
+        return;
     }
 
-    int success = flightLogParse(log, logIndex, onMetadataReady, onFrameReady, onEvent, options.raw);
+    query.framesSearched++;
 
-    if (options.mergeGPS && haveBufferedMainFrame) {
-        // Print out last log entry that wasn't already printed
-        outputMergeFrame(log);
+    for (int i = 0; i < query.conditionCount && !matches; i++) {
+        matches = zoneMapConditionMatches(&query.conditions[i], frame);
     }
 
-    if (success)
-        printStats(log, logIndex, options.raw, options.limits);
+    if (matches) {
+        if (!query.inRun) {
+            query.inRun = true;
+            query.runStartTime = frame[FLIGHT_LOG_FIELD_INDEX_TIME];
+            query.runStartIteration = (uint32_t) frame[FLIGHT_LOG_FIELD_INDEX_ITERATION];
+            query.runFrames = 0;
+        }
 
-    if (!options.toStdout)
-        fclose(csvFile);
+        query.runEndTime = frame[FLIGHT_LOG_FIELD_INDEX_TIME];
+        query.runEndIteration = (uint32_t) frame[FLIGHT_LOG_FIELD_INDEX_ITERATION];
+        query.runFrames++;
+        query.framesMatched++;
+    } else {
+        queryEndRun();
+    }
+}
 
-    free(eventFilename);
-    if (eventFile)
-        fclose(eventFile);
+static bool queryBlockMayMatch(const zoneMap_t *map, int block)
+{
+    for (int i = 0; i < query.conditionCount; i++) {
+        if (zoneMapBlockMayMatch(map, block, &query.conditions[i]))
+            return true;
+    }
 
-    free(gpsCsvFilename);
-    if (gpsCsvFile)
-        fclose(gpsCsvFile);
+    return false;
+}
 
-    gpxWriterDestroy(gpx);
+/**
+ * Print the runs of frames in the log that match the query to stdout as CSV. If the log has an up-to-date zone map,
+ * only the blocks that could contain a match are decoded. Otherwise the whole log is scanned and a zone map is written
+ * for next time.
+ */
+int queryFlightLog(flightLog_t *log, const char *filename, int logIndex)
+{
+    int64_t startTime = time_monotonic_us();
+    char *mapFilename;
+    zoneMap_t *map;
+    int searchedBlocks = 0;
+    bool success = true, usedZoneMap;
 
-    if (options.saveHeaders && headersFile != NULL) {
-        writeLogHeaders(log, logIndex);
-        fclose(headersFile);
+    if (!flightLogParseHeaders(log, logIndex)) {
+        return -1;
+    }
+
+    parseQuery(log, options.query);
+
+    query.logIndex = logIndex;
+    query.building = NULL;
+    query.inRun = false;
+    query.framesSearched = 0;
+    query.framesMatched = 0;
+    query.runCount = 0;
+
+    mapFilename = zoneMapFilename(filename, logIndex);
+    map = zoneMapLoad(log, logIndex, mapFilename);
+    usedZoneMap = map != NULL;
+
+    if (usedZoneMap) {
+        for (int block = 0; block < map->blockCount && success; ) {
+            flightLogDataRange_t range;
+
+            if (!queryBlockMayMatch(map, block)) {
+                block++;
+                continue;
+            }
+
+            // Decode this run of candidate blocks in one go, so a run of matching frames can carry across blocks
+            range = map->ranges[block];
+
+            do {
+                range.end = map->ranges[block].end;
+                block++;
+                searchedBlocks++;
+            } while (block < map->blockCount && queryBlockMayMatch(map, block));
+
+            success = flightLogParseRange(log, logIndex, &range, NULL, queryOnFrameReady, NULL, false);
+
+            queryEndRun();
+        }
+    } else {
+        bool isSerial = (log->private->stream->mapping.stats.st_mode & S_IFMT) == S_IFCHR;
+
+        if (!isSerial) {
+            query.building = zoneMapCreate(log->frameDefs['I'].fieldCount);
+        }
+
+        success = flightLogParse(log, logIndex, NULL, queryOnFrameReady, NULL, false);
+
+        queryEndRun();
+
+        if (query.building) {
+            if (success) {
+                zoneMapFinish(query.building, log, logIndex);
+
+                if (!zoneMapSave(query.building, log, logIndex, mapFilename)) {
+                    fprintf(stderr, "Failed to write zone map file %s\n", mapFilename);
+                }
+            }
+
+            zoneMapDestroy(query.building);
+            query.building = NULL;
+        }
+    }
+
+    if (usedZoneMap) {
+        fprintf(stderr, "Log %d: searched %d of %d blocks (%" PRId64 " frames)", logIndex + 1, searchedBlocks, map->blockCount, query.framesSearched);
+    } else {
+        fprintf(stderr, "Log %d: no zone map yet, searched the whole log (%" PRId64 " frames)", logIndex + 1, query.framesSearched);
     }
+
+    fprintf(stderr, " and found %" PRId64 " matching frames in %d runs after %.1f ms\n", query.framesMatched, query.runCount,
+        (time_monotonic_us() - startTime) / 1000.0);
+
+    zoneMapDestroy(map);
+    free(mapFilename);
+
     return success ? 0 : -1;
 }
 
@@ -1347,9 +2657,24 @@ void printUsage(const char *argv0)
         "Options:\n"
         "   --help                   This page\n"
         "   --index <num>            Choose the log from the file that should be decoded (or omit to decode all)\n"
-        "   --limits                 Print the limits and range of each field\n"
+        "   --limits                 Print the limits, range and percentiles of each field, and the looptime percentiles\n"
+        "   --stats-json             Also write the statistics, with the percentiles of the looptime and every field,\n"
+        "                            to a .stats.json file\n"
         "   --stdout                 Write log to stdout instead of to a file\n"
         "   --output-dir <dir>       Directory to write output CSV files to (default: same as input file)\n"
+        "   --format <format>        Format of the main output (csv|ndjson), default is csv. ndjson writes the main,\n"
+        "                            GPS and slow frames and the events as JSON records in one time-ordered stream\n"
+        "   --emit <outputs>         Comma-separated list of outputs to produce in one pass, from csv, merged-csv,\n"
+        "                            ndjson, gps-csv, gpx, events, headers, zonemap, segments, spectrum,\n"
+        "                            step-response, stats and stats-json\n"
+        "                            (default csv,gps-csv,gpx,events,stats)\n"
+        "   --where <expression>     Only write the main rows that match an expression like\n"
+        "                            \"motor[0] > 1900 || abs(gyroADC[2]) > 1500\" (on the raw field values)\n"
+        "   --context <num>          Also write this many rows before and after each row that matches --where\n",
+        argv0
+    );
+
+    fprintf(stderr,
         "   --unit-amperage <unit>   Current meter unit (raw|mA|A), default is A (amps)\n"
         "   --unit-flags <unit>      State flags unit (raw|flags), default is flags\n"
         "   --unit-frame-time <unit> Frame timestamp unit (us|s), default is us (microseconds)\n"
@@ -1364,6 +2689,25 @@ void printUsage(const char *argv0)
         "   --sim-current-meter-scale   Override the FC's settings for the current meter simulation\n"
         "   --sim-current-meter-offset  Override the FC's settings for the current meter simulation\n"
         "   --save-headers           Save the log headers to a CSV file\n"
+        "   --cache                  Keep a decoded copy of the log in a .bbcache file next to it, and use that\n"
+        "                            instead of decoding the log again on later runs\n"
+        "   --segments               Also write a .segments.csv table with a row for each stretch of the log with\n"
+        "                            the same flight modes, flags, failsafe phase and armed state\n"
+        "   --segment-fields <list>  Comma-separated main fields to summarise in each segment (motor[*] selects\n"
+        "                            every motor), default is %s\n"
+        "   --spectrum               Also write the power spectral density of the --spectrum-fields fields averaged\n"
+        "                            over the log to a .spectrum.csv file, and over time to a .spectrogram.csv file\n"
+        "   --spectrum-fields <list> Comma-separated main fields to analyse, default is %s\n"
+        "   --spectrum-window <num>  Number of samples in each spectrum window (a power of two), default is %d\n"
+        "   --step-response          Also write the average step response of the roll, pitch and yaw gyros to the\n"
+        "                            stick commands to a .step.csv file\n"
+        "   --zone-map               Also write a .bbzones file next to the log, holding the range of each field\n"
+        "                            over every block of ~%d frames, so that --query can skip most of the log\n"
+        "   --query <condition>      Instead of decoding, print the runs of frames that match a condition like\n"
+        "                            \"motor[*] > 1900\" (compared against the raw field values) as CSV on stdout\n"
+        "   --threads <num>          Number of threads to use to format the CSV output (default %d)\n"
+        "   --gzip                   Compress the output files with gzip (adds a .gz extension)\n"
+        "   --gzip-level <num>       Gzip compression level (1-9, implies --gzip), default is %d\n"
         "   --simulate-imu           Compute tilt/roll/heading fields from gyro/accel/mag data\n"
         "   --include-imu-degrees    Include (deg) in the header for tilt/roll/heading (Note. Requires --include-imu"
         "   --imu-ignore-mag         Ignore magnetometer data when computing heading\n"
@@ -1371,7 +2715,7 @@ void printUsage(const char *argv0)
         "   --declination-dec <val>  Set magnetic declination in decimal degrees (e.g. -12.97 for New York)\n"
         "   --debug                  Show extra debugging information\n"
         "   --raw                    Don't apply predictions to fields (show raw field deltas)\n"
-        "\n", argv0
+        "\n", options.segmentFields, options.spectrumFields, options.spectrumWindow, ZONE_MAP_FRAMES_PER_BLOCK, options.threads, OUTPUT_STREAM_COMPRESSION_DEFAULT_LEVEL
     );
 }
 
@@ -1406,6 +2750,17 @@ void parseCommandlineOptions(int argc, char **argv)
         SETTING_UNIT_FLAGS,
         SETTING_ALT_OFFSET,
         SETTING_OUTPUT_DIR,
+        SETTING_GZIP,
+        SETTING_GZIP_LEVEL,
+        SETTING_THREADS,
+        SETTING_EMIT,
+        SETTING_FORMAT,
+        SETTING_QUERY,
+        SETTING_WHERE,
+        SETTING_CONTEXT,
+        SETTING_SEGMENT_FIELDS,
+        SETTING_SPECTRUM_FIELDS,
+        SETTING_SPECTRUM_WINDOW,
     };
 
     while (1)
@@ -1415,10 +2770,14 @@ void parseCommandlineOptions(int argc, char **argv)
             {"raw", no_argument, &options.raw, 1},
             {"debug", no_argument, &options.debug, 1},
             {"limits", no_argument, &options.limits, 1},
+            {"stats-json", no_argument, &options.statsJson, 1},
             {"stdout", no_argument, &options.toStdout, 1},
             {"merge-gps", no_argument, &options.mergeGPS, 1},
             {"simulate-imu", no_argument, &options.simulateIMU, 1},
             {"save-headers", no_argument, &options.saveHeaders, 1},
+            {"cache", no_argument, &options.useCache, 1},
+            {"zone-map", no_argument, &options.zoneMap, 1},
+            {"segments", no_argument, &options.segments, 1},
             {"include-imu-degrees", no_argument, &options.includeIMUDegrees, 1},
             {"simulate-current-meter", no_argument, &options.simulateCurrentMeter, 1},
             {"imu-ignore-mag", no_argument, &options.imuIgnoreMag, 1},
@@ -1438,6 +2797,19 @@ void parseCommandlineOptions(int argc, char **argv)
             {"unit-frame-time", required_argument, 0, SETTING_UNIT_FRAME_TIME},
             {"unit-flags", required_argument, 0, SETTING_UNIT_FLAGS},
             {"alt-offset", required_argument, 0, SETTING_ALT_OFFSET},
+            {"gzip", no_argument, 0, SETTING_GZIP},
+            {"gzip-level", required_argument, 0, SETTING_GZIP_LEVEL},
+            {"threads", required_argument, 0, SETTING_THREADS},
+            {"emit", required_argument, 0, SETTING_EMIT},
+            {"format", required_argument, 0, SETTING_FORMAT},
+            {"query", required_argument, 0, SETTING_QUERY},
+            {"where", required_argument, 0, SETTING_WHERE},
+            {"context", required_argument, 0, SETTING_CONTEXT},
+            {"segment-fields", required_argument, 0, SETTING_SEGMENT_FIELDS},
+            {"spectrum", no_argument, &options.spectrum, 1},
+            {"spectrum-fields", required_argument, 0, SETTING_SPECTRUM_FIELDS},
+            {"spectrum-window", required_argument, 0, SETTING_SPECTRUM_WINDOW},
+            {"step-response", no_argument, &options.stepResponse, 1},
             {0, 0, 0, 0}
         };
 
@@ -1460,6 +2832,47 @@ void parseCommandlineOptions(int argc, char **argv)
             case SETTING_OUTPUT_DIR:
                 options.outputDir = optarg;
             break;
+            case SETTING_EMIT:
+                options.emit = optarg;
+            break;
+            case SETTING_QUERY:
+                options.query = optarg;
+            break;
+            case SETTING_SEGMENT_FIELDS:
+                options.segmentFields = optarg;
+            break;
+            case SETTING_SPECTRUM_FIELDS:
+                options.spectrumFields = optarg;
+            break;
+            case SETTING_SPECTRUM_WINDOW:
+                options.spectrumWindow = atoi(optarg);
+
+                if (!fftSizeIsValid(options.spectrumWindow)) {
+                    fprintf(stderr, "The spectrum window must be a power of two, like 512 or 1024\n");
+                    exit(-1);
+                }
+            break;
+            case SETTING_WHERE:
+                options.where = optarg;
+            break;
+            case SETTING_CONTEXT:
+                options.context = atoi(optarg);
+
+                if (options.context < 0) {
+                    fprintf(stderr, "Bad number of context rows\n");
+                    exit(-1);
+                }
+            break;
+            case SETTING_FORMAT:
+                if (strcmp(optarg, "csv") == 0) {
+                    options.format = OUTPUT_FORMAT_CSV;
+                } else if (strcmp(optarg, "ndjson") == 0) {
+                    options.format = OUTPUT_FORMAT_NDJSON;
+                } else {
+                    fprintf(stderr, "Bad output format (should be csv or ndjson)\n");
+                    exit(-1);
+                }
+            break;
             case SETTING_UNIT_GPS_SPEED:
                 if (!unitFromName(optarg, &options.unitGPSSpeed)) {
                     fprintf(stderr, "Bad GPS speed unit\n");
@@ -1509,10 +2922,10 @@ void parseCommandlineOptions(int argc, char **argv)
                 }
             break;
             case SETTING_DECLINATION:
-                imuSetMagneticDeclination(parseDegreesMinutes(optarg));
+                options.magneticDeclination = parseDegreesMinutes(optarg);
             break;
             case SETTING_DECLINATION_DECIMAL:
-                imuSetMagneticDeclination(atof(optarg));
+                options.magneticDeclination = atof(optarg);
             break;
             case SETTING_CURRENT_METER_SCALE:
                 options.overrideSimCurrentMeterScale = true;
@@ -1525,6 +2938,27 @@ void parseCommandlineOptions(int argc, char **argv)
             case SETTING_ALT_OFFSET:
                 options.altOffset = atof(optarg);
             break;
+            case SETTING_THREADS:
+                options.threads = atoi(optarg);
+
+                if (options.threads < 1) {
+                    fprintf(stderr, "Bad number of threads\n");
+                    exit(-1);
+                }
+            break;
+            case SETTING_GZIP:
+                if (options.compressionLevel == OUTPUT_STREAM_COMPRESSION_NONE) {
+                    options.compressionLevel = OUTPUT_STREAM_COMPRESSION_DEFAULT_LEVEL;
+                }
+            break;
+            case SETTING_GZIP_LEVEL:
+                options.compressionLevel = atoi(optarg);
+
+                if (options.compressionLevel < 1 || options.compressionLevel > 9) {
+                    fprintf(stderr, "Bad gzip compression level (should be 1-9)\n");
+                    exit(-1);
+                }
+            break;
             case '\0':
                 //Longopt which has set a flag
             break;
@@ -1550,6 +2984,7 @@ int main(int argc, char **argv)
     flightLog_t *log;
     int fd;
     int logIndex;
+    int (*processLog)(flightLog_t *log, const char *filename, int logIndex);
 
     platform_init();
 
@@ -1565,6 +3000,116 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    if (options.emit) {
+        enableSinks(options.emit);
+    } else {
+        enableSinks("csv,gps-csv,gpx,events,stats");
+    }
+
+    // The NDJSON stream takes the place of the main CSV, and already includes the GPS frames and events
+    if (options.format == OUTPUT_FORMAT_NDJSON && csvSink.enabled) {
+        csvSink.enabled = false;
+        ndjsonSink.enabled = true;
+
+        if (!options.emit) {
+            gpsCsvSink.enabled = false;
+            eventsSink.enabled = false;
+        }
+    }
+
+    // When merging GPS, the main CSV has the GPS data merged into it so it doesn't need its own file
+    if (options.mergeGPS && csvSink.enabled) {
+        csvSink.enabled = false;
+        mergedCsvSink.enabled = true;
+
+        if (!options.emit) {
+            gpsCsvSink.enabled = false;
+        }
+    }
+
+    if (options.saveHeaders) {
+        headersSink.enabled = true;
+    }
+
+    if (options.zoneMap) {
+        zoneMapSink.enabled = true;
+    }
+
+    if (options.segments) {
+        segmentsSink.enabled = true;
+    }
+
+    if (options.statsJson) {
+        statsJsonSink.enabled = true;
+    }
+
+    if (options.spectrum) {
+        spectrumSink.enabled = true;
+    }
+
+    if (options.stepResponse) {
+        stepResponseSink.enabled = true;
+    }
+
+    trackFieldDistributions = statsJsonSink.enabled || (statsSink.enabled && options.limits);
+
+    if (zoneMapSink.enabled && options.raw) {
+        fprintf(stderr, "Can't build a zone map from raw field values, so no zone map will be written\n");
+        zoneMapSink.enabled = false;
+    }
+
+    if (spectrumSink.enabled && options.raw) {
+        fprintf(stderr, "Can't compute spectra from raw field values, so no spectrum will be written\n");
+        spectrumSink.enabled = false;
+    }
+
+    if (stepResponseSink.enabled && options.raw) {
+        fprintf(stderr, "Can't compute a step response from raw field values, so no step response will be written\n");
+        stepResponseSink.enabled = false;
+    }
+
+    if (options.toStdout && csvSink.enabled + mergedCsvSink.enabled + ndjsonSink.enabled + segmentsSink.enabled + statsJsonSink.enabled
+            + spectrumSink.enabled + stepResponseSink.enabled > 1) {
+        fprintf(stderr, "Only one of the csv, merged-csv, ndjson, segments, stats-json, spectrum and step-response outputs can be written to stdout\n");
+        return -1;
+    }
+
+    sinkContext = (decodeSinkContext_t) {
+        .toStdout = options.toStdout,
+        .raw = options.raw,
+        .simulateIMU = options.simulateIMU,
+        .simulateCurrentMeter = options.simulateCurrentMeter,
+        .compressionLevel = options.compressionLevel,
+        .threads = options.threads,
+        .unitFrameTime = options.unitFrameTime,
+        .unitAmperage = options.unitAmperage,
+        .unitFlags = options.unitFlags,
+        .naming = &outputNaming,
+        .outputStats = &outputStats,
+        .lastFrameTime = &lastFrameTime,
+        .slowFrame = bufferedSlowFrame,
+        .simulation = &simulation,
+        .mainFieldUnit = mainFieldUnit,
+        .slowFieldUnit = slowFieldUnit
+    };
+
+    for (int i = 0; i < SINK_COUNT; i++) {
+        if (sinks[i]->init) {
+            sinks[i]->init(&sinkContext);
+        }
+    }
+
+    segmentsSinkConfigure(options.segmentFields);
+    spectrumSinkConfigure(options.spectrumFields, options.spectrumWindow);
+
+    if (options.query) {
+        processLog = queryFlightLog;
+
+        fprintf(stdout, "log,start time (us),end time (us),start iteration,end iteration,frames\n");
+    } else {
+        processLog = decodeFlightLog;
+    }
+
     for (int i = optind; i < argc; i++) {
         const char *filename = argv[i];
 
@@ -1592,15 +3137,15 @@ int main(int argc, char **argv)
             if (logIndex == -1)
                 return -1;
 
-            decodeFlightLog(log, filename, logIndex);
+            processLog(log, filename, logIndex);
         } else {
             //Decode all the logs
             for (logIndex = 0; logIndex < log->logCount; logIndex++)
-                decodeFlightLog(log, filename, logIndex);
+                processLog(log, filename, logIndex);
         }
 
         flightLogDestroy(log);
     }
 
-    return 0;
+    return outputFailed ? -1 : 0;
 }
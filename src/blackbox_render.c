@@ -31,7 +31,11 @@
 #include "parser.h"
 #include "datapoints.h"
 #include "expo.h"
+#include "videostream.h"
+#include "pngwriter.h"
+#include "workqueue.h"
 #include "imu.h"
+#include "logcache.h"
 
 #define STR_HELPER(x) #x
 #define STR(x) STR_HELPER(x)
@@ -52,6 +56,12 @@
 
 #define DATAPOINTS_EXTRA_COMPUTED_FIELDS 6
 
+// The graphs' lines are placed on their pixel grid in steps of 1/GRAPH_SUBPIXELS of a pixel (cairo's own precision)
+#define GRAPH_SUBPIXELS 256
+// The lines are started this many pixels to the left of the area being plotted, which is far enough for them to have
+// settled into the same path that they'd follow if they'd been started any further back (see plotLine())
+#define GRAPH_PLOT_MARGIN 16
+
 typedef enum Unit {
     UNIT_RAW = 0,
     UNIT_DEGREES_PER_SEC = 1
@@ -72,6 +82,32 @@ static const char* const PROP_STYLE_NAME[] = {
     "pie"
 };
 
+typedef enum OutputFormat {
+    OUTPUT_FORMAT_PNG = 0,
+    OUTPUT_FORMAT_Y4M = 1,
+    OUTPUT_FORMAT_RAW_RGBA = 2
+} OutputFormat;
+
+static const char* const OUTPUT_FORMAT_NAME[] = {
+    "png",
+    "y4m",
+    "rawrgba"
+};
+
+// Indexed by PNGFilter and PNGStrategy
+static const char* const PNG_FILTER_NAME[] = {
+    "none",
+    "sub",
+    "up"
+};
+
+static const char* const PNG_STRATEGY_NAME[] = {
+    "default",
+    "filtered",
+    "rle",
+    "huffman"
+};
+
 typedef struct point_t {
   double x, y;
 } point_t;
@@ -84,11 +120,6 @@ typedef struct colorAlpha_t {
     double r, g, b, a;
 } colorAlpha_t;
 
-typedef struct pngRenderingTask_t {
-    cairo_surface_t *surface;
-    int outputLogIndex, outputFrameIndex;
-} pngRenderingTask_t;
-
 typedef struct craftDrawingParameters_t {
     int numBlades, numMotors;
     int bladeLength;
@@ -122,20 +153,22 @@ typedef struct renderOptions_t {
 
     int gapless;
     int rawAmperage;
+    int useCache;
 
     PropStyle propStyle;
 
+    OutputFormat outputFormat;
+    pngWriterOptions_t png;
+
     //Start and end time of video in seconds offset from the beginning of the log
     uint32_t timeStart, timeEnd;
 
     colorAlpha_t sticksTextColor, stickColor, stickAreaColor, crosshairColor, stickTrailColor;
     int stickTrailLength, stickRadius, stickTrailRadius;
 
-    char *filename, *outputPrefix;
+    char *filename, *outputPrefix, *outputFilename;
 } renderOptions_t;
 
-int stickTrailCurrent[2] = {0, 0};
-
 const double DASHED_LINE[] = {
     20.0,  /* ink */
     5.0  /* skip */
@@ -178,6 +211,7 @@ typedef struct fieldIdentifications_t {
     int roll, pitch, heading;
     int axisPIDSum[3];
     int cumulativeCurrent;
+    int propAngle[MAX_MOTORS];
 } fieldIdentifications_t;
 
 color_t lineColors[] = {
@@ -203,7 +237,8 @@ static const colorAlpha_t craftColor = {0.3, 0.3, 0.3, 1};
 
 static const renderOptions_t defaultOptions = {
     .imageWidth = 1920, .imageHeight = 1080,
-    .fps = 30, .help = 0, .threads = 3, .propStyle = PROP_STYLE_PIE_CHART,
+    .fps = 30, .help = 0, .threads = 3, .propStyle = PROP_STYLE_PIE_CHART, .outputFormat = OUTPUT_FORMAT_PNG,
+    .png = {.compressionLevel = 6, .strategy = PNG_STRATEGY_DEFAULT, .filter = PNG_FILTER_UP, .stripes = 1},
     .plotPids = false, .plotPidSum = false, .plotGyros = true, .plotMotors = true,
     .pidSmoothing = 4, .gyroSmoothing = 2, .motorSmoothing = 2,
     .drawCraft = true, .drawPidTable = true, .drawSticks = true, .drawTime = true,
@@ -216,6 +251,7 @@ static const renderOptions_t defaultOptions = {
     .logNumber = 0,
     .gapless = 0,
     .rawAmperage = 0,
+    .useCache = 0,
     .sticksTextColor = {1, 1, 1, 1},
     .stickColor = {1, 0.4, 0.4, 1.0},
     .stickAreaColor = {0.3, 0.3, 0.3, 0.8},
@@ -232,21 +268,203 @@ extern cairo_font_face_t* cairo_ft_font_face_create_for_ft_face(FT_Face face, in
 static renderOptions_t options;
 static expoCurve_t *pitchStickCurve, *pidCurve, *gyroCurve, *accCurve, *motorCurve, *servoCurve;
 
-static semaphore_t pngRenderingSem;
-static bool pngRenderingSemCreated = false;
-
 static flightLog_t *flightLog;
 static datapoints_t *points;
+//Min/max pyramids of the fields we plot as graphs, indexed by field (NULL for fields that aren't plotted)
+static datapointsPyramid_t **plotPyramids;
 static int selectedLogIndex;
 
 //Information about fields we have classified
 static fieldIdentifications_t fieldMeta;
 
-static FT_Library freetypeLibrary;
-
 static uint32_t syncBeepTime = -1;
 
-static point_t *stickTrails[2];
+/**
+ * A surface for drawing video frames on, which is recycled from frame to frame rather than being created for each.
+ */
+typedef struct frameSurface_t {
+    cairo_surface_t *surface;
+    cairo_t *cr;
+
+    // The video frame drawn on it, while it waits to be saved
+    uint32_t outputFrameIndex;
+} frameSurface_t;
+
+/**
+ * The parts of rendering the video that are shared by all of the render workers, and don't change during the render.
+ */
+typedef struct renderJob_t {
+    uint32_t startFrame, outputFrames;
+    int64_t logStartTime;
+
+    craft_parameters_t craftParameters;
+
+    // Where the frames go when they're streamed as video rather than saved as PNGs
+    videoStream_t *stream;
+
+    // The surfaces that frames are drawn on, the ones which are free to draw on, and the drawn frames waiting to be
+    // saved as PNGs
+    frameSurface_t *surfaces;
+    int surfaceCount;
+    workQueue_t *freeSurfaces, *framesToSave;
+
+    // One for each of the threads that save the PNGs
+    pngWriter_t **pngWriters;
+    int pngWriterCount;
+
+    // The next video frame for a worker to pick up (counting from startFrame), and the number that are finished
+    volatile uint32_t nextFrame, framesRendered;
+
+    semaphore_t workerExited, pngSaverExited;
+
+    // The number of threads started for the render (not counting the PNG writers' own)
+    int threadsStarted;
+} renderJob_t;
+
+/**
+ * A part of the overlay that looks the same in every frame, drawn once on its own surface so that each frame only has
+ * to copy it into place.
+ */
+typedef struct staticLayer_t {
+    // NULL if the layer isn't drawn
+    cairo_surface_t *surface;
+
+    // Where the top-left of the surface goes on the frame
+    int x, y;
+} staticLayer_t;
+
+typedef struct graphLayers_t {
+    // The origin line is drawn underneath the graph's lines, and the label on top of them
+    staticLayer_t axisLine, axisLabel;
+} graphLayers_t;
+
+typedef struct staticLayers_t {
+    graphLayers_t motorGraph, pidGraphs[3], gyroGraph;
+
+    // One for each stick, since the first stick's trail and labels are drawn before the second stick's surround
+    staticLayer_t stickSurrounds[2];
+
+    staticLayer_t pidTableHeadings, craftBody;
+} staticLayers_t;
+
+/**
+ * The graphs as they were drawn for the last frame that a worker rendered. The windows of nearby frames overlap in all
+ * but a strip on the right, so the next frame can scroll the graphs along and only plot that strip.
+ */
+typedef struct scrollingGraphs_t {
+    // NULL if there aren't any graphs. The graphs are scrolled onto the scratch surface and then the two are swapped.
+    cairo_surface_t *surface, *scratch;
+
+    bool valid;
+
+    // The column of the graphs' pixel grid at the left edge of the surface
+    int64_t leftColumn;
+
+    // The graphs' labels don't move, so everything from the left of the leftmost one is replotted along with the strip
+    int labelsLeft;
+
+    // Finds where the lines start, which only moves forwards while the worker's frames do
+    datapointsCursor_t lineStartCursor;
+} scrollingGraphs_t;
+
+/**
+ * The state that a render worker keeps to itself, so that it can draw frames at the same time as the others.
+ */
+typedef struct renderContext_t {
+    renderJob_t *job;
+
+    FT_Library freetypeLibrary;
+    FT_Face ft_face;
+    cairo_font_face_t *cairo_face;
+
+    // Each worker takes frames in increasing order, so it can carry on searching from where its last frame got to
+    datapointsCursor_t windowCenterCursor;
+
+    point_t *stickTrails[2];
+
+    staticLayers_t layers;
+
+    scrollingGraphs_t graphs;
+
+    // The total time spent drawing this worker's frames
+    int64_t drawTimeMicros;
+} renderContext_t;
+
+/**
+ * The readings shown in the bottom left, smoothed over the last few video frames.
+ */
+typedef struct hudReadings_t {
+    double acceleration, cellVoltage, current;
+    int altitude;
+} hudReadings_t;
+
+// How many frames each render worker can be ahead of the video stream's writer
+#define VIDEO_FRAMES_IN_FLIGHT_PER_THREAD 2
+
+// How many video frames the HUD readings are smoothed over
+#define HUD_SMOOTHING_FRAMES 16
+
+/**
+ * Once the log's headers are read, we know what fields its frames have, so we can add our own computed fields to them
+ * and create the datapoints to decode the frames into.
+ */
+void onMetadataReady(flightLog_t *log)
+{
+    char **fieldNames;
+
+    // Assign field indexes to the fields we'll add
+    int newFieldIndex = log->frameDefs['I'].fieldCount, combinedFieldCount;
+
+    fieldMeta.roll = newFieldIndex++;
+    fieldMeta.pitch = newFieldIndex++;
+    fieldMeta.heading = newFieldIndex++;
+
+    fieldMeta.axisPIDSum[0] = newFieldIndex++;
+    fieldMeta.axisPIDSum[1] = newFieldIndex++;
+    fieldMeta.axisPIDSum[2] = newFieldIndex++;
+
+    if (log->mainFieldIndexes.amperageLatest > -1) {
+        fieldMeta.cumulativeCurrent = newFieldIndex++;
+    } else {
+        fieldMeta.cumulativeCurrent = -1;
+    }
+
+    for (int i = 0; i < MAX_MOTORS; i++) {
+        fieldMeta.propAngle[i] = log->mainFieldIndexes.motor[i] > -1 ? newFieldIndex++ : -1;
+    }
+
+    combinedFieldCount = newFieldIndex;
+
+    // Create a copy of the array of field names so we can add our custom fields to it
+    fieldNames = malloc(sizeof(*fieldNames) * combinedFieldCount);
+
+    for (int i = 0; i < log->frameDefs['I'].fieldCount; i++) {
+        fieldNames[i] = strdup(log->frameDefs['I'].fieldName[i]);
+    }
+
+    // And add our synthetic field names
+    fieldNames[fieldMeta.roll] = strdup("roll");
+    fieldNames[fieldMeta.pitch] = strdup("pitch");
+    fieldNames[fieldMeta.heading] = strdup("heading");
+    fieldNames[fieldMeta.axisPIDSum[0]] = strdup("axisPID[0]");
+    fieldNames[fieldMeta.axisPIDSum[1]] = strdup("axisPID[1]");
+    fieldNames[fieldMeta.axisPIDSum[2]] = strdup("axisPID[2]");
+
+    if (fieldMeta.cumulativeCurrent > -1) {
+        fieldNames[fieldMeta.cumulativeCurrent] = strdup("cumulativeCurrent");
+    }
+
+    for (int i = 0; i < MAX_MOTORS; i++) {
+        if (fieldMeta.propAngle[i] > -1) {
+            char fieldName[16];
+
+            snprintf(fieldName, sizeof(fieldName), "propAngle[%d]", i);
+            fieldNames[fieldMeta.propAngle[i]] = strdup(fieldName);
+        }
+    }
+
+    points = datapointsCreate(combinedFieldCount, fieldNames);
+}
 
 void loadFrameIntoPoints(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int fieldCount, int frameOffset, int frameSize)
 {
@@ -344,15 +562,104 @@ void updateFieldMetadata()
     }
 }
 
-void drawCommandSticks(int64_t *frame, int imageWidth, int imageHeight, cairo_t *cr)
+/**
+ * Find the positions of the sticks in the given frame in the range [-1..1] (left stick x, left stick y, right stick x,
+ * right stick y). Returns false if the log doesn't have the stick commands.
+ */
+static bool computeStickPositions(int64_t *frame, double stickPositions[4])
+{
+    double rcCommand[4];
+    const int yawStickMax = 500;
+    int stickIndex;
+
+    for (stickIndex = 0; stickIndex < 4; stickIndex++) {
+        //Check that stick data is present to be drawn:
+        if (flightLog->mainFieldIndexes.rcCommand[stickIndex] < 0)
+            return false;
+
+        rcCommand[stickIndex] = frame[flightLog->mainFieldIndexes.rcCommand[stickIndex]];
+    }
+
+    stickPositions[0] = -rcCommand[2] / yawStickMax; //Yaw
+    stickPositions[1] = (1500 - rcCommand[3]) / 500; //Throttle
+    stickPositions[2] = expoCurveLookup(pitchStickCurve, rcCommand[0]); //Roll
+    stickPositions[3] = expoCurveLookup(pitchStickCurve, -rcCommand[1]); //Pitch
+
+    for (stickIndex = 0; stickIndex < 4; stickIndex++) {
+        //Clamp to [-1..1]
+        stickPositions[stickIndex] = stickPositions[stickIndex] > 1 ? 1 : (stickPositions[stickIndex] < -1 ? -1 : stickPositions[stickIndex]);
+    }
+
+    return true;
+}
+
+static bool logHasStickCommands(void)
+{
+    for (int stickIndex = 0; stickIndex < 4; stickIndex++) {
+        if (flightLog->mainFieldIndexes.rcCommand[stickIndex] < 0)
+            return false;
+    }
+
+    return true;
+}
+
+static int decideStickSurroundRadius(int imageHeight)
 {
-    double rcCommand[4] = {0, 0, 0, 0};
-    int stickSurroundRadius = imageHeight / 11;
     if (options.sticksWidth > 0) {
-      stickSurroundRadius = options.sticksWidth;
+      return options.sticksWidth;
     }
+
+    return imageHeight / 11;
+}
+
+/**
+ * Copy the static layer into place on the frame, whatever the current transformation is.
+ */
+static void drawStaticLayer(cairo_t *cr, const staticLayer_t *layer)
+{
+    if (!layer->surface)
+        return;
+
+    cairo_save(cr);
+
+    cairo_identity_matrix(cr);
+    cairo_set_source_surface(cr, layer->surface, layer->x, layer->y);
+    cairo_paint(cr);
+
+    cairo_restore(cr);
+}
+
+/**
+ * Draw the background and crosshair of a stick centred on the origin, which don't change from frame to frame.
+ */
+void drawStickSurround(int imageHeight, cairo_t *cr)
+{
+    const int stickSurroundRadius = decideStickSurroundRadius(imageHeight);
+
+    //Fill in background
+    cairo_set_source_rgba(cr, options.stickAreaColor.r, options.stickAreaColor.g, options.stickAreaColor.b, options.stickAreaColor.a);
+    cairo_rectangle(cr, -stickSurroundRadius, -stickSurroundRadius, stickSurroundRadius * 2, stickSurroundRadius * 2);
+    cairo_fill(cr);
+
+    //Draw crosshair
+    cairo_set_line_width(cr, 1);
+    cairo_set_source_rgba(cr, options.crosshairColor.r, options.crosshairColor.g, options.crosshairColor.b, options.crosshairColor.a);
+    cairo_move_to(cr, -stickSurroundRadius, 0);
+    cairo_line_to(cr, stickSurroundRadius, 0);
+    cairo_move_to(cr, 0, -stickSurroundRadius);
+    cairo_line_to(cr, 0, stickSurroundRadius);
+    cairo_stroke(cr);
+}
+
+/**
+ * Draw the sticks, and the trails of stickTrailCount positions (in the range [-1..1], oldest first) they left behind,
+ * each on top of its surround (drawn by drawStickSurround() onto the static layers `surrounds`).
+ */
+void drawCommandSticks(int64_t *frame, point_t *stickTrails[2], int stickTrailCount, const staticLayer_t surrounds[2],
+    int imageWidth, int imageHeight, cairo_t *cr)
+{
+    const int stickSurroundRadius = decideStickSurroundRadius(imageHeight);
     const int stickSpacing = stickSurroundRadius * 3;
-    const int yawStickMax = 500;
     int stickIndex;
 
     int stickRadius = stickSurroundRadius / 5;
@@ -371,26 +678,13 @@ void drawCommandSticks(int64_t *frame, int imageWidth, int imageHeight, cairo_t
 
     (void) imageWidth;
 
-    for (stickIndex = 0; stickIndex < 4; stickIndex++) {
-        //Check that stick data is present to be drawn:
-        if (flightLog->mainFieldIndexes.rcCommand[stickIndex] < 0)
-            return;
-
-        rcCommand[stickIndex] = frame[flightLog->mainFieldIndexes.rcCommand[stickIndex]];
-    }
-
     //Compute the position of the sticks in the range [-1..1] (left stick x, left stick y, right stick x, right stick y)
     double stickPositions[4];
 
-    stickPositions[0] = -rcCommand[2] / yawStickMax; //Yaw
-    stickPositions[1] = (1500 - rcCommand[3]) / 500; //Throttle
-    stickPositions[2] = expoCurveLookup(pitchStickCurve, rcCommand[0]); //Roll
-    stickPositions[3] = expoCurveLookup(pitchStickCurve, -rcCommand[1]); //Pitch
+    if (!computeStickPositions(frame, stickPositions))
+        return;
 
     for (stickIndex = 0; stickIndex < 4; stickIndex++) {
-        //Clamp to [-1..1]
-        stickPositions[stickIndex] = stickPositions[stickIndex] > 1 ? 1 : (stickPositions[stickIndex] < -1 ? -1 : stickPositions[stickIndex]);
-
         //Scale to our stick size
         stickPositions[stickIndex] *= stickSurroundRadius;
     }
@@ -401,46 +695,21 @@ void drawCommandSticks(int64_t *frame, int imageWidth, int imageHeight, cairo_t
 
     //For each stick
     for (int i = 0; i < 2; i++) {
-        //Fill in background
-        cairo_set_source_rgba(cr, options.stickAreaColor.r, options.stickAreaColor.g, options.stickAreaColor.b, options.stickAreaColor.a);
-        cairo_rectangle(cr, -stickSurroundRadius, -stickSurroundRadius, stickSurroundRadius * 2, stickSurroundRadius * 2);
-        cairo_fill(cr);
-
-        //Draw crosshair
-        cairo_set_line_width(cr, 1);
-        cairo_set_source_rgba(cr, options.crosshairColor.r, options.crosshairColor.g, options.crosshairColor.b, options.crosshairColor.a);
-        cairo_move_to(cr, -stickSurroundRadius, 0);
-        cairo_line_to(cr, stickSurroundRadius, 0);
-        cairo_move_to(cr, 0, -stickSurroundRadius);
-        cairo_line_to(cr, 0, stickSurroundRadius);
-        cairo_stroke(cr);
+        drawStaticLayer(cr, &surrounds[i]);
 
         //Draw trail
-        for (int j = 0; j < stickTrailCurrent[i]; j++) {
+        for (int j = 0; j < stickTrailCount; j++) {
           point_t current = stickTrails[i][j];
 
-          cairo_set_source_rgba(cr, options.stickTrailColor.r, options.stickTrailColor.g, options.stickTrailColor.b, options.stickTrailColor.a - (options.stickTrailColor.a - (j / (stickTrailCurrent[i] + 1.0))));
-          cairo_arc(cr, current.x, current.y, stickTrailRadius, 0, 2 * M_PI);
+          cairo_set_source_rgba(cr, options.stickTrailColor.r, options.stickTrailColor.g, options.stickTrailColor.b, options.stickTrailColor.a - (options.stickTrailColor.a - (j / (stickTrailCount + 1.0))));
+          cairo_arc(cr, current.x * stickSurroundRadius, current.y * stickSurroundRadius, stickTrailRadius, 0, 2 * M_PI);
           cairo_fill(cr);
-
-          if (j > 0) {
-            stickTrails[i][j-1] = stickTrails[i][j];
-          }
         }
 
         //Draw circle to represent stick position
         double stickX = stickPositions[i * 2 + 0];
         double stickY = stickPositions[i * 2 + 1];
 
-        if (stickTrailCurrent[i] < options.stickTrailLength) {
-          stickTrailCurrent[i]++;
-        }
-
-        if (stickTrailCurrent[i] > 0) {
-          point_t p = {stickX, stickY};
-          stickTrails[i][stickTrailCurrent[i] - 1] = p;
-        }
-
         cairo_set_source_rgba(cr, options.stickColor.r, options.stickColor.g, options.stickColor.b, options.stickColor.a);
         cairo_arc(cr, stickX, stickY, stickRadius, 0, 2 * M_PI);
         cairo_fill(cr);
@@ -476,7 +745,7 @@ void drawCommandSticks(int64_t *frame, int imageWidth, int imageHeight, cairo_t
 /*
  * Draw a vertically-oriented propeller at the origin with the current source color
  */
-void drawPropeller(cairo_t *cr, craft_parameters_t *parameters)
+void drawPropeller(cairo_t *cr, const craft_parameters_t *parameters)
 {
     cairo_move_to(cr, 0, 0);
 
@@ -491,24 +760,25 @@ void drawPropeller(cairo_t *cr, craft_parameters_t *parameters)
 }
 
 /**
- * Draw a craft with spinning blades at the origin
+ * The speed that the given motor's prop is spinning at in this frame, in radians per second.
  */
-void drawCraft(cairo_t *cr, int64_t *frame, int64_t timeElapsedMicros, craft_parameters_t *parameters)
+static double motorAngularSpeed(int64_t *frame, int motorIndex)
 {
-    static double propAngles[MAX_MOTORS] = {0};
+    double scaled = doubleMax(frame[flightLog->mainFieldIndexes.motor[motorIndex]] - (int32_t) flightLog->sysConfig.motorOutputLow, 0) / (flightLog->sysConfig.motorOutputHigh - flightLog->sysConfig.motorOutputLow);
 
-    double angularSpeed[MAX_MOTORS];
-    double rotationThisFrame[MAX_MOTORS];
-    int onionLayers[MAX_MOTORS];
-    int motorIndex, onion;
-    double opacity;
+    //If motors are armed (above minthrottle), keep them spinning at least a bit
+    if (scaled > 0)
+        scaled = scaled * 0.9 + 0.1;
 
-    char motorLabel[16];
-    cairo_text_extents_t extent;
+    return scaled * M_PI * 2 * MOTOR_MAX_RPS;
+}
 
-    /*if (fieldMeta.heading) {
-        cairo_rotate(cr, intToFloat(frame[fieldMeta.heading]));
-    }*/
+/**
+ * Draw the arms and hub of the craft at the origin, which don't move.
+ */
+void drawCraftBody(cairo_t *cr, const craft_parameters_t *parameters)
+{
+    int motorIndex;
 
     //Draw arms
     cairo_set_line_width(cr, parameters->bladeLength * 0.30);
@@ -531,17 +801,35 @@ void drawCraft(cairo_t *cr, int64_t *frame, int64_t timeElapsedMicros, craft_par
     cairo_move_to(cr, 0, 0);
     cairo_arc(cr, 0, 0, parameters->motorSpacing * 0.4, 0, 2 * M_PI);
     cairo_fill(cr);
+}
+
+/**
+ * Draw the spinning blades of the craft at the origin, on top of its body from drawCraftBody(). The props are drawn at
+ * the angle they've turned to by timeSinceFrameMicros after the given frame, blurred over the angle they turned through
+ * in the last timeElapsedMicros.
+ */
+void drawCraft(cairo_t *cr, int64_t *frame, int64_t timeSinceFrameMicros, int64_t timeElapsedMicros, const craft_parameters_t *parameters)
+{
+    double propAngles[MAX_MOTORS] = {0};
+    double angularSpeed[MAX_MOTORS] = {0};
+    double rotationThisFrame[MAX_MOTORS] = {0};
+    int onionLayers[MAX_MOTORS] = {0};
+    int motorIndex, onion;
+    double opacity;
+
+    char motorLabel[16];
+    cairo_text_extents_t extent;
+
+    /*if (fieldMeta.heading) {
+        cairo_rotate(cr, intToFloat(frame[fieldMeta.heading]));
+    }*/
 
     //Compute prop speed and position
     for (motorIndex = 0; motorIndex < parameters->numMotors; motorIndex++) {
         if (flightLog->mainFieldIndexes.motor[motorIndex] > -1) {
-            double scaled = doubleMax(frame[flightLog->mainFieldIndexes.motor[motorIndex]] - (int32_t) flightLog->sysConfig.motorOutputLow, 0) / (flightLog->sysConfig.motorOutputHigh - flightLog->sysConfig.motorOutputLow);
+            angularSpeed[motorIndex] = motorAngularSpeed(frame, motorIndex);
 
-            //If motors are armed (above minthrottle), keep them spinning at least a bit
-            if (scaled > 0)
-                scaled = scaled * 0.9 + 0.1;
-
-            angularSpeed[motorIndex] = scaled * M_PI * 2 * MOTOR_MAX_RPS;
+            propAngles[motorIndex] = intToFloat(frame[fieldMeta.propAngle[motorIndex]]) + angularSpeed[motorIndex] * timeSinceFrameMicros / 1000000;
 
             rotationThisFrame[motorIndex] = angularSpeed[motorIndex] * timeElapsedMicros / 1000000;
 
@@ -581,7 +869,7 @@ void drawCraft(cairo_t *cr, int64_t *frame, int64_t timeElapsedMicros, craft_par
                             opacity * ((((double) onion / onionLayers[motorIndex]) + 1.0) / 2)
                         );
 
-                        cairo_rotate(cr, (propAngles[motorIndex] + (rotationThisFrame[motorIndex] * onion) / onionLayers[motorIndex]) * parameters->motorDirection[motorIndex]);
+                        cairo_rotate(cr, (propAngles[motorIndex] - rotationThisFrame[motorIndex] + (rotationThisFrame[motorIndex] * onion) / onionLayers[motorIndex]) * parameters->motorDirection[motorIndex]);
 
                         drawPropeller(cr, parameters);
                     }
@@ -640,9 +928,6 @@ void drawCraft(cairo_t *cr, int64_t *frame, int64_t timeElapsedMicros, craft_par
         }
         cairo_restore(cr);
     }
-
-    for (motorIndex = 0; motorIndex < parameters->numMotors; motorIndex++)
-        propAngles[motorIndex] += rotationThisFrame[motorIndex];
 }
 
 void decideCraftParameters(craft_parameters_t *parameters, int imageWidth, int imageHeight)
@@ -695,86 +980,269 @@ void decideCraftParameters(craft_parameters_t *parameters, int imageWidth, int i
         parameters->propColor[i] = fieldMeta.motorColors[i];
 }
 
+typedef struct plotPen_t {
+    bool drawingLine;
+    double lastX, lastY;
+
+    // The middle of the range of values of the last point or column plotted
+    double lastMiddleY;
+} plotPen_t;
+
 /**
- * Plot the given field within the specified time period. When the output from the curve applied to a field
- * value reaches 1.0 it'll be drawn plotHeight pixels away from the origin.
+ * Continue the plotted line to the given point. If a gap in the log comes before it, mark both ends of the gap with
+ * warning boxes instead of joining them.
  */
-void plotLine(cairo_t *cr, color_t color, int64_t windowStartTime, int64_t windowEndTime, int firstFrameIndex,
-        int fieldIndex, expoCurve_t *curve, int plotHeight)
+static void plotPenAddPoint(cairo_t *cr, plotPen_t *pen, double nextX, double nextY, bool gapBefore)
 {
     static const int GAP_WARNING_BOX_RADIUS = 4;
-    uint32_t windowWidthMicros = (uint32_t) (windowEndTime - windowStartTime);
-    int64_t fieldValue;
-    int64_t frameTime;
-
-    bool drawingLine = false;
-    double lastX, lastY;
-
-    //Draw points from this line until we leave the window
-    for (int frameIndex = firstFrameIndex; frameIndex < points->frameCount; frameIndex++) {
-        datapointsGetFieldAtIndex(points, frameIndex, fieldIndex, &fieldValue);
-        datapointsGetTimeAtIndex(points, frameIndex, &frameTime);
-
-        double nextX, nextY;
 
-        nextY = (double) -expoCurveLookup(curve, fieldValue) * plotHeight;
-        nextX = (double)(frameTime - windowStartTime) / windowWidthMicros * options.imageWidth;
+    if (pen->drawingLine) {
+        if (gapBefore) {
+            //Draw a warning box at the beginning and end of the gap to mark it
+            cairo_rectangle(cr, pen->lastX - GAP_WARNING_BOX_RADIUS, pen->lastY - GAP_WARNING_BOX_RADIUS, GAP_WARNING_BOX_RADIUS * 2, GAP_WARNING_BOX_RADIUS * 2);
+            cairo_rectangle(cr, nextX - GAP_WARNING_BOX_RADIUS, nextY - GAP_WARNING_BOX_RADIUS, GAP_WARNING_BOX_RADIUS * 2, GAP_WARNING_BOX_RADIUS * 2);
 
-        if (drawingLine) {
-            if (!options.gapless && datapointsGetGapStartsAtIndex(points, frameIndex - 1)) {
-                //Draw a warning box at the beginning and end of the gap to mark it
-                cairo_rectangle(cr, lastX - GAP_WARNING_BOX_RADIUS, lastY - GAP_WARNING_BOX_RADIUS, GAP_WARNING_BOX_RADIUS * 2, GAP_WARNING_BOX_RADIUS * 2);
-                cairo_rectangle(cr, nextX - GAP_WARNING_BOX_RADIUS, nextY - GAP_WARNING_BOX_RADIUS, GAP_WARNING_BOX_RADIUS * 2, GAP_WARNING_BOX_RADIUS * 2);
-
-                cairo_move_to(cr, nextX, nextY);
-            } else {
-                cairo_line_to(cr, nextX, nextY);
-            }
-        } else {
             cairo_move_to(cr, nextX, nextY);
+        } else {
+            cairo_line_to(cr, nextX, nextY);
         }
-
-        drawingLine = true;
-        lastX = nextX;
-        lastY = nextY;
-
-        if (frameTime >= windowEndTime)
-            break;
+    } else {
+        cairo_move_to(cr, nextX, nextY);
     }
 
-    cairo_set_source_rgb(cr, color.r, color.g, color.b);
-    cairo_stroke(cr);
+    pen->drawingLine = true;
+    pen->lastX = nextX;
+    pen->lastY = nextY;
+    pen->lastMiddleY = nextY;
 }
 
-void drawPIDTable(cairo_t *cr, int64_t *frame)
+/**
+ * The range of values of the field seen by the pixel column that's being drawn.
+ */
+typedef struct plotColumn_t {
+    bool active, gapBefore;
+    int x;
+    int64_t min, max;
+} plotColumn_t;
+
+/**
+ * Draw the column as a vertical stroke from one extreme to the other, starting at the one nearest to the middle of the
+ * last point or column so that the line doesn't cross itself much. That only depends on the log's values, and not on
+ * where the line was started, so plots started at different frames end up drawing the same path.
+ */
+static void plotColumnFlush(cairo_t *cr, plotPen_t *pen, plotColumn_t *column, expoCurve_t *curve, int plotHeight)
 {
-    cairo_font_extents_t fontExtent;
+    double x = column->x + 0.5;
+    double minY = (double) -expoCurveLookup(curve, column->min) * plotHeight;
+    double maxY = (double) -expoCurveLookup(curve, column->max) * plotHeight;
 
-    cairo_font_extents(cr, &fontExtent);
+    if (!column->active)
+        return;
 
-    const double INTERROW_SPACING = 32;
-    const double VERT_SPACING = fontExtent.height + INTERROW_SPACING;
-    const double FIRST_ROW_TOP = fontExtent.height + INTERROW_SPACING;
-    const double HORZ_SPACING = 100, FIRST_COL_LEFT = 140;
+    if (pen->drawingLine && fabs(maxY - pen->lastMiddleY) < fabs(minY - pen->lastMiddleY)) {
+        double swap = minY;
 
-    const double HORZ_EXTENT = FIRST_COL_LEFT + HORZ_SPACING * 5 - 30;
-    const double VERT_EXTENT = FIRST_ROW_TOP + fontExtent.height * 3 + INTERROW_SPACING * 2;
+        minY = maxY;
+        maxY = swap;
+    }
 
-    const double PADDING = 32;
+    plotPenAddPoint(cr, pen, x, minY, column->gapBefore);
 
-    char fieldLabel[16];
+    if (maxY != minY) {
+        plotPenAddPoint(cr, pen, x, maxY, false);
+    }
+
+    pen->lastMiddleY = (minY + maxY) / 2;
+
+    column->active = false;
+}
+
+static int64_t divideRoundingDown(int64_t dividend, int64_t divisor)
+{
+    int64_t quotient = dividend / divisor;
+
+    return quotient * divisor > dividend ? quotient - 1 : quotient;
+}
+
+/**
+ * The graphs are drawn on a pixel grid that's fixed to the log's timeline, with windowWidthMicros to every imageWidth
+ * columns. Each time has a fixed position on the grid, to the nearest 1/GRAPH_SUBPIXELS of a pixel, and each frame's
+ * graphs cover a whole number of its columns. So a line plotted for one frame is exactly a whole number of pixels away
+ * from the same line plotted for another.
+ */
+static int64_t graphTimeToSubpixel(int64_t time, uint32_t windowWidthMicros)
+{
+    return divideRoundingDown(time * options.imageWidth * GRAPH_SUBPIXELS + windowWidthMicros / 2, windowWidthMicros);
+}
+
+/**
+ * The earliest time which is in the given column of the graphs' pixel grid, or after it.
+ */
+static int64_t graphColumnToTime(int64_t column, uint32_t windowWidthMicros)
+{
+    return divideRoundingDown(column * windowWidthMicros, options.imageWidth);
+}
+
+/**
+ * The stretch of the log that the graphs cover, and the column of their pixel grid which is at the left of the frame.
+ */
+typedef struct graphWindow_t {
+    int64_t startTime, endTime;
+    int64_t leftColumn;
+} graphWindow_t;
+
+/**
+ * The position of a frame on the graphs. This is a multiple of 1/GRAPH_SUBPIXELS, which both doubles and cairo hold
+ * exactly.
+ */
+static double plotTimeToX(int64_t frameTime, const graphWindow_t *window)
+{
+    uint32_t windowWidthMicros = (uint32_t) (window->endTime - window->startTime);
+
+    return (double) (graphTimeToSubpixel(frameTime, windowWidthMicros) - window->leftColumn * GRAPH_SUBPIXELS)
+        / GRAPH_SUBPIXELS;
+}
+
+/**
+ * Plot the given field within the specified time period. When the output from the curve applied to a field
+ * value reaches 1.0 it'll be drawn plotHeight pixels away from the origin.
+ *
+ * If the field has a min/max pyramid and there are several frames per pixel, whole buckets of frames that fit within
+ * one pixel column are drawn as the column's range of values, so the cost depends on the width of the image rather
+ * than the number of frames in the window. Frames near the edges of the window and around gaps are drawn individually.
+ *
+ * Wherever the line is started, it follows the same path as a line started further back from a few pixels after the
+ * start onwards: buckets line up with the same frames whatever the first frame is, and each column's path only depends
+ * on its own values and those of the column before it.
+ */
+void plotLine(cairo_t *cr, color_t color, const graphWindow_t *window, int firstFrameIndex,
+        int fieldIndex, expoCurve_t *curve, int plotHeight)
+{
+    uint32_t windowWidthMicros = (uint32_t) (window->endTime - window->startTime);
+    // The graphs' columns can reach up to half a pixel past the end of the window
+    int64_t windowEndTime = window->endTime + windowWidthMicros / options.imageWidth + 1;
+    datapointsPyramid_t *pyramid = plotPyramids ? plotPyramids[fieldIndex] : NULL;
+    datapointsPyramidLevel_t *level = NULL;
+    int64_t fieldValue;
+    int64_t frameTime;
+
+    plotPen_t pen = {false, 0, 0, 0};
+    plotColumn_t column = {false, false, 0, 0, 0};
+
+    if (pyramid) {
+        int levelIndex = datapointsPyramidChooseLevel(pyramid, (double) windowWidthMicros / options.imageWidth);
+
+        if (levelIndex > -1)
+            level = &pyramid->levels[levelIndex];
+    }
+
+    //Draw points from this line until we leave the window
+    for (int frameIndex = firstFrameIndex; frameIndex < points->frameCount; ) {
+        if (level && frameIndex % level->bucketFrames == 0 && frameIndex + level->bucketFrames <= points->frameCount) {
+            int bucket = frameIndex / level->bucketFrames;
+            int64_t lastFrameTime;
+
+            datapointsGetTimeAtIndex(points, frameIndex + level->bucketFrames - 1, &lastFrameTime);
+
+            if (!level->hasGap[bucket] && lastFrameTime < windowEndTime) {
+                double x;
+
+                datapointsGetTimeAtIndex(points, frameIndex, &frameTime);
+                x = plotTimeToX(frameTime, window);
+
+                if (column.active && column.x != (int) floor(x)) {
+                    plotColumnFlush(cr, &pen, &column, curve, plotHeight);
+                }
+
+                if (column.active) {
+                    column.min = level->min[bucket] < column.min ? level->min[bucket] : column.min;
+                    column.max = level->max[bucket] > column.max ? level->max[bucket] : column.max;
+                } else {
+                    column.active = true;
+                    column.gapBefore = !options.gapless && datapointsGetGapStartsAtIndex(points, frameIndex - 1);
+                    column.x = (int) floor(x);
+                    column.min = level->min[bucket];
+                    column.max = level->max[bucket];
+                }
+
+                frameIndex += level->bucketFrames;
+                continue;
+            }
+        }
+
+        plotColumnFlush(cr, &pen, &column, curve, plotHeight);
+
+        datapointsGetFieldAtIndex(points, frameIndex, fieldIndex, &fieldValue);
+        datapointsGetTimeAtIndex(points, frameIndex, &frameTime);
+
+        plotPenAddPoint(cr, &pen,
+            plotTimeToX(frameTime, window),
+            (double) -expoCurveLookup(curve, fieldValue) * plotHeight,
+            !options.gapless && datapointsGetGapStartsAtIndex(points, frameIndex - 1));
+
+        if (frameTime >= windowEndTime)
+            break;
+
+        frameIndex++;
+    }
+
+    plotColumnFlush(cr, &pen, &column, curve, plotHeight);
+
+    cairo_set_source_rgb(cr, color.r, color.g, color.b);
+    cairo_stroke(cr);
+}
+
+/**
+ * Where the rows and columns of the PID table go, which depends on the current font.
+ */
+typedef struct pidTableLayout_t {
+    double rowHeight, vertSpacing, firstRowTop;
+    double horzSpacing, firstColLeft;
+
+    double horzExtent, vertExtent, padding;
+} pidTableLayout_t;
+
+static void decidePIDTableLayout(cairo_t *cr, pidTableLayout_t *layout)
+{
+    cairo_font_extents_t fontExtent;
+
+    cairo_font_extents(cr, &fontExtent);
+
+    const double INTERROW_SPACING = 32;
+
+    layout->rowHeight = fontExtent.height;
+    layout->vertSpacing = fontExtent.height + INTERROW_SPACING;
+    layout->firstRowTop = fontExtent.height + INTERROW_SPACING;
+    layout->horzSpacing = 100;
+    layout->firstColLeft = 140;
+
+    layout->horzExtent = layout->firstColLeft + layout->horzSpacing * 5 - 30;
+    layout->vertExtent = layout->firstRowTop + fontExtent.height * 3 + INTERROW_SPACING * 2;
+
+    layout->padding = 32;
+}
+
+/**
+ * Draw the background and the row and column headings of the PID table centred on the origin, which don't change from
+ * frame to frame.
+ */
+void drawPIDTableHeadings(cairo_t *cr)
+{
+    pidTableLayout_t layout;
     int pidType, axisIndex;
     const char *pidName;
 
+    decidePIDTableLayout(cr, &layout);
+
     cairo_save(cr);
 
     //Centre about the origin
-    cairo_translate(cr, -HORZ_EXTENT / 2, -VERT_EXTENT / 2);
+    cairo_translate(cr, -layout.horzExtent / 2, -layout.vertExtent / 2);
 
     //Draw a background box
     cairo_set_source_rgba(cr, 0, 0, 0, 0.33);
 
-    cairo_rectangle(cr, -PADDING, -PADDING, HORZ_EXTENT + PADDING * 2, VERT_EXTENT + PADDING * 2);
+    cairo_rectangle(cr, -layout.padding, -layout.padding, layout.horzExtent + layout.padding * 2, layout.vertExtent + layout.padding * 2);
 
     cairo_fill(cr);
 
@@ -802,7 +1270,7 @@ void drawPIDTable(cairo_t *cr, int64_t *frame)
             default:
                 pidName = "";
         }
-        cairo_move_to (cr, (pidType + 1) * HORZ_SPACING + FIRST_COL_LEFT, fontExtent.height);
+        cairo_move_to (cr, (pidType + 1) * layout.horzSpacing + layout.firstColLeft, layout.rowHeight);
         cairo_show_text (cr, pidName);
     }
 
@@ -821,11 +1289,30 @@ void drawPIDTable(cairo_t *cr, int64_t *frame)
                 pidName = "";
         }
 
-        cairo_move_to (cr, 0, FIRST_ROW_TOP + axisIndex * VERT_SPACING + fontExtent.height);
+        cairo_move_to (cr, 0, layout.firstRowTop + axisIndex * layout.vertSpacing + layout.rowHeight);
         cairo_show_text (cr, pidName);
     }
 
-    //Now draw the values
+    cairo_restore(cr);
+}
+
+/**
+ * Draw the values in the PID table centred on the origin, on top of the headings from drawPIDTableHeadings().
+ */
+void drawPIDTable(cairo_t *cr, int64_t *frame)
+{
+    pidTableLayout_t layout;
+    char fieldLabel[16];
+    int pidType, axisIndex;
+
+    decidePIDTableLayout(cr, &layout);
+
+    cairo_save(cr);
+
+    cairo_translate(cr, -layout.horzExtent / 2, -layout.vertExtent / 2);
+
+    cairo_set_font_size(cr, FONTSIZE_PID_TABLE_LABEL);
+
     for (pidType = PID_P - 1; pidType <= PID_TOTAL; pidType++) {
         for (axisIndex = 0; axisIndex < 3; axisIndex++) {
             int32_t fieldValue;
@@ -882,8 +1369,8 @@ void drawPIDTable(cairo_t *cr, int64_t *frame)
 
             cairo_move_to (
                 cr,
-                FIRST_COL_LEFT + (pidType + 1) * HORZ_SPACING,
-                FIRST_ROW_TOP + axisIndex * VERT_SPACING + fontExtent.height
+                layout.firstColLeft + (pidType + 1) * layout.horzSpacing,
+                layout.firstRowTop + axisIndex * layout.vertSpacing + layout.rowHeight
             );
             cairo_show_text (cr, fieldLabel);
         }
@@ -951,22 +1438,19 @@ void drawFrameLabel(cairo_t *cr, uint32_t frameIndex, uint32_t frameTimeMsec)
     cairo_show_text(cr, frameNumberBuf);
 }
 
-void drawAccelerometerData(cairo_t *cr, int64_t *frame)
+/**
+ * Read the unsmoothed values of the HUD readings from the frame.
+ */
+static void readHudValues(int64_t *frame, hudReadings_t *readings)
 {
     int16_t accSmooth[3];
     attitude_t attitude;
     t_fp_vector acceleration;
-    double magnitude;
-    static double lastAccel = 0, lastVoltage = 0, lastCurrent = 0;
-    static int lastAlt = 0;
-    cairo_text_extents_t extent;
-
-    char labelBuf[32];
 
-    cairo_set_font_size(cr, FONTSIZE_FRAME_LABEL);
-    cairo_set_source_rgba(cr, 1, 1, 1, 0.65);
-
-    cairo_text_extents(cr, "Acceleration 0.0G", &extent);
+    readings->acceleration = 0;
+    readings->cellVoltage = 0;
+    readings->current = 0;
+    readings->altitude = 0;
 
     if (flightLog->sysConfig.acc_1G && fieldMeta.hasAccs) {
         for (int axis = 0; axis < 3; axis++)
@@ -984,50 +1468,100 @@ void drawAccelerometerData(cairo_t *cr, int64_t *frame)
         acceleration.V.Y /= flightLog->sysConfig.acc_1G;
         acceleration.V.Z /= flightLog->sysConfig.acc_1G;
 
-        magnitude = sqrt(acceleration.V.X * acceleration.V.X + acceleration.V.Y * acceleration.V.Y + acceleration.V.Z * acceleration.V.Z);
+        readings->acceleration = sqrt(acceleration.V.X * acceleration.V.X + acceleration.V.Y * acceleration.V.Y + acceleration.V.Z * acceleration.V.Z);
+    }
 
-        //Weighted moving average with the recent history to smooth out noise
-        lastAccel = (lastAccel * 2 + magnitude) / 3;
+    if (flightLog->mainFieldIndexes.vbatLatest > -1) {
+        readings->cellVoltage = flightLogVbatADCToMillivolts(flightLog, frame[flightLog->mainFieldIndexes.vbatLatest]) / (1000.0 * fieldMeta.numCells);
+    }
+
+    if (flightLog->mainFieldIndexes.BaroAlt > -1) {
+        readings->altitude = frame[flightLog->mainFieldIndexes.BaroAlt];
+    }
 
+    if (flightLog->mainFieldIndexes.amperageLatest > -1) {
+        readings->current = flightLogAmperageADCToMilliamps(flightLog, frame[flightLog->mainFieldIndexes.amperageLatest]) / 1000.0;
+    }
+}
+
+/**
+ * The HUD readings for the given video frame, as a weighted moving average over the video frames leading up to it to
+ * smooth out noise. This only looks back a limited number of frames (beyond which the weights are negligible) so that
+ * any video frame can be rendered on its own.
+ */
+static void smoothHudReadings(const renderJob_t *job, uint32_t outputFrameIndex, hudReadings_t *smoothed)
+{
+    uint32_t history = outputFrameIndex - job->startFrame < HUD_SMOOTHING_FRAMES ? outputFrameIndex - job->startFrame : HUD_SMOOTHING_FRAMES;
+    int64_t frameTime, frame[FLIGHT_LOG_MAX_FIELDS];
+    hudReadings_t readings;
+    bool first = true;
+
+    for (uint32_t i = outputFrameIndex - history; i <= outputFrameIndex; i++) {
+        int64_t windowCenterTime = job->logStartTime + ((int64_t) i * 1000000) / options.fps;
+
+        if (!datapointsGetFrameAtIndex(points, datapointsFindFrameAtTime(points, windowCenterTime), &frameTime, frame))
+            continue;
+
+        readHudValues(frame, &readings);
+
+        if (first) {
+            *smoothed = readings;
+            first = false;
+        } else {
+            smoothed->acceleration = (smoothed->acceleration * 2 + readings.acceleration) / 3;
+            smoothed->cellVoltage = (smoothed->cellVoltage * 2 + readings.cellVoltage) / 3;
+            smoothed->current = (smoothed->current * 2 + readings.current) / 3;
+            smoothed->altitude = (smoothed->altitude * 2 + readings.altitude) / 3;
+        }
+    }
+}
+
+void drawAccelerometerData(cairo_t *cr, int64_t *frame, const hudReadings_t *readings)
+{
+    cairo_text_extents_t extent;
+
+    char labelBuf[32];
+
+    cairo_set_font_size(cr, FONTSIZE_FRAME_LABEL);
+    cairo_set_source_rgba(cr, 1, 1, 1, 0.65);
+
+    cairo_text_extents(cr, "Acceleration 0.0G", &extent);
+
+    if (flightLog->sysConfig.acc_1G && fieldMeta.hasAccs) {
         cairo_move_to(cr, X_POS_LABEL, options.imageHeight - 8);
         cairo_show_text(cr, "Accel.");
 
-        snprintf(labelBuf, sizeof(labelBuf), "%.2f G", lastAccel);
+        snprintf(labelBuf, sizeof(labelBuf), "%.2f G", readings->acceleration);
 
         cairo_move_to(cr, X_POS_VALUE, options.imageHeight - 8);
         cairo_show_text(cr, labelBuf);
     }
 
     if (flightLog->mainFieldIndexes.vbatLatest > -1) {
-        lastVoltage = (lastVoltage * 2 + flightLogVbatADCToMillivolts(flightLog, frame[flightLog->mainFieldIndexes.vbatLatest]) / (1000.0 * fieldMeta.numCells)) / 3;
-
         cairo_move_to(cr, X_POS_LABEL, options.imageHeight - 8 - (extent.height + 8));
         cairo_show_text(cr, "Batt. cell");
 
-        snprintf(labelBuf, sizeof(labelBuf), "%.2f V", lastVoltage);
+        snprintf(labelBuf, sizeof(labelBuf), "%.2f V", readings->cellVoltage);
 
         cairo_move_to(cr, X_POS_VALUE, options.imageHeight - 8 - (extent.height + 8));
         cairo_show_text(cr, labelBuf);
     }
 
     if (flightLog->mainFieldIndexes.BaroAlt > -1) {
-        lastAlt = (lastAlt * 2 + frame[flightLog->mainFieldIndexes.BaroAlt]) / 3;
-
         cairo_move_to(cr, X_POS_LABEL, options.imageHeight - 8 - (extent.height + 8) * 2);
         cairo_show_text(cr, "Altitude");
 
-        snprintf(labelBuf, sizeof(labelBuf), "%.1f m", lastAlt / 100.0);
+        snprintf(labelBuf, sizeof(labelBuf), "%.1f m", readings->altitude / 100.0);
 
         cairo_move_to(cr, X_POS_VALUE, options.imageHeight - 8 - (extent.height + 8) * 2);
         cairo_show_text(cr, labelBuf);
     }
 
     if (flightLog->mainFieldIndexes.amperageLatest > -1) {
-        lastCurrent = (lastCurrent * 2 + flightLogAmperageADCToMilliamps(flightLog, frame[flightLog->mainFieldIndexes.amperageLatest]) / 1000.0) / 3;
         cairo_move_to(cr, X_POS_LABEL, options.imageHeight - 8 - (extent.height + 8) * 3);
         cairo_show_text(cr, "Current");
 
-        snprintf(labelBuf, sizeof(labelBuf), "%.2f A", lastCurrent);
+        snprintf(labelBuf, sizeof(labelBuf), "%.2f A", readings->current);
         cairo_move_to(cr, X_POS_VALUE, options.imageHeight - 8 - (extent.height + 8) * 3);
         cairo_show_text(cr, labelBuf);
 
@@ -1049,101 +1583,878 @@ void drawAccelerometerData(cairo_t *cr, int64_t *frame)
     }
 }
 
-void* pngRenderThread(void *arg)
+typedef struct pngSaver_t {
+    renderJob_t *job;
+    pngWriter_t *writer;
+} pngSaver_t;
+
+/**
+ * PNG encoding is so slow and so easily run in parallel that it's done on its own pool of threads. Each saves the
+ * drawn frames it's handed until it's handed a NULL one, and hands their surfaces back to be drawn on again.
+ */
+static void* pngSaverThread(void *arg)
 {
+    pngSaver_t *saver = (pngSaver_t *) arg;
+    renderJob_t *job = saver->job;
+    frameSurface_t *frame;
     char filename[256];
-    pngRenderingTask_t *task = (pngRenderingTask_t *) arg;
 
-    snprintf(filename, sizeof(filename), "%s.%02d.%06d.png", options.outputPrefix, task->outputLogIndex + 1, task->outputFrameIndex);
-    cairo_surface_write_to_png (task->surface, filename);
-    cairo_surface_destroy (task->surface);
+    while ((frame = (frameSurface_t *) workQueuePop(job->framesToSave)) != NULL) {
+        snprintf(filename, sizeof(filename), "%s.%02d.%06d.png", options.outputPrefix, selectedLogIndex + 1, frame->outputFrameIndex);
+        cairo_surface_flush(frame->surface);
+
+        if (!pngWriterWriteARGB32ToFilename(saver->writer, filename, cairo_image_surface_get_data(frame->surface),
+                cairo_image_surface_get_width(frame->surface), cairo_image_surface_get_height(frame->surface),
+                cairo_image_surface_get_stride(frame->surface))) {
+            fprintf(stderr, "Failed to write %s: %s\n", filename, strerror(errno));
+        }
+
+        workQueuePush(job->freeSurfaces, frame);
+    }
+
+    semaphore_signal(&job->pngSaverExited);
+
+    return 0;
+}
+
+static int64_t videoFrameCenterTime(const renderJob_t *job, uint32_t outputFrameIndex)
+{
+    return job->logStartTime + ((int64_t) outputFrameIndex * 1000000) / options.fps;
+}
+
+/**
+ * Collect the stick positions of the video frames leading up to this one (oldest first) into the context's stick
+ * trails, and return how many there are. They're found in the log again rather than remembered from the frames we
+ * drew before, so that any video frame can be rendered on its own.
+ */
+static int gatherStickTrails(renderContext_t *context, uint32_t outputFrameIndex)
+{
+    const renderJob_t *job = context->job;
+    uint32_t history = outputFrameIndex - job->startFrame < (uint32_t) options.stickTrailLength ? outputFrameIndex - job->startFrame : (uint32_t) options.stickTrailLength;
+    int64_t frameTime, frame[FLIGHT_LOG_MAX_FIELDS];
+    double stickPositions[4];
+    int count = 0;
+
+    for (uint32_t i = outputFrameIndex - history; i < outputFrameIndex; i++) {
+        if (datapointsGetFrameAtIndex(points, datapointsFindFrameAtTime(points, videoFrameCenterTime(job, i)), &frameTime, frame)
+                && computeStickPositions(frame, stickPositions)) {
+            for (int stick = 0; stick < 2; stick++) {
+                context->stickTrails[stick][count].x = stickPositions[stick * 2 + 0];
+                context->stickTrails[stick][count].y = stickPositions[stick * 2 + 1];
+            }
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static double motorGraphOriginY(void)
+{
+    if (options.plotPids) {
+        //Move up a little bit to make room for the pid graphs
+        return options.imageHeight * 0.15;
+    }
+
+    return options.imageHeight * 0.25;
+}
+
+static double pidGraphOriginY(int axis)
+{
+    return options.imageHeight * 0.60 + options.imageHeight * 0.2 * (axis - 1);
+}
+
+static double gyroGraphOriginY(void)
+{
+    return options.imageHeight * 0.70;
+}
+
+static const char* pidGraphLabel(int axis)
+{
+    if (options.plotGyros) {
+        switch (axis) {
+            case 0:
+                return "Gyro + PID roll";
+            case 1:
+                return "Gyro + PID pitch";
+            case 2:
+                return "Gyro + PID yaw";
+            default:
+                return "Unknown";
+        }
+    } else {
+        switch (axis) {
+            case 0:
+                return "Roll PIDs";
+            case 1:
+                return "Pitch PIDs";
+            case 2:
+                return "Yaw PIDs";
+            default:
+                return "Unknown";
+        }
+    }
+}
+
+static void sticksOrigin(double *x, double *y)
+{
+    if (options.sticksTop != 0 && options.sticksRight != 0) {
+        *x = options.imageWidth - options.sticksRight;
+        *y = options.sticksTop;
+    } else if (options.sticksRight != 0) {
+        *x = options.imageWidth - options.sticksRight;
+        *y = 0.20 * options.imageHeight;
+    } else if (options.sticksTop != 0) {
+        *x = 0.75 * options.imageWidth;
+        *y = options.sticksTop;
+    } else {
+        *x = 0.75 * options.imageWidth;
+        *y = 0.20 * options.imageHeight;
+    }
+}
+
+static void craftOrigin(double *x, double *y)
+{
+    if (options.craftTop != 0 && options.craftRight != 0) {
+        *x = options.imageWidth - options.craftRight;
+        *y = options.craftTop;
+    } else if (options.craftRight != 0) {
+        *x = options.imageWidth - options.craftRight;
+        *y = 0.20 * options.imageHeight;
+    } else if (options.craftTop != 0) {
+        *x = 0.75 * options.imageWidth;
+        *y = options.craftTop;
+    } else {
+        *x = 0.75 * options.imageWidth;
+        *y = 0.20 * options.imageHeight;
+    }
+}
+
+/**
+ * Create the surface for a static layer which covers the box from (left, top) to (right, bottom) around the origin,
+ * which is at (originX, originY) on the frame. Returns a context for drawing the layer's content around the origin,
+ * which the caller destroys when it's done.
+ */
+static cairo_t* beginStaticLayer(renderContext_t *context, staticLayer_t *layer, double originX, double originY,
+    double left, double top, double right, double bottom)
+{
+    // Cover whole pixels so that the layer is copied into place without any resampling, with a pixel to spare on each
+    // side for antialiasing, but don't bother keeping anything that's off the frame
+    int x1 = (int) floor(originX + left) - 1, y1 = (int) floor(originY + top) - 1;
+    int x2 = (int) ceil(originX + right) + 1, y2 = (int) ceil(originY + bottom) + 1;
+    cairo_t *cr;
+
+    x1 = x1 < 0 ? 0 : x1;
+    y1 = y1 < 0 ? 0 : y1;
+    x2 = x2 > options.imageWidth ? options.imageWidth : x2;
+    y2 = y2 > options.imageHeight ? options.imageHeight : y2;
+
+    layer->x = x1;
+    layer->y = y1;
+    layer->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, x2 > x1 ? x2 - x1 : 1, y2 > y1 ? y2 - y1 : 1);
+
+    cr = cairo_create(layer->surface);
+
+    cairo_set_font_face(cr, context->cairo_face);
+    cairo_translate(cr, -x1, -y1);
+    cairo_translate(cr, originX, originY);
+
+    return cr;
+}
+
+static void createGraphLayers(renderContext_t *context, graphLayers_t *layers, double originY, const char *axisLabel,
+    cairo_t *measure)
+{
+    cairo_text_extents_t extent;
+    cairo_t *cr;
+
+    cr = beginStaticLayer(context, &layers->axisLine, 0, originY, 0, -1, options.imageWidth, 1);
+    drawAxisLine(cr);
+    cairo_destroy(cr);
+
+    cairo_set_font_size(measure, FONTSIZE_AXIS_LABEL);
+    cairo_text_extents(measure, axisLabel, &extent);
+
+    cr = beginStaticLayer(context, &layers->axisLabel, 0, originY,
+        options.imageWidth - 8 - extent.width + extent.x_bearing, -8 + extent.y_bearing,
+        options.imageWidth - 8 + extent.x_bearing, -8 + extent.y_bearing + extent.height);
+    drawAxisLabel(cr, axisLabel);
+    cairo_destroy(cr);
+}
+
+/**
+ * Draw the parts of the overlay which don't change from frame to frame (for the current options) onto their own
+ * surfaces, so renderFrame() can copy them into place instead of drawing them every time.
+ */
+static void createStaticLayers(renderContext_t *context)
+{
+    staticLayers_t *layers = &context->layers;
+    cairo_surface_t *measureSurface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+    cairo_t *measure = cairo_create(measureSurface);
+    double originX, originY;
+    cairo_t *cr;
+
+    cairo_set_font_face(measure, context->cairo_face);
+
+    if (options.plotMotors) {
+        createGraphLayers(context, &layers->motorGraph, motorGraphOriginY(), "Motors", measure);
+    }
+
+    if (options.plotPids) {
+        for (int axis = 0; axis < 3; axis++) {
+            createGraphLayers(context, &layers->pidGraphs[axis], pidGraphOriginY(axis), pidGraphLabel(axis), measure);
+        }
+    } else if (options.plotGyros) {
+        createGraphLayers(context, &layers->gyroGraph, gyroGraphOriginY(), "Gyro", measure);
+    }
+
+    // The sticks aren't drawn at all if the log doesn't have their commands
+    if (options.drawSticks && logHasStickCommands()) {
+        const int stickSurroundRadius = decideStickSurroundRadius(options.imageHeight);
+        const int stickSpacing = stickSurroundRadius * 3;
+
+        sticksOrigin(&originX, &originY);
+
+        for (int i = 0; i < 2; i++) {
+            cr = beginStaticLayer(context, &layers->stickSurrounds[i], originX - stickSpacing / 2 + stickSpacing * i, originY,
+                -stickSurroundRadius, -stickSurroundRadius, stickSurroundRadius, stickSurroundRadius);
+            drawStickSurround(options.imageHeight, cr);
+            cairo_destroy(cr);
+        }
+    }
+
+    if (options.drawPidTable) {
+        pidTableLayout_t layout;
+
+        // The table is laid out for whatever font size is current when it's drawn, which is the default one
+        decidePIDTableLayout(measure, &layout);
+
+        cr = beginStaticLayer(context, &layers->pidTableHeadings, 0.25 * options.imageWidth, 0.75 * options.imageHeight,
+            -layout.horzExtent / 2 - layout.padding, -layout.vertExtent / 2 - layout.padding,
+            layout.horzExtent / 2 + layout.padding, layout.vertExtent / 2 + layout.padding);
+        drawPIDTableHeadings(cr);
+        cairo_destroy(cr);
+    }
+
+    if (options.drawCraft) {
+        const craft_parameters_t *parameters = &context->job->craftParameters;
+        // The arms reach out a little past the motors, and their round caps a little further
+        double reach = 0;
+
+        for (int motorIndex = 0; motorIndex < parameters->numMotors; motorIndex++) {
+            reach = doubleMax(reach, doubleMax(doubleAbs(parameters->motorX[motorIndex]), doubleAbs(parameters->motorY[motorIndex])));
+        }
+        reach = reach * parameters->motorSpacing * 1.2 + parameters->bladeLength * 0.15;
+
+        craftOrigin(&originX, &originY);
+
+        cr = beginStaticLayer(context, &layers->craftBody, originX, originY, -reach, -reach, reach, reach);
+        drawCraftBody(cr, parameters);
+        cairo_destroy(cr);
+    }
+
+    cairo_destroy(measure);
+    cairo_surface_destroy(measureSurface);
+}
+
+static void destroyStaticLayer(staticLayer_t *layer)
+{
+    if (layer->surface) {
+        cairo_surface_destroy(layer->surface);
+        layer->surface = NULL;
+    }
+}
+
+static void destroyStaticLayers(staticLayers_t *layers)
+{
+    graphLayers_t *graphs[] = {&layers->motorGraph, &layers->pidGraphs[0], &layers->pidGraphs[1], &layers->pidGraphs[2], &layers->gyroGraph};
+
+    for (unsigned i = 0; i < ARRAY_LENGTH(graphs); i++) {
+        destroyStaticLayer(&graphs[i]->axisLine);
+        destroyStaticLayer(&graphs[i]->axisLabel);
+    }
+
+    destroyStaticLayer(&layers->stickSurrounds[0]);
+    destroyStaticLayer(&layers->stickSurrounds[1]);
+    destroyStaticLayer(&layers->pidTableHeadings);
+    destroyStaticLayer(&layers->craftBody);
+}
+
+/**
+ * Clip to the parts of the graphs where a line with the given dash pattern has ink. The dashes are laid along the
+ * columns of the graphs' pixel grid rather than along the line itself, so they fall in the same place however much of
+ * the line was plotted.
+ */
+static void clipToGraphDashes(cairo_t *cr, const double *dashes, int dashCount, const graphWindow_t *window)
+{
+    cairo_matrix_t matrix;
+    int64_t period = 0, column;
+
+    for (int i = 0; i < dashCount; i++) {
+        period += (int64_t) dashes[i];
+    }
+
+    cairo_get_matrix(cr, &matrix);
+    cairo_identity_matrix(cr);
+
+    // Start from the last repeat of the pattern that begins at or before the left of the frame
+    column = window->leftColumn - (window->leftColumn % period + period) % period;
+
+    while (column < window->leftColumn + options.imageWidth) {
+        for (int i = 0; i < dashCount; i += 2) {
+            cairo_rectangle(cr, (double) (column - window->leftColumn), 0, dashes[i], options.imageHeight);
+            column += (int64_t) dashes[i] + (i + 1 < dashCount ? (int64_t) dashes[i + 1] : 0);
+        }
+    }
+
+    cairo_set_matrix(cr, &matrix);
+    cairo_clip(cr);
+}
+
+/**
+ * Draw the graphs (their origin lines, plotted fields and labels) for the given window, starting the lines from the
+ * frame at firstFrameIndex.
+ */
+static void drawGraphs(renderContext_t *context, cairo_t *cr, const graphWindow_t *window, int firstFrameIndex)
+{
+    int i;
+
+    //Plot the upper motor graph
+    if (options.plotMotors) {
+        int motorGraphHeight = (int) (options.imageHeight * (options.plotPids ? 0.15 : 0.20));
+
+        cairo_save(cr);
+        {
+            cairo_translate(cr, 0, motorGraphOriginY());
+
+            drawStaticLayer(cr, &context->layers.motorGraph.axisLine);
+
+            cairo_set_line_width(cr, 2.5);
+
+            for (i = 0; i < fieldMeta.numMotors; i++) {
+                plotLine(cr, fieldMeta.motorColors[i], window, firstFrameIndex,
+                        flightLog->mainFieldIndexes.motor[i], motorCurve, motorGraphHeight);
+            }
+
+            if (fieldMeta.numServos) {
+                for (i = 0; i < MAX_SERVOS; i++) {
+                    if (flightLog->mainFieldIndexes.servo[i] > -1) {
+                        plotLine(cr, fieldMeta.servoColors[i], window, firstFrameIndex,
+                            flightLog->mainFieldIndexes.servo[i], motorCurve, motorGraphHeight);
+                    }
+                }
+            }
+
+            drawStaticLayer(cr, &context->layers.motorGraph.axisLabel);
+        }
+        cairo_restore(cr);
+    }
+
+    //Plot the lower PID graphs
+    cairo_save(cr);
+    {
+        if (options.plotPids) {
+            //Plot three axes as different graphs
+            for (int axis = 0; axis < 3; axis++) {
+                cairo_save(cr);
+
+                cairo_translate(cr, 0, pidGraphOriginY(axis));
+
+                drawStaticLayer(cr, &context->layers.pidGraphs[axis].axisLine);
+
+                for (int pidType = PID_D; pidType >= PID_P; pidType--) {
+                    if (flightLog->mainFieldIndexes.pid[pidType][axis] > -1) {
+                        cairo_save(cr);
+
+                        switch (pidType) {
+                            case PID_P:
+                                cairo_set_line_width(cr, 2);
+                            break;
+                            case PID_I:
+                                clipToGraphDashes(cr, DASHED_LINE, DASHED_LINE_NUM_POINTS, window);
+                                cairo_set_line_width(cr, 2);
+                            break;
+                            case PID_D:
+                                clipToGraphDashes(cr, DOTTED_LINE, DOTTED_LINE_NUM_POINTS, window);
+                                cairo_set_line_width(cr, 2);
+                        }
+
+                        plotLine(cr, fieldMeta.PIDAxisColors[pidType][axis], window, firstFrameIndex,
+                                flightLog->mainFieldIndexes.pid[pidType][axis], pidCurve, (int) (options.imageHeight * 0.15));
+
+                        cairo_restore(cr);
+                    }
+                }
+
+                if (options.plotGyros) {
+                    cairo_set_line_width(cr, 3);
+
+                    plotLine(cr, fieldMeta.gyroColors[axis], window, firstFrameIndex,
+                        flightLog->mainFieldIndexes.gyroADC[axis], gyroCurve, (int) (options.imageHeight * 0.15));
+                }
+
+                drawStaticLayer(cr, &context->layers.pidGraphs[axis].axisLabel);
+
+                cairo_restore(cr);
+            }
+        } else if (options.plotGyros) {
+            //Plot three gyro axes on one graph
+            cairo_translate(cr, 0, gyroGraphOriginY());
+
+            drawStaticLayer(cr, &context->layers.gyroGraph.axisLine);
+
+            for (int axis = 0; axis < 3; axis++) {
+                plotLine(cr, fieldMeta.gyroColors[axis], window, firstFrameIndex,
+                        flightLog->mainFieldIndexes.gyroADC[axis], gyroCurve, (int) (options.imageHeight * 0.25));
+            }
+
+            drawStaticLayer(cr, &context->layers.gyroGraph.axisLabel);
+        }
+    }
+    cairo_restore(cr);
+}
+
+static void createScrollingGraphs(renderContext_t *context)
+{
+    scrollingGraphs_t *graphs = &context->graphs;
+    const staticLayer_t *labels[] = {&context->layers.motorGraph.axisLabel, &context->layers.pidGraphs[0].axisLabel,
+        &context->layers.pidGraphs[1].axisLabel, &context->layers.pidGraphs[2].axisLabel, &context->layers.gyroGraph.axisLabel};
+
+    graphs->valid = false;
+    graphs->labelsLeft = options.imageWidth;
+
+    for (unsigned i = 0; i < ARRAY_LENGTH(labels); i++) {
+        if (labels[i]->surface && labels[i]->x < graphs->labelsLeft)
+            graphs->labelsLeft = labels[i]->x;
+    }
+
+    if (options.plotMotors || options.plotPids || options.plotGyros) {
+        graphs->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, options.imageWidth, options.imageHeight);
+        graphs->scratch = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, options.imageWidth, options.imageHeight);
+    } else {
+        graphs->surface = NULL;
+        graphs->scratch = NULL;
+    }
+
+    datapointsCursorInit(&graphs->lineStartCursor, points);
+}
+
+static void destroyScrollingGraphs(scrollingGraphs_t *graphs)
+{
+    if (graphs->surface) {
+        cairo_surface_destroy(graphs->surface);
+        cairo_surface_destroy(graphs->scratch);
+        graphs->surface = NULL;
+        graphs->scratch = NULL;
+    }
+}
+
+/**
+ * Bring the context's graphs up to date for the given window. If the last frame this worker drew was close enough
+ * before this one, the graphs are scrolled left by the whole number of pixels that the window has moved along their
+ * pixel grid, and only the strip that comes into view on the right is plotted. Otherwise they're plotted from scratch.
+ * Either way the result is the same.
+ */
+static void updateScrollingGraphs(renderContext_t *context, int64_t windowStartTime, int64_t windowEndTime)
+{
+    scrollingGraphs_t *graphs = &context->graphs;
+    uint32_t windowWidthMicros = (uint32_t) (windowEndTime - windowStartTime);
+    graphWindow_t window;
+    int64_t shiftPixels;
+    int stripLeft, firstFrameIndex;
+    cairo_t *cr;
+
+    window.startTime = windowStartTime;
+    window.endTime = windowEndTime;
+    window.leftColumn = divideRoundingDown(graphTimeToSubpixel(windowStartTime, windowWidthMicros) + GRAPH_SUBPIXELS / 2,
+        GRAPH_SUBPIXELS);
+
+    shiftPixels = window.leftColumn - graphs->leftColumn;
+
+    // Scrolling past the labels would leave nothing worth keeping
+    if (graphs->valid && shiftPixels >= 0 && shiftPixels < graphs->labelsLeft) {
+        cairo_surface_t *scrolled = graphs->scratch;
+
+        stripLeft = graphs->labelsLeft - (int) shiftPixels;
+
+        cr = cairo_create(scrolled);
+
+        // Pixels which scroll into view from off the surface come out transparent
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_surface(cr, graphs->surface, (double) -shiftPixels, 0);
+        cairo_paint(cr);
+
+        cairo_rectangle(cr, stripLeft, 0, options.imageWidth - stripLeft, options.imageHeight);
+        cairo_clip(cr);
+
+        graphs->scratch = graphs->surface;
+        graphs->surface = scrolled;
+    } else {
+        stripLeft = 0;
+
+        cr = cairo_create(graphs->surface);
+    }
+
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+    // Miter joins are worked out from the absolute position of the line, which isn't exactly the same calculation once
+    // it's been scrolled, but bevels are
+    cairo_set_line_join(cr, CAIRO_LINE_JOIN_BEVEL);
+
+    // Find the frame just to the left of where the lines need to start
+    firstFrameIndex = datapointsCursorSeek(&graphs->lineStartCursor,
+        graphColumnToTime(window.leftColumn + stripLeft - GRAPH_PLOT_MARGIN, windowWidthMicros) - 1);
+
+    drawGraphs(context, cr, &window, firstFrameIndex == -1 ? 0 : firstFrameIndex);
+
+    cairo_destroy(cr);
+
+    graphs->leftColumn = window.leftColumn;
+    graphs->valid = true;
+}
+
+/**
+ * Draw the video frame with the given index onto the (reused) surface of cr. Everything drawn depends only on the
+ * index (scrolled graphs come out exactly as if they'd been plotted afresh), so frames can be rendered in any order, by
+ * any number of workers, and still come out the same.
+ */
+static void renderFrame(renderContext_t *context, uint32_t outputFrameIndex, cairo_t *cr)
+{
+    //Change how much data is displayed at one time
+    const int windowWidthMicros = 1000 * 1000;
+
+    //Bring the current time into the center of the plot
+    const int startXTimeOffset = windowWidthMicros / 2;
+
+    const renderJob_t *job = context->job;
+
+    int64_t windowCenterTime = videoFrameCenterTime(job, outputFrameIndex);
+    int64_t windowStartTime = windowCenterTime - startXTimeOffset;
+    int64_t windowEndTime = windowStartTime + windowWidthMicros;
+
+    int64_t frameValues[FLIGHT_LOG_MAX_FIELDS];
+    int64_t frameTime;
+
+    // Keep our drawing state from leaking into the next frame drawn on this surface
+    cairo_save(cr);
+
+    if (context->graphs.surface) {
+        updateScrollingGraphs(context, windowStartTime, windowEndTime);
+
+        // Replace the last frame drawn on this surface with the graphs
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_surface(cr, context->graphs.surface, 0, 0);
+        cairo_paint(cr);
+    } else {
+        // Wipe the last frame drawn on this surface
+        cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+        cairo_paint(cr);
+    }
+
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+    cairo_set_font_face(cr, context->cairo_face);
+
+    //Draw a bar highlighting the current time if we are drawing any graphs
+    if (options.plotGyros || options.plotMotors || options.plotPids || options.plotPidSum) {
+        double centerX = options.imageWidth / 2.0;
+
+        cairo_set_source_rgba(cr, 1, 0.25, 0.25, 0.2);
+        cairo_set_line_width(cr, 20);
+
+        cairo_move_to(cr, centerX, 0);
+        cairo_line_to(cr, centerX, options.imageHeight);
+        cairo_stroke(cr);
+    }
+
+    int centerFrameIndex = datapointsCursorSeek(&context->windowCenterCursor, windowCenterTime);
+
+    //Draw the command stick positions from the centered frame
+    if (datapointsGetFrameAtIndex(points, centerFrameIndex, &frameTime, frameValues)) {
+        if (options.drawSticks) {
+            cairo_save(cr);
+            {
+                double sticksX, sticksY;
+
+                sticksOrigin(&sticksX, &sticksY);
+                cairo_translate(cr, sticksX, sticksY);
+
+                int stickTrailCount = gatherStickTrails(context, outputFrameIndex);
+
+                drawCommandSticks(frameValues, context->stickTrails, stickTrailCount, context->layers.stickSurrounds,
+                    options.imageWidth, options.imageHeight, cr);
+            }
+            cairo_restore(cr);
+        }
+
+        if (options.drawPidTable) {
+            cairo_save(cr);
+            {
+                cairo_translate(cr, 0.25 * options.imageWidth, 0.75 * options.imageHeight);
+                drawStaticLayer(cr, &context->layers.pidTableHeadings);
+                drawPIDTable(cr, frameValues);
+            }
+            cairo_restore(cr);
+        }
+
+        if (options.drawCraft) {
+            cairo_save(cr);
+            {
+                double craftX, craftY;
+
+                craftOrigin(&craftX, &craftY);
+                cairo_translate(cr, craftX, craftY);
+
+                drawStaticLayer(cr, &context->layers.craftBody);
+                drawCraft(cr, frameValues, windowCenterTime - frameTime,
+                    outputFrameIndex > 0 ? windowCenterTime - videoFrameCenterTime(job, outputFrameIndex - 1) : 0, &job->craftParameters);
+            }
+            cairo_restore(cr);
+        }
+
+        if (options.drawAcc) {
+          hudReadings_t readings;
+
+          smoothHudReadings(job, outputFrameIndex, &readings);
+          drawAccelerometerData(cr, frameValues, &readings);
+        }
+
+        if (options.drawTime)
+            drawFrameLabel(cr, frameValues[FLIGHT_LOG_FIELD_INDEX_ITERATION], (uint32_t) ((windowCenterTime - flightLog->stats.field[FLIGHT_LOG_FIELD_INDEX_TIME].min) / 1000));
+    }
+
+    // Draw a synchronisation line
+    if (syncBeepTime >= windowStartTime && syncBeepTime < windowEndTime) {
+        double lineX = (double) ((int64_t) options.imageWidth * (syncBeepTime - windowStartTime) / windowWidthMicros);
+
+        cairo_set_source_rgba(cr, 0.25, 0.25, 1, 0.2);
+        cairo_set_line_width(cr, 20);
+
+        cairo_move_to(cr, lineX, 0);
+        cairo_line_to(cr, lineX, options.imageHeight);
+        cairo_stroke(cr);
+    }
+
+    cairo_new_path(cr);
+    cairo_restore(cr);
+}
+
+static void renderContextInit(renderContext_t *context, renderJob_t *job)
+{
+    context->job = job;
+
+    FT_Init_FreeType(&context->freetypeLibrary);
+
+    if (FT_New_Memory_Face(context->freetypeLibrary, (const FT_Byte*)SourceSansPro_Regular_otf, SourceSansPro_Regular_otf_len, 0, &context->ft_face)) {
+        fprintf(stderr, "Failed to load font file\n");
+        exit(-1);
+    }
+    context->cairo_face = cairo_ft_font_face_create_for_ft_face(context->ft_face, 0);
+
+    datapointsCursorInit(&context->windowCenterCursor, points);
+
+    context->stickTrails[0] = malloc(options.stickTrailLength * sizeof(point_t));
+    context->stickTrails[1] = malloc(options.stickTrailLength * sizeof(point_t));
+
+    createStaticLayers(context);
+    createScrollingGraphs(context);
+
+    context->drawTimeMicros = 0;
+}
+
+static void renderContextDestroy(renderContext_t *context)
+{
+    destroyStaticLayers(&context->layers);
+    destroyScrollingGraphs(&context->graphs);
+
+    free(context->stickTrails[0]);
+    free(context->stickTrails[1]);
+
+    cairo_font_face_destroy(context->cairo_face);
+    FT_Done_Face(context->ft_face);
+    FT_Done_FreeType(context->freetypeLibrary);
+}
+
+/**
+ * Render video frames in the order they're handed out until there are none left.
+ */
+static void* renderWorkerThread(void *arg)
+{
+    renderContext_t *context = (renderContext_t *) arg;
+    renderJob_t *job = context->job;
+
+    while (1) {
+        if (job->stream)
+            videoStreamWaitForRoom(job->stream);
+
+        uint32_t frameOffset = atomic_fetch_add_u32(&job->nextFrame, 1);
+        uint32_t outputFrameIndex = job->startFrame + frameOffset;
+
+        if (frameOffset >= job->outputFrames)
+            break;
+
+        frameSurface_t *frame = (frameSurface_t *) workQueuePop(job->freeSurfaces);
+
+        int64_t drawStartTime = time_monotonic_us();
+
+        renderFrame(context, outputFrameIndex, frame->cr);
+
+        context->drawTimeMicros += time_monotonic_us() - drawStartTime;
+
+        if (job->stream) {
+            cairo_surface_flush(frame->surface);
+            videoStreamSubmitFrame(job->stream, frameOffset, cairo_image_surface_get_data(frame->surface),
+                cairo_image_surface_get_stride(frame->surface));
+
+            workQueuePush(job->freeSurfaces, frame);
+        } else {
+            frame->outputFrameIndex = outputFrameIndex;
+
+            workQueuePush(job->framesToSave, frame);
+        }
+
+        uint32_t frameWrittenCount = atomic_fetch_add_u32(&job->framesRendered, 1) + 1;
+        if (frameWrittenCount % 500 == 0 || frameWrittenCount == job->outputFrames) {
+            fprintf(stderr, "Rendered %d frames (%.1f%%)%s\n",
+                frameWrittenCount, (double)frameWrittenCount / job->outputFrames * 100,
+                frameWrittenCount < job->outputFrames ? "..." : ".");
+        }
+    }
+
+    semaphore_signal(&job->workerExited);
+
+    return 0;
+}
+
+/**
+ * Open the file (or FIFO) named by --output to stream the video to, or stdout.
+ */
+static FILE* openVideoOutput(void)
+{
+    FILE *file;
+
+    if (!options.outputFilename) {
+#ifdef WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        return stdout;
+    }
+
+    file = fopen(options.outputFilename, "wb");
+
+    if (!file) {
+        fprintf(stderr, "Failed to open video output '%s': %s\n", options.outputFilename, strerror(errno));
+        exit(-1);
+    }
 
-    //Release our slot in the rendering pool, we're done
-    semaphore_signal(&pngRenderingSem);
+    return file;
+}
 
-    free(task);
+static void startRenderThread(renderJob_t *job, threadRoutine_t routine, void *arg)
+{
+    thread_create_detached(routine, arg);
 
-    return 0;
+    job->threadsStarted++;
 }
 
 /**
- * PNG encoding is so slow and so easily run in parallel, so save the frames using this function
- * (which'll use extra threads to do the work). Be sure to call waitForFramesToSave() before
- * the program ends.
+ * Create the surfaces that the frames are drawn on. Each worker needs one to draw on, and when the frames are saved as
+ * PNGs, each PNG saver needs one for the frame it's saving, so there's never a need to wait for a free one.
  */
-void saveSurfaceAsync(cairo_surface_t *surface, int logIndex, int outputFrameIndex)
+static void createFrameSurfaces(renderJob_t *job)
 {
-    if (!pngRenderingSemCreated) {
-        semaphore_create(&pngRenderingSem, options.threads);
-        pngRenderingSemCreated = true;
-    }
+    job->pngWriterCount = job->stream ? 0 : options.threads;
+    job->surfaceCount = options.threads + job->pngWriterCount;
+
+    job->surfaces = calloc(job->surfaceCount, sizeof(*job->surfaces));
+    job->freeSurfaces = workQueueCreate(job->surfaceCount);
+    job->framesToSave = workQueueCreate(job->surfaceCount);
 
-    pngRenderingTask_t *task = (pngRenderingTask_t*) malloc(sizeof(*task));
+    for (int i = 0; i < job->surfaceCount; i++) {
+        job->surfaces[i].surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, options.imageWidth, options.imageHeight);
+        job->surfaces[i].cr = cairo_create(job->surfaces[i].surface);
 
-    task->surface = surface;
-    task->outputLogIndex = logIndex;
-    task->outputFrameIndex = outputFrameIndex;
+        workQueuePush(job->freeSurfaces, &job->surfaces[i]);
+    }
+}
 
-    // Reserve a slot in the rendering pool...
-    semaphore_wait(&pngRenderingSem);
+static void destroyFrameSurfaces(renderJob_t *job)
+{
+    for (int i = 0; i < job->surfaceCount; i++) {
+        cairo_destroy(job->surfaces[i].cr);
+        cairo_surface_destroy(job->surfaces[i].surface);
+    }
 
-    thread_create_detached(pngRenderThread, task);
+    workQueueDestroy(job->freeSurfaces);
+    workQueueDestroy(job->framesToSave);
+    free(job->surfaces);
 }
 
-void waitForFramesToSave()
+static void startPNGSavers(renderJob_t *job, pngSaver_t **savers)
 {
-    int i;
+    job->pngWriters = calloc(job->pngWriterCount, sizeof(*job->pngWriters));
+    *savers = calloc(job->pngWriterCount, sizeof(**savers));
 
-    if (pngRenderingSemCreated) {
-        for (i = 0; i < options.threads; i++) {
-            semaphore_wait(&pngRenderingSem);
-        }
+    for (int i = 0; i < job->pngWriterCount; i++) {
+        job->pngWriters[i] = pngWriterCreate(&options.png, options.imageWidth, options.imageHeight);
+
+        (*savers)[i].job = job;
+        (*savers)[i].writer = job->pngWriters[i];
+
+        startRenderThread(job, pngSaverThread, &(*savers)[i]);
     }
 }
 
-void renderAnimation(uint32_t startFrame, uint32_t endFrame)
+/**
+ * The number of surfaces and buffers that have been allocated for drawing and saving frames.
+ */
+static uint32_t countFrameAllocations(const renderJob_t *job)
 {
-    //Change how much data is displayed at one time
-    const int windowWidthMicros = 1000 * 1000;
+    uint32_t count = job->surfaceCount;
 
-    //Bring the current time into the center of the plot
-    const int startXTimeOffset = windowWidthMicros / 2;
+    for (int i = 0; i < job->pngWriterCount; i++) {
+        count += pngWriterGetAllocationCount(job->pngWriters[i]);
+    }
 
-    int i;
+    return count;
+}
 
-    int64_t logStartTime = flightLog->stats.field[FLIGHT_LOG_FIELD_INDEX_TIME].min;
+/**
+ * Render the video frames on options.threads workers at once, which each pick up the next frame that needs drawing
+ * when they finish their last one. The frames are either saved as PNGs, or put back into order and streamed as video
+ * from this thread.
+ */
+void renderAnimation(uint32_t startFrame, uint32_t endFrame)
+{
     int64_t logEndTime = flightLog->stats.field[FLIGHT_LOG_FIELD_INDEX_TIME].max;
     int64_t logDurationMicro;
 
-    uint32_t outputFrames;
-
-    int64_t frameValues[FLIGHT_LOG_MAX_FIELDS];
-    uint64_t lastCenterTime;
-    int64_t frameTime;
-
-    FT_Face ft_face;
-    cairo_font_face_t *cairo_face;
+    renderJob_t job;
+    renderContext_t *contexts;
+    pngSaver_t *savers;
+    uint32_t allocationsBeforeRender;
+    int threadsBeforeRender;
+    int64_t drawTimeMicros = 0;
 
-    struct craftDrawingParameters_t craftParameters;
+    job.logStartTime = flightLog->stats.field[FLIGHT_LOG_FIELD_INDEX_TIME].min;
 
     //If sync beep time looks reasonable, start the log there instead of at the first frame
-    if (abs((int) ((int64_t)syncBeepTime - logStartTime)) < 1000000) //Expected to be well within 1 second of the start
-        logStartTime = syncBeepTime;
+    if (abs((int) ((int64_t)syncBeepTime - job.logStartTime)) < 1000000) //Expected to be well within 1 second of the start
+        job.logStartTime = syncBeepTime;
 
-    logDurationMicro = logEndTime - logStartTime;
+    logDurationMicro = logEndTime - job.logStartTime;
 
     if (endFrame == (uint32_t) -1) {
         endFrame = (uint32_t) ((logDurationMicro * options.fps + (1000000 - 1)) / 1000000);
     }
-    outputFrames = endFrame - startFrame;
-
-    if (FT_New_Memory_Face(freetypeLibrary, (const FT_Byte*)SourceSansPro_Regular_otf, SourceSansPro_Regular_otf_len, 0, &ft_face)) {
-        fprintf(stderr, "Failed to load font file\n");
-        exit(-1);
-    }
-    cairo_face = cairo_ft_font_face_create_for_ft_face(ft_face, 0);
+    job.startFrame = startFrame;
+    job.outputFrames = endFrame - startFrame;
+    job.nextFrame = 0;
+    job.framesRendered = 0;
 
-    decideCraftParameters(&craftParameters, options.imageWidth, options.imageHeight);
+    decideCraftParameters(&job.craftParameters, options.imageWidth, options.imageHeight);
 
     //Exaggerate values around the origin and compress values near the edges:
     pitchStickCurve = expoCurveCreate(0, 0.700, 500 * (flightLog->sysConfig.rcRate ? flightLog->sysConfig.rcRate : 100) / 100, 1.0, 10);
@@ -1158,256 +2469,91 @@ void renderAnimation(uint32_t startFrame, uint32_t endFrame)
     // Default Servo range is [1020...2000] but we'll just use [1000...2000] for simplicity
     servoCurve = expoCurveCreate(-1500, 1.0, 1000, 1.0, 2);
 
-    int durationSecs = (outputFrames + (options.fps - 1)) / (options.fps);
+    int durationSecs = (job.outputFrames + (options.fps - 1)) / (options.fps);
     int durationMins = durationSecs / 60;
     durationSecs %= 60;
 
-    fprintf(stderr, "%d frames to be rendered at %d FPS [%d:%02d]\n", outputFrames, options.fps, durationMins, durationSecs);
+    fprintf(stderr, "%d frames to be rendered at %d FPS [%d:%02d]\n", job.outputFrames, options.fps, durationMins, durationSecs);
     fprintf(stderr, "\n");
 
-    for (uint32_t outputFrameIndex = startFrame; outputFrameIndex < endFrame; outputFrameIndex++) {
-        int64_t windowCenterTime = logStartTime + ((int64_t) outputFrameIndex * 1000000) / options.fps;
-        int64_t windowStartTime = windowCenterTime - startXTimeOffset;
-        int64_t windowEndTime = windowStartTime + windowWidthMicros;
-
-        cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, options.imageWidth, options.imageHeight);
-        cairo_t *cr = cairo_create(surface);
-
-        // Find the frame just to the left of the first pixel so we can start drawing lines from there
-        int firstFrameIndex = datapointsFindFrameAtTime(points, windowStartTime - 1);
-
-        if (firstFrameIndex == -1) {
-            firstFrameIndex = 0;
-        }
-
-        cairo_set_font_face(cr, cairo_face);
-
-        //Plot the upper motor graph
-        if (options.plotMotors) {
-            int motorGraphHeight = (int) (options.imageHeight * (options.plotPids ? 0.15 : 0.20));
-
-            cairo_save(cr);
-            {
-                if (options.plotPids) {
-                    //Move up a little bit to make room for the pid graphs
-                    cairo_translate(cr, 0, options.imageHeight * 0.15);
-                } else {
-                    cairo_translate(cr, 0, options.imageHeight * 0.25);
-                }
-
-                drawAxisLine(cr);
-
-                cairo_set_line_width(cr, 2.5);
-
-                for (i = 0; i < fieldMeta.numMotors; i++) {
-                    plotLine(cr, fieldMeta.motorColors[i], windowStartTime, windowEndTime, firstFrameIndex,
-                            flightLog->mainFieldIndexes.motor[i], motorCurve, motorGraphHeight);
-                }
-
-                if (fieldMeta.numServos) {
-                    for (i = 0; i < MAX_SERVOS; i++) {
-                        if (flightLog->mainFieldIndexes.servo[i] > -1) {
-                            plotLine(cr, fieldMeta.servoColors[i], windowStartTime, windowEndTime, firstFrameIndex,
-                                flightLog->mainFieldIndexes.servo[i], motorCurve, motorGraphHeight);
-                        }
-                    }
-                }
-
-                drawAxisLabel(cr, "Motors");
-            }
-            cairo_restore(cr);
-        }
-
-        //Plot the lower PID graphs
-        cairo_save(cr);
-        {
-            if (options.plotPids) {
-                //Plot three axes as different graphs
-                cairo_translate(cr, 0, options.imageHeight * 0.60);
-                for (int axis = 0; axis < 3; axis++) {
-                    cairo_save(cr);
-
-                    cairo_translate(cr, 0, options.imageHeight * 0.2 * (axis - 1));
-
-                    drawAxisLine(cr);
-
-                    for (int pidType = PID_D; pidType >= PID_P; pidType--) {
-                        if (flightLog->mainFieldIndexes.pid[pidType][axis] > -1) {
-                            switch (pidType) {
-                                case PID_P:
-                                    cairo_set_line_width(cr, 2);
-                                break;
-                                case PID_I:
-                                    cairo_set_dash(cr, DASHED_LINE, DASHED_LINE_NUM_POINTS, 0);
-                                    cairo_set_line_width(cr, 2);
-                                break;
-                                case PID_D:
-                                    cairo_set_dash(cr, DOTTED_LINE, DOTTED_LINE_NUM_POINTS, 0);
-                                    cairo_set_line_width(cr, 2);
-                            }
-
-                            plotLine(cr, fieldMeta.PIDAxisColors[pidType][axis], windowStartTime, windowEndTime, firstFrameIndex,
-                                    flightLog->mainFieldIndexes.pid[pidType][axis], pidCurve, (int) (options.imageHeight * 0.15));
-
-                            cairo_set_dash(cr, 0, 0, 0);
-                        }
-                    }
-
-                    if (options.plotGyros) {
-                        cairo_set_line_width(cr, 3);
-
-                        plotLine(cr, fieldMeta.gyroColors[axis], windowStartTime, windowEndTime, firstFrameIndex,
-                            flightLog->mainFieldIndexes.gyroADC[axis], gyroCurve, (int) (options.imageHeight * 0.15));
-                    }
-
-                    const char *axisLabel;
-                    if (options.plotGyros) {
-                        switch (axis) {
-                            case 0:
-                                axisLabel = "Gyro + PID roll";
-                            break;
-                            case 1:
-                                axisLabel = "Gyro + PID pitch";
-                            break;
-                            case 2:
-                                axisLabel = "Gyro + PID yaw";
-                            break;
-                            default:
-                                axisLabel = "Unknown";
-                        }
-                    } else {
-                        switch (axis) {
-                            case 0:
-                                axisLabel = "Roll PIDs";
-                            break;
-                            case 1:
-                                axisLabel = "Pitch PIDs";
-                            break;
-                            case 2:
-                                axisLabel = "Yaw PIDs";
-                            break;
-                            default:
-                                axisLabel = "Unknown";
-                        }
-                    }
-
-                    drawAxisLabel(cr, axisLabel);
-
-                    cairo_restore(cr);
-                }
-            } else if (options.plotGyros) {
-                //Plot three gyro axes on one graph
-                cairo_translate(cr, 0, options.imageHeight * 0.70);
-
-                drawAxisLine(cr);
+    semaphore_create(&job.workerExited, 0);
+    semaphore_create(&job.pngSaverExited, 0);
+    job.threadsStarted = 0;
 
-                for (int axis = 0; axis < 3; axis++) {
-                    plotLine(cr, fieldMeta.gyroColors[axis], windowStartTime, windowEndTime, firstFrameIndex,
-                            flightLog->mainFieldIndexes.gyroADC[axis], gyroCurve, (int) (options.imageHeight * 0.25));
-                }
-
-                drawAxisLabel(cr, "Gyro");
-            }
-        }
-        cairo_restore(cr);
-
-        //Draw a bar highlighting the current time if we are drawing any graphs
-        if (options.plotGyros || options.plotMotors || options.plotPids || options.plotPidSum) {
-            double centerX = options.imageWidth / 2.0;
+    if (options.outputFormat == OUTPUT_FORMAT_PNG) {
+        job.stream = NULL;
+    } else {
+        job.stream = videoStreamCreate(openVideoOutput(),
+            options.outputFormat == OUTPUT_FORMAT_Y4M ? VIDEO_STREAM_FORMAT_Y4M : VIDEO_STREAM_FORMAT_RAW_RGBA,
+            options.imageWidth, options.imageHeight, options.fps, options.threads * VIDEO_FRAMES_IN_FLIGHT_PER_THREAD);
+    }
 
-            cairo_set_source_rgba(cr, 1, 0.25, 0.25, 0.2);
-            cairo_set_line_width(cr, 20);
+    createFrameSurfaces(&job);
+    startPNGSavers(&job, &savers);
 
-            cairo_move_to(cr, centerX, 0);
-            cairo_line_to(cr, centerX, options.imageHeight);
-            cairo_stroke(cr);
-        }
+    // The workers share the read-only log data and curves, but each needs its own fonts and search state
+    contexts = calloc(options.threads, sizeof(*contexts));
 
-        int centerFrameIndex = datapointsFindFrameAtTime(points, windowCenterTime);
+    for (int i = 0; i < options.threads; i++) {
+        renderContextInit(&contexts[i], &job);
+    }
 
-        //Draw the command stick positions from the centered frame
-        if (datapointsGetFrameAtIndex(points, centerFrameIndex, &frameTime, frameValues)) {
-            if (options.drawSticks) {
-                cairo_save(cr);
-                {
-
-                    if (options.sticksTop != 0 && options.sticksRight != 0) {
-                      cairo_translate(cr, options.imageWidth - options.sticksRight, options.sticksTop);
-                    } else if (options.sticksRight != 0) {
-                      cairo_translate(cr, options.imageWidth - options.sticksRight, 0.20 * options.imageHeight);
-                    } else if (options.sticksTop != 0) {
-                      cairo_translate(cr, 0.75 * options.imageWidth, options.sticksTop);
-                    } else {
-                      cairo_translate(cr, 0.75 * options.imageWidth, 0.20 * options.imageHeight);
-                    }
+    allocationsBeforeRender = countFrameAllocations(&job);
+    threadsBeforeRender = job.threadsStarted + options.threads;
 
-                    drawCommandSticks(frameValues, options.imageWidth, options.imageHeight, cr);
-                }
-                cairo_restore(cr);
-            }
+    for (int i = 0; i < options.threads; i++) {
+        startRenderThread(&job, renderWorkerThread, &contexts[i]);
+    }
 
-            if (options.drawPidTable) {
-                cairo_save(cr);
-                {
-                    cairo_translate(cr, 0.25 * options.imageWidth, 0.75 * options.imageHeight);
-                    drawPIDTable(cr, frameValues);
-                }
-                cairo_restore(cr);
-            }
+    if (job.stream) {
+        videoStreamWriteFrames(job.stream, job.outputFrames);
+    }
 
-            if (options.drawCraft) {
-                cairo_save(cr);
-                {
-                    if (options.craftTop != 0 && options.craftRight != 0) {
-                      cairo_translate(cr, options.imageWidth - options.craftRight, options.craftTop);
-                    } else if (options.craftRight != 0) {
-                      cairo_translate(cr, options.imageWidth - options.craftRight, 0.20 * options.imageHeight);
-                    } else if (options.craftTop != 0) {
-                      cairo_translate(cr, 0.75 * options.imageWidth, options.craftTop);
-                    } else {
-                      cairo_translate(cr, 0.75 * options.imageWidth, 0.20 * options.imageHeight);
-                    }
+    for (int i = 0; i < options.threads; i++) {
+        semaphore_wait(&job.workerExited);
+    }
 
-                    drawCraft(cr, frameValues, outputFrameIndex > 0 ? windowCenterTime - lastCenterTime : 0, &craftParameters);
-                }
-                cairo_restore(cr);
-            }
+    // Tell the PNG savers to exit once they've saved all the frames before this
+    for (int i = 0; i < job.pngWriterCount; i++) {
+        workQueuePush(job.framesToSave, NULL);
+    }
 
-            if (options.drawAcc) {
-              drawAccelerometerData(cr, frameValues);
-            }
+    for (int i = 0; i < job.pngWriterCount; i++) {
+        semaphore_wait(&job.pngSaverExited);
+    }
 
-            if (options.drawTime)
-                drawFrameLabel(cr, frameValues[FLIGHT_LOG_FIELD_INDEX_ITERATION], (uint32_t) ((windowCenterTime - flightLog->stats.field[FLIGHT_LOG_FIELD_INDEX_TIME].min) / 1000));
-        }
+    fprintf(stderr, "Drew on %d recycled surfaces with %d threads, which were set up before the first frame. "
+        "Buffers allocated while rendering: %u, threads started while rendering: %d.\n",
+        job.surfaceCount, threadsBeforeRender,
+        countFrameAllocations(&job) - allocationsBeforeRender, job.threadsStarted - threadsBeforeRender);
 
-        // Draw a synchronisation line
-        if (syncBeepTime >= windowStartTime && syncBeepTime < windowEndTime) {
-            double lineX = (double) ((int64_t) options.imageWidth * (syncBeepTime - windowStartTime) / windowWidthMicros);
+    for (int i = 0; i < options.threads; i++) {
+        drawTimeMicros += contexts[i].drawTimeMicros;
+        renderContextDestroy(&contexts[i]);
+    }
+    free(contexts);
 
-            cairo_set_source_rgba(cr, 0.25, 0.25, 1, 0.2);
-            cairo_set_line_width(cr, 20);
+    if (job.outputFrames > 0) {
+        fprintf(stderr, "Drawing took %.2fms per frame on average.\n", (double) drawTimeMicros / job.outputFrames / 1000);
+    }
 
-            cairo_move_to(cr, lineX, 0);
-            cairo_line_to(cr, lineX, options.imageHeight);
-            cairo_stroke(cr);
-        }
+    semaphore_destroy(&job.workerExited);
+    semaphore_destroy(&job.pngSaverExited);
 
-        cairo_destroy(cr);
+    if (job.stream) {
+        if (job.stream->file != stdout)
+            fclose(job.stream->file);
 
-        lastCenterTime = windowCenterTime;
+        videoStreamDestroy(job.stream);
+    }
 
-        saveSurfaceAsync(surface, selectedLogIndex, outputFrameIndex);
+    destroyFrameSurfaces(&job);
 
-        uint32_t frameWrittenCount = outputFrameIndex - startFrame + 1;
-        if (frameWrittenCount % 500 == 0 || frameWrittenCount == outputFrames) {
-            fprintf(stderr, "Rendered %d frames (%.1f%%)%s\n",
-                frameWrittenCount, (double)frameWrittenCount / outputFrames * 100,
-                frameWrittenCount < outputFrames ? "..." : ".");
-        }
+    for (int i = 0; i < job.pngWriterCount; i++) {
+        pngWriterDestroy(job.pngWriters[i]);
     }
-
-    waitForFramesToSave();
+    free(job.pngWriters);
+    free(savers);
 }
 
 void printUsage(const char *argv0)
@@ -1426,8 +2572,14 @@ void printUsage(const char *argv0)
         "   --width <px>           Choose the width of the image (default %d)\n"
         "   --height <px>          Choose the height of the image (default %d)\n"
         "   --fps                  FPS of the resulting video (default %d)\n"
-        "   --threads              Number of threads to use to render frames (default %d)\n"
+        "   --threads              Number of threads to draw and save frames on (default %d)\n"
         "   --prefix <filename>    Set the prefix of the output frame filenames\n"
+        "   --output-format <name> Save frames as PNGs, or stream them as video (png/y4m/rawrgba, default %s)\n"
+        "   --output <filename>    Stream the video to this file or FIFO rather than to stdout\n"
+        "   --png-compression <n>  PNG compression level, 0 (store only) to 9 (default %d)\n"
+        "   --png-strategy <name>  PNG compression strategy (default/filtered/rle/huffman, default %s)\n"
+        "   --png-filter <name>    PNG filter for every row (none/sub/up, default %s)\n"
+        "   --png-stripes <n>      Compress each PNG in this many stripes on separate threads (default %d)\n"
         "   --start <x:xx>         Begin the log at this time offset (default 0:00)\n"
         "   --end <x:xx>           End the log at this time offset\n"
         "   --[no-]draw-pid-table  Show table with PIDs and gyros (default on)\n"
@@ -1452,6 +2604,8 @@ void printUsage(const char *argv0)
         "   --prop-style <name>    Style of propeller display (pie/blades, default %s)\n"
         "   --gapless              Fill in gaps in the log with straight lines\n"
         "   --raw-amperage         Print the current sensor ADC value along with computed amperage\n"
+        "   --cache                Keep a decoded copy of the log in a .bbcache file next to it, and use that\n"
+        "                          instead of decoding the log again on later runs\n"
         "   --sticks-text-color    Set the RGBA text color (default 1.0,1.0,1.0,1.0)\n"
         "   --sticks-color         Set the RGBA sticks color (default 1.0,0.4,0.4,1.0)\n"
         "   --sticks-area-color    Set the RGBA sticks area color (default 0.3,0.3,0.3,0.8)\n"
@@ -1459,6 +2613,8 @@ void printUsage(const char *argv0)
         "   --sticks-trail-length <px> Length of the stick trails (default %d)\n"
         "   --sticks-trail-color   Set the RGBA stick trail color (default 1.0,1.0,1.0,1.0)\n"
         "\n", argv0, defaultOptions.imageWidth, defaultOptions.imageHeight, defaultOptions.fps, defaultOptions.threads,
+            OUTPUT_FORMAT_NAME[defaultOptions.outputFormat], defaultOptions.png.compressionLevel,
+            PNG_STRATEGY_NAME[defaultOptions.png.strategy], PNG_FILTER_NAME[defaultOptions.png.filter], defaultOptions.png.stripes,
             defaultOptions.pidSmoothing, defaultOptions.gyroSmoothing, defaultOptions.motorSmoothing,
             UNIT_NAME[defaultOptions.gyroUnit], PROP_STYLE_NAME[defaultOptions.propStyle], defaultOptions.stickTrailLength
     );
@@ -1539,10 +2695,23 @@ Unit parseUnit(const char *s)
     return UNIT_RAW;
 }
 
+/**
+ * Find the index of the name in the list of names, or -1 if it isn't there.
+ */
+static int parseName(const char *s, const char* const *names, int nameCount)
+{
+    for (int i = 0; i < nameCount; i++) {
+        if (strcmp(s, names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
 void parseCommandlineOptions(int argc, char **argv)
 {
     int option_index = 0;
-    int c;
+    int c, nameIndex;
     enum {
         SETTING_INDEX = 1,
         SETTING_WIDTH,
@@ -1571,6 +2740,12 @@ void parseCommandlineOptions(int argc, char **argv)
         SETTING_CRAFT_WIDTH,
         SETTING_STICK_RADIUS,
         SETTING_STICK_TRAIL_RADIUS,
+        SETTING_OUTPUT_FORMAT,
+        SETTING_OUTPUT,
+        SETTING_PNG_COMPRESSION,
+        SETTING_PNG_STRATEGY,
+        SETTING_PNG_FILTER,
+        SETTING_PNG_STRIPES,
     };
 
     memcpy(&options, &defaultOptions, sizeof(options));
@@ -1584,6 +2759,12 @@ void parseCommandlineOptions(int argc, char **argv)
             {"height", required_argument, 0, SETTING_HEIGHT},
             {"fps", required_argument, 0, SETTING_FPS},
             {"prefix", required_argument, 0, SETTING_PREFIX},
+            {"output-format", required_argument, 0, SETTING_OUTPUT_FORMAT},
+            {"output", required_argument, 0, SETTING_OUTPUT},
+            {"png-compression", required_argument, 0, SETTING_PNG_COMPRESSION},
+            {"png-strategy", required_argument, 0, SETTING_PNG_STRATEGY},
+            {"png-filter", required_argument, 0, SETTING_PNG_FILTER},
+            {"png-stripes", required_argument, 0, SETTING_PNG_STRIPES},
             {"start", required_argument, 0, SETTING_START},
             {"end", required_argument, 0, SETTING_END},
             {"plot-pid", no_argument, &options.plotPids, 1},
@@ -1610,6 +2791,7 @@ void parseCommandlineOptions(int argc, char **argv)
             {"threads", required_argument, 0, SETTING_THREADS},
             {"gapless", no_argument, &options.gapless, 1},
             {"raw-amperage", no_argument, &options.rawAmperage, 1},
+            {"cache", no_argument, &options.useCache, 1},
             {"sticks-top", required_argument, 0, SETTING_STICKS_TOP},
             {"sticks-right", required_argument, 0, SETTING_STICKS_RIGHT},
             {"sticks-width", required_argument, 0, SETTING_STICKS_WIDTH},
@@ -1689,6 +2871,57 @@ void parseCommandlineOptions(int argc, char **argv)
             case SETTING_PREFIX:
                 options.outputPrefix = optarg;
             break;
+            case SETTING_OUTPUT_FORMAT:
+                if (strcmp(optarg, "png") == 0) {
+                    options.outputFormat = OUTPUT_FORMAT_PNG;
+                } else if (strcmp(optarg, "y4m") == 0) {
+                    options.outputFormat = OUTPUT_FORMAT_Y4M;
+                } else if (strcmp(optarg, "rawrgba") == 0) {
+                    options.outputFormat = OUTPUT_FORMAT_RAW_RGBA;
+                } else {
+                    fprintf(stderr, "Bad --output-format value, expected png, y4m or rawrgba\n");
+                    exit(-1);
+                }
+            break;
+            case SETTING_OUTPUT:
+                options.outputFilename = optarg;
+            break;
+            case SETTING_PNG_COMPRESSION:
+                options.png.compressionLevel = atoi(optarg);
+
+                if (options.png.compressionLevel < 0 || options.png.compressionLevel > 9) {
+                    fprintf(stderr, "Bad --png-compression level (should be 0-9)\n");
+                    exit(-1);
+                }
+            break;
+            case SETTING_PNG_STRATEGY:
+                nameIndex = parseName(optarg, PNG_STRATEGY_NAME, ARRAY_LENGTH(PNG_STRATEGY_NAME));
+
+                if (nameIndex == -1) {
+                    fprintf(stderr, "Bad --png-strategy value, expected default, filtered, rle or huffman\n");
+                    exit(-1);
+                }
+
+                options.png.strategy = (PNGStrategy) nameIndex;
+            break;
+            case SETTING_PNG_FILTER:
+                nameIndex = parseName(optarg, PNG_FILTER_NAME, ARRAY_LENGTH(PNG_FILTER_NAME));
+
+                if (nameIndex == -1) {
+                    fprintf(stderr, "Bad --png-filter value, expected none, sub or up\n");
+                    exit(-1);
+                }
+
+                options.png.filter = (PNGFilter) nameIndex;
+            break;
+            case SETTING_PNG_STRIPES:
+                options.png.stripes = atoi(optarg);
+
+                if (options.png.stripes < 1 || options.png.stripes > PNG_WRITER_MAX_STRIPES) {
+                    fprintf(stderr, "Bad --png-stripes value (should be 1-%d)\n", PNG_WRITER_MAX_STRIPES);
+                    exit(-1);
+                }
+            break;
             case SETTING_SMOOTHING_PID:
                 options.pidSmoothing = atoi(optarg);
             break;
@@ -1790,39 +3023,144 @@ static void applySmoothing() {
     }
 }
 
-void computeExtraFields(void) {
-    int16_t accSmooth[3], gyroADC[3], magADC[3];
-    int64_t frameTime, lastFrameTime = 0;
-    int32_t frameIndex;
-    int64_t frame[FLIGHT_LOG_MAX_FIELDS];
-    double cumulativeCurrent = 0.0; // in milliamp-hours
-    attitude_t attitude;
-    bool calculateAttitude = fieldMeta.hasGyros && fieldMeta.hasAccs && flightLog->sysConfig.acc_1G;
+/**
+ * Store the angle that each prop has turned to by each frame (in radians, as floats packed into the field), so that
+ * the props can be drawn at any time without having to draw all of the video frames before it. This must follow the
+ * smoothing so the props spin at the speed that the motors are drawn at.
+ */
+static void integratePropAngles(void)
+{
+    double angle[MAX_MOTORS] = {0}, angularSpeed[MAX_MOTORS] = {0};
+    int64_t frameTime, lastFrameTime = 0, frame[FLIGHT_LOG_MAX_FIELDS];
+    bool first = true;
+
+    for (int32_t frameIndex = 0; frameIndex < points->frameCount; frameIndex++) {
+        if (!datapointsGetFrameAtIndex(points, frameIndex, &frameTime, frame))
+            continue;
+
+        for (int motor = 0; motor < MAX_MOTORS; motor++) {
+            if (fieldMeta.propAngle[motor] > -1) {
+                if (!first) {
+                    angle[motor] = fmod(angle[motor] + angularSpeed[motor] * (frameTime - lastFrameTime) / 1000000, M_PI * 2);
+                }
 
-    imuInit();
+                angularSpeed[motor] = motorAngularSpeed(frame, motor);
 
-    for (frameIndex = 0; frameIndex < points->frameCount; frameIndex++) {
-        if (datapointsGetFrameAtIndex(points, frameIndex, &frameTime, frame)) {
-            if (calculateAttitude) {
-                for (int axis = 0; axis < 3; axis++) {
-                    accSmooth[axis] = frame[flightLog->mainFieldIndexes.accSmooth[axis]];
-                    gyroADC[axis] = frame[flightLog->mainFieldIndexes.gyroADC[axis]];
-                }
+                datapointsSetFieldAtIndex(points, frameIndex, fieldMeta.propAngle[motor], floatToInt((float) angle[motor]));
+            }
+        }
+
+        first = false;
+        lastFrameTime = frameTime;
+    }
+}
+
+static void addPlotPyramid(int fieldIndex)
+{
+    if (fieldIndex > -1 && !plotPyramids[fieldIndex])
+        plotPyramids[fieldIndex] = datapointsPyramidCreate(points, fieldIndex);
+}
+
+/**
+ * Build the min/max pyramids for the fields that we'll draw graphs of. This must follow the smoothing, since the
+ * pyramids are taken from the final values.
+ */
+static void buildPlotPyramids(void)
+{
+    plotPyramids = calloc(points->fieldCount, sizeof(*plotPyramids));
+
+    if (options.plotMotors) {
+        for (int motor = 0; motor < fieldMeta.numMotors; motor++)
+            addPlotPyramid(flightLog->mainFieldIndexes.motor[motor]);
+
+        if (fieldMeta.numServos) {
+            for (int servo = 0; servo < MAX_SERVOS; servo++)
+                addPlotPyramid(flightLog->mainFieldIndexes.servo[servo]);
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (options.plotPids) {
+            for (int pid = PID_P; pid <= PID_D; pid++)
+                addPlotPyramid(flightLog->mainFieldIndexes.pid[pid][axis]);
+        }
+
+        if (options.plotGyros)
+            addPlotPyramid(flightLog->mainFieldIndexes.gyroADC[axis]);
+    }
+}
+
+/**
+ * Run the IMU simulation over the whole log, storing the attitude of each frame in its roll, pitch and heading fields.
+ */
+static void computeAttitude(void)
+{
+    int16_t gyroADC[3][IMU_BATCH_SIZE], accSmooth[3][IMU_BATCH_SIZE], magADC[3][IMU_BATCH_SIZE];
+    uint32_t frameTime[IMU_BATCH_SIZE];
+    int32_t frameIndex[IMU_BATCH_SIZE];
+    attitude_t attitude[IMU_BATCH_SIZE];
+    imuSensorColumns_t columns;
+    imuState_t imu;
+    int64_t time, frame[FLIGHT_LOG_MAX_FIELDS];
+    int count = 0;
+
+    imuStateInit(&imu);
+
+    columns.time = frameTime;
+
+    for (int axis = 0; axis < 3; axis++) {
+        columns.gyroADC[axis] = gyroADC[axis];
+        columns.accSmooth[axis] = accSmooth[axis];
+        columns.magADC[axis] = fieldMeta.hasMagADC ? magADC[axis] : NULL;
+    }
+
+    // Gather the sensor readings of the valid frames into blocks of columns for the IMU
+    for (int32_t i = 0; i <= points->frameCount; i++) {
+        if (i < points->frameCount) {
+            if (!datapointsGetFrameAtIndex(points, i, &time, frame))
+                continue;
+
+            for (int axis = 0; axis < 3; axis++) {
+                accSmooth[axis][count] = frame[flightLog->mainFieldIndexes.accSmooth[axis]];
+                gyroADC[axis][count] = frame[flightLog->mainFieldIndexes.gyroADC[axis]];
 
                 if (fieldMeta.hasMagADC) {
-                    for (int axis = 0; axis < 3; axis++) {
-                        magADC[axis] = frame[flightLog->mainFieldIndexes.magADC[axis]];
-                    }
+                    magADC[axis][count] = frame[flightLog->mainFieldIndexes.magADC[axis]];
                 }
+            }
+
+            frameTime[count] = (uint32_t) time;
+            frameIndex[count] = i;
+            count++;
+        }
 
-                updateEstimatedAttitude(gyroADC, accSmooth, fieldMeta.hasMagADC ? magADC : 0, (uint32_t) frameTime, flightLog->sysConfig.acc_1G, flightLog->sysConfig.gyroScale, &attitude);
+        if (count == IMU_BATCH_SIZE || (i == points->frameCount && count > 0)) {
+            imuUpdateAttitudeBatch(&imu, &columns, count, flightLog->sysConfig.acc_1G, flightLog->sysConfig.gyroScale, attitude);
 
-                //Pack those floats into signed ints to store into the datapoints array:
-                datapointsSetFieldAtIndex(points, frameIndex, fieldMeta.roll, floatToInt(attitude.roll));
-                datapointsSetFieldAtIndex(points, frameIndex, fieldMeta.pitch, floatToInt(attitude.pitch));
-                datapointsSetFieldAtIndex(points, frameIndex, fieldMeta.heading, floatToInt(attitude.heading));
+            //Pack those floats into signed ints to store into the datapoints array:
+            for (int j = 0; j < count; j++) {
+                datapointsSetFieldAtIndex(points, frameIndex[j], fieldMeta.roll, floatToInt(attitude[j].roll));
+                datapointsSetFieldAtIndex(points, frameIndex[j], fieldMeta.pitch, floatToInt(attitude[j].pitch));
+                datapointsSetFieldAtIndex(points, frameIndex[j], fieldMeta.heading, floatToInt(attitude[j].heading));
             }
 
+            count = 0;
+        }
+    }
+}
+
+void computeExtraFields(void) {
+    int64_t frameTime, lastFrameTime = 0;
+    int32_t frameIndex;
+    int64_t frame[FLIGHT_LOG_MAX_FIELDS];
+    double cumulativeCurrent = 0.0; // in milliamp-hours
+
+    if (fieldMeta.hasGyros && fieldMeta.hasAccs && flightLog->sysConfig.acc_1G) {
+        computeAttitude();
+    }
+
+    for (frameIndex = 0; frameIndex < points->frameCount; frameIndex++) {
+        if (datapointsGetFrameAtIndex(points, frameIndex, &frameTime, frame)) {
             if (fieldMeta.hasPIDs) {
                 for (int axis = 0; axis < 3; axis++) {
                     int32_t pidSum = frame[flightLog->mainFieldIndexes.pid[PID_P][axis]] + frame[flightLog->mainFieldIndexes.pid[PID_I][axis]] + frame[flightLog->mainFieldIndexes.pid[PID_D][axis]];
@@ -1879,7 +3217,6 @@ int main(int argc, char **argv)
 {
     struct stat directoryStat;
     char outputDirectory[256];
-    char **fieldNames;
     uint32_t frameStart, frameEnd;
     int fd;
 
@@ -1894,17 +3231,12 @@ int main(int argc, char **argv)
 
     options.bottomGraphSplitAxes = options.plotPids;
 
-    stickTrails[0] = malloc(options.stickTrailLength * sizeof(struct point_t));
-    stickTrails[1] = malloc(options.stickTrailLength * sizeof(struct point_t));
-
     fd = open(options.filename, O_RDONLY);
     if (fd < 0) {
         fprintf(stderr, "Failed to open log file '%s': %s\n", options.filename, strerror(errno));
         return -1;
     }
 
-    FT_Init_FreeType(&freetypeLibrary);
-
     flightLog = flightLogCreate(fd);
 
     selectedLogIndex = chooseLog(flightLog);
@@ -1913,7 +3245,7 @@ int main(int argc, char **argv)
         return -1;
 
     //If the user didn't supply an output filename prefix, create our own based on the input filename
-    if (!options.outputPrefix) {
+    if (!options.outputPrefix && options.outputFormat == OUTPUT_FORMAT_PNG) {
         char *fileExtensionPeriod = strrchr(options.filename, '.');
         char *fileSlash = strrchr(options.filename, '/');
         char *logNameStart, *logNameEnd;
@@ -1943,59 +3275,33 @@ int main(int argc, char **argv)
         snprintf(options.outputPrefix, 256, "%s/%.*s", outputDirectory, (int) (logNameEnd - logNameStart), logNameStart);
     }
 
-    //First check out how many frames we need to store so we can pre-allocate (parsing will update the flightlog stats which contain that info)
-    flightLogParse(flightLog, selectedLogIndex, NULL, NULL, NULL, false);
-
-    // Assign field indexes to the fields we'll add
-    int newFieldIndex = flightLog->frameDefs['I'].fieldCount, combinedFieldCount;
-
-    fieldMeta.roll = newFieldIndex++;
-    fieldMeta.pitch = newFieldIndex++;
-    fieldMeta.heading = newFieldIndex++;
+    //Decode the flight log into the points array, which is created once the headers have been read
+    if (options.useCache) {
+        logCacheStatistics_t cacheStats;
 
-    fieldMeta.axisPIDSum[0] = newFieldIndex++;
-    fieldMeta.axisPIDSum[1] = newFieldIndex++;
-    fieldMeta.axisPIDSum[2] = newFieldIndex++;
+        flightLogParseCached(flightLog, options.filename, selectedLogIndex, onMetadataReady, loadFrameIntoPoints, onLogEvent, false, &cacheStats);
 
-    if (flightLog->mainFieldIndexes.amperageLatest > -1) {
-        fieldMeta.cumulativeCurrent = newFieldIndex++;
+        fprintf(stderr, "%s: first frame after %.1f ms, finished after %.1f ms\n", cacheStats.hit ? "Read log from cache" : "Decoded log",
+            cacheStats.firstFrameMicros / 1000.0, cacheStats.totalMicros / 1000.0);
     } else {
-        fieldMeta.cumulativeCurrent = -1;
-    }
-
-    combinedFieldCount = newFieldIndex;
-
-    // Create a copy of the array of field names so we can add our custom fields to it
-    fieldNames = malloc(sizeof(*fieldNames) * combinedFieldCount);
-
-    for (int i = 0; i < flightLog->frameDefs['I'].fieldCount; i++) {
-        fieldNames[i] = strdup(flightLog->frameDefs['I'].fieldName[i]);
+        flightLogParse(flightLog, selectedLogIndex, onMetadataReady, loadFrameIntoPoints, onLogEvent, false);
     }
 
-    // And add our synthetic field names
-    fieldNames[fieldMeta.roll] = strdup("roll");
-    fieldNames[fieldMeta.pitch] = strdup("pitch");
-    fieldNames[fieldMeta.heading] = strdup("heading");
-    fieldNames[fieldMeta.axisPIDSum[0]] = strdup("axisPID[0]");
-    fieldNames[fieldMeta.axisPIDSum[1]] = strdup("axisPID[1]");
-    fieldNames[fieldMeta.axisPIDSum[2]] = strdup("axisPID[2]");
-
-    if (fieldMeta.cumulativeCurrent > -1) {
-        fieldNames[fieldMeta.cumulativeCurrent] = strdup("cumulativeCurrent");
+    if (!points) {
+        fprintf(stderr, "Error: This log has no frames to render.\n");
+        return -1;
     }
 
-    // Create the pre-allocated array of frames that we'll decode into
-    points = datapointsCreate(combinedFieldCount, fieldNames, (int) (flightLog->stats.field[FLIGHT_LOG_FIELD_INDEX_ITERATION].max + 1));
-
-    //Now decode the flight log into the points array
-    flightLogParse(flightLog, selectedLogIndex, 0, loadFrameIntoPoints, onLogEvent, false);
-
     updateFieldMetadata();
 
     computeExtraFields();
 
     applySmoothing();
 
+    integratePropAngles();
+
+    buildPlotPyramids();
+
     frameStart = options.timeStart * options.fps;
 
     if (options.timeEnd == 0)
@@ -6,7 +6,9 @@
 #include "datapoints.h"
 #include "parser.h"
 
-datapoints_t *datapointsCreate(int fieldCount, char **fieldNames, int frameCapacity)
+#define DATAPOINTS_CHUNK_MASK (DATAPOINTS_CHUNK_FRAMES - 1)
+
+datapoints_t *datapointsCreate(int fieldCount, char **fieldNames)
 {
     datapoints_t *result = (datapoints_t*) malloc(sizeof(datapoints_t));
 
@@ -14,23 +16,158 @@ datapoints_t *datapointsCreate(int fieldCount, char **fieldNames, int frameCapac
     result->fieldNames = fieldNames;
 
     result->frameCount = 0;
-    result->frameCapacity = frameCapacity;
 
-    result->frames = malloc(sizeof(*result->frames) * fieldCount * frameCapacity);
-    result->frameTime = calloc(1, sizeof(*result->frameTime) * frameCapacity);
-    result->frameGap = calloc(1, sizeof(*result->frameGap) * frameCapacity);
+    result->chunkCount = 0;
+    result->chunkCapacity = 0;
+    result->chunks = NULL;
+
+    result->timeSorted = true;
 
     return result;
 }
 
 void datapointsDestroy(datapoints_t *points)
 {
-    free(points->frames);
-    free(points->frameTime);
-    free(points->frameGap);
+    for (int i = 0; i < points->chunkCount; i++) {
+        for (int j = 0; j < points->fieldCount; j++) {
+            free(points->chunks[i]->columns[j].values);
+        }
+        free(points->chunks[i]->columns);
+        free(points->chunks[i]);
+    }
+
+    free(points->chunks);
     free(points);
 }
 
+static int64_t columnGet(const datapointsColumn_t *column, int index)
+{
+    switch (column->width) {
+        case 0:
+            return column->base;
+        case 1:
+            return column->base + ((int8_t*) column->values)[index];
+        case 2:
+            return column->base + ((int16_t*) column->values)[index];
+        case 4:
+            return column->base + ((int32_t*) column->values)[index];
+        default:
+            return ((int64_t*) column->values)[index];
+    }
+}
+
+static void columnPut(datapointsColumn_t *column, int index, int64_t value)
+{
+    switch (column->width) {
+        case 0:
+        break;
+        case 1:
+            ((int8_t*) column->values)[index] = (int8_t) (value - column->base);
+        break;
+        case 2:
+            ((int16_t*) column->values)[index] = (int16_t) (value - column->base);
+        break;
+        case 4:
+            ((int32_t*) column->values)[index] = (int32_t) (value - column->base);
+        break;
+        default:
+            ((int64_t*) column->values)[index] = value;
+    }
+}
+
+static bool columnFits(const datapointsColumn_t *column, int64_t value)
+{
+    uint64_t half;
+
+    if (column->width == 0)
+        return value == column->base;
+
+    if (column->width == 8)
+        return true;
+
+    half = (uint64_t) 1 << (column->width * 8 - 1);
+
+    // The differences are worked out unsigned so that distant values can't overflow
+    if (value >= column->base)
+        return (uint64_t) value - (uint64_t) column->base < half;
+
+    return (uint64_t) column->base - (uint64_t) value <= half;
+}
+
+/**
+ * Store the value at the given index of a column that holds 'count' values, widening the column first if the value
+ * doesn't fit in it. The other values are re-encoded with a base in the middle of their range and the new value's.
+ */
+static void columnStore(datapointsColumn_t *column, int count, int index, int64_t value)
+{
+    if (!columnFits(column, value)) {
+        datapointsColumn_t widened;
+        int64_t min = value, max = value;
+        uint64_t span;
+
+        for (int i = 0; i < count; i++) {
+            if (i != index) {
+                int64_t other = columnGet(column, i);
+
+                min = other < min ? other : min;
+                max = other > max ? other : max;
+            }
+        }
+
+        span = (uint64_t) max - (uint64_t) min;
+
+        if (span == 0) {
+            widened.width = 0;
+        } else if (span <= UINT8_MAX) {
+            widened.width = 1;
+        } else if (span <= UINT16_MAX) {
+            widened.width = 2;
+        } else if (span <= UINT32_MAX) {
+            widened.width = 4;
+        } else {
+            widened.width = 8;
+        }
+
+        widened.base = widened.width == 8 ? 0 : min + (int64_t) ((span + 1) / 2);
+        widened.values = widened.width ? malloc((size_t) DATAPOINTS_CHUNK_FRAMES * widened.width) : NULL;
+
+        for (int i = 0; i < count; i++) {
+            if (i != index) {
+                columnPut(&widened, i, columnGet(column, i));
+            }
+        }
+
+        free(column->values);
+        *column = widened;
+    }
+
+    columnPut(column, index, value);
+}
+
+static int64_t datapointsValue(datapoints_t *points, int frameIndex, int fieldIndex)
+{
+    return columnGet(&points->chunks[frameIndex >> DATAPOINTS_CHUNK_FRAMES_LOG2]->columns[fieldIndex], frameIndex & DATAPOINTS_CHUNK_MASK);
+}
+
+static void datapointsSetValue(datapoints_t *points, int frameIndex, int fieldIndex, int64_t value)
+{
+    int chunkStart = frameIndex & ~DATAPOINTS_CHUNK_MASK;
+    int chunkFrames = points->frameCount - chunkStart < DATAPOINTS_CHUNK_FRAMES ? points->frameCount - chunkStart : DATAPOINTS_CHUNK_FRAMES;
+
+    columnStore(&points->chunks[frameIndex >> DATAPOINTS_CHUNK_FRAMES_LOG2]->columns[fieldIndex], chunkFrames,
+        frameIndex & DATAPOINTS_CHUNK_MASK, value);
+}
+
+static int64_t datapointsTime(datapoints_t *points, int frameIndex)
+{
+    return points->chunks[frameIndex >> DATAPOINTS_CHUNK_FRAMES_LOG2]->frameTime[frameIndex & DATAPOINTS_CHUNK_MASK];
+}
+
+static uint8_t datapointsGap(datapoints_t *points, int frameIndex)
+{
+    return points->chunks[frameIndex >> DATAPOINTS_CHUNK_FRAMES_LOG2]->frameGap[frameIndex & DATAPOINTS_CHUNK_MASK];
+}
+
 /**
  * Smooth the values for the field with the given index by replacing each value with an
  * average over the a window of width (windowRadius*2+1) centered at the point.
@@ -90,7 +227,7 @@ void datapointsSmoothField(datapoints_t *points, int fieldIndex, int windowRadiu
 
             //New value is added to the window
             if (windowRightIndex < partitionRight) {
-                int64_t fieldValue = points->frames[points->fieldCount * windowRightIndex + fieldIndex];
+                int64_t fieldValue = datapointsValue(points, windowRightIndex, fieldIndex);
 
                 accumulator += fieldValue;
 
@@ -100,13 +237,13 @@ void datapointsSmoothField(datapoints_t *points, int fieldIndex, int windowRadiu
                 valuesInHistory++;
 
                 //If there is a discontinuity after this point, adjust the right edge of the partition so we stop looking further
-                if (points->frameGap[windowRightIndex])
+                if (datapointsGap(points, windowRightIndex))
                     partitionRight = windowRightIndex + 1;
             }
 
             // Store the average of the history window into the frame in the center of the window
             if (windowCenterIndex >= partitionLeft) {
-                points->frames[points->fieldCount * windowCenterIndex + fieldIndex] = accumulator / valuesInHistory;
+                datapointsSetValue(points, windowCenterIndex, fieldIndex, accumulator / valuesInHistory);
             }
         }
     }
@@ -115,7 +252,26 @@ void datapointsSmoothField(datapoints_t *points, int fieldIndex, int windowRadiu
 }
 
 /**
- * Find the index of the latest frame whose time is equal to or later than 'time'.
+ * Find the index of the first frame in [start...end) whose time is later than 'time' (or 'end' if there isn't one), in
+ * datapoints whose frame times are sorted.
+ */
+static int datapointsSearchTime(datapoints_t *points, int start, int end, int64_t time)
+{
+    while (start < end) {
+        int middle = start + (end - start) / 2;
+
+        if (time < datapointsTime(points, middle)) {
+            end = middle;
+        } else {
+            start = middle + 1;
+        }
+    }
+
+    return start;
+}
+
+/**
+ * Find the index of the latest frame whose time is equal to or earlier than 'time'.
  *
  * Returns -1 if the time is before any frame in the datapoints.
  */
@@ -123,9 +279,13 @@ int datapointsFindFrameAtTime(datapoints_t *points, int64_t time)
 {
     int i, lastGoodFrame = -1;
 
-    //TODO make me a binary search
+    if (points->timeSorted) {
+        return datapointsSearchTime(points, 0, points->frameCount, time) - 1;
+    }
+
+    // Without sorted times we can only return the frame before the first one that's later than the time
     for (i = 0; i < points->frameCount; i++) {
-        if (time < points->frameTime[i]) {
+        if (time < datapointsTime(points, i)) {
             return lastGoodFrame;
         }
         lastGoodFrame = i;
@@ -134,13 +294,57 @@ int datapointsFindFrameAtTime(datapoints_t *points, int64_t time)
     return lastGoodFrame;
 }
 
+void datapointsCursorInit(datapointsCursor_t *cursor, datapoints_t *points)
+{
+    cursor->points = points;
+    cursor->frameIndex = -1;
+}
+
+/**
+ * Move the cursor to the latest frame whose time is equal to or earlier than 'time', and return its index (or -1 if
+ * the time is before any frame), just like datapointsFindFrameAtTime().
+ *
+ * The search gallops forwards from the cursor's last position, so it takes time proportional to the log of the number
+ * of frames that were skipped, instead of the log of the number of frames in the datapoints.
+ */
+int datapointsCursorSeek(datapointsCursor_t *cursor, int64_t time)
+{
+    datapoints_t *points = cursor->points;
+    int start = cursor->frameIndex + 1, step = 1, end;
+
+    if (!points->timeSorted || (cursor->frameIndex >= 0 && time < datapointsTime(points, cursor->frameIndex))) {
+        // Moving backwards isn't the common case, so just start again
+        cursor->frameIndex = datapointsFindFrameAtTime(points, time);
+        return cursor->frameIndex;
+    }
+
+    // The answer is in [start - 1...frameCount), find a range that's closer to the start to search in
+    end = start;
+
+    while (end < points->frameCount && datapointsTime(points, end) <= time) {
+        start = end + 1;
+        end += step;
+        step *= 2;
+    }
+
+    if (end > points->frameCount) {
+        end = points->frameCount;
+    }
+
+    cursor->frameIndex = datapointsSearchTime(points, start, end, time) - 1;
+
+    return cursor->frameIndex;
+}
+
 bool datapointsGetFrameAtIndex(datapoints_t *points, int frameIndex, int64_t *frameTime, int64_t *frame)
 {
     if (frameIndex < 0 || frameIndex >= points->frameCount)
         return false;
 
-    memcpy(frame, points->frames + frameIndex * points->fieldCount, points->fieldCount * sizeof(*points->frames));
-    *frameTime = points->frameTime[frameIndex];
+    for (int i = 0; i < points->fieldCount; i++) {
+        frame[i] = datapointsValue(points, frameIndex, i);
+    }
+    *frameTime = datapointsTime(points, frameIndex);
 
     return true;
 }
@@ -150,7 +354,7 @@ bool datapointsGetFieldAtIndex(datapoints_t *points, int frameIndex, int fieldIn
     if (frameIndex < 0 || frameIndex >= points->frameCount)
         return false;
 
-    *frameValue = points->frames[frameIndex * points->fieldCount + fieldIndex];
+    *frameValue = datapointsValue(points, frameIndex, fieldIndex);
 
     return true;
 }
@@ -160,7 +364,7 @@ bool datapointsSetFieldAtIndex(datapoints_t *points, int frameIndex, int fieldIn
     if (frameIndex < 0 || frameIndex >= points->frameCount)
         return false;
 
-    points->frames[frameIndex * points->fieldCount + fieldIndex] = frameValue;
+    datapointsSetValue(points, frameIndex, fieldIndex, frameValue);
 
     return true;
 }
@@ -170,31 +374,50 @@ bool datapointsGetTimeAtIndex(datapoints_t *points, int frameIndex, int64_t *fra
     if (frameIndex < 0 || frameIndex >= points->frameCount)
         return false;
 
-    *frameTime = points->frameTime[frameIndex];
+    *frameTime = datapointsTime(points, frameIndex);
 
     return true;
 }
 
 bool datapointsGetGapStartsAtIndex(datapoints_t *points, int frameIndex)
 {
-    return frameIndex >= 0 && frameIndex < points->frameCount && points->frameGap[frameIndex];
+    return frameIndex >= 0 && frameIndex < points->frameCount && datapointsGap(points, frameIndex);
 }
 
 /**
- * Set the data for the frame with the given index. The second field of the frame is expected to be a timestamp
- * (if you want to be able to find frames at given times).
+ * Add a frame after the last one, starting a new chunk if the last is full. The second field of the frame is expected
+ * to be a timestamp (if you want to be able to find frames at given times).
  */
-bool datapointsAddFrame(datapoints_t *points, int64_t frameTime, const int64_t *frame)
+void datapointsAddFrame(datapoints_t *points, int64_t frameTime, const int64_t *frame)
 {
-    if (points->frameCount >= points->frameCapacity)
-        return false;
+    int offset = points->frameCount & DATAPOINTS_CHUNK_MASK;
+    datapointsChunk_t *chunk;
 
-    points->frameTime[points->frameCount] = frameTime;
-    memcpy(points->frames + points->frameCount * points->fieldCount, frame, points->fieldCount * sizeof(*points->frames));
+    if (points->frameCount > 0 && frameTime < datapointsTime(points, points->frameCount - 1)) {
+        points->timeSorted = false;
+    }
 
-    points->frameCount++;
+    if (offset == 0) {
+        if (points->chunkCount == points->chunkCapacity) {
+            points->chunkCapacity = points->chunkCapacity ? points->chunkCapacity * 2 : 16;
+            points->chunks = realloc(points->chunks, points->chunkCapacity * sizeof(*points->chunks));
+        }
 
-    return true;
+        chunk = calloc(1, sizeof(*chunk));
+        chunk->columns = calloc(points->fieldCount, sizeof(*chunk->columns));
+
+        points->chunks[points->chunkCount++] = chunk;
+    } else {
+        chunk = points->chunks[points->chunkCount - 1];
+    }
+
+    chunk->frameTime[offset] = frameTime;
+
+    for (int i = 0; i < points->fieldCount; i++) {
+        columnStore(&chunk->columns[i], offset, offset, frame[i]);
+    }
+
+    points->frameCount++;
 }
 
 /**
@@ -203,5 +426,116 @@ bool datapointsAddFrame(datapoints_t *points, int64_t frameTime, const int64_t *
 void datapointsAddGap(datapoints_t *points)
 {
     if (points->frameCount > 0)
-        points->frameGap[points->frameCount - 1] = 1;
+        points->chunks[(points->frameCount - 1) >> DATAPOINTS_CHUNK_FRAMES_LOG2]->frameGap[(points->frameCount - 1) & DATAPOINTS_CHUNK_MASK] = 1;
+}
+
+/**
+ * Build the min/max pyramid for the given field. Call this after the field's values are final (e.g. after smoothing),
+ * since the pyramid doesn't see later changes.
+ */
+datapointsPyramid_t* datapointsPyramidCreate(datapoints_t *points, int fieldIndex)
+{
+    datapointsPyramid_t *pyramid = calloc(1, sizeof(*pyramid));
+    int64_t gapTime = 0;
+    int gapCount = 0, levelCapacity = 0;
+
+    pyramid->fieldIndex = fieldIndex;
+
+    for (int i = 0; i + 1 < points->frameCount; i++) {
+        if (datapointsGap(points, i)) {
+            gapTime += datapointsTime(points, i + 1) - datapointsTime(points, i);
+            gapCount++;
+        }
+    }
+
+    if (points->frameCount - 1 - gapCount > 0) {
+        pyramid->frameInterval = (double) (datapointsTime(points, points->frameCount - 1) - datapointsTime(points, 0) - gapTime)
+            / (points->frameCount - 1 - gapCount);
+    }
+
+    for (int bucketFrames = DATAPOINTS_PYRAMID_BASE_FRAMES; bucketFrames < points->frameCount; bucketFrames *= 2) {
+        datapointsPyramidLevel_t *level;
+
+        if (pyramid->levelCount == levelCapacity) {
+            levelCapacity = levelCapacity ? levelCapacity * 2 : 16;
+            pyramid->levels = realloc(pyramid->levels, levelCapacity * sizeof(*pyramid->levels));
+        }
+
+        level = &pyramid->levels[pyramid->levelCount];
+
+        level->bucketFrames = bucketFrames;
+        level->bucketCount = (points->frameCount + bucketFrames - 1) / bucketFrames;
+        level->min = malloc(level->bucketCount * sizeof(*level->min));
+        level->max = malloc(level->bucketCount * sizeof(*level->max));
+        level->hasGap = malloc(level->bucketCount * sizeof(*level->hasGap));
+
+        if (pyramid->levelCount == 0) {
+            for (int bucket = 0; bucket < level->bucketCount; bucket++) {
+                int start = bucket * bucketFrames;
+                int end = start + bucketFrames < points->frameCount ? start + bucketFrames : points->frameCount;
+                int64_t min = datapointsValue(points, start, fieldIndex), max = min;
+                uint8_t hasGap = 0;
+
+                for (int i = start; i < end; i++) {
+                    int64_t value = datapointsValue(points, i, fieldIndex);
+
+                    min = value < min ? value : min;
+                    max = value > max ? value : max;
+                    hasGap |= datapointsGap(points, i);
+                }
+
+                level->min[bucket] = min;
+                level->max[bucket] = max;
+                level->hasGap[bucket] = hasGap;
+            }
+        } else {
+            // Each bucket covers the next two buckets of the level below (or just one at the end)
+            datapointsPyramidLevel_t *below = level - 1;
+
+            for (int bucket = 0; bucket < level->bucketCount; bucket++) {
+                int first = bucket * 2, second = first + 1 < below->bucketCount ? first + 1 : first;
+
+                level->min[bucket] = below->min[first] < below->min[second] ? below->min[first] : below->min[second];
+                level->max[bucket] = below->max[first] > below->max[second] ? below->max[first] : below->max[second];
+                level->hasGap[bucket] = below->hasGap[first] | below->hasGap[second];
+            }
+        }
+
+        pyramid->levelCount++;
+    }
+
+    return pyramid;
+}
+
+void datapointsPyramidDestroy(datapointsPyramid_t *pyramid)
+{
+    if (!pyramid)
+        return;
+
+    for (int i = 0; i < pyramid->levelCount; i++) {
+        free(pyramid->levels[i].min);
+        free(pyramid->levels[i].max);
+        free(pyramid->levels[i].hasGap);
+    }
+
+    free(pyramid->levels);
+    free(pyramid);
+}
+
+/**
+ * Choose the coarsest level whose buckets are no wider than a pixel that spans the given time, or return -1 if there
+ * are so few frames per pixel that they should be drawn individually.
+ */
+int datapointsPyramidChooseLevel(const datapointsPyramid_t *pyramid, double microsPerPixel)
+{
+    int level = -1;
+
+    if (!(pyramid->frameInterval > 0))
+        return -1;
+
+    while (level + 1 < pyramid->levelCount && pyramid->levels[level + 1].bucketFrames * pyramid->frameInterval <= microsPerPixel) {
+        level++;
+    }
+
+    return level;
 }
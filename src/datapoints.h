@@ -4,17 +4,52 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/**
+ * Frames are stored in chunks of this many, so the datapoints can grow as the log is decoded without knowing how many
+ * frames it has, and without moving the frames that are already stored.
+ */
+#define DATAPOINTS_CHUNK_FRAMES_LOG2 14
+#define DATAPOINTS_CHUNK_FRAMES (1 << DATAPOINTS_CHUNK_FRAMES_LOG2)
+
+/**
+ * The values of one field within a chunk, each stored as its difference from the base in the fewest bytes that the
+ * range of the chunk's values needs (0 if they're all the same, then 1, 2, 4 or 8). Values that don't fit widen the
+ * column.
+ */
+typedef struct datapointsColumn_t {
+    int64_t base;
+    int width;
+    void *values;
+} datapointsColumn_t;
+
+typedef struct datapointsChunk_t {
+    datapointsColumn_t *columns;
+
+    int64_t frameTime[DATAPOINTS_CHUNK_FRAMES];
+    uint8_t frameGap[DATAPOINTS_CHUNK_FRAMES];
+} datapointsChunk_t;
+
 typedef struct datapoints_t {
     int fieldCount, frameCount;
-    int frameCapacity;
     char **fieldNames;
 
-    int64_t *frames;
-    int64_t *frameTime;
-    uint8_t *frameGap;
+    int chunkCount, chunkCapacity;
+    datapointsChunk_t **chunks;
+
+    // True if the frame times never decrease, so frames can be found by binary search
+    bool timeSorted;
 } datapoints_t;
 
-datapoints_t *datapointsCreate(int fieldCount, char **fieldNames, int frameCapacity);
+/**
+ * A position in the datapoints for finding the frames at a series of times, which is quick if each time is a little
+ * after the last (like the frames of a video).
+ */
+typedef struct datapointsCursor_t {
+    datapoints_t *points;
+    int frameIndex;
+} datapointsCursor_t;
+
+datapoints_t *datapointsCreate(int fieldCount, char **fieldNames);
 void datapointsDestroy(datapoints_t *points);
 
 bool datapointsGetFrameAtIndex(datapoints_t *points, int frameIndex, int64_t *frameTime, int64_t *frame);
@@ -26,7 +61,39 @@ bool datapointsGetGapStartsAtIndex(datapoints_t *points, int frameIndex);
 bool datapointsGetTimeAtIndex(datapoints_t *points, int frameIndex, int64_t *frameTime);
 int datapointsFindFrameAtTime(datapoints_t *points, int64_t time);
 
-bool datapointsAddFrame(datapoints_t *points, int64_t frameTime, const int64_t *frame);
+void datapointsCursorInit(datapointsCursor_t *cursor, datapoints_t *points);
+int datapointsCursorSeek(datapointsCursor_t *cursor, int64_t time);
+
+/**
+ * A level-of-detail pyramid of one field of the datapoints, for drawing a long stretch of it quickly. Each level divides
+ * the frames into buckets of a power-of-two number of frames (starting at DATAPOINTS_PYRAMID_BASE_FRAMES) and records
+ * the minimum and maximum of the field within each bucket.
+ */
+#define DATAPOINTS_PYRAMID_BASE_FRAMES 4
+
+typedef struct datapointsPyramidLevel_t {
+    int bucketFrames, bucketCount;
+
+    int64_t *min, *max;
+    // True if a gap begins at any frame in the bucket (including after its last frame)
+    uint8_t *hasGap;
+} datapointsPyramidLevel_t;
+
+typedef struct datapointsPyramid_t {
+    int fieldIndex;
+
+    // The typical time between frames, not counting gaps
+    double frameInterval;
+
+    int levelCount;
+    datapointsPyramidLevel_t *levels;
+} datapointsPyramid_t;
+
+datapointsPyramid_t* datapointsPyramidCreate(datapoints_t *points, int fieldIndex);
+void datapointsPyramidDestroy(datapointsPyramid_t *pyramid);
+int datapointsPyramidChooseLevel(const datapointsPyramid_t *pyramid, double microsPerPixel);
+
+void datapointsAddFrame(datapoints_t *points, int64_t frameTime, const int64_t *frame);
 void datapointsAddGap(datapoints_t *points);
 
 void datapointsSmoothField(datapoints_t *points, int fieldIndex, int windowSize);
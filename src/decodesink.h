@@ -0,0 +1,94 @@
+#ifndef DECODESINK_H_
+#define DECODESINK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "parser.h"
+#include "imu.h"
+#include "battery.h"
+#include "units.h"
+#include "outputstream.h"
+
+// The pieces that output filenames for the current log are built from:
+typedef struct outputNaming_t {
+    const char *logFilename;
+    const char *baseNamePrefix;
+    int baseNamePrefixLen;
+    int pathSeparatorLen;
+    int logIndex;
+} outputNaming_t;
+
+// Computed states, which depend on all the frames that came before:
+typedef struct simulationState_t {
+    imuState_t imu;
+    attitude_t attitude;
+    currentMeterState_t currentMeterMeasured;
+    currentMeterState_t currentMeterVirtual;
+} simulationState_t;
+
+/**
+ * The settings and computed states that blackbox_decode shares with the sinks that live in their own modules.
+ */
+typedef struct decodeSinkContext_t {
+    bool toStdout, raw;
+    bool simulateIMU, simulateCurrentMeter;
+    int compressionLevel;
+    // The number of worker threads a sink may use for its analysis
+    int threads;
+    Unit unitFrameTime, unitAmperage, unitFlags;
+
+    const outputNaming_t *naming;
+    // The statistics that output files add to as they're closed
+    outputStreamStatistics_t *outputStats;
+
+    // The decoder's state as of the frame being passed to the sinks
+    const int64_t *lastFrameTime;
+    const int64_t *slowFrame;
+    const simulationState_t *simulation;
+
+    // The units the user chose for each main and slow field
+    const Unit *mainFieldUnit, *slowFieldUnit;
+} decodeSinkContext_t;
+
+/**
+ * An output product of the decoder. Every enabled sink sees the same stream of parsed frames, so any combination of
+ * outputs can be produced from a single pass over the log. Callbacks that a sink doesn't need are left NULL.
+ */
+typedef struct decodeSink_t {
+    // The name used to select this sink with --emit
+    const char *name;
+    bool enabled;
+
+    // Set for the sinks that write a row for each main frame, which only see the main frames that pass --where
+    bool writesRows;
+
+    // Called once before any log is decoded, with the settings and decoder states that the sink may read from then on
+    void (*init)(const decodeSinkContext_t *context);
+    // Create the sink's output files before the log is parsed. Return false to abandon decoding this log.
+    bool (*open)(flightLog_t *log);
+    // The log's headers have been parsed, so its field definitions are known
+    void (*beginLog)(flightLog_t *log);
+
+    void (*onMainFrame)(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize);
+    void (*onGPSFrame)(flightLog_t *log, int64_t *frame);
+    void (*onSlowFrame)(flightLog_t *log, int64_t *frame);
+    void (*onEvent)(flightLog_t *log, flightLogEvent_t *event);
+
+    // Parsing finished (`success` is false if it failed), so flush and close outputs
+    void (*endLog)(flightLog_t *log, int logIndex, bool success);
+} decodeSink_t;
+
+extern const char *const INFLIGHT_ADJUSTMENT_FUNCTIONS[];
+extern const int INFLIGHT_ADJUSTMENT_FUNCTION_COUNT;
+
+char* createOutputFilename(const char *extension, bool compressible);
+int selectMainFields(flightLog_t *log, const char *patterns, int *fields);
+
+void fprintfMilliampsInUnit(outputStream_t *file, int32_t milliamps, Unit unit);
+void fprintfMicrosecondsInUnit(outputStream_t *file, int64_t microseconds, Unit unit);
+bool fprintfMainFieldInUnit(flightLog_t *log, outputStream_t *file, int fieldIndex, int64_t fieldValue, Unit unit);
+void outputGPSField(outputStream_t *file, int fieldIndex, int64_t value);
+int64_t getGPSFrameTime(flightLog_t *log, int64_t *frame);
+
+#endif
@@ -0,0 +1,626 @@
+/**
+ * Filter expressions like "motor[0] > 1900 || abs(gyroADC[2]) > 1500", which are compiled into a small program for a
+ * stack machine and then run against each main frame.
+ *
+ * Field names are resolved to field indexes once, when the expression is compiled. The compiler folds constant
+ * subexpressions and fuses a comparison between a field and a constant (the bulk of most filters) into a single
+ * instruction. "&&" and "||" skip their right-hand side when the left-hand side already decides the result, so
+ * rejecting a frame usually only takes one or two instructions.
+ *
+ * All arithmetic is on 64-bit integers. Comparisons and logical operators give 0 or 1, and dividing by zero gives 0.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "expression.h"
+
+// The most values that the program can need on the stack at once
+#define EXPRESSION_MAX_DEPTH 32
+
+typedef enum {
+    OP_CONST,
+    OP_FIELD,
+
+    OP_NEGATE,
+    OP_NOT,
+    OP_ABS,
+    OP_BOOL,
+
+    OP_ADD,
+    OP_SUBTRACT,
+    OP_MULTIPLY,
+    OP_DIVIDE,
+    OP_MODULO,
+    OP_MIN,
+    OP_MAX,
+
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+
+    // "field <comparison> constant", in the same order as the comparisons above
+    OP_FIELD_LT,
+    OP_FIELD_LE,
+    OP_FIELD_GT,
+    OP_FIELD_GE,
+    OP_FIELD_EQ,
+    OP_FIELD_NE,
+
+    // If the value on the top of the stack decides the result of "&&"/"||", jump to the target leaving it on the stack,
+    // otherwise pop it and carry on to evaluate the right-hand side
+    OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE
+} expressionOpcode_e;
+
+typedef struct expressionInstruction_t {
+    expressionOpcode_e opcode;
+
+    // Field index for field instructions, or the target instruction for jumps
+    int32_t operand;
+
+    int64_t value;
+} expressionInstruction_t;
+
+struct expression_t {
+    expressionInstruction_t *code;
+    int length, capacity;
+};
+
+typedef struct expressionCompiler_t {
+    const char *text;
+    const char *pos;
+
+    const char *const *fieldNames;
+    int fieldCount;
+
+    expression_t *expression;
+
+    // The depth of the stack after the instructions compiled so far have run
+    int depth;
+
+    char *error;
+    size_t errorLen;
+    bool failed;
+} expressionCompiler_t;
+
+static void compileOr(expressionCompiler_t *compiler);
+
+static void compileError(expressionCompiler_t *compiler, const char *format, ...)
+{
+    va_list args;
+    int used;
+
+    if (compiler->failed)
+        return;
+
+    compiler->failed = true;
+
+    if (!compiler->error || compiler->errorLen == 0)
+        return;
+
+    va_start(args, format);
+    used = vsnprintf(compiler->error, compiler->errorLen, format, args);
+    va_end(args);
+
+    if (used >= 0 && (size_t) used < compiler->errorLen) {
+        snprintf(compiler->error + used, compiler->errorLen - used, " (at character %d)", (int) (compiler->pos - compiler->text) + 1);
+    }
+}
+
+static int64_t applyOperator(expressionOpcode_e opcode, int64_t left, int64_t right)
+{
+    switch (opcode) {
+        case OP_ADD:
+            return (int64_t) ((uint64_t) left + (uint64_t) right);
+        case OP_SUBTRACT:
+            return (int64_t) ((uint64_t) left - (uint64_t) right);
+        case OP_MULTIPLY:
+            return (int64_t) ((uint64_t) left * (uint64_t) right);
+        case OP_DIVIDE:
+            if (right == 0)
+                return 0;
+            if (right == -1)
+                return (int64_t) (0 - (uint64_t) left);
+            return left / right;
+        case OP_MODULO:
+            if (right == 0 || right == -1)
+                return 0;
+            return left % right;
+        case OP_MIN:
+            return left < right ? left : right;
+        case OP_MAX:
+            return left > right ? left : right;
+        case OP_LT:
+            return left < right;
+        case OP_LE:
+            return left <= right;
+        case OP_GT:
+            return left > right;
+        case OP_GE:
+            return left >= right;
+        case OP_EQ:
+            return left == right;
+        case OP_NE:
+            return left != right;
+        case OP_NEGATE:
+            return (int64_t) (0 - (uint64_t) right);
+        case OP_NOT:
+            return !right;
+        case OP_ABS:
+            return right < 0 ? (int64_t) (0 - (uint64_t) right) : right;
+        case OP_BOOL:
+            return right != 0;
+        default:
+            return 0;
+    }
+}
+
+static expressionInstruction_t* emit(expressionCompiler_t *compiler, expressionOpcode_e opcode, int32_t operand, int64_t value)
+{
+    expression_t *expression = compiler->expression;
+    expressionInstruction_t *instruction;
+
+    if (expression->length == expression->capacity) {
+        expression->capacity = expression->capacity ? expression->capacity * 2 : 16;
+        expression->code = (expressionInstruction_t *) realloc(expression->code, expression->capacity * sizeof(*expression->code));
+    }
+
+    instruction = &expression->code[expression->length++];
+
+    instruction->opcode = opcode;
+    instruction->operand = operand;
+    instruction->value = value;
+
+    return instruction;
+}
+
+static void emitPush(expressionCompiler_t *compiler, expressionOpcode_e opcode, int32_t operand, int64_t value)
+{
+    if (compiler->depth == EXPRESSION_MAX_DEPTH) {
+        compileError(compiler, "Filter expression is too deeply nested");
+        return;
+    }
+
+    emit(compiler, opcode, operand, value);
+    compiler->depth++;
+}
+
+/**
+ * Get the instruction `back` places from the end of the program, or NULL if there isn't one.
+ */
+static expressionInstruction_t* lastInstruction(expressionCompiler_t *compiler, int back)
+{
+    expression_t *expression = compiler->expression;
+
+    return expression->length > back ? &expression->code[expression->length - 1 - back] : NULL;
+}
+
+static void emitUnary(expressionCompiler_t *compiler, expressionOpcode_e opcode)
+{
+    expressionInstruction_t *operand = lastInstruction(compiler, 0);
+
+    if (operand && operand->opcode == OP_CONST) {
+        operand->value = applyOperator(opcode, 0, operand->value);
+    } else {
+        emit(compiler, opcode, 0, 0);
+    }
+}
+
+static void emitBinary(expressionCompiler_t *compiler, expressionOpcode_e opcode)
+{
+    expressionInstruction_t *left = lastInstruction(compiler, 1);
+    expressionInstruction_t *right = lastInstruction(compiler, 0);
+    bool isComparison = opcode >= OP_LT && opcode <= OP_NE;
+
+    compiler->depth--;
+
+    /*
+     * Jumps only ever target the OP_BOOL that ends a "&&"/"||", so the last two instructions are always run one after
+     * the other and it's safe to merge them.
+     */
+    if (left && left->opcode == OP_CONST && right->opcode == OP_CONST) {
+        left->value = applyOperator(opcode, left->value, right->value);
+        compiler->expression->length--;
+    } else if (isComparison && left && left->opcode == OP_FIELD && right->opcode == OP_CONST) {
+        left->opcode = OP_FIELD_LT + (opcode - OP_LT);
+        left->value = right->value;
+        compiler->expression->length--;
+    } else if (isComparison && left && left->opcode == OP_CONST && right->opcode == OP_FIELD) {
+        // "1900 < motor[0]" is "motor[0] > 1900"
+        static const expressionOpcode_e mirrored[] = {OP_FIELD_GT, OP_FIELD_GE, OP_FIELD_LT, OP_FIELD_LE, OP_FIELD_EQ, OP_FIELD_NE};
+
+        left->opcode = mirrored[opcode - OP_LT];
+        left->operand = right->operand;
+        compiler->expression->length--;
+    } else {
+        emit(compiler, opcode, 0, 0);
+    }
+}
+
+static void skipSpace(expressionCompiler_t *compiler)
+{
+    while (isspace((unsigned char) *compiler->pos))
+        compiler->pos++;
+}
+
+/**
+ * If the next token is `token`, consume it and return true.
+ */
+static bool acceptToken(expressionCompiler_t *compiler, const char *token)
+{
+    size_t len = strlen(token);
+
+    skipSpace(compiler);
+
+    if (strncmp(compiler->pos, token, len) == 0) {
+        compiler->pos += len;
+        return true;
+    }
+
+    return false;
+}
+
+static void expectToken(expressionCompiler_t *compiler, const char *token)
+{
+    if (!acceptToken(compiler, token)) {
+        compileError(compiler, "Expected '%s'", token);
+    }
+}
+
+static bool isIdentifierStart(char c)
+{
+    return isalpha((unsigned char) c) || c == '_';
+}
+
+static bool isIdentifierChar(char c)
+{
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+static void compileFunction(expressionCompiler_t *compiler, const char *name, int nameLen)
+{
+    static const struct {
+        const char *name;
+        int argumentCount;
+        expressionOpcode_e opcode;
+    } functions[] = {
+        {"abs", 1, OP_ABS},
+        {"min", 2, OP_MIN},
+        {"max", 2, OP_MAX}
+    };
+
+    for (unsigned int i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        if ((int) strlen(functions[i].name) == nameLen && strncmp(functions[i].name, name, nameLen) == 0) {
+            for (int argument = 0; argument < functions[i].argumentCount && !compiler->failed; argument++) {
+                if (argument > 0) {
+                    expectToken(compiler, ",");
+                }
+
+                compileOr(compiler);
+            }
+
+            expectToken(compiler, ")");
+
+            if (compiler->failed)
+                return;
+
+            if (functions[i].argumentCount == 1) {
+                emitUnary(compiler, functions[i].opcode);
+            } else {
+                emitBinary(compiler, functions[i].opcode);
+            }
+
+            return;
+        }
+    }
+
+    compileError(compiler, "Unknown function '%.*s'", nameLen, name);
+}
+
+static void compilePrimary(expressionCompiler_t *compiler)
+{
+    skipSpace(compiler);
+
+    if (isdigit((unsigned char) *compiler->pos)) {
+        bool hex = compiler->pos[0] == '0' && (compiler->pos[1] == 'x' || compiler->pos[1] == 'X');
+        char *end;
+        int64_t value;
+
+        errno = 0;
+        value = strtoll(compiler->pos, &end, hex ? 16 : 10);
+
+        if (isIdentifierChar(*end)) {
+            compileError(compiler, "Bad number");
+            return;
+        }
+
+        if (errno == ERANGE) {
+            compileError(compiler, "Number '%.*s' is too large", (int) (end - compiler->pos), compiler->pos);
+            return;
+        }
+
+        compiler->pos = end;
+        emitPush(compiler, OP_CONST, 0, value);
+    } else if (acceptToken(compiler, "(")) {
+        compileOr(compiler);
+        expectToken(compiler, ")");
+    } else if (isIdentifierStart(*compiler->pos)) {
+        const char *name = compiler->pos;
+        int nameLen;
+
+        while (isIdentifierChar(*compiler->pos))
+            compiler->pos++;
+
+        // Array fields like "motor[0]"
+        if (compiler->pos[0] == '[' && isdigit((unsigned char) compiler->pos[1])) {
+            const char *end = compiler->pos + 1;
+
+            while (isdigit((unsigned char) *end))
+                end++;
+
+            if (*end == ']') {
+                compiler->pos = end + 1;
+            }
+        }
+
+        nameLen = compiler->pos - name;
+
+        if (acceptToken(compiler, "(")) {
+            compileFunction(compiler, name, nameLen);
+            return;
+        }
+
+        for (int i = 0; i < compiler->fieldCount; i++) {
+            if (compiler->fieldNames[i] && (int) strlen(compiler->fieldNames[i]) == nameLen && strncmp(compiler->fieldNames[i], name, nameLen) == 0) {
+                emitPush(compiler, OP_FIELD, i, 0);
+                return;
+            }
+        }
+
+        compiler->pos = name;
+        compileError(compiler, "Unknown field '%.*s'", nameLen, name);
+    } else if (*compiler->pos) {
+        compileError(compiler, "Unexpected '%c'", *compiler->pos);
+    } else {
+        compileError(compiler, "Unexpected end of filter expression");
+    }
+}
+
+static void compileUnary(expressionCompiler_t *compiler)
+{
+    if (acceptToken(compiler, "-")) {
+        compileUnary(compiler);
+        emitUnary(compiler, OP_NEGATE);
+    } else if (acceptToken(compiler, "!") ) {
+        compileUnary(compiler);
+        emitUnary(compiler, OP_NOT);
+    } else {
+        compilePrimary(compiler);
+    }
+}
+
+static void compileProduct(expressionCompiler_t *compiler)
+{
+    compileUnary(compiler);
+
+    while (!compiler->failed) {
+        expressionOpcode_e opcode;
+
+        if (acceptToken(compiler, "*")) {
+            opcode = OP_MULTIPLY;
+        } else if (acceptToken(compiler, "/")) {
+            opcode = OP_DIVIDE;
+        } else if (acceptToken(compiler, "%")) {
+            opcode = OP_MODULO;
+        } else {
+            break;
+        }
+
+        compileUnary(compiler);
+        emitBinary(compiler, opcode);
+    }
+}
+
+static void compileSum(expressionCompiler_t *compiler)
+{
+    compileProduct(compiler);
+
+    while (!compiler->failed) {
+        expressionOpcode_e opcode;
+
+        if (acceptToken(compiler, "+")) {
+            opcode = OP_ADD;
+        } else if (acceptToken(compiler, "-")) {
+            opcode = OP_SUBTRACT;
+        } else {
+            break;
+        }
+
+        compileProduct(compiler);
+        emitBinary(compiler, opcode);
+    }
+}
+
+static void compileComparison(expressionCompiler_t *compiler)
+{
+    static const struct {
+        const char *symbol;
+        expressionOpcode_e opcode;
+    } comparisons[] = {
+        // Longer operators must come first so that "<=" isn't taken as "<"
+        {"<=", OP_LE}, {">=", OP_GE}, {"==", OP_EQ}, {"!=", OP_NE}, {"<", OP_LT}, {">", OP_GT}
+    };
+
+    compileSum(compiler);
+
+    if (compiler->failed)
+        return;
+
+    for (unsigned int i = 0; i < sizeof(comparisons) / sizeof(comparisons[0]); i++) {
+        if (acceptToken(compiler, comparisons[i].symbol)) {
+            compileSum(compiler);
+            emitBinary(compiler, comparisons[i].opcode);
+            return;
+        }
+    }
+}
+
+/**
+ * Compile a chain of `operand`s joined by the short-circuiting operator `token`.
+ */
+static void compileLogical(expressionCompiler_t *compiler, const char *token, expressionOpcode_e jumpOpcode,
+    void (*compileOperand)(expressionCompiler_t *compiler))
+{
+    compileOperand(compiler);
+
+    while (!compiler->failed && acceptToken(compiler, token)) {
+        int jump = compiler->expression->length;
+
+        emit(compiler, jumpOpcode, 0, 0);
+        compiler->depth--;
+
+        compileOperand(compiler);
+
+        // Both the jump and the right-hand side land here, to turn the result into a 0 or 1
+        compiler->expression->code[jump].operand = compiler->expression->length;
+        emit(compiler, OP_BOOL, 0, 0);
+    }
+}
+
+static void compileAnd(expressionCompiler_t *compiler)
+{
+    compileLogical(compiler, "&&", OP_JUMP_IF_FALSE, compileComparison);
+}
+
+static void compileOr(expressionCompiler_t *compiler)
+{
+    compileLogical(compiler, "||", OP_JUMP_IF_TRUE, compileAnd);
+}
+
+/**
+ * Compile the expression `text`, where fields are referred to by the names in `fieldNames` and are then read from the
+ * same index in the frame.
+ *
+ * Returns NULL if the expression couldn't be compiled, and if `error` is non-NULL, a description of the problem is
+ * written there.
+ */
+expression_t* expressionCompile(const char *text, const char *const *fieldNames, int fieldCount, char *error, size_t errorLen)
+{
+    expressionCompiler_t compiler;
+
+    memset(&compiler, 0, sizeof(compiler));
+
+    compiler.text = text;
+    compiler.pos = text;
+    compiler.fieldNames = fieldNames;
+    compiler.fieldCount = fieldCount;
+    compiler.error = error;
+    compiler.errorLen = errorLen;
+    compiler.expression = (expression_t *) calloc(1, sizeof(*compiler.expression));
+
+    compileOr(&compiler);
+
+    skipSpace(&compiler);
+
+    if (!compiler.failed && *compiler.pos) {
+        compileError(&compiler, "Unexpected '%c'", *compiler.pos);
+    }
+
+    if (compiler.failed) {
+        expressionDestroy(compiler.expression);
+        return NULL;
+    }
+
+    return compiler.expression;
+}
+
+/**
+ * Run the compiled expression against the given frame and return its value.
+ */
+int64_t expressionEvaluate(const expression_t *expression, const int64_t *frame)
+{
+    int64_t stack[EXPRESSION_MAX_DEPTH];
+    int top = -1;
+    const expressionInstruction_t *code = expression->code;
+    const expressionInstruction_t *instruction = code, *end = code + expression->length;
+
+    while (instruction < end) {
+        switch (instruction->opcode) {
+            case OP_CONST:
+                stack[++top] = instruction->value;
+            break;
+            case OP_FIELD:
+                stack[++top] = frame[instruction->operand];
+            break;
+            case OP_FIELD_LT:
+                stack[++top] = frame[instruction->operand] < instruction->value;
+            break;
+            case OP_FIELD_LE:
+                stack[++top] = frame[instruction->operand] <= instruction->value;
+            break;
+            case OP_FIELD_GT:
+                stack[++top] = frame[instruction->operand] > instruction->value;
+            break;
+            case OP_FIELD_GE:
+                stack[++top] = frame[instruction->operand] >= instruction->value;
+            break;
+            case OP_FIELD_EQ:
+                stack[++top] = frame[instruction->operand] == instruction->value;
+            break;
+            case OP_FIELD_NE:
+                stack[++top] = frame[instruction->operand] != instruction->value;
+            break;
+            case OP_JUMP_IF_FALSE:
+                if (stack[top] == 0) {
+                    instruction = code + instruction->operand;
+                    continue;
+                }
+                top--;
+            break;
+            case OP_JUMP_IF_TRUE:
+                if (stack[top] != 0) {
+                    instruction = code + instruction->operand;
+                    continue;
+                }
+                top--;
+            break;
+            case OP_NEGATE:
+            case OP_NOT:
+            case OP_ABS:
+            case OP_BOOL:
+                stack[top] = applyOperator(instruction->opcode, 0, stack[top]);
+            break;
+            default:
+                stack[top - 1] = applyOperator(instruction->opcode, stack[top - 1], stack[top]);
+                top--;
+        }
+
+        instruction++;
+    }
+
+    return stack[0];
+}
+
+/**
+ * Check if the frame satisfies the expression (i.e. the expression is non-zero for it).
+ */
+bool expressionMatches(const expression_t *expression, const int64_t *frame)
+{
+    return expressionEvaluate(expression, frame) != 0;
+}
+
+void expressionDestroy(expression_t *expression)
+{
+    if (!expression)
+        return;
+
+    free(expression->code);
+    free(expression);
+}
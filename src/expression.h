@@ -0,0 +1,15 @@
+#ifndef EXPRESSION_H_
+#define EXPRESSION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct expression_t expression_t;
+
+expression_t* expressionCompile(const char *text, const char *const *fieldNames, int fieldCount, char *error, size_t errorLen);
+int64_t expressionEvaluate(const expression_t *expression, const int64_t *frame);
+bool expressionMatches(const expression_t *expression, const int64_t *frame);
+void expressionDestroy(expression_t *expression);
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ * A radix-2 fast Fourier transform for power-of-two sizes.
+ *
+ * The complex data is kept in separate arrays of real and imaginary parts, and the twiddle factors for each stage are
+ * stored contiguously, so that the butterflies in each stage are a simple loop over consecutive elements which the
+ * compiler can turn into SIMD instructions.
+ */
+#include <stdlib.h>
+#include <math.h>
+
+#include "fft.h"
+
+#ifndef M_PI
+    #define M_PI 3.14159265358979323846
+#endif
+
+struct fftPlan_t {
+    int size;
+
+    // The index each element is swapped with to put the input into bit-reversed order (or itself)
+    int *bitReverse;
+
+    /*
+     * Twiddle factors for every stage: the stage whose butterflies span `half` elements uses the `half` factors which
+     * begin at index `half`.
+     */
+    float *twiddleRe, *twiddleIm;
+};
+
+bool fftSizeIsValid(int size)
+{
+    return size >= 4 && (size & (size - 1)) == 0;
+}
+
+/**
+ * Create a plan for transforms of the given size, which must be a power of two (and at least 4).
+ */
+fftPlan_t* fftPlanCreate(int size)
+{
+    fftPlan_t *plan;
+    int bits = 0;
+
+    if (!fftSizeIsValid(size))
+        return NULL;
+
+    plan = (fftPlan_t *) malloc(sizeof(*plan));
+
+    plan->size = size;
+    plan->bitReverse = (int *) malloc(size * sizeof(*plan->bitReverse));
+    plan->twiddleRe = (float *) malloc(size * sizeof(*plan->twiddleRe));
+    plan->twiddleIm = (float *) malloc(size * sizeof(*plan->twiddleIm));
+
+    while ((1 << bits) < size) {
+        bits++;
+    }
+
+    for (int i = 0; i < size; i++) {
+        int reversed = 0;
+
+        for (int bit = 0; bit < bits; bit++) {
+            if (i & (1 << bit)) {
+                reversed |= 1 << (bits - 1 - bit);
+            }
+        }
+
+        plan->bitReverse[i] = reversed;
+    }
+
+    for (int half = 1; half < size; half *= 2) {
+        for (int j = 0; j < half; j++) {
+            double angle = -M_PI * j / half;
+
+            plan->twiddleRe[half + j] = (float) cos(angle);
+            plan->twiddleIm[half + j] = (float) sin(angle);
+        }
+    }
+
+    return plan;
+}
+
+void fftPlanDestroy(fftPlan_t *plan)
+{
+    if (!plan)
+        return;
+
+    free(plan->bitReverse);
+    free(plan->twiddleRe);
+    free(plan->twiddleIm);
+    free(plan);
+}
+
+int fftPlanGetSize(const fftPlan_t *plan)
+{
+    return plan->size;
+}
+
+static void fftButterflies(float * restrict re0, float * restrict im0, float * restrict re1, float * restrict im1,
+    const float * restrict twiddleRe, const float * restrict twiddleIm, int count)
+{
+    for (int j = 0; j < count; j++) {
+        float tRe = re1[j] * twiddleRe[j] - im1[j] * twiddleIm[j];
+        float tIm = re1[j] * twiddleIm[j] + im1[j] * twiddleRe[j];
+
+        re1[j] = re0[j] - tRe;
+        im1[j] = im0[j] - tIm;
+        re0[j] += tRe;
+        im0[j] += tIm;
+    }
+}
+
+/**
+ * Replace the complex sequence in `re` and `im` with its discrete Fourier transform (unnormalised, with a negative
+ * exponent).
+ */
+void fftTransform(const fftPlan_t *plan, float *re, float *im)
+{
+    int size = plan->size;
+
+    for (int i = 0; i < size; i++) {
+        int j = plan->bitReverse[i];
+
+        if (j > i) {
+            float temp = re[i];
+            re[i] = re[j];
+            re[j] = temp;
+
+            temp = im[i];
+            im[i] = im[j];
+            im[j] = temp;
+        }
+    }
+
+    // The first two stages have trivial twiddle factors and too few butterflies per group to be worth vectorizing
+    for (int i = 0; i < size; i += 4) {
+        float aRe = re[i] + re[i + 1], aIm = im[i] + im[i + 1];
+        float bRe = re[i] - re[i + 1], bIm = im[i] - im[i + 1];
+        float cRe = re[i + 2] + re[i + 3], cIm = im[i + 2] + im[i + 3];
+        // The difference of the second pair, multiplied by the twiddle factor -i
+        float dRe = im[i + 2] - im[i + 3], dIm = re[i + 3] - re[i + 2];
+
+        re[i] = aRe + cRe;
+        im[i] = aIm + cIm;
+        re[i + 1] = bRe + dRe;
+        im[i + 1] = bIm + dIm;
+        re[i + 2] = aRe - cRe;
+        im[i + 2] = aIm - cIm;
+        re[i + 3] = bRe - dRe;
+        im[i + 3] = bIm - dIm;
+    }
+
+    for (int half = 4; half < size; half *= 2) {
+        for (int group = 0; group < size; group += half * 2) {
+            fftButterflies(re + group, im + group, re + group + half, im + group + half,
+                plan->twiddleRe + half, plan->twiddleIm + half, half);
+        }
+    }
+}
+
+/**
+ * Compute the power spectra (|X[k]|^2 for k = 0 to size / 2) of two real sequences at once, by transforming them as
+ * the real and imaginary parts of one complex sequence.
+ *
+ * On entry `re` and `im` hold the two sequences. They're used as scratch space, and each power array receives
+ * size / 2 + 1 values.
+ */
+void fftRealPairPower(const fftPlan_t *plan, float *re, float *im, float *powerA, float *powerB)
+{
+    int size = plan->size;
+
+    fftTransform(plan, re, im);
+
+    // The transform of the real part is the conjugate-symmetric half of Z, and the imaginary part the antisymmetric half
+    for (int k = 0; k <= size / 2; k++) {
+        int mirror = (size - k) & (size - 1);
+
+        float aRe = (re[k] + re[mirror]) / 2, aIm = (im[k] - im[mirror]) / 2;
+        float bRe = (im[k] + im[mirror]) / 2, bIm = (re[mirror] - re[k]) / 2;
+
+        powerA[k] = aRe * aRe + aIm * aIm;
+        powerB[k] = bRe * bRe + bIm * bIm;
+    }
+}
+
+/**
+ * Compute the spectra (X[k] for k = 0 to size / 2) of two real sequences at once, like fftRealPairPower().
+ *
+ * On entry `re` and `im` hold the two sequences, and they're used as scratch space. Each of the output arrays receives
+ * size / 2 + 1 values.
+ */
+void fftRealPairTransform(const fftPlan_t *plan, float *re, float *im, float *aRe, float *aIm, float *bRe, float *bIm)
+{
+    int size = plan->size;
+
+    fftTransform(plan, re, im);
+
+    for (int k = 0; k <= size / 2; k++) {
+        int mirror = (size - k) & (size - 1);
+
+        aRe[k] = (re[k] + re[mirror]) / 2;
+        aIm[k] = (im[k] - im[mirror]) / 2;
+        bRe[k] = (im[k] + im[mirror]) / 2;
+        bIm[k] = (re[mirror] - re[k]) / 2;
+    }
+}
+
+/**
+ * Replace the spectrum in `re` and `im` with its inverse discrete Fourier transform (normalised, so that it undoes
+ * fftTransform()).
+ */
+void fftInverseTransform(const fftPlan_t *plan, float *re, float *im)
+{
+    int size = plan->size;
+    float scale = 1.0f / size;
+
+    // Swapping the real and imaginary parts conjugates the sequence (up to a factor of i), which turns the forward
+    // transform into the inverse one
+    fftTransform(plan, im, re);
+
+    for (int i = 0; i < size; i++) {
+        re[i] *= scale;
+        im[i] *= scale;
+    }
+}
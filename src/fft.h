@@ -0,0 +1,19 @@
+#ifndef FFT_H_
+#define FFT_H_
+
+#include <stdbool.h>
+
+typedef struct fftPlan_t fftPlan_t;
+
+bool fftSizeIsValid(int size);
+
+fftPlan_t* fftPlanCreate(int size);
+void fftPlanDestroy(fftPlan_t *plan);
+int fftPlanGetSize(const fftPlan_t *plan);
+
+void fftTransform(const fftPlan_t *plan, float *re, float *im);
+void fftRealPairPower(const fftPlan_t *plan, float *re, float *im, float *powerA, float *powerB);
+void fftRealPairTransform(const fftPlan_t *plan, float *re, float *im, float *aRe, float *aIm, float *bRe, float *bIm);
+void fftInverseTransform(const fftPlan_t *plan, float *re, float *im);
+
+#endif
@@ -0,0 +1,215 @@
+/**
+ * A pool of worker threads that format blocks of data into text in parallel, while the text is written to the
+ * destination stream in the same order that the blocks were submitted. A pool without a destination runs blocks of
+ * other work in parallel, and its optional collect callback gathers their results in submission order.
+ *
+ * The producer fills a ring of block slots in order. Slot i is always formatted by worker (i % threads), so each
+ * worker simply works through its own slots in order and no shared work queue is needed. When the producer comes
+ * back around to a slot that is still in flight, it waits for that slot's worker to finish and then writes the
+ * slot's text out, which keeps the output in submission order.
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "platform.h"
+#include "formatpool.h"
+
+// How many blocks each worker can have queued up or in progress at once
+#define FORMAT_POOL_BLOCKS_PER_THREAD 2
+
+typedef struct formatPoolSlot_t {
+    void *block;
+    outputStream_t *text;
+
+    // Signalled by the worker once it has finished formatting this slot
+    semaphore_t done;
+
+    // Only touched by the producer
+    bool inFlight;
+} formatPoolSlot_t;
+
+typedef struct formatPoolWorker_t {
+    struct formatPool_t *pool;
+    int index;
+
+    semaphore_t workAvailable;
+} formatPoolWorker_t;
+
+struct formatPool_t {
+    int threads;
+    int slotCount;
+
+    formatPoolSlot_t *slots;
+    formatPoolWorker_t *workers;
+
+    // The slot the producer will fill next (this is also the oldest slot that could still be in flight)
+    int nextSlot;
+
+    formatPoolWork_t work;
+    formatPoolCollect_t collect;
+    void *context;
+    outputStream_t *destination;
+
+    bool shuttingDown;
+    semaphore_t workerExited;
+};
+
+static void* formatPoolWorkerThread(void *arg)
+{
+    formatPoolWorker_t *worker = (formatPoolWorker_t *) arg;
+    formatPool_t *pool = worker->pool;
+    int slotIndex = worker->index;
+
+    while (1) {
+        formatPoolSlot_t *slot;
+
+        semaphore_wait(&worker->workAvailable);
+
+        if (pool->shuttingDown)
+            break;
+
+        slot = &pool->slots[slotIndex];
+
+        pool->work(pool->context, slot->block, slot->text);
+
+        semaphore_signal(&slot->done);
+
+        slotIndex = (slotIndex + pool->threads) % pool->slotCount;
+    }
+
+    semaphore_signal(&pool->workerExited);
+
+    return 0;
+}
+
+/**
+ * Wait for the given slot to be formatted (if it's in flight), then collect it and write its text to the destination.
+ */
+static void formatPoolRetire(formatPool_t *pool, formatPoolSlot_t *slot)
+{
+    if (slot->inFlight) {
+        semaphore_wait(&slot->done);
+
+        if (pool->collect) {
+            pool->collect(pool->context, slot->block);
+        }
+
+        if (pool->destination) {
+            outputStreamTransfer(pool->destination, slot->text);
+        }
+
+        slot->inFlight = false;
+    }
+}
+
+/**
+ * Create a pool of `threads` workers which call `work` to format blocks of `blockSize` bytes, and write the
+ * resulting text to `destination` in order. `collect` and `destination` may be NULL.
+ */
+formatPool_t* formatPoolCreate(int threads, size_t blockSize, formatPoolWork_t work, formatPoolCollect_t collect, void *context,
+    outputStream_t *destination)
+{
+    formatPool_t *pool = (formatPool_t *) calloc(1, sizeof(*pool));
+
+    pool->threads = threads;
+    pool->slotCount = threads * FORMAT_POOL_BLOCKS_PER_THREAD;
+    pool->work = work;
+    pool->collect = collect;
+    pool->context = context;
+    pool->destination = destination;
+
+    pool->slots = (formatPoolSlot_t *) calloc(pool->slotCount, sizeof(*pool->slots));
+
+    for (int i = 0; i < pool->slotCount; i++) {
+        pool->slots[i].block = calloc(1, blockSize);
+        pool->slots[i].text = destination ? outputStreamCreateMemory() : NULL;
+
+        semaphore_create(&pool->slots[i].done, 0);
+    }
+
+    semaphore_create(&pool->workerExited, 0);
+
+    pool->workers = (formatPoolWorker_t *) calloc(threads, sizeof(*pool->workers));
+
+    for (int i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+
+        semaphore_create(&pool->workers[i].workAvailable, 0);
+
+        thread_create_detached(formatPoolWorkerThread, &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+/**
+ * Get the next block for the producer to fill. Its contents are whatever was left there by the last time the
+ * block was used.
+ */
+void* formatPoolAcquire(formatPool_t *pool)
+{
+    formatPoolSlot_t *slot = &pool->slots[pool->nextSlot];
+
+    formatPoolRetire(pool, slot);
+
+    return slot->block;
+}
+
+/**
+ * Hand the block returned by the last formatPoolAcquire() call over to its worker to be formatted.
+ */
+void formatPoolSubmit(formatPool_t *pool)
+{
+    formatPoolSlot_t *slot = &pool->slots[pool->nextSlot];
+
+    slot->inFlight = true;
+
+    semaphore_signal(&pool->workers[pool->nextSlot % pool->threads].workAvailable);
+
+    pool->nextSlot = (pool->nextSlot + 1) % pool->slotCount;
+}
+
+/**
+ * Wait for all submitted blocks to be formatted, collected and written to the destination.
+ */
+void formatPoolFlush(formatPool_t *pool)
+{
+    for (int i = 0; i < pool->slotCount; i++) {
+        formatPoolRetire(pool, &pool->slots[(pool->nextSlot + i) % pool->slotCount]);
+    }
+}
+
+void formatPoolDestroy(formatPool_t *pool)
+{
+    if (!pool)
+        return;
+
+    formatPoolFlush(pool);
+
+    pool->shuttingDown = true;
+
+    for (int i = 0; i < pool->threads; i++) {
+        semaphore_signal(&pool->workers[i].workAvailable);
+    }
+
+    for (int i = 0; i < pool->threads; i++) {
+        semaphore_wait(&pool->workerExited);
+    }
+
+    for (int i = 0; i < pool->threads; i++) {
+        semaphore_destroy(&pool->workers[i].workAvailable);
+    }
+
+    for (int i = 0; i < pool->slotCount; i++) {
+        free(pool->slots[i].block);
+        outputStreamClose(pool->slots[i].text, NULL);
+        semaphore_destroy(&pool->slots[i].done);
+    }
+
+    semaphore_destroy(&pool->workerExited);
+
+    free(pool->workers);
+    free(pool->slots);
+    free(pool);
+}
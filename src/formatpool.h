@@ -0,0 +1,29 @@
+#ifndef FORMATPOOL_H_
+#define FORMATPOOL_H_
+
+#include <stddef.h>
+
+#include "outputstream.h"
+
+/**
+ * Format the given block of work as text into `output` (a memory stream, or NULL if the pool has no destination).
+ * Called on a worker thread.
+ */
+typedef void (*formatPoolWork_t)(void *context, void *block, outputStream_t *output);
+
+/**
+ * Called on the producer's thread for each block once it has been worked on, in the order that the blocks were
+ * submitted, e.g. to add up results that the blocks computed.
+ */
+typedef void (*formatPoolCollect_t)(void *context, void *block);
+
+typedef struct formatPool_t formatPool_t;
+
+formatPool_t* formatPoolCreate(int threads, size_t blockSize, formatPoolWork_t work, formatPoolCollect_t collect, void *context,
+    outputStream_t *destination);
+void* formatPoolAcquire(formatPool_t *pool);
+void formatPoolSubmit(formatPool_t *pool);
+void formatPoolFlush(formatPool_t *pool);
+void formatPoolDestroy(formatPool_t *pool);
+
+#endif
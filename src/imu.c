@@ -2,6 +2,8 @@
  * This IMU code is used for attitude estimation, and is directly derived from Baseflight's imu.c.
  */
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 //For msvcrt to define M_PI:
 #define _USE_MATH_DEFINES
@@ -30,44 +32,46 @@ typedef enum {
 
 //Settings that would normally be set by the user in MW config:
 static const uint16_t gyro_cmpf_factor = 600;
-static const float accz_lpf_cutoff = 5.0f;
 static const uint16_t gyro_cmpfm_factor = 250;
-static float magneticDeclination = 0.0f;
 
-//IMU fields:
-static float fc_acc;
-static float invGyroComplimentaryFilter_M_Factor;
+#define INV_GYR_CMPF_FACTOR   (1.0f / ((float)gyro_cmpf_factor + 1.0f))
+#define INV_GYR_CMPFM_FACTOR  (1.0f / ((float)gyro_cmpfm_factor + 1.0f))
 
-static t_fp_vector EstM;
-static t_fp_vector EstN;
-static uint32_t previousTime;
+/*
+ * Up to this angle (in radians) the sine and cosine of the gyro's rotation in each frame are computed from their Taylor
+ * series, which is then as accurate as sinf()/cosf() in single precision. Even a 2000 deg/s rotation only turns the
+ * craft by 0.035 radians between frames at 1kHz, so the library functions are almost never needed.
+ */
+#define IMU_SMALL_ANGLE 0.25f
 
 /**
- * Call before any other routines in order to set up IMU constants and such.
+ * Call before any other routines in order to set up the IMU's state for a new log.
  */
-void imuInit(void)
+void imuStateInit(imuState_t *state)
 {
-    fc_acc = (float) (0.5f / (M_PI * accz_lpf_cutoff)); // calculate RC time constant used in the accZ lpf
-    invGyroComplimentaryFilter_M_Factor = (1.0f / (gyro_cmpfm_factor + 1.0f));
+    state->EstG.V.X = 0.0f;
+    state->EstG.V.Y = 0.0f;
+    state->EstG.V.Z = 0.0f;
 
-    EstM.V.X = 1.0f;
-    EstM.V.Y = 0.0f;
-    EstM.V.Z = 0.0f;
+    state->EstM.V.X = 1.0f;
+    state->EstM.V.Y = 0.0f;
+    state->EstM.V.Z = 0.0f;
 
-    EstN.V.X = 1.0f;
-    EstN.V.Y = 0.0f;
-    EstN.V.Z = 0.0f;
+    state->EstN.V.X = 1.0f;
+    state->EstN.V.Y = 0.0f;
+    state->EstN.V.Z = 0.0f;
 
-    previousTime = 0;
+    state->previousTime = 0;
+    state->magneticDeclination = 0.0f;
 }
 
 /**
  * Set the magnetic declination in decimal degrees.
  */
-void imuSetMagneticDeclination(double declination)
+void imuStateSetMagneticDeclination(imuState_t *state, double declination)
 {
     //Convert to radians now so we don't have to later on
-    magneticDeclination = (float) (declination * RAD);
+    state->magneticDeclination = (float) (declination * RAD);
 }
 
 // **************************************************
@@ -84,10 +88,6 @@ void imuSetMagneticDeclination(double declination)
 //
 // **************************************************
 
-#define INV_GYR_CMPF_FACTOR   (1.0f / ((float)gyro_cmpf_factor + 1.0f))
-
-static t_fp_vector EstG;
-
 static void normalizeVector(struct fp_vector *src, struct fp_vector *dest)
 {
     float length;
@@ -100,26 +100,33 @@ static void normalizeVector(struct fp_vector *src, struct fp_vector *dest)
     }
 }
 
-static void rotateVector(struct fp_vector *v, float *delta)
+/**
+ * The Taylor series of sine and cosine, accurate for angles up to IMU_SMALL_ANGLE.
+ */
+static inline float smallAngleSin(float x)
 {
-    struct fp_vector v_tmp = *v;
+    float x2 = x * x;
 
-    // This does a  "proper" matrix rotation using gyro deltas without small-angle approximation
-    float mat[3][3];
-    float cosx, sinx, cosy, siny, cosz, sinz;
-    float coszcosx, sinzcosx, coszsinx, sinzsinx;
+    return x * (1.0f - x2 / 6.0f * (1.0f - x2 / 20.0f * (1.0f - x2 / 42.0f)));
+}
+
+static inline float smallAngleCos(float x)
+{
+    float x2 = x * x;
+
+    return 1.0f - x2 / 2.0f * (1.0f - x2 / 12.0f * (1.0f - x2 / 30.0f * (1.0f - x2 / 56.0f)));
+}
 
-    cosx = cosf(delta[ROLL]);
-    sinx = sinf(delta[ROLL]);
-    cosy = cosf(delta[PITCH]);
-    siny = sinf(delta[PITCH]);
-    cosz = cosf(delta[YAW]);
-    sinz = sinf(delta[YAW]);
+static void rotationMatrix(const float sine[3], const float cosine[3], float mat[3][3])
+{
+    float cosx = cosine[ROLL], sinx = sine[ROLL];
+    float cosy = cosine[PITCH], siny = sine[PITCH];
+    float cosz = cosine[YAW], sinz = sine[YAW];
 
-    coszcosx = cosz * cosx;
-    sinzcosx = sinz * cosx;
-    coszsinx = sinx * cosz;
-    sinzsinx = sinx * sinz;
+    float coszcosx = cosz * cosx;
+    float sinzcosx = sinz * cosx;
+    float coszsinx = sinx * cosz;
+    float sinzsinx = sinx * sinz;
 
     mat[0][0] = cosz * cosy;
     mat[0][1] = -cosy * sinz;
@@ -130,12 +137,32 @@ static void rotateVector(struct fp_vector *v, float *delta)
     mat[2][0] = (sinzsinx) - (coszcosx * siny);
     mat[2][1] = (coszsinx) + (sinzcosx * siny);
     mat[2][2] = cosy * cosx;
+}
+
+static void rotateVectorByMatrix(struct fp_vector *v, float mat[3][3])
+{
+    struct fp_vector v_tmp = *v;
 
     v->X = v_tmp.X * mat[0][0] + v_tmp.Y * mat[1][0] + v_tmp.Z * mat[2][0];
     v->Y = v_tmp.X * mat[0][1] + v_tmp.Y * mat[1][1] + v_tmp.Z * mat[2][1];
     v->Z = v_tmp.X * mat[0][2] + v_tmp.Y * mat[1][2] + v_tmp.Z * mat[2][2];
 }
 
+static void rotateVector(struct fp_vector *v, float *delta)
+{
+    // This does a  "proper" matrix rotation using gyro deltas without small-angle approximation
+    float mat[3][3];
+    float sine[3], cosine[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+        sine[axis] = sinf(delta[axis]);
+        cosine[axis] = cosf(delta[axis]);
+    }
+
+    rotationMatrix(sine, cosine, mat);
+    rotateVectorByMatrix(v, mat);
+}
+
 t_fp_vector calculateAccelerationInEarthFrame(int16_t accSmooth[3], attitude_t *attitude, uint16_t acc_1G)
 {
     float rpy[3];
@@ -158,7 +185,7 @@ t_fp_vector calculateAccelerationInEarthFrame(int16_t accSmooth[3], attitude_t *
 }
 
 // baseflight calculation by Luggi09 originates from arducopter
-static float calculateHeading(t_fp_vector *vec, float angleradRoll, float angleradPitch)
+static float calculateHeading(t_fp_vector *vec, float angleradRoll, float angleradPitch, float magneticDeclination)
 {
     float cosineRoll = cosf(angleradRoll);
     float sineRoll = sinf(angleradRoll);
@@ -174,53 +201,155 @@ static float calculateHeading(t_fp_vector *vec, float angleradRoll, float angler
     return hd;
 }
 
-void updateEstimatedAttitude(int16_t gyroADC[3], int16_t accSmooth[3], int16_t magADC[3], uint32_t currentTime, uint16_t acc_1G, float gyroScale, attitude_t *attitude)
+/**
+ * The part of the attitude update which follows the gyro integration: rotate the estimated vectors by this frame's
+ * rotation matrix, then correct them with the accelerometer and magnetometer.
+ */
+static void imuApplyFrame(imuState_t *state, float mat[3][3], const int16_t accSmooth[3], const int16_t magADC[3], uint16_t acc_1G, attitude_t *attitude)
 {
     int32_t accMag = 0;
-    uint32_t deltaTime;
-    float scale, deltaGyroAngle[3];
-
-    if (previousTime == 0) {
-        deltaTime = 1;
-    } else {
-        deltaTime = currentTime - previousTime;
-    }
-
-    scale = deltaTime * gyroScale;
-    previousTime = currentTime;
 
-    // Initialization
     for (int axis = 0; axis < 3; axis++) {
-        deltaGyroAngle[axis] = gyroADC[axis] * scale;
-
         accMag += (int32_t)accSmooth[axis] * accSmooth[axis];
     }
     accMag = accMag * 100 / ((int32_t)acc_1G * acc_1G);
 
-    rotateVector(&EstG.V, deltaGyroAngle);
+    rotateVectorByMatrix(&state->EstG.V, mat);
 
     // Apply complimentary filter (Gyro drift correction)
     // If accel magnitude >1.15G or <0.85G and  ACC vector outside of the limit range => we neutralize the effect of accelerometers in the angle estimation.
     // To do that, we just skip filter, as Est V already rotated by Gyro
     if (72 < (uint16_t)accMag && (uint16_t)accMag < 133) {
         for (int axis = 0; axis < 3; axis++)
-            EstG.A[axis] = (EstG.A[axis] * (float)gyro_cmpf_factor + accSmooth[axis]) * INV_GYR_CMPF_FACTOR;
+            state->EstG.A[axis] = (state->EstG.A[axis] * (float)gyro_cmpf_factor + accSmooth[axis]) * INV_GYR_CMPF_FACTOR;
     }
 
     // Attitude of the estimated vector
-    attitude->roll = atan2f(EstG.V.Y, EstG.V.Z);
-    attitude->pitch = atan2f(-EstG.V.X, sqrtf(EstG.V.Y * EstG.V.Y + EstG.V.Z * EstG.V.Z));
+    attitude->roll = atan2f(state->EstG.V.Y, state->EstG.V.Z);
+    attitude->pitch = atan2f(-state->EstG.V.X, sqrtf(state->EstG.V.Y * state->EstG.V.Y + state->EstG.V.Z * state->EstG.V.Z));
 
     if (magADC) {
-        rotateVector(&EstM.V, deltaGyroAngle);
-        
+        rotateVectorByMatrix(&state->EstM.V, mat);
+
         for (int axis = 0; axis < 3; axis++) {
-            EstM.A[axis] = (EstM.A[axis] * gyro_cmpfm_factor + magADC[axis]) * invGyroComplimentaryFilter_M_Factor;
+            state->EstM.A[axis] = (state->EstM.A[axis] * gyro_cmpfm_factor + magADC[axis]) * INV_GYR_CMPFM_FACTOR;
         }
-        attitude->heading = calculateHeading(&EstM, attitude->roll, attitude->pitch);
+        attitude->heading = calculateHeading(&state->EstM, attitude->roll, attitude->pitch, state->magneticDeclination);
     } else {
-        rotateVector(&EstN.V, deltaGyroAngle);
-        normalizeVector(&EstN.V, &EstN.V);
-        attitude->heading = calculateHeading(&EstN, attitude->roll, attitude->pitch);
+        rotateVectorByMatrix(&state->EstN.V, mat);
+        normalizeVector(&state->EstN.V, &state->EstN.V);
+        attitude->heading = calculateHeading(&state->EstN, attitude->roll, attitude->pitch, state->magneticDeclination);
+    }
+}
+
+/**
+ * Update the estimated attitude with one frame's sensor readings. Pass NULL for magADC if there's no magnetometer.
+ */
+void imuUpdateAttitude(imuState_t *state, int16_t gyroADC[3], int16_t accSmooth[3], int16_t magADC[3], uint32_t currentTime, uint16_t acc_1G, float gyroScale, attitude_t *attitude)
+{
+    uint32_t deltaTime;
+    float scale, mat[3][3], sine[3], cosine[3];
+
+    if (state->previousTime == 0) {
+        deltaTime = 1;
+    } else {
+        deltaTime = currentTime - state->previousTime;
+    }
+
+    scale = deltaTime * gyroScale;
+    state->previousTime = currentTime;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float deltaGyroAngle = gyroADC[axis] * scale;
+
+        sine[axis] = sinf(deltaGyroAngle);
+        cosine[axis] = cosf(deltaGyroAngle);
+    }
+
+    rotationMatrix(sine, cosine, mat);
+
+    imuApplyFrame(state, mat, accSmooth, magADC, acc_1G, attitude);
+}
+
+/**
+ * Update the estimated attitude with `count` consecutive frames, writing the attitude after each frame to
+ * `attitudes`. This agrees with calling imuUpdateAttitude() for each frame in turn to within single-precision rounding,
+ * since the sines and cosines of small rotations come from their Taylor series here rather than from sinf()/cosf().
+ *
+ * The gyro rotations of a block of frames don't depend on the filter state, so they're worked out first for the
+ * whole block in simple loops over the columns, which the compiler can vectorize. Only the filter itself has to step
+ * through the frames one by one.
+ */
+void imuUpdateAttitudeBatch(imuState_t *state, const imuSensorColumns_t *columns, int count, uint16_t acc_1G, float gyroScale, attitude_t *attitudes)
+{
+    uint32_t deltaTime[IMU_BATCH_SIZE];
+    float scale[IMU_BATCH_SIZE], angle[IMU_BATCH_SIZE];
+    float sine[3][IMU_BATCH_SIZE], cosine[3][IMU_BATCH_SIZE];
+    bool hasMag = columns->magADC[0] != NULL;
+
+    for (int start = 0; start < count; start += IMU_BATCH_SIZE) {
+        int blockSize = count - start < IMU_BATCH_SIZE ? count - start : IMU_BATCH_SIZE;
+        const uint32_t *time = columns->time + start;
+
+        // Time deltas as in imuUpdateAttitude(), treating the first frame after a zero time as 1us long
+        deltaTime[0] = state->previousTime == 0 ? 1 : time[0] - state->previousTime;
+
+        for (int i = 1; i < blockSize; i++) {
+            uint32_t delta = time[i] - time[i - 1];
+
+            deltaTime[i] = time[i - 1] == 0 ? 1 : delta;
+        }
+
+        state->previousTime = time[blockSize - 1];
+
+        for (int i = 0; i < blockSize; i++) {
+            // Convert the halves separately, since only signed integers have a vector conversion to float (this is
+            // still exact, as both halves convert exactly and the sum is rounded once)
+            scale[i] = ((float) (int32_t) (deltaTime[i] >> 16) * 65536.0f + (float) (int32_t) (deltaTime[i] & 0xFFFF)) * gyroScale;
+        }
+
+        for (int axis = 0; axis < 3; axis++) {
+            const int16_t *gyro = columns->gyroADC[axis] + start;
+            float *axisSine = sine[axis], *axisCosine = cosine[axis];
+            int largeAngles = 0;
+
+            for (int i = 0; i < blockSize; i++) {
+                angle[i] = gyro[i] * scale[i];
+            }
+
+            for (int i = 0; i < blockSize; i++) {
+                axisSine[i] = smallAngleSin(angle[i]);
+                axisCosine[i] = smallAngleCos(angle[i]);
+                largeAngles += fabsf(angle[i]) > IMU_SMALL_ANGLE;
+            }
+
+            if (largeAngles) {
+                for (int i = 0; i < blockSize; i++) {
+                    if (fabsf(angle[i]) > IMU_SMALL_ANGLE) {
+                        axisSine[i] = sinf(angle[i]);
+                        axisCosine[i] = cosf(angle[i]);
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < blockSize; i++) {
+            float mat[3][3], frameSine[3], frameCosine[3];
+            int16_t accSmooth[3], magADC[3];
+
+            for (int axis = 0; axis < 3; axis++) {
+                frameSine[axis] = sine[axis][i];
+                frameCosine[axis] = cosine[axis][i];
+                accSmooth[axis] = columns->accSmooth[axis][start + i];
+
+                if (hasMag) {
+                    magADC[axis] = columns->magADC[axis][start + i];
+                }
+            }
+
+            rotationMatrix(frameSine, frameCosine, mat);
+
+            imuApplyFrame(state, mat, accSmooth, hasMag ? magADC : NULL, acc_1G, attitudes + start + i);
+        }
     }
 }
@@ -1,6 +1,8 @@
 #ifndef IMU_H_
 #define IMU_H_
 
+#include <stdint.h>
+
 typedef struct fp_vector {
     float X;
     float Y;
@@ -19,10 +21,35 @@ typedef struct attitude_t {
     float heading;
 } attitude_t;
 
-void imuInit(void);
-void imuSetMagneticDeclination(double declination);
+// The attitude estimator's filter state, so several logs can be simulated at once
+typedef struct imuState_t {
+    t_fp_vector EstG, EstM, EstN;
+    uint32_t previousTime;
+
+    // In radians
+    float magneticDeclination;
+} imuState_t;
+
+/**
+ * A block of consecutive frames' sensor readings for imuUpdateAttitudeBatch(), one array per field.
+ */
+typedef struct imuSensorColumns_t {
+    const uint32_t *time;
+    const int16_t *gyroADC[3];
+    const int16_t *accSmooth[3];
+    // Set magADC[0] to NULL to estimate the heading without a magnetometer
+    const int16_t *magADC[3];
+} imuSensorColumns_t;
+
+// The number of frames imuUpdateAttitudeBatch() works on at a time
+#define IMU_BATCH_SIZE 256
+
+void imuStateInit(imuState_t *state);
+void imuStateSetMagneticDeclination(imuState_t *state, double declination);
+
+void imuUpdateAttitude(imuState_t *state, int16_t gyroADC[3], int16_t accSmooth[3], int16_t magADC[3], uint32_t currentTime, uint16_t acc_1G, float gyroScale, attitude_t *attitude);
+void imuUpdateAttitudeBatch(imuState_t *state, const imuSensorColumns_t *columns, int count, uint16_t acc_1G, float gyroScale, attitude_t *attitudes);
 
-void updateEstimatedAttitude(int16_t gyroADC[3], int16_t accSmooth[3], int16_t magADC[3], uint32_t currentTime, uint16_t acc_1G, float gyroScale, attitude_t *attitude);
 t_fp_vector calculateAccelerationInEarthFrame(int16_t accSmooth[3], attitude_t *attitude, uint16_t acc_1G);
 
 #endif
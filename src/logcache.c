@@ -0,0 +1,972 @@
+/**
+ * A cache of the decoded contents of a flight log, stored in a ".bbcache" file next to the log, so that tools which
+ * process the same log over and over don't have to decode its frames every time.
+ *
+ * The cache is a recording of everything the parser reported for the log: every frame and event in order, along with
+ * the log's statistics. On later runs only the log's header lines are read again (to fill in the field definitions),
+ * and the recording is replayed to the caller's callbacks straight out of the memory-mapped cache file.
+ *
+ * Frames are stored in tables, one per frame type, column by column in groups of LOG_CACHE_ROWS_PER_GROUP rows (the
+ * first group is smaller, so the first frames can be replayed without decoding thousands of rows beforehand). Each
+ * column of a group is stored as either the deltas between successive values or the offsets of the values from the
+ * group's minimum (whichever needs fewer bits), bit-packed at the narrowest width that fits. So slowly changing fields
+ * like the loop iteration and time only take a few bits per frame, and the frame validity (gap) flags become bitmaps.
+ *
+ * The cache is keyed by the size and modification time of the log file along with a hash of the log's headers, like
+ * the zone maps. The frames aren't hashed, since reading the whole log to check the key would cost about as much as
+ * decoding it. It's specific to the build of the tool that wrote it, since some structures are stored verbatim.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+    #include <unistd.h>
+#else
+    #include <io.h>
+#endif
+
+#include "platform.h"
+#include "utils.h"
+#include "logcache.h"
+
+#define LOG_CACHE_MAGIC "BBCACHE"
+#define LOG_CACHE_VERSION 2
+
+#define LOG_CACHE_ROWS_PER_GROUP 4096
+#define LOG_CACHE_ROWS_IN_FIRST_GROUP 64
+
+// Each column of a row group begins with its encoding, bit width and base value:
+#define LOG_CACHE_COLUMN_HEADER_SIZE (1 + 1 + sizeof(int64_t))
+
+typedef enum {
+    // Values are stored as (value - base), where base is the minimum value in the group
+    LOG_CACHE_ENCODING_OFFSET = 0,
+    // The first value is the base, and the remaining values are stored as zigzag-encoded differences from the value before
+    LOG_CACHE_ENCODING_DELTA = 1
+} logCacheEncoding_e;
+
+typedef enum {
+    // One row for each frame or event the parser reported, in order
+    LOG_CACHE_TABLE_RECORDS = 0,
+    LOG_CACHE_TABLE_MAIN,
+    LOG_CACHE_TABLE_GPS,
+    LOG_CACHE_TABLE_GPS_HOME,
+    LOG_CACHE_TABLE_SLOW,
+    LOG_CACHE_TABLE_COUNT
+} logCacheTable_e;
+
+// The columns of the records table:
+enum {
+    RECORD_COLUMN_TYPE = 0, // The frame type, or zero for an event
+    RECORD_COLUMN_FLAGS,
+    RECORD_COLUMN_OFFSET,
+    RECORD_COLUMN_SIZE,
+    RECORD_COLUMN_COUNT
+};
+
+#define LOG_CACHE_RECORD_VALID     1
+#define LOG_CACHE_RECORD_HAS_FRAME 2
+
+// The frame types the parser collects statistics for
+static const uint8_t LOG_CACHE_FRAME_TYPES[] = {'I', 'P', 'G', 'H', 'E', 'S'};
+
+#define LOG_CACHE_FRAME_TYPE_COUNT ((int) sizeof(LOG_CACHE_FRAME_TYPES))
+
+typedef struct logCacheHeader_t {
+    char magic[8];
+    uint32_t version;
+
+    // Sizes of the structures we store verbatim, so a cache from an incompatible build gets rejected
+    uint32_t statisticsSize, eventSize;
+
+    // The key:
+    uint32_t logIndex;
+    uint32_t raw;
+    uint64_t fileSize;
+    int64_t fileModified;
+    uint64_t headerHash;
+
+    // Set if the parser found the start of the log data and called onMetadataReady
+    uint32_t metadataReady;
+
+    uint32_t eventCount;
+} logCacheHeader_t;
+
+typedef struct logCacheStoredStatistics_t {
+    uint32_t totalBytes;
+    uint32_t totalCorruptFrames;
+    uint32_t intentionallyAbsentIterations;
+    uint32_t haveFieldStats;
+
+    flightLogFieldStatistics_t field[FLIGHT_LOG_MAX_FIELDS];
+    flightLogFrameStatistics_t frame[LOG_CACHE_FRAME_TYPE_COUNT];
+} logCacheStoredStatistics_t;
+
+typedef struct logCacheTableHeader_t {
+    uint32_t columnCount;
+    uint32_t rowCount;
+    uint64_t byteLength;
+} logCacheTableHeader_t;
+
+typedef struct logCacheTableWriter_t {
+    int columnCount;
+    uint32_t rowCount;
+
+    // The rows of the group being collected, row-major
+    int64_t *group;
+    int groupRows;
+
+    // Encoded groups
+    uint8_t *data;
+    size_t length, capacity;
+} logCacheTableWriter_t;
+
+typedef struct logCacheTableReader_t {
+    int columnCount;
+    uint32_t rowCount, rowsRemaining;
+
+    const uint8_t *pos;
+
+    // The decoded rows of the current group, row-major
+    int64_t *group;
+    int groupRows, nextRow;
+} logCacheTableReader_t;
+
+typedef struct logCacheRecorder_t {
+    // The caller's callbacks, which the recording callbacks forward to
+    FlightLogMetadataReady onMetadataReady;
+    FlightLogFrameReady onFrameReady;
+    FlightLogEventReady onEvent;
+
+    bool metadataReady;
+
+    logCacheTableWriter_t tables[LOG_CACHE_TABLE_COUNT];
+
+    flightLogEvent_t *events;
+    uint32_t eventCount, eventCapacity;
+
+    int64_t startTime;
+    logCacheStatistics_t *statistics;
+} logCacheRecorder_t;
+
+static logCacheRecorder_t recorder;
+
+/**
+ * Build the name of the cache file for the given log, like "LOG00001.01.bbcache" for the first log in "LOG00001.TXT".
+ * The caller must free the result.
+ */
+char* logCacheFilename(const char *logFilename, int logIndex)
+{
+    return logSidecarFilename(logFilename, logIndex, "bbcache");
+}
+
+/**
+ * Find the end of the header lines at the start of the log. The key is built before the log is parsed, so the
+ * parser hasn't recorded this in log->logHeaderEnd yet.
+ */
+static const char* logCacheFindHeaderEnd(flightLog_t *log, int logIndex)
+{
+    const char *pos = log->logBegin[logIndex];
+    const char *end = log->logBegin[logIndex + 1];
+
+    while (pos < end && *pos == 'H') {
+        const char *lineEnd = memchr(pos, '\n', end - pos);
+
+        if (!lineEnd) {
+            return end;
+        }
+
+        pos = lineEnd + 1;
+    }
+
+    return pos;
+}
+
+static void logCacheMakeKey(flightLog_t *log, int logIndex, bool raw, logCacheHeader_t *header)
+{
+    fileMapping_t *mapping = &log->private->stream->mapping;
+
+    memset(header, 0, sizeof(*header));
+
+    memcpy(header->magic, LOG_CACHE_MAGIC, sizeof(LOG_CACHE_MAGIC));
+    header->version = LOG_CACHE_VERSION;
+    header->statisticsSize = sizeof(logCacheStoredStatistics_t);
+    header->eventSize = sizeof(flightLogEvent_t);
+
+    header->logIndex = logIndex;
+    header->raw = raw;
+    header->fileSize = mapping->stats.st_size;
+    header->fileModified = mapping->stats.st_mtime;
+    header->headerHash = hashBytes(log->logBegin[logIndex], logCacheFindHeaderEnd(log, logIndex) - log->logBegin[logIndex]);
+}
+
+static bool logCacheKeyMatches(const logCacheHeader_t *cached, const logCacheHeader_t *expected)
+{
+    return memcmp(cached->magic, expected->magic, sizeof(cached->magic)) == 0
+        && cached->version == expected->version
+        && cached->statisticsSize == expected->statisticsSize
+        && cached->eventSize == expected->eventSize
+        && cached->logIndex == expected->logIndex
+        && cached->raw == expected->raw
+        && cached->fileSize == expected->fileSize
+        && cached->fileModified == expected->fileModified
+        && cached->headerHash == expected->headerHash;
+}
+
+static int logCacheBitWidth(uint64_t value)
+{
+    int width = 0;
+
+    while (value) {
+        width++;
+        value >>= 1;
+    }
+
+    return width;
+}
+
+/**
+ * The number of rows in the group of a table which begins after `rowsBefore` rows (or fewer, if the table ends first).
+ */
+static int logCacheGroupRows(uint32_t rowsBefore)
+{
+    return rowsBefore == 0 ? LOG_CACHE_ROWS_IN_FIRST_GROUP : LOG_CACHE_ROWS_PER_GROUP;
+}
+
+static uint64_t zigzagEncode(int64_t value)
+{
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t zigzagDecode(uint64_t value)
+{
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+typedef struct bitWriter_t {
+    uint8_t *pos;
+    uint64_t buffer;
+    int bufferedBits;
+} bitWriter_t;
+
+static void bitWriterWrite(bitWriter_t *writer, uint64_t value, int width)
+{
+    // Add the value in pieces of up to 32 bits so the buffer never overflows
+    while (width > 0) {
+        int chunk = width > 32 ? 32 : width;
+
+        writer->buffer |= (value & ((1ULL << chunk) - 1)) << writer->bufferedBits;
+        writer->bufferedBits += chunk;
+
+        value >>= chunk;
+        width -= chunk;
+
+        while (writer->bufferedBits >= 8) {
+            *writer->pos++ = (uint8_t) writer->buffer;
+            writer->buffer >>= 8;
+            writer->bufferedBits -= 8;
+        }
+    }
+}
+
+static void bitWriterFlush(bitWriter_t *writer)
+{
+    if (writer->bufferedBits > 0) {
+        *writer->pos++ = (uint8_t) writer->buffer;
+    }
+
+    writer->buffer = 0;
+    writer->bufferedBits = 0;
+}
+
+typedef struct bitReader_t {
+    const uint8_t *pos;
+    uint64_t buffer;
+    int bufferedBits;
+} bitReader_t;
+
+static uint64_t bitReaderRead(bitReader_t *reader, int width)
+{
+    uint64_t result = 0;
+    int shift = 0;
+
+    while (width > 0) {
+        int chunk = width > 32 ? 32 : width;
+
+        while (reader->bufferedBits < chunk) {
+            reader->buffer |= (uint64_t) *reader->pos++ << reader->bufferedBits;
+            reader->bufferedBits += 8;
+        }
+
+        result |= (reader->buffer & ((1ULL << chunk) - 1)) << shift;
+
+        reader->buffer >>= chunk;
+        reader->bufferedBits -= chunk;
+
+        shift += chunk;
+        width -= chunk;
+    }
+
+    return result;
+}
+
+static size_t logCachePackedSize(int valueCount, int width)
+{
+    return ((size_t) valueCount * width + 7) / 8;
+}
+
+static void tableWriterInit(logCacheTableWriter_t *table, int columnCount)
+{
+    memset(table, 0, sizeof(*table));
+
+    table->columnCount = columnCount;
+    // Allocate at least one column so that tables without any fields still have somewhere to put their rows
+    table->group = malloc(LOG_CACHE_ROWS_PER_GROUP * (columnCount > 0 ? columnCount : 1) * sizeof(*table->group));
+}
+
+static void tableWriterFree(logCacheTableWriter_t *table)
+{
+    free(table->group);
+    free(table->data);
+
+    memset(table, 0, sizeof(*table));
+}
+
+/**
+ * Encode the rows collected for the current group onto the end of the table's data.
+ */
+static void tableWriterEncodeGroup(logCacheTableWriter_t *table)
+{
+    int rows = table->groupRows;
+    // Worst case every value takes 64 bits
+    size_t maxGroupSize = table->columnCount * (LOG_CACHE_COLUMN_HEADER_SIZE + logCachePackedSize(rows, 64));
+
+    if (rows == 0) {
+        return;
+    }
+
+    if (table->length + maxGroupSize > table->capacity) {
+        while (table->length + maxGroupSize > table->capacity) {
+            table->capacity = table->capacity ? table->capacity * 2 : 64 * 1024;
+        }
+
+        table->data = realloc(table->data, table->capacity);
+    }
+
+    for (int column = 0; column < table->columnCount; column++) {
+        const int64_t *values = table->group + column;
+        int stride = table->columnCount;
+        int64_t min = values[0], max = values[0];
+        uint64_t maxDelta = 0;
+        int offsetWidth, deltaWidth;
+        uint8_t encoding, width;
+        int64_t base;
+        bitWriter_t writer = {0};
+
+        for (int row = 1; row < rows; row++) {
+            int64_t value = values[row * stride];
+            // Computed with wraparound, since the fields of invalid frames can hold any value at all
+            uint64_t delta = zigzagEncode((int64_t) ((uint64_t) value - (uint64_t) values[(row - 1) * stride]));
+
+            if (value < min)
+                min = value;
+            if (value > max)
+                max = value;
+            if (delta > maxDelta)
+                maxDelta = delta;
+        }
+
+        offsetWidth = logCacheBitWidth((uint64_t) max - (uint64_t) min);
+        deltaWidth = logCacheBitWidth(maxDelta);
+
+        if (deltaWidth < offsetWidth) {
+            encoding = LOG_CACHE_ENCODING_DELTA;
+            width = deltaWidth;
+            base = values[0];
+        } else {
+            encoding = LOG_CACHE_ENCODING_OFFSET;
+            width = offsetWidth;
+            base = min;
+        }
+
+        table->data[table->length++] = encoding;
+        table->data[table->length++] = width;
+        memcpy(table->data + table->length, &base, sizeof(base));
+        table->length += sizeof(base);
+
+        writer.pos = table->data + table->length;
+
+        if (width > 0) {
+            if (encoding == LOG_CACHE_ENCODING_DELTA) {
+                for (int row = 1; row < rows; row++) {
+                    bitWriterWrite(&writer, zigzagEncode((int64_t) ((uint64_t) values[row * stride] - (uint64_t) values[(row - 1) * stride])), width);
+                }
+            } else {
+                for (int row = 0; row < rows; row++) {
+                    bitWriterWrite(&writer, (uint64_t) values[row * stride] - (uint64_t) min, width);
+                }
+            }
+
+            bitWriterFlush(&writer);
+        }
+
+        table->length = writer.pos - table->data;
+    }
+
+    table->groupRows = 0;
+}
+
+/**
+ * Add a row to the table and return a pointer to it for the caller to fill in.
+ */
+static int64_t* tableWriterAddRow(logCacheTableWriter_t *table)
+{
+    if (table->groupRows == logCacheGroupRows(table->rowCount - table->groupRows)) {
+        tableWriterEncodeGroup(table);
+    }
+
+    table->rowCount++;
+
+    return table->group + table->groupRows++ * table->columnCount;
+}
+
+/**
+ * The number of bytes the packed values of a column take up in a group with `rows` rows.
+ */
+static size_t logCacheColumnPackedSize(uint8_t encoding, uint8_t width, int rows)
+{
+    return logCachePackedSize(encoding == LOG_CACHE_ENCODING_DELTA ? rows - 1 : rows, width);
+}
+
+/**
+ * Check that the table data at `pos` is well-formed and lies within the file, and return the table's header.
+ */
+static bool tableValidate(const uint8_t *pos, const uint8_t *end, logCacheTableHeader_t *header)
+{
+    uint32_t rowsRemaining;
+    const uint8_t *dataEnd;
+
+    if ((size_t) (end - pos) < sizeof(*header)) {
+        return false;
+    }
+
+    memcpy(header, pos, sizeof(*header));
+    pos += sizeof(*header);
+
+    if (header->columnCount > FLIGHT_LOG_MAX_FIELDS || header->byteLength > (uint64_t) (end - pos)) {
+        return false;
+    }
+
+    dataEnd = pos + header->byteLength;
+
+    for (rowsRemaining = header->rowCount; rowsRemaining > 0; ) {
+        int rows = logCacheGroupRows(header->rowCount - rowsRemaining);
+
+        if ((uint32_t) rows > rowsRemaining) {
+            rows = (int) rowsRemaining;
+        }
+
+        for (uint32_t column = 0; column < header->columnCount; column++) {
+            if ((size_t) (dataEnd - pos) < LOG_CACHE_COLUMN_HEADER_SIZE || pos[0] > LOG_CACHE_ENCODING_DELTA || pos[1] > 64) {
+                return false;
+            }
+
+            size_t packedSize = logCacheColumnPackedSize(pos[0], pos[1], rows);
+
+            pos += LOG_CACHE_COLUMN_HEADER_SIZE;
+
+            if ((size_t) (dataEnd - pos) < packedSize) {
+                return false;
+            }
+
+            pos += packedSize;
+        }
+
+        rowsRemaining -= rows;
+    }
+
+    return pos == dataEnd;
+}
+
+static void tableReaderInit(logCacheTableReader_t *table, const uint8_t *pos)
+{
+    logCacheTableHeader_t header;
+
+    memcpy(&header, pos, sizeof(header));
+
+    table->columnCount = header.columnCount;
+    table->rowCount = header.rowCount;
+    table->rowsRemaining = header.rowCount;
+    table->pos = pos + sizeof(header);
+    table->group = malloc(LOG_CACHE_ROWS_PER_GROUP * (header.columnCount > 0 ? header.columnCount : 1) * sizeof(*table->group));
+    table->groupRows = 0;
+    table->nextRow = 0;
+}
+
+static void tableReaderDecodeGroup(logCacheTableReader_t *table)
+{
+    int rows = logCacheGroupRows(table->rowCount - table->rowsRemaining);
+
+    if ((uint32_t) rows > table->rowsRemaining) {
+        rows = (int) table->rowsRemaining;
+    }
+
+    for (int column = 0; column < table->columnCount; column++) {
+        int64_t *values = table->group + column;
+        int stride = table->columnCount;
+        uint8_t encoding = table->pos[0];
+        uint8_t width = table->pos[1];
+        int64_t base;
+        bitReader_t reader = {0};
+
+        memcpy(&base, table->pos + 2, sizeof(base));
+        table->pos += LOG_CACHE_COLUMN_HEADER_SIZE;
+
+        reader.pos = table->pos;
+
+        if (width == 0) {
+            for (int row = 0; row < rows; row++) {
+                values[row * stride] = base;
+            }
+        } else if (encoding == LOG_CACHE_ENCODING_DELTA) {
+            values[0] = base;
+
+            for (int row = 1; row < rows; row++) {
+                values[row * stride] = (int64_t) ((uint64_t) values[(row - 1) * stride] + (uint64_t) zigzagDecode(bitReaderRead(&reader, width)));
+            }
+        } else {
+            for (int row = 0; row < rows; row++) {
+                values[row * stride] = (int64_t) ((uint64_t) base + bitReaderRead(&reader, width));
+            }
+        }
+
+        table->pos += logCacheColumnPackedSize(encoding, width, rows);
+    }
+
+    table->rowsRemaining -= rows;
+    table->groupRows = rows;
+    table->nextRow = 0;
+}
+
+/**
+ * Get the next row of the table, or NULL if there are no more rows.
+ */
+static int64_t* tableReaderNextRow(logCacheTableReader_t *table)
+{
+    if (table->nextRow == table->groupRows) {
+        if (table->rowsRemaining == 0) {
+            return NULL;
+        }
+
+        tableReaderDecodeGroup(table);
+    }
+
+    return table->group + table->nextRow++ * table->columnCount;
+}
+
+static int logCacheTableForFrameType(uint8_t frameType)
+{
+    switch (frameType) {
+        case 'I':
+        case 'P':
+            return LOG_CACHE_TABLE_MAIN;
+        case 'G':
+            return LOG_CACHE_TABLE_GPS;
+        case 'H':
+            return LOG_CACHE_TABLE_GPS_HOME;
+        case 'S':
+            return LOG_CACHE_TABLE_SLOW;
+        default:
+            return -1;
+    }
+}
+
+static void logCacheNoteFirstFrame(int64_t startTime, logCacheStatistics_t *statistics)
+{
+    if (statistics && statistics->firstFrameMicros == -1) {
+        statistics->firstFrameMicros = time_monotonic_us() - startTime;
+    }
+}
+
+static void logCacheRecordMetadata(flightLog_t *log)
+{
+    tableWriterInit(&recorder.tables[LOG_CACHE_TABLE_MAIN], log->frameDefs['I'].fieldCount);
+    tableWriterInit(&recorder.tables[LOG_CACHE_TABLE_GPS], log->frameDefs['G'].fieldCount);
+    tableWriterInit(&recorder.tables[LOG_CACHE_TABLE_GPS_HOME], log->frameDefs['H'].fieldCount);
+    tableWriterInit(&recorder.tables[LOG_CACHE_TABLE_SLOW], log->frameDefs['S'].fieldCount);
+
+    recorder.metadataReady = true;
+
+    if (recorder.onMetadataReady) {
+        recorder.onMetadataReady(log);
+    }
+}
+
+static void logCacheRecordFrame(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int fieldCount, int frameOffset, int frameSize)
+{
+    int tableIndex = logCacheTableForFrameType(frameType);
+    int64_t flags = frameValid ? LOG_CACHE_RECORD_VALID : 0;
+    int64_t *record;
+
+    if (frame && tableIndex != -1 && recorder.metadataReady) {
+        logCacheTableWriter_t *table = &recorder.tables[tableIndex];
+
+        memcpy(tableWriterAddRow(table), frame, table->columnCount * sizeof(*frame));
+
+        flags |= LOG_CACHE_RECORD_HAS_FRAME;
+    }
+
+    record = tableWriterAddRow(&recorder.tables[LOG_CACHE_TABLE_RECORDS]);
+
+    record[RECORD_COLUMN_TYPE] = frameType;
+    record[RECORD_COLUMN_FLAGS] = flags;
+    record[RECORD_COLUMN_OFFSET] = frameOffset;
+    record[RECORD_COLUMN_SIZE] = frameSize;
+
+    logCacheNoteFirstFrame(recorder.startTime, recorder.statistics);
+
+    if (recorder.onFrameReady) {
+        recorder.onFrameReady(log, frameValid, frame, frameType, fieldCount, frameOffset, frameSize);
+    }
+}
+
+static void logCacheRecordEvent(flightLog_t *log, flightLogEvent_t *event)
+{
+    int64_t *record;
+
+    if (recorder.eventCount == recorder.eventCapacity) {
+        recorder.eventCapacity = recorder.eventCapacity ? recorder.eventCapacity * 2 : 64;
+        recorder.events = realloc(recorder.events, recorder.eventCapacity * sizeof(*recorder.events));
+    }
+
+    recorder.events[recorder.eventCount++] = *event;
+
+    record = tableWriterAddRow(&recorder.tables[LOG_CACHE_TABLE_RECORDS]);
+
+    record[RECORD_COLUMN_TYPE] = 0;
+    record[RECORD_COLUMN_FLAGS] = 0;
+    record[RECORD_COLUMN_OFFSET] = 0;
+    record[RECORD_COLUMN_SIZE] = 0;
+
+    if (recorder.onEvent) {
+        recorder.onEvent(log, event);
+    }
+}
+
+static void logCacheSaveStatistics(flightLog_t *log, logCacheStoredStatistics_t *stored)
+{
+    memset(stored, 0, sizeof(*stored));
+
+    stored->totalBytes = log->stats.totalBytes;
+    stored->totalCorruptFrames = log->stats.totalCorruptFrames;
+    stored->intentionallyAbsentIterations = log->stats.intentionallyAbsentIterations;
+    stored->haveFieldStats = log->stats.haveFieldStats;
+
+    memcpy(stored->field, log->stats.field, sizeof(stored->field));
+
+    for (int i = 0; i < LOG_CACHE_FRAME_TYPE_COUNT; i++) {
+        stored->frame[i] = log->stats.frame[LOG_CACHE_FRAME_TYPES[i]];
+    }
+}
+
+static void logCacheRestoreStatistics(flightLog_t *log, const logCacheStoredStatistics_t *stored)
+{
+    memset(&log->stats, 0, sizeof(log->stats));
+
+    log->stats.totalBytes = stored->totalBytes;
+    log->stats.totalCorruptFrames = stored->totalCorruptFrames;
+    log->stats.intentionallyAbsentIterations = stored->intentionallyAbsentIterations;
+    log->stats.haveFieldStats = stored->haveFieldStats;
+
+    memcpy(log->stats.field, stored->field, sizeof(stored->field));
+
+    for (int i = 0; i < LOG_CACHE_FRAME_TYPE_COUNT; i++) {
+        log->stats.frame[LOG_CACHE_FRAME_TYPES[i]] = stored->frame[i];
+    }
+}
+
+/**
+ * Write out the recording along with the log's statistics. The file is written under a temporary name and renamed
+ * into place at the end, so a reader never sees a partially written cache.
+ */
+static bool logCacheWrite(flightLog_t *log, const char *cacheFilename, logCacheHeader_t *header)
+{
+    int tempFilenameLen = strlen(cacheFilename) + strlen(".tmp") + 1;
+    char *tempFilename = malloc(tempFilenameLen);
+    logCacheStoredStatistics_t stored;
+    bool success;
+    FILE *file;
+
+    snprintf(tempFilename, tempFilenameLen, "%s.tmp", cacheFilename);
+
+    file = fopen(tempFilename, "wb");
+
+    if (!file) {
+        free(tempFilename);
+        return false;
+    }
+
+    header->metadataReady = recorder.metadataReady;
+    header->eventCount = recorder.eventCount;
+
+    logCacheSaveStatistics(log, &stored);
+
+    success = fwrite(header, sizeof(*header), 1, file) == 1
+        && fwrite(&stored, sizeof(stored), 1, file) == 1
+        && fwrite(recorder.events, sizeof(*recorder.events), recorder.eventCount, file) == recorder.eventCount;
+
+    for (int i = 0; i < LOG_CACHE_TABLE_COUNT && success; i++) {
+        logCacheTableWriter_t *table = &recorder.tables[i];
+        logCacheTableHeader_t tableHeader;
+
+        tableWriterEncodeGroup(table);
+
+        tableHeader.columnCount = table->columnCount;
+        tableHeader.rowCount = table->rowCount;
+        tableHeader.byteLength = table->length;
+
+        success = fwrite(&tableHeader, sizeof(tableHeader), 1, file) == 1
+            && fwrite(table->data, 1, table->length, file) == table->length;
+    }
+
+    success = fclose(file) == 0 && success;
+
+    if (success) {
+        // Windows won't rename over an existing file
+        remove(cacheFilename);
+        success = rename(tempFilename, cacheFilename) == 0;
+    }
+
+    if (!success) {
+        remove(tempFilename);
+    }
+
+    free(tempFilename);
+
+    return success;
+}
+
+/**
+ * Parse the log while recording everything the parser reports, then save the recording to the cache file.
+ */
+static bool logCacheParseAndRecord(flightLog_t *log, const char *cacheFilename, int logIndex, logCacheHeader_t *key,
+    FlightLogMetadataReady onMetadataReady, FlightLogFrameReady onFrameReady, FlightLogEventReady onEvent, bool raw, int64_t startTime,
+    logCacheStatistics_t *statistics)
+{
+    bool success;
+
+    memset(&recorder, 0, sizeof(recorder));
+
+    recorder.onMetadataReady = onMetadataReady;
+    recorder.onFrameReady = onFrameReady;
+    recorder.onEvent = onEvent;
+    recorder.startTime = startTime;
+    recorder.statistics = statistics;
+
+    tableWriterInit(&recorder.tables[LOG_CACHE_TABLE_RECORDS], RECORD_COLUMN_COUNT);
+
+    success = flightLogParse(log, logIndex, logCacheRecordMetadata, logCacheRecordFrame, logCacheRecordEvent, raw);
+
+    if (success) {
+        bool written = logCacheWrite(log, cacheFilename, key);
+
+        if (statistics) {
+            statistics->written = written;
+        }
+    }
+
+    for (int i = 0; i < LOG_CACHE_TABLE_COUNT; i++) {
+        tableWriterFree(&recorder.tables[i]);
+    }
+
+    free(recorder.events);
+
+    memset(&recorder, 0, sizeof(recorder));
+
+    return success;
+}
+
+/**
+ * Deliver the log's frames and events to the callbacks from the cache file, if it exists and matches the given key.
+ * Returns false without calling any callbacks if the cache can't be used.
+ */
+static bool logCacheReplay(flightLog_t *log, const char *cacheFilename, int logIndex, logCacheHeader_t *key,
+    FlightLogMetadataReady onMetadataReady, FlightLogFrameReady onFrameReady, FlightLogEventReady onEvent, int64_t startTime,
+    logCacheStatistics_t *statistics)
+{
+    fileMapping_t mapping;
+    logCacheHeader_t header;
+    logCacheStoredStatistics_t stored;
+    const uint8_t *tableStart[LOG_CACHE_TABLE_COUNT];
+    logCacheTableReader_t tables[LOG_CACHE_TABLE_COUNT];
+    const uint8_t *pos, *end;
+    const uint8_t *events;
+    int64_t *record;
+    uint32_t eventIndex = 0;
+    int fd;
+
+    fd = open(cacheFilename, O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    memset(&mapping, 0, sizeof(mapping));
+
+    if (!mmap_file(&mapping, fd)) {
+        close(fd);
+        return false;
+    }
+
+    if (mapping.size < sizeof(header) + sizeof(stored)) {
+        goto fail;
+    }
+
+    pos = (const uint8_t *) mapping.data;
+    end = pos + mapping.size;
+
+    memcpy(&header, pos, sizeof(header));
+    pos += sizeof(header);
+
+    if (!logCacheKeyMatches(&header, key)) {
+        goto fail;
+    }
+
+    memcpy(&stored, pos, sizeof(stored));
+    pos += sizeof(stored);
+
+    if ((size_t) (end - pos) < (size_t) header.eventCount * sizeof(flightLogEvent_t)) {
+        goto fail;
+    }
+
+    // The events may not be aligned, so they're copied out one at a time as they're delivered
+    events = pos;
+    pos += (size_t) header.eventCount * sizeof(flightLogEvent_t);
+
+    for (int i = 0; i < LOG_CACHE_TABLE_COUNT; i++) {
+        logCacheTableHeader_t tableHeader;
+
+        if (!tableValidate(pos, end, &tableHeader)) {
+            goto fail;
+        }
+
+        tableStart[i] = pos;
+        pos += sizeof(tableHeader) + tableHeader.byteLength;
+    }
+
+    if (!flightLogParseHeaders(log, logIndex)) {
+        goto fail;
+    }
+
+    logCacheRestoreStatistics(log, &stored);
+
+    if (header.metadataReady && onMetadataReady) {
+        onMetadataReady(log);
+    }
+
+    if (statistics) {
+        statistics->hit = true;
+    }
+
+    // If the caller was only interested in the log's metadata and statistics, we're done already
+    if (!onFrameReady && !onEvent) {
+        munmap_file(&mapping);
+        close(fd);
+        return true;
+    }
+
+    for (int i = 0; i < LOG_CACHE_TABLE_COUNT; i++) {
+        tableReaderInit(&tables[i], tableStart[i]);
+    }
+
+    while ((record = tableReaderNextRow(&tables[LOG_CACHE_TABLE_RECORDS])) != NULL) {
+        uint8_t frameType = (uint8_t) record[RECORD_COLUMN_TYPE];
+
+        if (frameType == 0) {
+            flightLogEvent_t event;
+
+            memcpy(&event, events + eventIndex * sizeof(event), sizeof(event));
+            eventIndex++;
+
+            if (onEvent) {
+                onEvent(log, &event);
+            }
+        } else {
+            int tableIndex = logCacheTableForFrameType(frameType);
+            int64_t *frame = NULL;
+            int fieldCount = 0;
+
+            if ((record[RECORD_COLUMN_FLAGS] & LOG_CACHE_RECORD_HAS_FRAME) && tableIndex != -1) {
+                frame = tableReaderNextRow(&tables[tableIndex]);
+                fieldCount = tables[tableIndex].columnCount;
+            }
+
+            logCacheNoteFirstFrame(startTime, statistics);
+
+            if (onFrameReady) {
+                onFrameReady(log, (record[RECORD_COLUMN_FLAGS] & LOG_CACHE_RECORD_VALID) != 0, frame, frameType, fieldCount,
+                    (int) record[RECORD_COLUMN_OFFSET], (int) record[RECORD_COLUMN_SIZE]);
+            }
+        }
+    }
+
+    for (int i = 0; i < LOG_CACHE_TABLE_COUNT; i++) {
+        free(tables[i].group);
+    }
+
+    munmap_file(&mapping);
+    close(fd);
+
+    return true;
+
+fail:
+    munmap_file(&mapping);
+    close(fd);
+
+    return false;
+}
+
+/**
+ * Parse the log with the given index like flightLogParse(), but use the log's cache file instead of decoding the log
+ * if a cache file exists and is up to date. Otherwise the log is decoded and a new cache file is written.
+ *
+ * `logFilename` is used to name the cache file. If `statistics` is non-NULL, it's filled with timings and whether the
+ * cache was used.
+ */
+bool flightLogParseCached(flightLog_t *log, const char *logFilename, int logIndex, FlightLogMetadataReady onMetadataReady,
+    FlightLogFrameReady onFrameReady, FlightLogEventReady onEvent, bool raw, logCacheStatistics_t *statistics)
+{
+    int64_t startTime = time_monotonic_us();
+    logCacheHeader_t key;
+    char *cacheFilename;
+    bool success;
+
+    if (statistics) {
+        memset(statistics, 0, sizeof(*statistics));
+        statistics->firstFrameMicros = -1;
+    }
+
+    // Logs being read from a serial port can't be cached
+    if (logIndex < 0 || logIndex >= log->logCount || (log->private->stream->mapping.stats.st_mode & S_IFMT) == S_IFCHR) {
+        return flightLogParse(log, logIndex, onMetadataReady, onFrameReady, onEvent, raw);
+    }
+
+    logCacheMakeKey(log, logIndex, raw, &key);
+
+    cacheFilename = logCacheFilename(logFilename, logIndex);
+
+    success = logCacheReplay(log, cacheFilename, logIndex, &key, onMetadataReady, onFrameReady, onEvent, startTime, statistics)
+        || logCacheParseAndRecord(log, cacheFilename, logIndex, &key, onMetadataReady, onFrameReady, onEvent, raw, startTime, statistics);
+
+    free(cacheFilename);
+
+    if (statistics) {
+        statistics->totalMicros = time_monotonic_us() - startTime;
+    }
+
+    return success;
+}
@@ -0,0 +1,25 @@
+#ifndef LOGCACHE_H_
+#define LOGCACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "parser.h"
+
+typedef struct logCacheStatistics_t {
+    // True if the log was replayed from an existing cache file rather than parsed
+    bool hit;
+    // True if a new cache file was written
+    bool written;
+
+    // Time from the start of the call until the first frame was delivered, and until the call finished
+    int64_t firstFrameMicros;
+    int64_t totalMicros;
+} logCacheStatistics_t;
+
+char* logCacheFilename(const char *logFilename, int logIndex);
+
+bool flightLogParseCached(flightLog_t *log, const char *logFilename, int logIndex, FlightLogMetadataReady onMetadataReady,
+    FlightLogFrameReady onFrameReady, FlightLogEventReady onEvent, bool raw, logCacheStatistics_t *statistics);
+
+#endif
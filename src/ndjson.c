@@ -0,0 +1,328 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+//For msvcrt to define M_PI:
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "ndjson.h"
+
+/*
+ * "ndjson" sink: main, GPS and slow frames and events as typed JSON records in a single stream, one record per line, in
+ * the order they appear in the log (which is also time order).
+ *
+ * Every field's key (like `,"gyroADC[0]":`) is rendered once when the log's field definitions become available, so
+ * writing a record is mostly a matter of copying keys and formatting integers.
+ */
+
+static outputStream_t *ndjsonFile;
+
+static const decodeSinkContext_t *decodeContext;
+static jsonKey_t ndjsonMainKeys[FLIGHT_LOG_MAX_FIELDS], ndjsonGPSKeys[FLIGHT_LOG_MAX_FIELDS], ndjsonSlowKeys[FLIGHT_LOG_MAX_FIELDS];
+
+/**
+ * Render the key for a field called `name` into `key`, preceded by a comma (since it always follows the record type).
+ */
+void createJSONKey(jsonKey_t *key, const char *name)
+{
+    char *pos;
+
+    // Worst case every character needs escaping
+    key->text = malloc(strlen(name) * 2 + strlen(",\"\":") + 1);
+
+    pos = key->text;
+    *pos++ = ',';
+    *pos++ = '"';
+
+    for (const char *c = name; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            *pos++ = '\\';
+        }
+        *pos++ = *c;
+    }
+
+    *pos++ = '"';
+    *pos++ = ':';
+    *pos = '\0';
+
+    key->length = pos - key->text;
+}
+
+static void freeJSONKeys(jsonKey_t *keys)
+{
+    for (int i = 0; i < FLIGHT_LOG_MAX_FIELDS; i++) {
+        free(keys[i].text);
+        keys[i].text = NULL;
+    }
+}
+
+static void writeJSONKey(outputStream_t *file, jsonKey_t *key)
+{
+    outputStreamWrite(file, key->text, key->length);
+}
+
+void writeJSONLiteral(outputStream_t *file, const char *text)
+{
+    outputStreamWrite(file, text, strlen(text));
+}
+
+/**
+ * Write a time as a JSON number in the user's chosen time unit, or null if the time is unknown (-1).
+ */
+static void writeJSONTime(outputStream_t *file, int64_t time)
+{
+    if (time == -1) {
+        writeJSONLiteral(file, "null");
+    } else if (decodeContext->unitFrameTime == UNIT_MICROSECONDS) {
+        outputStreamWriteInt(file, time);
+    } else {
+        fprintfMicrosecondsInUnit(file, time, decodeContext->unitFrameTime);
+    }
+}
+
+static void ndjsonWriteMainField(flightLog_t *log, int fieldIndex, int64_t value)
+{
+    // The common units get formatted with the fast integer writer, and the rest the same way as the CSV does
+    switch (decodeContext->mainFieldUnit[fieldIndex]) {
+        case UNIT_RAW:
+            if (log->frameDefs['I'].fieldSigned[fieldIndex] || decodeContext->raw) {
+                outputStreamWriteInt(ndjsonFile, (int32_t) value);
+            } else {
+                outputStreamWriteInt(ndjsonFile, (uint32_t) value);
+            }
+            return;
+        case UNIT_MILLIVOLTS:
+            outputStreamWriteInt(ndjsonFile, (uint32_t) ((int32_t) value * 100));
+            return;
+        case UNIT_MILLIAMPS:
+            outputStreamWriteInt(ndjsonFile, (uint32_t) ((int32_t) value * 10));
+            return;
+        default:
+            if (!fprintfMainFieldInUnit(log, ndjsonFile, fieldIndex, value, decodeContext->mainFieldUnit[fieldIndex])) {
+                fprintf(stderr, "Bad unit for field %d\n", fieldIndex);
+                exit(-1);
+            }
+    }
+}
+
+static bool ndjsonSinkOpen(flightLog_t *log)
+{
+    char *ndjsonFilename;
+
+    (void) log;
+
+    if (decodeContext->toStdout) {
+        ndjsonFile = outputStreamCreate(stdout, false, decodeContext->compressionLevel);
+        return true;
+    }
+
+    ndjsonFilename = createOutputFilename(".ndjson", true);
+
+    ndjsonFile = outputStreamOpen(ndjsonFilename, decodeContext->compressionLevel);
+
+    if (!ndjsonFile) {
+        fprintf(stderr, "Failed to create output file %s\n", ndjsonFilename);
+
+        free(ndjsonFilename);
+        return false;
+    }
+
+    fprintf(stderr, "Decoding log '%s' to '%s'...\n", decodeContext->naming->logFilename, ndjsonFilename);
+    free(ndjsonFilename);
+
+    return true;
+}
+
+static void ndjsonSinkBeginLog(flightLog_t *log)
+{
+    for (int i = 0; i < log->frameDefs['I'].fieldCount; i++) {
+        createJSONKey(&ndjsonMainKeys[i], log->frameDefs['I'].fieldName[i]);
+    }
+
+    for (int i = 0; i < log->frameDefs['G'].fieldCount; i++) {
+        createJSONKey(&ndjsonGPSKeys[i], log->frameDefs['G'].fieldName[i]);
+    }
+
+    for (int i = 0; i < log->frameDefs['S'].fieldCount; i++) {
+        createJSONKey(&ndjsonSlowKeys[i], log->frameDefs['S'].fieldName[i]);
+    }
+}
+
+static void ndjsonSinkOnMainFrame(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    (void) frameType;
+    (void) frameOffset;
+    (void) frameSize;
+
+    if (!frameValid && !(frame && decodeContext->raw)) {
+        return;
+    }
+
+    writeJSONLiteral(ndjsonFile, "{\"type\":\"main\"");
+
+    for (int i = 0; i < log->frameDefs['I'].fieldCount; i++) {
+        writeJSONKey(ndjsonFile, &ndjsonMainKeys[i]);
+
+        if (i == FLIGHT_LOG_FIELD_INDEX_TIME) {
+            writeJSONTime(ndjsonFile, frameValid ? frame[i] : -1);
+        } else {
+            ndjsonWriteMainField(log, i, frame[i]);
+        }
+    }
+
+    if (decodeContext->simulateIMU) {
+        outputStreamPrintf(ndjsonFile, ",\"roll\":%.2f,\"pitch\":%.2f,\"heading\":%.2f", decodeContext->simulation->attitude.roll * 180 / M_PI,
+            decodeContext->simulation->attitude.pitch * 180 / M_PI, decodeContext->simulation->attitude.heading * 180 / M_PI);
+    }
+
+    if (log->mainFieldIndexes.amperageLatest != -1) {
+        writeJSONLiteral(ndjsonFile, ",\"energyCumulative\":");
+        outputStreamWriteInt(ndjsonFile, (int) round(decodeContext->simulation->currentMeterMeasured.energyMilliampHours));
+    }
+
+    if (decodeContext->simulateCurrentMeter) {
+        writeJSONLiteral(ndjsonFile, ",\"currentVirtual\":");
+        fprintfMilliampsInUnit(ndjsonFile, decodeContext->simulation->currentMeterVirtual.currentMilliamps, decodeContext->unitAmperage);
+
+        writeJSONLiteral(ndjsonFile, ",\"energyCumulativeVirtual\":");
+        outputStreamWriteInt(ndjsonFile, (int) round(decodeContext->simulation->currentMeterVirtual.energyMilliampHours));
+    }
+
+    writeJSONLiteral(ndjsonFile, "}\n");
+}
+
+static void ndjsonSinkOnGPSFrame(flightLog_t *log, int64_t *frame)
+{
+    writeJSONLiteral(ndjsonFile, "{\"type\":\"gps\",\"time\":");
+    writeJSONTime(ndjsonFile, getGPSFrameTime(log, frame));
+
+    for (int i = 0; i < log->frameDefs['G'].fieldCount; i++) {
+        if (i == log->gpsFieldIndexes.time)
+            continue;
+
+        writeJSONKey(ndjsonFile, &ndjsonGPSKeys[i]);
+        outputGPSField(ndjsonFile, i, frame[i]);
+    }
+
+    writeJSONLiteral(ndjsonFile, "}\n");
+}
+
+static void ndjsonSinkOnSlowFrame(flightLog_t *log, int64_t *frame)
+{
+    enum {
+        BUFFER_LEN = 1024
+    };
+    char buffer[BUFFER_LEN];
+
+    writeJSONLiteral(ndjsonFile, "{\"type\":\"slow\",\"time\":");
+    writeJSONTime(ndjsonFile, *decodeContext->lastFrameTime);
+
+    for (int i = 0; i < log->frameDefs['S'].fieldCount; i++) {
+        writeJSONKey(ndjsonFile, &ndjsonSlowKeys[i]);
+
+        if (decodeContext->slowFieldUnit[i] == UNIT_FLAGS) {
+            if (i == log->slowFieldIndexes.flightModeFlags) {
+                flightlogFlightModeToString(frame[i], buffer, BUFFER_LEN);
+            } else if (i == log->slowFieldIndexes.stateFlags) {
+                flightlogFlightStateToString(frame[i], buffer, BUFFER_LEN);
+            } else {
+                flightlogFailsafePhaseToString(frame[i], buffer, BUFFER_LEN);
+            }
+
+            // Flag names are plain identifiers separated by '|', so they don't need escaping
+            outputStreamPrintf(ndjsonFile, "\"%s\"", buffer);
+        } else {
+            outputStreamWriteInt(ndjsonFile, frame[i]);
+        }
+    }
+
+    writeJSONLiteral(ndjsonFile, "}\n");
+}
+
+static void ndjsonSinkOnEvent(flightLog_t *log, flightLogEvent_t *event)
+{
+    int adjustmentFunction;
+
+    (void) log;
+
+    writeJSONLiteral(ndjsonFile, "{\"type\":\"event\",\"time\":");
+
+    switch (event->event) {
+        case FLIGHT_LOG_EVENT_SYNC_BEEP:
+            writeJSONTime(ndjsonFile, event->data.syncBeep.time);
+            writeJSONLiteral(ndjsonFile, ",\"event\":\"syncBeep\"");
+        break;
+        case FLIGHT_LOG_EVENT_INFLIGHT_ADJUSTMENT:
+            adjustmentFunction = event->data.inflightAdjustment.adjustmentFunction & 127;
+
+            writeJSONTime(ndjsonFile, *decodeContext->lastFrameTime);
+            writeJSONLiteral(ndjsonFile, ",\"event\":\"inflightAdjustment\",\"adjustmentFunction\":");
+
+            // Functions that are newer than this decoder (or corrupt) are written as their number
+            if (adjustmentFunction < INFLIGHT_ADJUSTMENT_FUNCTION_COUNT) {
+                outputStreamPrintf(ndjsonFile, "\"%s\"", INFLIGHT_ADJUSTMENT_FUNCTIONS[adjustmentFunction]);
+            } else {
+                outputStreamWriteInt(ndjsonFile, adjustmentFunction);
+            }
+
+            writeJSONLiteral(ndjsonFile, ",\"value\":");
+
+            if (event->data.inflightAdjustment.adjustmentFunction > 127) {
+                if (isfinite(event->data.inflightAdjustment.newFloatValue)) {
+                    outputStreamPrintf(ndjsonFile, "%g", event->data.inflightAdjustment.newFloatValue);
+                } else {
+                    writeJSONLiteral(ndjsonFile, "null");
+                }
+            } else {
+                outputStreamWriteInt(ndjsonFile, event->data.inflightAdjustment.newValue);
+            }
+        break;
+        case FLIGHT_LOG_EVENT_LOGGING_RESUME:
+            writeJSONTime(ndjsonFile, event->data.loggingResume.currentTime);
+            writeJSONLiteral(ndjsonFile, ",\"event\":\"loggingResume\",\"logIteration\":");
+            outputStreamWriteInt(ndjsonFile, event->data.loggingResume.logIteration);
+        break;
+        case FLIGHT_LOG_EVENT_LOG_END:
+            writeJSONTime(ndjsonFile, *decodeContext->lastFrameTime);
+            writeJSONLiteral(ndjsonFile, ",\"event\":\"logEnd\"");
+        break;
+        default:
+            writeJSONTime(ndjsonFile, *decodeContext->lastFrameTime);
+            writeJSONLiteral(ndjsonFile, ",\"event\":\"unknown\",\"eventID\":");
+            outputStreamWriteInt(ndjsonFile, event->event);
+        break;
+    }
+
+    writeJSONLiteral(ndjsonFile, "}\n");
+}
+
+static void ndjsonSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    (void) log;
+    (void) logIndex;
+    (void) success;
+
+    outputStreamClose(ndjsonFile, decodeContext->outputStats);
+    ndjsonFile = NULL;
+
+    freeJSONKeys(ndjsonMainKeys);
+    freeJSONKeys(ndjsonGPSKeys);
+    freeJSONKeys(ndjsonSlowKeys);
+}
+
+static void ndjsonSinkInit(const decodeSinkContext_t *context)
+{
+    decodeContext = context;
+}
+
+decodeSink_t ndjsonSink = {
+    .name = "ndjson", .writesRows = true,
+    .init = ndjsonSinkInit, .open = ndjsonSinkOpen, .beginLog = ndjsonSinkBeginLog,
+    .onMainFrame = ndjsonSinkOnMainFrame, .onGPSFrame = ndjsonSinkOnGPSFrame, .onSlowFrame = ndjsonSinkOnSlowFrame,
+    .onEvent = ndjsonSinkOnEvent,
+    .endLog = ndjsonSinkEndLog
+};
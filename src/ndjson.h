@@ -0,0 +1,18 @@
+#ifndef NDJSON_H_
+#define NDJSON_H_
+
+#include "decodesink.h"
+
+// A JSON object key, rendered ahead of time along with the comma that precedes it
+typedef struct jsonKey_t {
+    char *text;
+    size_t length;
+} jsonKey_t;
+
+// The "ndjson" sink, which writes the frames and events as one JSON record per line
+extern decodeSink_t ndjsonSink;
+
+void createJSONKey(jsonKey_t *key, const char *name);
+void writeJSONLiteral(outputStream_t *file, const char *text);
+
+#endif
@@ -0,0 +1,509 @@
+/**
+ * Buffered output streams for the decoder's products (CSV, GPS CSV, events, headers).
+ *
+ * Text is formatted into large buffers which are handed to a dedicated writer thread through a lock-free queue, so
+ * decoding doesn't stall when the output device (or the consumer of a pipe) is slow. When compression is enabled the
+ * writer thread also takes care of gzipping the data.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+
+#include <zlib.h>
+
+#include "platform.h"
+#include "outputstream.h"
+
+#define OUTPUT_STREAM_BUFFER_SIZE (256 * 1024)
+
+// Maximum number of buffers in flight between the formatter and the writer before the formatter has to wait
+#define OUTPUT_STREAM_QUEUE_LENGTH 4
+
+// The decimal digits of 0 to 99, so that integers can be converted to text two digits at a time
+static const char DIGIT_PAIRS[] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+typedef struct outputBuffer_t {
+    char *data;
+    size_t length, capacity;
+
+    // Set on the final buffer of the stream so the writer knows to finish up (and end the gzip member)
+    bool last;
+} outputBuffer_t;
+
+struct outputStream_t {
+    // NULL for memory streams, which just accumulate their output in a single growable buffer with no writer thread
+    FILE *file;
+    bool ownsFile;
+
+    // The name of the file, for error messages (NULL if the stream wasn't created by outputStreamOpen())
+    char *filename;
+
+    // The errno of the first write that failed, after which the writer thread discards the rest of the output
+    int error;
+
+    int compressionLevel;
+
+    outputBuffer_t buffers[OUTPUT_STREAM_QUEUE_LENGTH];
+
+    /*
+     * Single-producer single-consumer ring of buffers. The formatter fills buffers[tail % QUEUE_LENGTH] and publishes
+     * it by incrementing tail, the writer drains buffers[head % QUEUE_LENGTH] and hands it back by incrementing head.
+     * Both counters only ever increase (wrapping around at 2^32), so tail - head is the number of buffers in flight.
+     */
+    volatile uint32_t head, tail;
+
+    // The buffer the formatter is currently filling (this is buffers[tail % QUEUE_LENGTH])
+    outputBuffer_t *fillBuffer;
+
+    /*
+     * A thread sets its flag before it sleeps on its semaphore, and the other thread clears the flag and signals the
+     * semaphore after it makes progress. So the semaphores are only touched when one side actually has to wait.
+     */
+    volatile uint32_t producerWaiting, writerWaiting;
+    semaphore_t spaceAvailable, dataAvailable, writerDone;
+
+    z_stream zlib;
+    char *compressed;
+
+    outputStreamStatistics_t stats;
+};
+
+static bool outputStreamHasSpace(outputStream_t *stream)
+{
+    return stream->tail - atomic_load_u32(&stream->head) < OUTPUT_STREAM_QUEUE_LENGTH;
+}
+
+static bool outputStreamHasData(outputStream_t *stream)
+{
+    return atomic_load_u32(&stream->tail) != stream->head;
+}
+
+/**
+ * Sleep until the other thread signals that it has made progress. The caller should re-check its condition
+ * afterwards.
+ */
+static void outputStreamSleep(outputStream_t *stream, volatile uint32_t *waitingFlag, semaphore_t *semaphore, bool (*isReady)(outputStream_t*))
+{
+    atomic_store_u32(waitingFlag, 1);
+
+    if (isReady(stream)) {
+        // We don't need to sleep after all, but if the other thread already claimed our flag, it's going to signal us
+        if (!atomic_exchange_u32(waitingFlag, 0)) {
+            semaphore_wait(semaphore);
+        }
+    } else {
+        semaphore_wait(semaphore);
+    }
+}
+
+static void outputStreamWake(volatile uint32_t *waitingFlag, semaphore_t *semaphore)
+{
+    if (atomic_exchange_u32(waitingFlag, 0)) {
+        semaphore_signal(semaphore);
+    }
+}
+
+/**
+ * Write data to the stream's file on the writer thread. The first failure is recorded for outputStreamClose() to
+ * report, since the output is incomplete from then on.
+ */
+static void outputStreamWriteFile(outputStream_t *stream, const void *data, size_t length)
+{
+    if (stream->error) {
+        return;
+    }
+
+    errno = 0;
+
+    if (fwrite(data, 1, length, stream->file) != length) {
+        stream->error = errno ? errno : EIO;
+        return;
+    }
+
+    stream->stats.bytesWritten += length;
+}
+
+static void outputStreamCompressBuffer(outputStream_t *stream, outputBuffer_t *buffer)
+{
+    int flush = buffer->last ? Z_FINISH : Z_NO_FLUSH;
+
+    stream->zlib.next_in = (Bytef *) buffer->data;
+    stream->zlib.avail_in = (uInt) buffer->length;
+
+    // Keep deflating until zlib stops filling the whole output buffer (for Z_FINISH, that means the stream ended)
+    do {
+        stream->zlib.next_out = (Bytef *) stream->compressed;
+        stream->zlib.avail_out = OUTPUT_STREAM_BUFFER_SIZE;
+
+        deflate(&stream->zlib, flush);
+
+        outputStreamWriteFile(stream, stream->compressed, OUTPUT_STREAM_BUFFER_SIZE - stream->zlib.avail_out);
+    } while (stream->zlib.avail_out == 0 && !stream->error);
+}
+
+static void* outputStreamWriterThread(void *arg)
+{
+    outputStream_t *stream = (outputStream_t *) arg;
+    bool last;
+
+    do {
+        outputBuffer_t *buffer;
+
+        if (!outputStreamHasData(stream)) {
+            int64_t waitStart = time_monotonic_us();
+
+            do {
+                outputStreamSleep(stream, &stream->writerWaiting, &stream->dataAvailable, outputStreamHasData);
+            } while (!outputStreamHasData(stream));
+
+            stream->stats.writerIdleMicros += time_monotonic_us() - waitStart;
+        }
+
+        buffer = &stream->buffers[stream->head % OUTPUT_STREAM_QUEUE_LENGTH];
+
+        if (stream->error) {
+            // The output is already incomplete, so there's no point compressing the rest of it
+        } else if (stream->compressionLevel == OUTPUT_STREAM_COMPRESSION_NONE) {
+            outputStreamWriteFile(stream, buffer->data, buffer->length);
+        } else {
+            outputStreamCompressBuffer(stream, buffer);
+        }
+
+        stream->stats.buffersWritten++;
+
+        last = buffer->last;
+        buffer->length = 0;
+
+        // Hand the buffer back to the formatter
+        atomic_store_u32(&stream->head, stream->head + 1);
+        outputStreamWake(&stream->producerWaiting, &stream->spaceAvailable);
+    } while (!last);
+
+    semaphore_signal(&stream->writerDone);
+
+    return 0;
+}
+
+/**
+ * Hand the buffer that is currently being filled over to the writer thread, and move onto the next buffer (waiting
+ * for the writer to free one up if all of them are in flight).
+ */
+static void outputStreamFlushBuffer(outputStream_t *stream, bool last)
+{
+    stream->fillBuffer->last = last;
+
+    atomic_store_u32(&stream->tail, stream->tail + 1);
+    outputStreamWake(&stream->writerWaiting, &stream->dataAvailable);
+
+    if (last) {
+        stream->fillBuffer = NULL;
+        return;
+    }
+
+    if (!outputStreamHasSpace(stream)) {
+        int64_t waitStart = time_monotonic_us();
+
+        do {
+            outputStreamSleep(stream, &stream->producerWaiting, &stream->spaceAvailable, outputStreamHasSpace);
+        } while (!outputStreamHasSpace(stream));
+
+        stream->stats.producerBlockedMicros += time_monotonic_us() - waitStart;
+        stream->stats.producerBlockedCount++;
+    }
+
+    stream->fillBuffer = &stream->buffers[stream->tail % OUTPUT_STREAM_QUEUE_LENGTH];
+}
+
+/**
+ * Create an output stream that writes to the given file. If `ownsFile` is set, the file will be closed when the
+ * stream is closed.
+ *
+ * compressionLevel - Set to OUTPUT_STREAM_COMPRESSION_NONE for plain output, or a zlib level 1-9 to write gzip.
+ */
+outputStream_t* outputStreamCreate(FILE *file, bool ownsFile, int compressionLevel)
+{
+    outputStream_t *stream = (outputStream_t *) calloc(1, sizeof(*stream));
+
+    stream->file = file;
+    stream->ownsFile = ownsFile;
+    stream->compressionLevel = compressionLevel;
+
+    for (int i = 0; i < OUTPUT_STREAM_QUEUE_LENGTH; i++) {
+        stream->buffers[i].data = malloc(OUTPUT_STREAM_BUFFER_SIZE);
+        stream->buffers[i].capacity = OUTPUT_STREAM_BUFFER_SIZE;
+    }
+
+    stream->fillBuffer = &stream->buffers[0];
+
+    if (compressionLevel != OUTPUT_STREAM_COMPRESSION_NONE) {
+        // Window bits of 15 + 16 asks zlib to wrap the deflate stream in a gzip header/trailer
+        if (deflateInit2(&stream->zlib, compressionLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            fprintf(stderr, "Failed to initialise zlib for compressed output\n");
+            exit(-1);
+        }
+
+        stream->compressed = malloc(OUTPUT_STREAM_BUFFER_SIZE);
+    }
+
+    semaphore_create(&stream->spaceAvailable, 0);
+    semaphore_create(&stream->dataAvailable, 0);
+    semaphore_create(&stream->writerDone, 0);
+
+    thread_create_detached(outputStreamWriterThread, stream);
+
+    return stream;
+}
+
+/**
+ * Create a file with the given name and return an output stream that writes to it, or NULL if the file couldn't
+ * be created.
+ */
+outputStream_t* outputStreamOpen(const char *filename, int compressionLevel)
+{
+    FILE *file = fopen(filename, "wb");
+    outputStream_t *stream;
+
+    if (!file) {
+        return NULL;
+    }
+
+    stream = outputStreamCreate(file, true, compressionLevel);
+    stream->filename = strdup(filename);
+
+    return stream;
+}
+
+/**
+ * Create a stream which collects its output in memory. Its contents can be appended to another stream with
+ * outputStreamTransfer().
+ */
+outputStream_t* outputStreamCreateMemory()
+{
+    outputStream_t *stream = (outputStream_t *) calloc(1, sizeof(*stream));
+
+    stream->fillBuffer = &stream->buffers[0];
+
+    stream->fillBuffer->capacity = 64 * 1024;
+    stream->fillBuffer->data = malloc(stream->fillBuffer->capacity);
+
+    return stream;
+}
+
+/**
+ * Append everything written to the memory stream `source` so far to `destination`, and empty `source`.
+ */
+void outputStreamTransfer(outputStream_t *destination, outputStream_t *source)
+{
+    outputStreamWrite(destination, source->fillBuffer->data, source->fillBuffer->length);
+
+    source->fillBuffer->length = 0;
+}
+
+/**
+ * Make room for at least `len` more bytes in the buffer being filled. Returns false if that isn't possible (the
+ * buffer will be empty but too small).
+ */
+static bool outputStreamReserve(outputStream_t *stream, size_t len)
+{
+    outputBuffer_t *buffer = stream->fillBuffer;
+
+    if (!stream->file) {
+        if (buffer->length + len > buffer->capacity) {
+            while (buffer->length + len > buffer->capacity) {
+                buffer->capacity *= 2;
+            }
+
+            buffer->data = realloc(buffer->data, buffer->capacity);
+        }
+
+        return true;
+    }
+
+    outputStreamFlushBuffer(stream, false);
+
+    return len <= stream->fillBuffer->capacity;
+}
+
+/**
+ * Write out any buffered data, finish compression and close the stream (and its file, if the stream owns it).
+ *
+ * If `statistics` is non-NULL, the stream's counters are added to it.
+ *
+ * Returns false if some of the output couldn't be written (e.g. the disk was full), after printing why to stderr.
+ */
+bool outputStreamClose(outputStream_t *stream, outputStreamStatistics_t *statistics)
+{
+    bool success;
+
+    if (!stream)
+        return true;
+
+    if (!stream->file) {
+        free(stream->fillBuffer->data);
+        free(stream);
+        return true;
+    }
+
+    outputStreamFlushBuffer(stream, true);
+
+    semaphore_wait(&stream->writerDone);
+
+    if (stream->compressionLevel != OUTPUT_STREAM_COMPRESSION_NONE) {
+        deflateEnd(&stream->zlib);
+        free(stream->compressed);
+    }
+
+    semaphore_destroy(&stream->spaceAvailable);
+    semaphore_destroy(&stream->dataAvailable);
+    semaphore_destroy(&stream->writerDone);
+
+    // Data that stdio still had buffered only gets written now, so this can fail too
+    errno = 0;
+
+    if (stream->ownsFile) {
+        if (fclose(stream->file) != 0 && !stream->error) {
+            stream->error = errno ? errno : EIO;
+        }
+    } else {
+        if (fflush(stream->file) != 0 && !stream->error) {
+            stream->error = errno ? errno : EIO;
+        }
+    }
+
+    success = stream->error == 0;
+
+    if (!success) {
+        fprintf(stderr, "Failed to write to %s: %s\n", stream->filename ? stream->filename : stream->file == stdout ? "stdout" : "the output",
+            strerror(stream->error));
+    }
+
+    if (statistics) {
+        statistics->producerBlockedMicros += stream->stats.producerBlockedMicros;
+        statistics->writerIdleMicros += stream->stats.writerIdleMicros;
+        statistics->producerBlockedCount += stream->stats.producerBlockedCount;
+        statistics->buffersWritten += stream->stats.buffersWritten;
+        statistics->bytesWritten += stream->stats.bytesWritten;
+        statistics->streamsFailed += success ? 0 : 1;
+    }
+
+    for (int i = 0; i < OUTPUT_STREAM_QUEUE_LENGTH; i++) {
+        free(stream->buffers[i].data);
+    }
+
+    free(stream->filename);
+    free(stream);
+
+    return success;
+}
+
+void outputStreamWrite(outputStream_t *stream, const void *data, size_t len)
+{
+    const char *src = (const char *) data;
+
+    if (!stream->file) {
+        outputStreamReserve(stream, len);
+    }
+
+    while (len > 0) {
+        outputBuffer_t *buffer = stream->fillBuffer;
+        size_t space = buffer->capacity - buffer->length;
+        size_t chunk = len < space ? len : space;
+
+        memcpy(buffer->data + buffer->length, src, chunk);
+        buffer->length += chunk;
+
+        src += chunk;
+        len -= chunk;
+
+        if (buffer->length == buffer->capacity && stream->file) {
+            outputStreamFlushBuffer(stream, false);
+        }
+    }
+}
+
+void outputStreamPrintf(outputStream_t *stream, const char *format, ...)
+{
+    outputBuffer_t *buffer = stream->fillBuffer;
+    size_t space = buffer->capacity - buffer->length;
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(buffer->data + buffer->length, space, format, args);
+    va_end(args);
+
+    if (len < 0) {
+        return;
+    }
+
+    if ((size_t) len < space) {
+        buffer->length += len;
+        return;
+    }
+
+    // The text didn't fit in the remainder of this buffer, so make more room and format it again
+    if (outputStreamReserve(stream, len + 1)) {
+        buffer = stream->fillBuffer;
+
+        va_start(args, format);
+        vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+        va_end(args);
+
+        buffer->length += len;
+    } else {
+        char *text = malloc(len + 1);
+
+        va_start(args, format);
+        vsnprintf(text, len + 1, format, args);
+        va_end(args);
+
+        outputStreamWrite(stream, text, len);
+
+        free(text);
+    }
+}
+
+/**
+ * Write `value` in decimal, this is several times faster than using outputStreamPrintf("%" PRId64).
+ */
+void outputStreamWriteInt(outputStream_t *stream, int64_t value)
+{
+    // Longest is "-9223372036854775808"
+    char text[20];
+    char *end = text + sizeof(text);
+    char *pos = end;
+    uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+    outputBuffer_t *buffer;
+    size_t len;
+
+    while (magnitude >= 100) {
+        pos -= 2;
+        memcpy(pos, DIGIT_PAIRS + (magnitude % 100) * 2, 2);
+        magnitude /= 100;
+    }
+
+    if (magnitude >= 10) {
+        pos -= 2;
+        memcpy(pos, DIGIT_PAIRS + magnitude * 2, 2);
+    } else {
+        *--pos = (char) ('0' + magnitude);
+    }
+
+    if (value < 0) {
+        *--pos = '-';
+    }
+
+    len = end - pos;
+    buffer = stream->fillBuffer;
+
+    if (buffer->capacity - buffer->length >= len) {
+        memcpy(buffer->data + buffer->length, pos, len);
+        buffer->length += len;
+    } else {
+        outputStreamWrite(stream, pos, len);
+    }
+}
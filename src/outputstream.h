@@ -0,0 +1,45 @@
+#ifndef OUTPUTSTREAM_H_
+#define OUTPUTSTREAM_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OUTPUT_STREAM_COMPRESSION_NONE 0
+#define OUTPUT_STREAM_COMPRESSION_DEFAULT_LEVEL 6
+
+typedef struct outputStream_t outputStream_t;
+
+/**
+ * Counters describing how well the formatting thread and the writer thread kept up with each other.
+ */
+typedef struct outputStreamStatistics_t {
+    // Time the formatting thread spent waiting for the writer because all buffers were in flight
+    int64_t producerBlockedMicros;
+    // Time the writer thread spent waiting for the formatter to fill a buffer
+    int64_t writerIdleMicros;
+
+    uint32_t producerBlockedCount;
+    uint32_t buffersWritten;
+    uint64_t bytesWritten;
+
+    // Streams that couldn't write all of their output
+    uint32_t streamsFailed;
+} outputStreamStatistics_t;
+
+outputStream_t* outputStreamCreate(FILE *file, bool ownsFile, int compressionLevel);
+outputStream_t* outputStreamOpen(const char *filename, int compressionLevel);
+outputStream_t* outputStreamCreateMemory();
+void outputStreamTransfer(outputStream_t *destination, outputStream_t *source);
+bool outputStreamClose(outputStream_t *stream, outputStreamStatistics_t *statistics);
+
+void outputStreamWrite(outputStream_t *stream, const void *data, size_t len);
+void outputStreamWriteInt(outputStream_t *stream, int64_t value);
+void outputStreamPrintf(outputStream_t *stream, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__ ((format (printf, 2, 3)))
+#endif
+;
+
+#endif
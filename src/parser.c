@@ -329,6 +329,9 @@ static size_t parseHeaderLine(flightLog_t *log, mmapStream_t *stream, ParserStat
 
         if (c == '\n') {
             i++;//size includes the newline.
+
+            // The header block of this log extends at least as far as the end of this line
+            log->logHeaderEnd[log->private->logIndex] = stream->pos;
             break;
         }
 
@@ -828,23 +831,57 @@ static void parseEventFrame(flightLog_t *log, mmapStream_t *stream, bool raw)
     }
 }
 
+/**
+ * Widen the running range of each field to include the given frame. This is branch-free so that the compiler can
+ * vectorize it (given an instruction set with 64-bit comparisons, like ARCH_FLAGS=-msse4.2).
+ */
+static void updateFieldRanges(const int64_t * restrict fields, int64_t * restrict min, int64_t * restrict max, int fieldCount)
+{
+    for (int i = 0; i < fieldCount; i++) {
+        int64_t value = fields[i];
+
+        min[i] = value < min[i] ? value : min[i];
+        max[i] = value > max[i] ? value : max[i];
+    }
+}
+
 static void updateMainFieldStatistics(flightLog_t *log, int64_t *fields)
 {
-    int i;
-    flightLogFrameDef_t *frameDef = &log->frameDefs['I'];
+    updateFieldRanges(fields, log->private->mainFieldMin, log->private->mainFieldMax, log->frameDefs['I'].fieldCount);
 
-    if (!log->stats.haveFieldStats) {
-        //If this is the first frame, there are no minimums or maximums in the stats to compare with
-        for (i = 0; i < frameDef->fieldCount; i++) {
-            log->stats.field[i].max = fields[i];
-            log->stats.field[i].min = fields[i];
+    log->stats.haveFieldStats = true;
+}
+
+/**
+ * Add the statistics from another parse (e.g. of a different range of the same log, or of another log with the same
+ * fields) to `stats`, so that the totals are the same as if all the frames had been parsed in one go.
+ */
+void flightLogStatisticsMerge(flightLogStatistics_t *stats, const flightLogStatistics_t *other)
+{
+    stats->totalBytes += other->totalBytes;
+    stats->totalCorruptFrames += other->totalCorruptFrames;
+    stats->intentionallyAbsentIterations += other->intentionallyAbsentIterations;
+
+    if (other->haveFieldStats) {
+        if (stats->haveFieldStats) {
+            for (int i = 0; i < FLIGHT_LOG_MAX_FIELDS; i++) {
+                stats->field[i].min = other->field[i].min < stats->field[i].min ? other->field[i].min : stats->field[i].min;
+                stats->field[i].max = other->field[i].max > stats->field[i].max ? other->field[i].max : stats->field[i].max;
+            }
+        } else {
+            memcpy(stats->field, other->field, sizeof(stats->field));
+            stats->haveFieldStats = true;
         }
+    }
 
-        log->stats.haveFieldStats = true;
-    } else {
-        for (i = 0; i < frameDef->fieldCount; i++) {
-            log->stats.field[i].max = fields[i] > log->stats.field[i].max ? fields[i] : log->stats.field[i].max;
-            log->stats.field[i].min = fields[i] < log->stats.field[i].min ? fields[i] : log->stats.field[i].min;
+    for (int i = 0; i < 256; i++) {
+        stats->frame[i].bytes += other->frame[i].bytes;
+        stats->frame[i].validCount += other->frame[i].validCount;
+        stats->frame[i].desyncCount += other->frame[i].desyncCount;
+        stats->frame[i].corruptCount += other->frame[i].corruptCount;
+
+        for (int j = 0; j <= FLIGHT_LOG_MAX_FRAME_LENGTH; j++) {
+            stats->frame[i].sizeCount[j] += other->frame[i].sizeCount[j];
         }
     }
 }
@@ -1299,7 +1336,12 @@ static void resetSysConfigToDefaults(flightLogSysConfig_t *config)
     config->firmwareType = FIRMWARE_TYPE_UNKNOWN;
 }
 
-bool flightLogParse(flightLog_t *log, int logIndex, FlightLogMetadataReady onMetadataReady, FlightLogFrameReady onFrameReady, FlightLogEventReady onEvent, bool raw) {
+/**
+ * Parse the log with the given index. If `headersOnly` is set, parsing stops once the headers have been read (and
+ * onMetadataReady isn't called). If `range` is non-NULL, only the frames in that range of the log are parsed.
+ */
+static bool flightLogParseInternal(flightLog_t *log, int logIndex, FlightLogMetadataReady onMetadataReady, FlightLogFrameReady onFrameReady, FlightLogEventReady onEvent, bool raw, bool headersOnly,
+    const flightLogDataRange_t *range) {
     ParserState parserState = PARSER_STATE_HEADER;
     const flightLogFrameType_t *frameType = 0;
 
@@ -1346,11 +1388,19 @@ bool flightLogParse(flightLog_t *log, int logIndex, FlightLogMetadataReady onMet
     private->lastMainFrameIteration = (uint32_t) -1;
     private->lastMainFrameTime = -1;
 
+    for (int i = 0; i < FLIGHT_LOG_MAX_FIELDS; i++) {
+        private->mainFieldMin[i] = INT64_MAX;
+        private->mainFieldMax[i] = INT64_MIN;
+    }
+
     private->onMetadataReady = onMetadataReady;
     private->onFrameReady = onFrameReady;
     private->onEvent = onEvent;
 
     //Set parsing ranges up for the log the caller selected
+    private->logIndex = logIndex;
+    log->logHeaderEnd[logIndex] = log->logBegin[logIndex];
+
     private->stream->start = log->logBegin[logIndex];
     private->stream->pos = private->stream->start;
     private->stream->end = log->logBegin[logIndex + 1];
@@ -1365,7 +1415,10 @@ bool flightLogParse(flightLog_t *log, int logIndex, FlightLogMetadataReady onMet
                     fillSerialBuffer(private->stream, frameSize, &parserState);
                 }
             } else if (command == EOF) {
-                fprintf(stderr, "Data file contained no events\n");
+                // Only worth mentioning to callers who were listening for events (a --query search isn't)
+                if (onEvent) {
+                    fprintf(stderr, "Data file contained no events\n");
+                }
                 break;
             } 
             if (parserState == PARSER_STATE_TRANSITION) {
@@ -1388,6 +1441,17 @@ bool flightLogParse(flightLog_t *log, int logIndex, FlightLogMetadataReady onMet
                         }
                     }
 
+                    if (headersOnly) {
+                        return true;
+                    }
+
+                    if (range) {
+                        // Skip straight to the requested frames, picking the timestamp rollover count up from there too
+                        private->stream->pos = private->stream->data + range->start;
+                        private->stream->end = private->stream->data + range->end;
+                        private->timeRolloverAccumulator = range->timeRolloverAccumulator;
+                    }
+
                     parserState = PARSER_STATE_DATA;
                     frameType = NULL;
 
@@ -1477,9 +1541,42 @@ bool flightLogParse(flightLog_t *log, int logIndex, FlightLogMetadataReady onMet
     done:
     log->stats.totalBytes = private->stream->end - private->stream->start;
 
+    if (log->stats.haveFieldStats) {
+        for (int i = 0; i < log->frameDefs['I'].fieldCount; i++) {
+            log->stats.field[i].min = private->mainFieldMin[i];
+            log->stats.field[i].max = private->mainFieldMax[i];
+        }
+    }
+
     return true;
 }
 
+bool flightLogParse(flightLog_t *log, int logIndex, FlightLogMetadataReady onMetadataReady, FlightLogFrameReady onFrameReady, FlightLogEventReady onEvent, bool raw)
+{
+    return flightLogParseInternal(log, logIndex, onMetadataReady, onFrameReady, onEvent, raw, false, NULL);
+}
+
+/**
+ * Parse just the frames in the given range of the log, as if the log began there. The range must begin with an
+ * intraframe (or else frames will be dropped until the next one arrives) and lie within the log's data section.
+ *
+ * The log's statistics only cover the frames in the range.
+ */
+bool flightLogParseRange(flightLog_t *log, int logIndex, const flightLogDataRange_t *range, FlightLogMetadataReady onMetadataReady,
+    FlightLogFrameReady onFrameReady, FlightLogEventReady onEvent, bool raw)
+{
+    return flightLogParseInternal(log, logIndex, onMetadataReady, onFrameReady, onEvent, raw, false, range);
+}
+
+/**
+ * Read just the headers of the given log, which fills in the field definitions and system configuration without
+ * decoding any frames. The log's statistics are left empty.
+ */
+bool flightLogParseHeaders(flightLog_t *log, int logIndex)
+{
+    return flightLogParseInternal(log, logIndex, NULL, NULL, NULL, false, true, NULL);
+}
+
 void flightLogDestroy(flightLog_t *log)
 {
     streamDestroy(log->private->stream);
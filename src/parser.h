@@ -156,6 +156,9 @@ typedef struct flightLog_t {
     const char *logBegin[FLIGHT_LOG_MAX_LOGS_IN_FILE + 1];
     int logCount;
 
+    // End of the block of "H" header lines at the start of each log, recorded when that log is parsed
+    const char *logHeaderEnd[FLIGHT_LOG_MAX_LOGS_IN_FILE];
+
     unsigned int frameIntervalI;
     unsigned int frameIntervalPNum, frameIntervalPDenom;
 
@@ -173,10 +176,24 @@ typedef void (*FlightLogMetadataReady)(flightLog_t *log);
 typedef void (*FlightLogFrameReady)(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int fieldCount, int frameOffset, int frameSize);
 typedef void (*FlightLogEventReady)(flightLog_t *log, flightLogEvent_t *event);
 
+/**
+ * A range of a log's data section to parse, given as byte offsets from the start of the log file. The range should
+ * begin at the marker of an intraframe.
+ */
+typedef struct flightLogDataRange_t {
+    int64_t start, end;
+
+    // The timestamp rollover count in effect at the start of the range (see flightLogDetectAndApplyTimestampRollover)
+    int64_t timeRolloverAccumulator;
+} flightLogDataRange_t;
+
 typedef struct flightLogPrivate_t
 {
     int dataVersion;
 
+    // Index of the log that's currently being parsed
+    int logIndex;
+
     char fcVersion[30];
 
     // Blackbox state:
@@ -208,6 +225,13 @@ typedef struct flightLogPrivate_t
     uint32_t lastMainFrameIteration;
     int64_t lastMainFrameTime;
 
+    /*
+     * The range of each main field over the frames parsed so far. These are separate arrays (rather than being kept in
+     * log->stats.field) so that updating them is a simple loop the compiler can vectorize, and they're copied into the
+     * log's statistics when parsing ends.
+     */
+    int64_t mainFieldMin[FLIGHT_LOG_MAX_FIELDS], mainFieldMax[FLIGHT_LOG_MAX_FIELDS];
+
     // Event handlers:
     FlightLogMetadataReady onMetadataReady;
     FlightLogFrameReady onFrameReady;
@@ -229,6 +253,11 @@ void flightlogFlightStateToString(uint32_t flightState, char *dest, int destLen)
 void flightlogFailsafePhaseToString(uint8_t failsafePhase, char *dest, int destLen);
 
 bool flightLogParse(flightLog_t *log, int logIndex, FlightLogMetadataReady onMetadataReady, FlightLogFrameReady onFrameReady, FlightLogEventReady onEvent, bool raw);
+bool flightLogParseHeaders(flightLog_t *log, int logIndex);
+bool flightLogParseRange(flightLog_t *log, int logIndex, const flightLogDataRange_t *range, FlightLogMetadataReady onMetadataReady,
+    FlightLogFrameReady onFrameReady, FlightLogEventReady onEvent, bool raw);
+void flightLogStatisticsMerge(flightLogStatistics_t *stats, const flightLogStatistics_t *other);
+
 void flightLogDestroy(flightLog_t *log);
 
 #endif
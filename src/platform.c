@@ -6,6 +6,7 @@
     #include <sys/stat.h>
     #include <stdlib.h>
     #include <stdint.h>
+    #include <time.h>
 #endif
 
 
@@ -87,7 +88,7 @@ void semaphore_create(semaphore_t *sem, int initialCount)
 #if defined(__APPLE__)
     *sem = dispatch_semaphore_create(initialCount);
 #elif defined(WIN32)
-    *sem = CreateSemaphore(NULL, initialCount, initialCount, NULL);
+    *sem = CreateSemaphore(NULL, initialCount, LONG_MAX, NULL);
 #else
     sem_init(sem, 0, initialCount);
 #endif
@@ -104,6 +105,63 @@ sem_destroy(sem);
 #endif
 }
 
+uint32_t atomic_load_u32(volatile uint32_t *ptr)
+{
+#if defined(WIN32)
+    return (uint32_t) InterlockedCompareExchange((volatile LONG *) ptr, 0, 0);
+#else
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+#endif
+}
+
+void atomic_store_u32(volatile uint32_t *ptr, uint32_t value)
+{
+#if defined(WIN32)
+    InterlockedExchange((volatile LONG *) ptr, (LONG) value);
+#else
+    __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+uint32_t atomic_exchange_u32(volatile uint32_t *ptr, uint32_t value)
+{
+#if defined(WIN32)
+    return (uint32_t) InterlockedExchange((volatile LONG *) ptr, (LONG) value);
+#else
+    return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/**
+ * Add to the value and return what it was before.
+ */
+uint32_t atomic_fetch_add_u32(volatile uint32_t *ptr, uint32_t value)
+{
+#if defined(WIN32)
+    return (uint32_t) InterlockedExchangeAdd((volatile LONG *) ptr, (LONG) value);
+#else
+    return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+int64_t time_monotonic_us()
+{
+#if defined(WIN32)
+    LARGE_INTEGER frequency, counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    return (int64_t) (counter.QuadPart / frequency.QuadPart * 1000000 + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
 bool directory_create(const char *name)
 {
 #if defined(WIN32)
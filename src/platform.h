@@ -2,6 +2,7 @@
 #define PLATFORM_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #define FLIGHT_LOG_MAX_FRAME_SERIAL_BUFFER_LENGTH 1024
 #define FLIGHT_LOG_MAX_FRAME_LENGTH 256
@@ -72,6 +73,18 @@ void semaphore_destroy(semaphore_t *sem);
 void semaphore_wait(semaphore_t *sem);
 void semaphore_signal(semaphore_t *sem);
 
+/*
+ * Sequentially-consistent atomic operations on 32-bit values shared between threads, for lock-free handoff of work
+ * between a pair of threads.
+ */
+uint32_t atomic_load_u32(volatile uint32_t *ptr);
+void atomic_store_u32(volatile uint32_t *ptr, uint32_t value);
+uint32_t atomic_exchange_u32(volatile uint32_t *ptr, uint32_t value);
+uint32_t atomic_fetch_add_u32(volatile uint32_t *ptr, uint32_t value);
+
+// Monotonic clock for measuring elapsed time, in microseconds:
+int64_t time_monotonic_us();
+
 bool directory_create(const char *name);
 
 void platform_init();
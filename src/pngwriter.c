@@ -0,0 +1,527 @@
+/**
+ * A PNG writer for Cairo's ARGB32 image surfaces, which is much quicker than cairo_surface_write_to_png() for the
+ * renderer's frames.
+ *
+ * Cairo's writer (through libpng) tries every PNG filter on every row to pick the best, then deflates the result at
+ * zlib's default level. Our frames are mostly flat overlay graphics on a transparent background, which compress about
+ * as well with one cheap filter for every row, and the zlib level and strategy can be chosen to trade size for speed.
+ *
+ * The image can also be split into horizontal stripes which are filtered and deflated on separate threads (like pigz
+ * does). Each stripe's raw deflate data ends on a byte boundary (after a sync flush) so that the stripes can simply be
+ * concatenated into one zlib stream, with their Adler-32 checksums combined for its trailer. Each stripe is primed with
+ * the 32kB of filtered image data that precedes it as its dictionary, so it barely costs any compression.
+ *
+ * A writer keeps its buffers, zlib streams and stripe threads from one image to the next, since the renderer writes
+ * thousands of images of the same size.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "platform.h"
+#include "pngwriter.h"
+
+#define DEFLATE_WINDOW_SIZE 32768
+
+// Room for the empty stored block that ends a sync flush, on top of zlib's estimate for the compressed size
+#define DEFLATE_FLUSH_MARGIN 16
+
+static const uint8_t PNG_SIGNATURE[] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+typedef struct pngStripe_t {
+    pngWriter_t *writer;
+
+    // The image being written, the rows of it in this stripe, and whether it's the last stripe (which ends the
+    // deflate stream)
+    const uint8_t *data;
+    int width, stride;
+    int firstRow, endRow;
+    bool last;
+
+    size_t compressedSize;
+
+    // Adler-32 of this stripe's uncompressed (filtered) data, and its length
+    uLong adler;
+    size_t rawSize;
+
+    bool ok;
+
+    // Kept from one image to the next
+    z_stream zlib;
+    bool zlibReady;
+
+    uint8_t *filtered, *compressed, *rows;
+    size_t filteredCapacity, compressedCapacity, rowsCapacity;
+
+    uint32_t allocationCount;
+
+    // Signalled to have the stripe's thread deflate it (or exit, once the writer is being destroyed)
+    semaphore_t start;
+} pngStripe_t;
+
+struct pngWriter_t {
+    pngWriterOptions_t options;
+
+    int stripeCount;
+    pngStripe_t stripes[PNG_WRITER_MAX_STRIPES];
+
+    // Signalled by the stripe threads when they finish a stripe, and when they exit
+    semaphore_t stripeDone, stripeThreadExited;
+    volatile uint32_t exiting;
+};
+
+typedef struct pngChunkWriter_t {
+    FILE *file;
+    uLong crc;
+    bool ok;
+} pngChunkWriter_t;
+
+static int zlibStrategy(PNGStrategy strategy)
+{
+    switch (strategy) {
+        case PNG_STRATEGY_FILTERED:
+            return Z_FILTERED;
+        case PNG_STRATEGY_RLE:
+            return Z_RLE;
+        case PNG_STRATEGY_HUFFMAN:
+            return Z_HUFFMAN_ONLY;
+        default:
+            return Z_DEFAULT_STRATEGY;
+    }
+}
+
+/**
+ * The two byte zlib header for a stream compressed with these options, flagging the compression level the same way
+ * that zlib would.
+ */
+static uint16_t zlibHeader(const pngWriterOptions_t *options)
+{
+    uint16_t header = 0x78 << 8; // Deflate with a 32kB window
+    int levelFlags;
+
+    if (options->strategy == PNG_STRATEGY_RLE || options->strategy == PNG_STRATEGY_HUFFMAN || options->compressionLevel < 2)
+        levelFlags = 0;
+    else if (options->compressionLevel < 6)
+        levelFlags = 1;
+    else if (options->compressionLevel == 6)
+        levelFlags = 2;
+    else
+        levelFlags = 3;
+
+    header |= levelFlags << 6;
+
+    // The header's check bits make it a multiple of 31
+    header += 31 - header % 31;
+
+    return header;
+}
+
+/*
+ * PNG wants straight (not premultiplied) alpha, so undo Cairo's premultiplication the same way that Cairo's own
+ * writer does.
+ */
+static void unpremultiplyRow(const uint32_t *argb, int width, uint8_t *rgba)
+{
+    for (int x = 0; x < width; x++) {
+        uint32_t pixel = argb[x];
+        uint32_t a = pixel >> 24;
+
+        if (a == 0xFF) {
+            rgba[0] = (uint8_t) (pixel >> 16);
+            rgba[1] = (uint8_t) (pixel >> 8);
+            rgba[2] = (uint8_t) pixel;
+            rgba[3] = 0xFF;
+        } else if (a == 0) {
+            rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+        } else {
+            rgba[0] = (uint8_t) ((((pixel >> 16) & 0xFF) * 255 + a / 2) / a);
+            rgba[1] = (uint8_t) ((((pixel >> 8) & 0xFF) * 255 + a / 2) / a);
+            rgba[2] = (uint8_t) (((pixel & 0xFF) * 255 + a / 2) / a);
+            rgba[3] = (uint8_t) a;
+        }
+
+        rgba += 4;
+    }
+}
+
+/**
+ * Filter a row of RGBA pixels into the PNG's data, starting with its filter type byte. previous is the row above
+ * (all zeros for the first row of the image).
+ */
+static void filterRow(PNGFilter filter, const uint8_t *current, const uint8_t *previous, int rowLength, uint8_t *output)
+{
+    *output++ = (uint8_t) filter;
+
+    switch (filter) {
+        case PNG_FILTER_SUB:
+            memcpy(output, current, 4);
+
+            for (int i = 4; i < rowLength; i++)
+                output[i] = (uint8_t) (current[i] - current[i - 4]);
+        break;
+        case PNG_FILTER_UP:
+            for (int i = 0; i < rowLength; i++)
+                output[i] = (uint8_t) (current[i] - previous[i]);
+        break;
+        default:
+            memcpy(output, current, rowLength);
+    }
+}
+
+/**
+ * Make sure the buffer can hold at least size bytes. Its old contents are lost if it has to grow.
+ */
+static void reserveBuffer(pngStripe_t *stripe, uint8_t **buffer, size_t *capacity, size_t size)
+{
+    if (size > *capacity) {
+        free(*buffer);
+
+        *buffer = malloc(size);
+        *capacity = size;
+
+        stripe->allocationCount++;
+    }
+}
+
+/**
+ * The number of rows before the given row that need to be filtered to fill the deflate window, so they can be used as
+ * a stripe's dictionary.
+ */
+static int dictionaryRowCount(int firstRow, size_t filteredRowLength)
+{
+    int rows = (DEFLATE_WINDOW_SIZE + filteredRowLength - 1) / filteredRowLength;
+
+    return firstRow > rows ? rows : firstRow;
+}
+
+/**
+ * Make sure the stripe's buffers are big enough for its rows of the image, which is set up in the stripe.
+ */
+static void reserveStripeBuffers(pngStripe_t *stripe)
+{
+    size_t rowLength = (size_t) stripe->width * 4;
+    size_t filteredRowLength = rowLength + 1;
+    int startRow = stripe->firstRow - dictionaryRowCount(stripe->firstRow, filteredRowLength);
+
+    reserveBuffer(stripe, &stripe->filtered, &stripe->filteredCapacity, (size_t) (stripe->endRow - startRow) * filteredRowLength);
+    reserveBuffer(stripe, &stripe->rows, &stripe->rowsCapacity, rowLength * 2);
+
+    if (stripe->zlibReady) {
+        reserveBuffer(stripe, &stripe->compressed, &stripe->compressedCapacity,
+            deflateBound(&stripe->zlib, (uLong) (stripe->endRow - stripe->firstRow) * filteredRowLength) + DEFLATE_FLUSH_MARGIN);
+    }
+}
+
+/**
+ * Filter and deflate the rows of one stripe of the image.
+ */
+static void deflateStripe(pngStripe_t *stripe)
+{
+    const pngWriterOptions_t *options = &stripe->writer->options;
+    int rowLength = stripe->width * 4;
+    size_t filteredRowLength = rowLength + 1;
+
+    int startRow = stripe->firstRow - dictionaryRowCount(stripe->firstRow, filteredRowLength);
+    size_t dictionaryLength = (size_t) (stripe->firstRow - startRow) * filteredRowLength;
+
+    uint8_t *current, *previous, *swap;
+    int flush = stripe->last ? Z_FINISH : Z_SYNC_FLUSH;
+    int status;
+
+    stripe->ok = stripe->zlibReady;
+
+    if (!stripe->ok)
+        return;
+
+    reserveStripeBuffers(stripe);
+
+    current = stripe->rows;
+    previous = stripe->rows + rowLength;
+
+    if (startRow > 0)
+        unpremultiplyRow((const uint32_t *) (stripe->data + (size_t) (startRow - 1) * stripe->stride), stripe->width, previous);
+    else
+        memset(previous, 0, rowLength);
+
+    for (int row = startRow; row < stripe->endRow; row++) {
+        unpremultiplyRow((const uint32_t *) (stripe->data + (size_t) row * stripe->stride), stripe->width, current);
+        filterRow(options->filter, current, previous, rowLength, stripe->filtered + (size_t) (row - startRow) * filteredRowLength);
+
+        swap = previous;
+        previous = current;
+        current = swap;
+    }
+
+    stripe->rawSize = (size_t) (stripe->endRow - stripe->firstRow) * filteredRowLength;
+    stripe->adler = adler32(adler32(0, Z_NULL, 0), stripe->filtered + dictionaryLength, (uInt) stripe->rawSize);
+
+    deflateReset(&stripe->zlib);
+
+    if (dictionaryLength > 0) {
+        size_t usedLength = dictionaryLength > DEFLATE_WINDOW_SIZE ? DEFLATE_WINDOW_SIZE : dictionaryLength;
+
+        deflateSetDictionary(&stripe->zlib, stripe->filtered + dictionaryLength - usedLength, (uInt) usedLength);
+    }
+
+    stripe->zlib.next_in = stripe->filtered + dictionaryLength;
+    stripe->zlib.avail_in = (uInt) stripe->rawSize;
+    stripe->zlib.next_out = stripe->compressed;
+    stripe->zlib.avail_out = (uInt) stripe->compressedCapacity;
+
+    status = deflate(&stripe->zlib, flush);
+
+    // The output buffer is big enough for the whole stripe, so it should all be done in one call
+    stripe->ok = (flush == Z_FINISH ? status == Z_STREAM_END : status == Z_OK) && stripe->zlib.avail_in == 0 && stripe->zlib.avail_out > 0;
+    stripe->compressedSize = stripe->compressedCapacity - stripe->zlib.avail_out;
+}
+
+/**
+ * Deflate stripes of each image for the writer whenever asked, until the writer is destroyed.
+ */
+static void* deflateStripeThread(void *arg)
+{
+    pngStripe_t *stripe = (pngStripe_t *) arg;
+    pngWriter_t *writer = stripe->writer;
+
+    while (1) {
+        semaphore_wait(&stripe->start);
+
+        if (atomic_load_u32(&writer->exiting))
+            break;
+
+        deflateStripe(stripe);
+
+        semaphore_signal(&writer->stripeDone);
+    }
+
+    semaphore_signal(&writer->stripeThreadExited);
+
+    return 0;
+}
+
+/**
+ * Divide the image up between the first stripeCount stripes.
+ */
+static void layoutStripes(pngWriter_t *writer, int stripeCount, const uint8_t *data, int width, int height, int stride)
+{
+    for (int i = 0; i < stripeCount; i++) {
+        pngStripe_t *stripe = &writer->stripes[i];
+
+        stripe->data = data;
+        stripe->width = width;
+        stripe->stride = stride;
+        stripe->firstRow = (int) ((int64_t) height * i / stripeCount);
+        stripe->endRow = (int) ((int64_t) height * (i + 1) / stripeCount);
+        stripe->last = i == stripeCount - 1;
+    }
+}
+
+static void pngChunkWrite(pngChunkWriter_t *writer, const void *data, size_t length)
+{
+    writer->crc = crc32(writer->crc, (const Bytef *) data, (uInt) length);
+
+    if (fwrite(data, 1, length, writer->file) != length)
+        writer->ok = false;
+}
+
+static void pngChunkWriteU32(pngChunkWriter_t *writer, uint32_t value)
+{
+    uint8_t bytes[4] = {(uint8_t) (value >> 24), (uint8_t) (value >> 16), (uint8_t) (value >> 8), (uint8_t) value};
+
+    pngChunkWrite(writer, bytes, sizeof(bytes));
+}
+
+/**
+ * Begin a chunk of the given type and data length. The CRC covers the type and the data but not the length.
+ */
+static void pngChunkBegin(pngChunkWriter_t *writer, const char *type, uint32_t length)
+{
+    pngChunkWriteU32(writer, length);
+
+    writer->crc = crc32(0, Z_NULL, 0);
+
+    pngChunkWrite(writer, type, 4);
+}
+
+static void pngChunkEnd(pngChunkWriter_t *writer)
+{
+    pngChunkWriteU32(writer, (uint32_t) writer->crc);
+}
+
+/**
+ * Create a writer for images of the given size with these options. Its buffers are allocated up front and its
+ * threads (when options->stripes is more than one) are started up front, so that writing images doesn't need to
+ * allocate memory or start threads. Images of other sizes can be written too, but larger ones will need their
+ * buffers to be enlarged.
+ */
+pngWriter_t* pngWriterCreate(const pngWriterOptions_t *options, int width, int height)
+{
+    pngWriter_t *writer = (pngWriter_t *) calloc(1, sizeof(*writer));
+
+    writer->options = *options;
+
+    writer->stripeCount = options->stripes;
+
+    if (writer->stripeCount > PNG_WRITER_MAX_STRIPES)
+        writer->stripeCount = PNG_WRITER_MAX_STRIPES;
+    if (writer->stripeCount > height)
+        writer->stripeCount = height;
+    if (writer->stripeCount < 1)
+        writer->stripeCount = 1;
+
+    layoutStripes(writer, writer->stripeCount, NULL, width, height, width * 4);
+
+    semaphore_create(&writer->stripeDone, 0);
+    semaphore_create(&writer->stripeThreadExited, 0);
+
+    for (int i = 0; i < writer->stripeCount; i++) {
+        pngStripe_t *stripe = &writer->stripes[i];
+
+        stripe->writer = writer;
+
+        // Negative window bits asks for raw deflate data, since we write the zlib header and trailer ourselves
+        stripe->zlibReady = deflateInit2(&stripe->zlib, options->compressionLevel, Z_DEFLATED, -15, 8,
+            zlibStrategy(options->strategy)) == Z_OK;
+
+        reserveStripeBuffers(stripe);
+
+        // The first stripe is deflated on the thread that's writing the image
+        if (i > 0) {
+            semaphore_create(&stripe->start, 0);
+            thread_create_detached(deflateStripeThread, stripe);
+        }
+    }
+
+    return writer;
+}
+
+void pngWriterDestroy(pngWriter_t *writer)
+{
+    if (!writer)
+        return;
+
+    atomic_store_u32(&writer->exiting, 1);
+
+    for (int i = 1; i < writer->stripeCount; i++)
+        semaphore_signal(&writer->stripes[i].start);
+
+    for (int i = 1; i < writer->stripeCount; i++)
+        semaphore_wait(&writer->stripeThreadExited);
+
+    for (int i = 0; i < writer->stripeCount; i++) {
+        pngStripe_t *stripe = &writer->stripes[i];
+
+        if (stripe->zlibReady)
+            deflateEnd(&stripe->zlib);
+
+        if (i > 0)
+            semaphore_destroy(&stripe->start);
+
+        free(stripe->filtered);
+        free(stripe->compressed);
+        free(stripe->rows);
+    }
+
+    semaphore_destroy(&writer->stripeDone);
+    semaphore_destroy(&writer->stripeThreadExited);
+
+    free(writer);
+}
+
+/**
+ * The number of buffers that the writer has allocated so far, including the ones it was created with.
+ */
+uint32_t pngWriterGetAllocationCount(const pngWriter_t *writer)
+{
+    uint32_t count = 0;
+
+    for (int i = 0; i < writer->stripeCount; i++)
+        count += writer->stripes[i].allocationCount;
+
+    return count;
+}
+
+/**
+ * Write an image of native-endian premultiplied ARGB32 pixels (as drawn by Cairo) to the file as an 8-bit RGBA PNG.
+ * Only one image can be written by a writer at a time.
+ *
+ * Returns false if the image couldn't be compressed or written.
+ */
+bool pngWriterWriteARGB32(pngWriter_t *writer, FILE *file, const uint8_t *data, int width, int height, int stride)
+{
+    pngStripe_t *stripes = writer->stripes;
+    int stripeCount = writer->stripeCount < height ? writer->stripeCount : height;
+    pngChunkWriter_t chunk = {file, 0, true};
+    uint16_t header = zlibHeader(&writer->options);
+    uint8_t headerBytes[2] = {(uint8_t) (header >> 8), (uint8_t) header};
+    uLong adler = adler32(0, Z_NULL, 0);
+    bool ok = true;
+
+    layoutStripes(writer, stripeCount, data, width, height, stride);
+
+    // Deflate the first stripe on this thread while the others are done on their own
+    for (int i = 1; i < stripeCount; i++)
+        semaphore_signal(&stripes[i].start);
+
+    deflateStripe(&stripes[0]);
+
+    for (int i = 1; i < stripeCount; i++)
+        semaphore_wait(&writer->stripeDone);
+
+    for (int i = 0; i < stripeCount; i++) {
+        ok = ok && stripes[i].ok;
+        adler = adler32_combine(adler, stripes[i].adler, (z_off_t) stripes[i].rawSize);
+    }
+
+    if (ok) {
+        if (fwrite(PNG_SIGNATURE, 1, sizeof(PNG_SIGNATURE), file) != sizeof(PNG_SIGNATURE))
+            chunk.ok = false;
+
+        pngChunkBegin(&chunk, "IHDR", 13);
+        pngChunkWriteU32(&chunk, width);
+        pngChunkWriteU32(&chunk, height);
+        // 8 bits per channel, RGBA, deflate, the standard filter method, no interlacing
+        pngChunkWrite(&chunk, "\x08\x06\x00\x00\x00", 5);
+        pngChunkEnd(&chunk);
+
+        // Each stripe gets its own IDAT chunk, the first begins with the zlib header and the last ends with its trailer
+        for (int i = 0; i < stripeCount; i++) {
+            pngChunkBegin(&chunk, "IDAT", (uint32_t) (stripes[i].compressedSize + (i == 0 ? 2 : 0) + (stripes[i].last ? 4 : 0)));
+
+            if (i == 0)
+                pngChunkWrite(&chunk, headerBytes, sizeof(headerBytes));
+
+            pngChunkWrite(&chunk, stripes[i].compressed, stripes[i].compressedSize);
+
+            if (stripes[i].last)
+                pngChunkWriteU32(&chunk, (uint32_t) adler);
+
+            pngChunkEnd(&chunk);
+        }
+
+        pngChunkBegin(&chunk, "IEND", 0);
+        pngChunkEnd(&chunk);
+
+        ok = chunk.ok;
+    }
+
+    return ok;
+}
+
+bool pngWriterWriteARGB32ToFilename(pngWriter_t *writer, const char *filename, const uint8_t *data, int width, int height, int stride)
+{
+    FILE *file = fopen(filename, "wb");
+    bool ok;
+
+    if (!file)
+        return false;
+
+    ok = pngWriterWriteARGB32(writer, file, data, width, height, stride);
+
+    if (fclose(file) != 0)
+        ok = false;
+
+    return ok;
+}
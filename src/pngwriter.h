@@ -0,0 +1,45 @@
+#ifndef PNGWRITER_H_
+#define PNGWRITER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define PNG_WRITER_MAX_STRIPES 64
+
+typedef struct pngWriter_t pngWriter_t;
+
+typedef enum PNGFilter {
+    PNG_FILTER_NONE = 0,
+    PNG_FILTER_SUB = 1,
+    PNG_FILTER_UP = 2
+} PNGFilter;
+
+typedef enum PNGStrategy {
+    PNG_STRATEGY_DEFAULT = 0,
+    PNG_STRATEGY_FILTERED,
+    PNG_STRATEGY_RLE,
+    PNG_STRATEGY_HUFFMAN
+} PNGStrategy;
+
+typedef struct pngWriterOptions_t {
+    // zlib compression level, from 0 (store only) to 9
+    int compressionLevel;
+    PNGStrategy strategy;
+
+    // The same filter is used for every row
+    PNGFilter filter;
+
+    // Number of horizontal stripes of the image to deflate at once on separate threads (1 to deflate on this one)
+    int stripes;
+} pngWriterOptions_t;
+
+pngWriter_t* pngWriterCreate(const pngWriterOptions_t *options, int width, int height);
+void pngWriterDestroy(pngWriter_t *writer);
+
+uint32_t pngWriterGetAllocationCount(const pngWriter_t *writer);
+
+bool pngWriterWriteARGB32(pngWriter_t *writer, FILE *file, const uint8_t *data, int width, int height, int stride);
+bool pngWriterWriteARGB32ToFilename(pngWriter_t *writer, const char *filename, const uint8_t *data, int width, int height, int stride);
+
+#endif
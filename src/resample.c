@@ -0,0 +1,209 @@
+/**
+ * Resampling of main fields onto a uniform time grid.
+ *
+ * The grid's interval is the median interval between the first RESAMPLE_CALIBRATION_FRAMES frames, which are held back
+ * until it has been measured, and values between frames are linearly interpolated. Wherever the log has a gap of more
+ * than RESAMPLE_MAX_GAP_INTERVALS grid intervals (or time goes backwards), a new stretch of the grid begins, and windows
+ * never span two stretches.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "resample.h"
+
+#define RESAMPLE_MAX_GAP_INTERVALS 4
+#define RESAMPLE_CALIBRATION_FRAMES 2048
+
+void uniformSeriesInit(uniformSeries_t *series, const int *fields, int fieldCount, uniformSeriesStart_t start,
+    uniformSeriesWindow_t window, void *context)
+{
+    memset(series, 0, sizeof(*series));
+
+    memcpy(series->fields, fields, fieldCount * sizeof(*fields));
+    series->fieldCount = fieldCount;
+
+    series->start = start;
+    series->window = window;
+    series->context = context;
+
+    series->pendingTime = malloc(RESAMPLE_CALIBRATION_FRAMES * sizeof(*series->pendingTime));
+    series->pendingValues = malloc((size_t) RESAMPLE_CALIBRATION_FRAMES * fieldCount * sizeof(*series->pendingValues));
+}
+
+void uniformSeriesFree(uniformSeries_t *series)
+{
+    free(series->pendingTime);
+    free(series->pendingValues);
+    free(series->samples);
+
+    memset(series, 0, sizeof(*series));
+}
+
+/**
+ * Add the sample between the frames `before` and `after` at `fraction` of the way from one to the other to the window,
+ * and pass the window on if that completes it.
+ */
+static void uniformSeriesAddSample(uniformSeries_t *series, double fraction, const float *before, const float *after)
+{
+    for (int i = 0; i < series->fieldCount; i++) {
+        series->samples[(size_t) i * series->windowSize + series->sampleCount] = before[i] + (after[i] - before[i]) * fraction;
+    }
+
+    series->sampleCount++;
+    series->nextSample++;
+
+    if (series->sampleCount == series->windowSize) {
+        int overlap = series->windowSize - series->windowStep;
+
+        series->window(series->context, series->samples,
+            series->stretchStartTime + (int64_t) ((series->windowStart + series->windowSize / 2) * series->sampleInterval));
+        series->windowCount++;
+
+        // Keep the part of this window that the next one overlaps
+        for (int i = 0; i < series->fieldCount; i++) {
+            float *row = series->samples + (size_t) i * series->windowSize;
+
+            memmove(row, row + series->windowStep, overlap * sizeof(*row));
+        }
+
+        series->sampleCount = overlap;
+        series->windowStart += series->windowStep;
+    }
+}
+
+static double uniformSeriesNextSampleTime(uniformSeries_t *series)
+{
+    return series->stretchStartTime + series->nextSample * series->sampleInterval;
+}
+
+static void uniformSeriesEndStretch(uniformSeries_t *series)
+{
+    // Every sample before the last frame has been added, but one could fall exactly on it
+    if (series->haveLastFrame && uniformSeriesNextSampleTime(series) == series->lastTime) {
+        uniformSeriesAddSample(series, 0, series->lastValues, series->lastValues);
+    }
+}
+
+/**
+ * Add a frame to the grid, which adds all the samples between the last frame and this one.
+ */
+static void uniformSeriesAddToGrid(uniformSeries_t *series, int64_t time, const float *values)
+{
+    double maxGap = series->sampleInterval * RESAMPLE_MAX_GAP_INTERVALS;
+
+    if (series->haveLastFrame && time >= series->lastTime && time - series->lastTime <= maxGap) {
+        double sampleTime;
+
+        while ((sampleTime = uniformSeriesNextSampleTime(series)) < time) {
+            double fraction = (sampleTime - series->lastTime) / (time - series->lastTime);
+
+            fraction = fraction < 0 ? 0 : fraction > 1 ? 1 : fraction;
+
+            uniformSeriesAddSample(series, fraction, series->lastValues, values);
+        }
+    } else {
+        uniformSeriesEndStretch(series);
+
+        series->stretchStartTime = time;
+        series->nextSample = 0;
+        series->sampleCount = 0;
+        series->windowStart = 0;
+    }
+
+    series->lastTime = time;
+    memcpy(series->lastValues, values, series->fieldCount * sizeof(*values));
+    series->haveLastFrame = true;
+}
+
+static int compareInt64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/**
+ * Measure the grid's interval from the frames that have been held back, and then add them to the grid. Returns false
+ * if they don't span any time to measure.
+ */
+static bool uniformSeriesCalibrate(uniformSeries_t *series)
+{
+    int64_t *intervals = malloc(RESAMPLE_CALIBRATION_FRAMES * sizeof(*intervals));
+    int intervalCount = 0;
+
+    for (int i = 1; i < series->pendingCount; i++) {
+        if (series->pendingTime[i] > series->pendingTime[i - 1]) {
+            intervals[intervalCount++] = series->pendingTime[i] - series->pendingTime[i - 1];
+        }
+    }
+
+    if (intervalCount == 0) {
+        free(intervals);
+        return false;
+    }
+
+    qsort(intervals, intervalCount, sizeof(*intervals), compareInt64);
+
+    series->sampleInterval = intervalCount % 2 ? intervals[intervalCount / 2]
+        : (intervals[intervalCount / 2 - 1] + intervals[intervalCount / 2]) / 2.0;
+
+    free(intervals);
+
+    series->start(series->context, series->sampleInterval, &series->windowSize, &series->windowStep);
+    series->samples = malloc((size_t) series->fieldCount * series->windowSize * sizeof(*series->samples));
+
+    for (int i = 0; i < series->pendingCount; i++) {
+        uniformSeriesAddToGrid(series, series->pendingTime[i], series->pendingValues + (size_t) i * series->fieldCount);
+    }
+
+    free(series->pendingTime);
+    free(series->pendingValues);
+
+    series->pendingTime = NULL;
+    series->pendingValues = NULL;
+    series->pendingCount = 0;
+
+    return true;
+}
+
+/**
+ * Add a valid main frame to the series.
+ */
+void uniformSeriesAddFrame(uniformSeries_t *series, const int64_t *frame)
+{
+    int64_t time = frame[FLIGHT_LOG_FIELD_INDEX_TIME];
+    float values[FLIGHT_LOG_MAX_FIELDS];
+
+    if (series->sampleInterval > 0) {
+        for (int i = 0; i < series->fieldCount; i++) {
+            values[i] = (float) frame[series->fields[i]];
+        }
+
+        uniformSeriesAddToGrid(series, time, values);
+    } else {
+        float *pending = series->pendingValues + (size_t) series->pendingCount * series->fieldCount;
+
+        series->pendingTime[series->pendingCount] = time;
+
+        for (int i = 0; i < series->fieldCount; i++) {
+            pending[i] = (float) frame[series->fields[i]];
+        }
+
+        series->pendingCount++;
+
+        // Frames whose time never moves forwards are no use for measuring the interval, so drop them and carry on
+        if (series->pendingCount == RESAMPLE_CALIBRATION_FRAMES && !uniformSeriesCalibrate(series)) {
+            series->pendingCount = 0;
+        }
+    }
+}
+
+/**
+ * Call at the end of the log, to pass on any windows that are completed by its last frame.
+ */
+void uniformSeriesFinish(uniformSeries_t *series)
+{
+    if (series->sampleInterval > 0 || uniformSeriesCalibrate(series)) {
+        uniformSeriesEndStretch(series);
+    }
+}
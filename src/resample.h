@@ -0,0 +1,67 @@
+#ifndef RESAMPLE_H_
+#define RESAMPLE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "parser.h"
+
+/**
+ * Called once the grid's interval (in us) has been measured, to choose the number of samples in each window and how
+ * many samples apart the windows begin (no more than the window size).
+ */
+typedef void (*uniformSeriesStart_t)(void *context, double sampleInterval, int *windowSize, int *windowStep);
+
+/**
+ * Called with each window as soon as it's complete. `samples` holds fieldCount rows of windowSize samples, which are
+ * only valid until the callback returns, and `time` is the log time at the center of the window.
+ */
+typedef void (*uniformSeriesWindow_t)(void *context, const float *samples, int64_t time);
+
+/**
+ * A set of main fields resampled onto a uniform time grid as the log's frames arrive, for analyses (like spectra)
+ * which need evenly spaced samples. The grid is cut into overlapping windows of a fixed number of samples, and only the
+ * window being filled is kept in memory.
+ */
+typedef struct uniformSeries_t {
+    int fields[FLIGHT_LOG_MAX_FIELDS];
+    int fieldCount;
+
+    uniformSeriesStart_t start;
+    uniformSeriesWindow_t window;
+    void *context;
+
+    // The first frames are held back (in rows of fieldCount) until there are enough to measure the grid's interval
+    int64_t *pendingTime;
+    float *pendingValues;
+    int pendingCount;
+
+    // The grid interval in us (zero until it has been measured), and the windows chosen by start()
+    double sampleInterval;
+    int windowSize, windowStep;
+
+    // The last frame added to the grid
+    bool haveLastFrame;
+    int64_t lastTime;
+    float lastValues[FLIGHT_LOG_MAX_FIELDS];
+
+    // The time of the first sample of the current stretch of the grid, and the index in the stretch of the next sample
+    int64_t stretchStartTime;
+    int nextSample;
+
+    // The window being filled (fieldCount rows of windowSize), the number of samples in it so far, and the index in
+    // the stretch of its first sample
+    float *samples;
+    int sampleCount;
+    int windowStart;
+
+    int windowCount;
+} uniformSeries_t;
+
+void uniformSeriesInit(uniformSeries_t *series, const int *fields, int fieldCount, uniformSeriesStart_t start,
+    uniformSeriesWindow_t window, void *context);
+void uniformSeriesAddFrame(uniformSeries_t *series, const int64_t *frame);
+void uniformSeriesFinish(uniformSeries_t *series);
+void uniformSeriesFree(uniformSeries_t *series);
+
+#endif
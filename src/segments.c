@@ -0,0 +1,265 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "segments.h"
+#include "stats.h"
+
+/*
+ * "segments" sink: a table with a row for each stretch of the log where the flight modes, state flags, failsafe phase
+ * and armed status stayed the same, giving its duration, the energy used, and the spread of a selection of main fields
+ * (--segment-fields) over the stretch. Rows are written as each segment ends, so only the current segment is kept in
+ * memory.
+ *
+ * The log doesn't record whether the craft is armed, so we say it's armed while motor[0] is at or above the motor
+ * output's idle level (motorOutputLow/minthrottle).
+ */
+
+typedef struct segmentKey_t {
+    int64_t flightModeFlags, stateFlags, failsafePhase;
+    int armed; // 1 or 0, or -1 if the log has no motor data
+} segmentKey_t;
+
+typedef struct segmentFieldStats_t {
+    int64_t min, max;
+    seriesStats_t series;
+    quantileSketch_t quantiles;
+} segmentFieldStats_t;
+
+typedef struct segmentsState_t {
+    outputStream_t *file;
+
+    // The main fields to compute statistics for
+    int fields[FLIGHT_LOG_MAX_FIELDS];
+    int fieldCount;
+
+    bool inSegment;
+    int segmentIndex;
+    segmentKey_t key;
+
+    int64_t startTime, lastTime;
+    uint32_t frameCount;
+    double startEnergyMeasured, startEnergyVirtual;
+
+    segmentFieldStats_t stats[FLIGHT_LOG_MAX_FIELDS];
+} segmentsState_t;
+
+static segmentsState_t segments;
+
+static const decodeSinkContext_t *decodeContext;
+
+// The comma-separated names of the main fields to compute statistics for (see selectMainFields())
+static const char *segmentFieldPatterns;
+
+static bool segmentsSinkOpen(flightLog_t *log)
+{
+    char *filename;
+
+    (void) log;
+
+    if (decodeContext->toStdout) {
+        segments.file = outputStreamCreate(stdout, false, decodeContext->compressionLevel);
+        return true;
+    }
+
+    filename = createOutputFilename(".segments.csv", true);
+
+    segments.file = outputStreamOpen(filename, decodeContext->compressionLevel);
+
+    if (!segments.file) {
+        fprintf(stderr, "Failed to create segments file %s\n", filename);
+    }
+
+    free(filename);
+
+    return true;
+}
+
+static void segmentsSinkBeginLog(flightLog_t *log)
+{
+    flightLogFrameDef_t *mainDef = &log->frameDefs['I'];
+
+    segments.fieldCount = selectMainFields(log, segmentFieldPatterns, segments.fields);
+    segments.inSegment = false;
+    segments.segmentIndex = 0;
+
+    for (int i = 0; i < segments.fieldCount; i++) {
+        quantileSketch_init(&segments.stats[i].quantiles, QUANTILE_SKETCH_DEFAULT_COMPRESSION);
+    }
+
+    if (!segments.file)
+        return;
+
+    outputStreamPrintf(segments.file, "log,segment,start time (us),end time (us),duration (s),frames,armed,flightModeFlags,stateFlags,failsafePhase,energy (mAh)");
+
+    if (decodeContext->simulateCurrentMeter) {
+        outputStreamPrintf(segments.file, ",energy (virtual) (mAh)");
+    }
+
+    for (int i = 0; i < segments.fieldCount; i++) {
+        const char *name = mainDef->fieldName[segments.fields[i]];
+
+        outputStreamPrintf(segments.file, ",%s min,%s max,%s mean,%s stddev,%s p50,%s p99", name, name, name, name, name, name);
+    }
+
+    outputStreamPrintf(segments.file, "\n");
+}
+
+static void segmentsWriteFlags(flightLog_t *log, int64_t flags, void (*toString)(uint32_t flags, char *dest, int destLen))
+{
+    char buffer[256];
+
+    (void) log;
+
+    if (decodeContext->unitFlags == UNIT_FLAGS) {
+        toString((uint32_t) flags, buffer, sizeof(buffer));
+        outputStreamPrintf(segments.file, ",%s", buffer);
+    } else {
+        outputStreamPrintf(segments.file, ",%" PRId64, flags);
+    }
+}
+
+static void segmentsWriteFailsafePhase(uint32_t phase, char *dest, int destLen)
+{
+    flightlogFailsafePhaseToString((uint8_t) phase, dest, destLen);
+}
+
+/**
+ * Write out the current segment, which ended at `endTime`.
+ */
+static void segmentsEnd(flightLog_t *log, int64_t endTime)
+{
+    if (!segments.inSegment)
+        return;
+
+    segments.inSegment = false;
+
+    if (!segments.file)
+        return;
+
+    outputStreamPrintf(segments.file, "%d,%d,%" PRId64 ",%" PRId64 ",%.3f,%u,%s", decodeContext->naming->logIndex + 1, segments.segmentIndex,
+        segments.startTime, endTime, (endTime - segments.startTime) / 1000000.0, segments.frameCount,
+        segments.key.armed == -1 ? "" : segments.key.armed ? "yes" : "no");
+
+    segmentsWriteFlags(log, segments.key.flightModeFlags, flightlogFlightModeToString);
+    segmentsWriteFlags(log, segments.key.stateFlags, flightlogFlightStateToString);
+    segmentsWriteFlags(log, segments.key.failsafePhase, segmentsWriteFailsafePhase);
+
+    outputStreamPrintf(segments.file, ",%.3f", decodeContext->simulation->currentMeterMeasured.energyMilliampHours - segments.startEnergyMeasured);
+
+    if (decodeContext->simulateCurrentMeter) {
+        outputStreamPrintf(segments.file, ",%.3f", decodeContext->simulation->currentMeterVirtual.energyMilliampHours - segments.startEnergyVirtual);
+    }
+
+    for (int i = 0; i < segments.fieldCount; i++) {
+        segmentFieldStats_t *stats = &segments.stats[i];
+
+        outputStreamPrintf(segments.file, ",%" PRId64 ",%" PRId64 ",%.2f,%.2f,%.2f,%.2f", stats->min, stats->max,
+            seriesStats_getMean(&stats->series), seriesStats_getStandardDeviation(&stats->series),
+            quantileSketch_getQuantile(&stats->quantiles, 0.5), quantileSketch_getQuantile(&stats->quantiles, 0.99));
+    }
+
+    outputStreamPrintf(segments.file, "\n");
+
+    segments.segmentIndex++;
+}
+
+static void segmentsSinkOnMainFrame(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    segmentKey_t key;
+    int64_t frameTime;
+
+    (void) frameType;
+    (void) frameOffset;
+    (void) frameSize;
+
+    if (!frameValid)
+        return;
+
+    frameTime = frame[FLIGHT_LOG_FIELD_INDEX_TIME];
+
+    memset(&key, 0, sizeof(key));
+
+    if (log->slowFieldIndexes.flightModeFlags != -1) {
+        key.flightModeFlags = decodeContext->slowFrame[log->slowFieldIndexes.flightModeFlags];
+    }
+    if (log->slowFieldIndexes.stateFlags != -1) {
+        key.stateFlags = decodeContext->slowFrame[log->slowFieldIndexes.stateFlags];
+    }
+    if (log->slowFieldIndexes.failsafePhase != -1) {
+        key.failsafePhase = decodeContext->slowFrame[log->slowFieldIndexes.failsafePhase];
+    }
+
+    key.armed = log->mainFieldIndexes.motor[0] == -1 ? -1 : frame[log->mainFieldIndexes.motor[0]] >= log->sysConfig.motorOutputLow;
+
+    if (segments.inSegment && memcmp(&key, &segments.key, sizeof(key)) != 0) {
+        segmentsEnd(log, frameTime);
+    }
+
+    if (!segments.inSegment) {
+        segments.inSegment = true;
+        segments.key = key;
+        segments.startTime = frameTime;
+        segments.frameCount = 0;
+        segments.startEnergyMeasured = decodeContext->simulation->currentMeterMeasured.energyMilliampHours;
+        segments.startEnergyVirtual = decodeContext->simulation->currentMeterVirtual.energyMilliampHours;
+
+        for (int i = 0; i < segments.fieldCount; i++) {
+            segments.stats[i].min = INT64_MAX;
+            segments.stats[i].max = INT64_MIN;
+            seriesStats_init(&segments.stats[i].series);
+            quantileSketch_reset(&segments.stats[i].quantiles);
+        }
+    }
+
+    for (int i = 0; i < segments.fieldCount; i++) {
+        segmentFieldStats_t *stats = &segments.stats[i];
+        int64_t value = frame[segments.fields[i]];
+
+        if (value < stats->min)
+            stats->min = value;
+        if (value > stats->max)
+            stats->max = value;
+
+        seriesStats_append(&stats->series, value);
+        quantileSketch_append(&stats->quantiles, value);
+    }
+
+    segments.frameCount++;
+    segments.lastTime = frameTime;
+}
+
+static void segmentsSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    (void) logIndex;
+    (void) success;
+
+    segmentsEnd(log, segments.lastTime);
+
+    for (int i = 0; i < segments.fieldCount; i++) {
+        quantileSketch_free(&segments.stats[i].quantiles);
+    }
+
+    outputStreamClose(segments.file, decodeContext->outputStats);
+    segments.file = NULL;
+}
+
+static void segmentsSinkInit(const decodeSinkContext_t *context)
+{
+    decodeContext = context;
+}
+
+decodeSink_t segmentsSink = {
+    .name = "segments",
+    .init = segmentsSinkInit, .open = segmentsSinkOpen, .beginLog = segmentsSinkBeginLog,
+    .onMainFrame = segmentsSinkOnMainFrame,
+    .endLog = segmentsSinkEndLog
+};
+
+void segmentsSinkConfigure(const char *fieldPatterns)
+{
+    segmentFieldPatterns = fieldPatterns;
+}
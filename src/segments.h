@@ -0,0 +1,11 @@
+#ifndef SEGMENTS_H_
+#define SEGMENTS_H_
+
+#include "decodesink.h"
+
+// The "segments" sink, which writes a row for each stretch of the log where the flight modes and armed status held
+extern decodeSink_t segmentsSink;
+
+void segmentsSinkConfigure(const char *fieldPatterns);
+
+#endif
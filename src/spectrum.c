@@ -0,0 +1,404 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+//For msvcrt to define M_PI:
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "spectrum.h"
+#include "formatpool.h"
+#include "fft.h"
+#include "resample.h"
+
+/*
+ * "spectrum" sink: the frequency content of the noisy fields (the gyros, D-terms and motors by default), for noise
+ * tuning.
+ *
+ * As the frames arrive, the fields are resampled onto a uniform time grid at the log's usual frame rate, which is cut
+ * into Hann windows that overlap by half. Each window's power spectral density is written to the spectrogram (a row
+ * per window and field), and the average over all the windows (Welch's method) is written as the spectrum at the end
+ * of the log. The windows are gathered into blocks which are transformed in parallel by the --threads workers, so only
+ * the blocks in flight are kept in memory.
+ */
+
+#define SPECTRUM_WINDOWS_PER_BLOCK 16
+// The smallest power spectral density we'll represent in decibels, to avoid taking the log of zero
+#define SPECTRUM_MIN_DENSITY 1e-12
+
+/**
+ * A block of windows to transform. In memory it's followed by the sum of its windows' power spectral densities
+ * (fieldCount rows of binCount), and then by the windows' samples (fieldCount rows of windowSize for each window).
+ */
+typedef struct spectrumBlock_t {
+    int windowCount;
+    int64_t windowTime[SPECTRUM_WINDOWS_PER_BLOCK];
+} spectrumBlock_t;
+
+typedef struct spectrumState_t {
+    uniformSeries_t series;
+
+    int windowSize, binCount;
+    double sampleRate;
+
+    fftPlan_t *plan;
+    float *window;
+    double densityScale;
+
+    char *spectrogramFilename;
+    outputStream_t *spectrogramFile;
+    bool writeSpectrogram;
+
+    // Created along with the spectrogram when the first window is complete
+    formatPool_t *pool;
+    // The block being filled with windows, if any
+    spectrumBlock_t *block;
+
+    // The sum of the power spectral densities of every window so far (fieldCount rows of binCount)
+    double *density;
+} spectrumState_t;
+
+static spectrumState_t spectrum;
+
+static const decodeSinkContext_t *decodeContext;
+
+// The main fields to analyse (see selectMainFields()), and the number of samples in each window
+static const char *spectrumFieldPatterns;
+static int spectrumWindowSize;
+
+static double* spectrumBlockDensity(spectrumBlock_t *block)
+{
+    return (double *) (block + 1);
+}
+
+static float* spectrumBlockSamples(spectrumBlock_t *block)
+{
+    return (float *) (spectrumBlockDensity(block) + (size_t) spectrum.series.fieldCount * spectrum.binCount);
+}
+
+static double spectrumDecibels(double density)
+{
+    return 10 * log10(density > SPECTRUM_MIN_DENSITY ? density : SPECTRUM_MIN_DENSITY);
+}
+
+static void spectrumWriteFrequencies(outputStream_t *file)
+{
+    for (int bin = 0; bin < spectrum.binCount; bin++) {
+        outputStreamPrintf(file, ",%.1f", bin * spectrum.sampleRate / spectrum.windowSize);
+    }
+
+    outputStreamPrintf(file, "\n");
+}
+
+/**
+ * Copy the window of samples beginning at `source` to `dest`, with its mean removed and the window function applied.
+ */
+static void spectrumLoadWindow(const float *source, float *dest, int windowSize)
+{
+    double mean = 0;
+
+    for (int i = 0; i < windowSize; i++) {
+        mean += source[i];
+    }
+
+    mean /= windowSize;
+
+    for (int i = 0; i < windowSize; i++) {
+        dest[i] = (float) (source[i] - mean) * spectrum.window[i];
+    }
+}
+
+/**
+ * Transform a block of windows (called from the worker threads), adding their power spectral densities to the
+ * block's sum and writing them to the spectrogram.
+ */
+static void formatSpectrumBlock(void *context, void *data, outputStream_t *output)
+{
+    flightLog_t *log = (flightLog_t *) context;
+    spectrumBlock_t *block = (spectrumBlock_t *) data;
+    uniformSeries_t *series = &spectrum.series;
+    int windowSize = spectrum.windowSize, binCount = spectrum.binCount;
+    double *blockDensity = spectrumBlockDensity(block);
+    float *re = malloc(windowSize * sizeof(*re)), *im = malloc(windowSize * sizeof(*im));
+    float *power[2] = {malloc(binCount * sizeof(float)), malloc(binCount * sizeof(float))};
+
+    memset(blockDensity, 0, (size_t) series->fieldCount * binCount * sizeof(*blockDensity));
+
+    for (int window = 0; window < block->windowCount; window++) {
+        const float *windowSamples = spectrumBlockSamples(block) + (size_t) window * series->fieldCount * windowSize;
+
+        // Transform the fields two at a time, as the real and imaginary parts of one complex sequence
+        for (int field = 0; field < series->fieldCount; field += 2) {
+            const float *samples = windowSamples + (size_t) field * windowSize;
+
+            spectrumLoadWindow(samples, re, windowSize);
+
+            if (field + 1 < series->fieldCount) {
+                spectrumLoadWindow(samples + windowSize, im, windowSize);
+            } else {
+                memset(im, 0, windowSize * sizeof(*im));
+            }
+
+            fftRealPairPower(spectrum.plan, re, im, power[0], power[1]);
+
+            for (int pair = 0; pair < 2 && field + pair < series->fieldCount; pair++) {
+                double *fieldDensity = blockDensity + (size_t) (field + pair) * binCount;
+
+                if (output) {
+                    outputStreamWriteInt(output, block->windowTime[window]);
+                    outputStreamPrintf(output, ",%s", log->frameDefs['I'].fieldName[series->fields[field + pair]]);
+                }
+
+                for (int bin = 0; bin < binCount; bin++) {
+                    // The bins between DC and Nyquist also stand in for the negative frequencies, which doubles them
+                    double density = power[pair][bin] * spectrum.densityScale * (bin == 0 || bin == binCount - 1 ? 1 : 2);
+
+                    fieldDensity[bin] += density;
+
+                    if (output) {
+                        outputStreamWrite(output, ",", 1);
+                        outputStreamWriteInt(output, (int64_t) floor(spectrumDecibels(density) + 0.5));
+                    }
+                }
+
+                if (output) {
+                    outputStreamWrite(output, "\n", 1);
+                }
+            }
+        }
+    }
+
+    free(re);
+    free(im);
+    free(power[0]);
+    free(power[1]);
+}
+
+/**
+ * Add a transformed block's densities to the total. The blocks come here in order, so the total is the same for any
+ * number of threads.
+ */
+static void collectSpectrumBlock(void *context, void *data)
+{
+    spectrumBlock_t *block = (spectrumBlock_t *) data;
+    double *blockDensity = spectrumBlockDensity(block);
+
+    (void) context;
+
+    for (size_t i = 0; i < (size_t) spectrum.series.fieldCount * spectrum.binCount; i++) {
+        spectrum.density[i] += blockDensity[i];
+    }
+}
+
+/**
+ * The grid's interval is known, so set up the transform for its sample rate.
+ */
+static void spectrumStart(void *context, double sampleInterval, int *windowSize, int *windowStep)
+{
+    double windowPower = 0;
+
+    (void) context;
+
+    spectrum.windowSize = spectrumWindowSize;
+    spectrum.binCount = spectrumWindowSize / 2 + 1;
+    spectrum.sampleRate = 1000000.0 / sampleInterval;
+
+    spectrum.plan = fftPlanCreate(spectrum.windowSize);
+    spectrum.window = malloc(spectrum.windowSize * sizeof(*spectrum.window));
+
+    // A periodic Hann window
+    for (int i = 0; i < spectrum.windowSize; i++) {
+        spectrum.window[i] = (float) (0.5 - 0.5 * cos(2 * M_PI * i / spectrum.windowSize));
+        windowPower += (double) spectrum.window[i] * spectrum.window[i];
+    }
+
+    spectrum.densityScale = 1.0 / (spectrum.sampleRate * windowPower);
+    spectrum.density = calloc((size_t) spectrum.series.fieldCount * spectrum.binCount, sizeof(*spectrum.density));
+
+    *windowSize = spectrum.windowSize;
+    *windowStep = spectrum.windowSize / 2;
+}
+
+/**
+ * Open the spectrogram and start the workers, once there's a window for them to work on.
+ */
+static void spectrumOpen(flightLog_t *log)
+{
+    size_t blockSize = sizeof(spectrumBlock_t)
+        + (size_t) spectrum.series.fieldCount * spectrum.binCount * sizeof(double)
+        + (size_t) SPECTRUM_WINDOWS_PER_BLOCK * spectrum.series.fieldCount * spectrum.windowSize * sizeof(float);
+
+    // The spectrogram is too big to be useful on stdout, so we only write the spectrum there
+    spectrum.writeSpectrogram = !decodeContext->toStdout;
+
+    if (spectrum.writeSpectrogram) {
+        spectrum.spectrogramFilename = createOutputFilename(".spectrogram.csv", true);
+        spectrum.spectrogramFile = outputStreamOpen(spectrum.spectrogramFilename, decodeContext->compressionLevel);
+
+        if (spectrum.spectrogramFile) {
+            outputStreamPrintf(spectrum.spectrogramFile, "time (us),field");
+            spectrumWriteFrequencies(spectrum.spectrogramFile);
+        } else {
+            fprintf(stderr, "Failed to create spectrogram file %s\n", spectrum.spectrogramFilename);
+            spectrum.writeSpectrogram = false;
+        }
+    }
+
+    spectrum.pool = formatPoolCreate(decodeContext->threads, blockSize, formatSpectrumBlock, collectSpectrumBlock, log,
+        spectrum.spectrogramFile);
+}
+
+static void spectrumAddWindow(void *context, const float *samples, int64_t time)
+{
+    flightLog_t *log = (flightLog_t *) context;
+    size_t windowLength = (size_t) spectrum.series.fieldCount * spectrum.windowSize;
+
+    if (!spectrum.pool) {
+        spectrumOpen(log);
+    }
+
+    if (!spectrum.block) {
+        spectrum.block = (spectrumBlock_t *) formatPoolAcquire(spectrum.pool);
+        spectrum.block->windowCount = 0;
+    }
+
+    memcpy(spectrumBlockSamples(spectrum.block) + spectrum.block->windowCount * windowLength, samples, windowLength * sizeof(*samples));
+    spectrum.block->windowTime[spectrum.block->windowCount] = time;
+    spectrum.block->windowCount++;
+
+    if (spectrum.block->windowCount == SPECTRUM_WINDOWS_PER_BLOCK) {
+        formatPoolSubmit(spectrum.pool);
+        spectrum.block = NULL;
+    }
+}
+
+static void spectrumSinkBeginLog(flightLog_t *log)
+{
+    int fields[FLIGHT_LOG_MAX_FIELDS];
+    int fieldCount = selectMainFields(log, spectrumFieldPatterns, fields);
+
+    uniformSeriesInit(&spectrum.series, fields, fieldCount, spectrumStart, spectrumAddWindow, log);
+}
+
+static void spectrumSinkOnMainFrame(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    (void) log;
+    (void) frameType;
+    (void) frameOffset;
+    (void) frameSize;
+
+    if (frameValid && spectrum.series.fieldCount > 0) {
+        uniformSeriesAddFrame(&spectrum.series, frame);
+    }
+}
+
+/**
+ * Transform the windows that are still waiting, and write the spectrum averaged over all of them.
+ */
+static void spectrumFinish(flightLog_t *log)
+{
+    uniformSeries_t *series = &spectrum.series;
+    char *spectrumFilename = NULL;
+    outputStream_t *spectrumFile;
+
+    uniformSeriesFinish(series);
+
+    if (spectrum.block) {
+        formatPoolSubmit(spectrum.pool);
+        spectrum.block = NULL;
+    }
+
+    formatPoolDestroy(spectrum.pool);
+    spectrum.pool = NULL;
+
+    outputStreamClose(spectrum.spectrogramFile, decodeContext->outputStats);
+    spectrum.spectrogramFile = NULL;
+
+    if (series->windowCount == 0) {
+        fprintf(stderr, "Log is too short to compute a spectrum with a window of %d frames\n", spectrumWindowSize);
+        return;
+    }
+
+    if (decodeContext->toStdout) {
+        spectrumFile = outputStreamCreate(stdout, false, decodeContext->compressionLevel);
+    } else {
+        spectrumFilename = createOutputFilename(".spectrum.csv", true);
+        spectrumFile = outputStreamOpen(spectrumFilename, decodeContext->compressionLevel);
+
+        if (!spectrumFile) {
+            fprintf(stderr, "Failed to create spectrum file %s\n", spectrumFilename);
+        }
+    }
+
+    if (spectrumFile) {
+        outputStreamPrintf(spectrumFile, "frequency (Hz)");
+
+        for (int i = 0; i < series->fieldCount; i++) {
+            outputStreamPrintf(spectrumFile, ",%s (dB)", log->frameDefs['I'].fieldName[series->fields[i]]);
+        }
+
+        outputStreamPrintf(spectrumFile, "\n");
+
+        for (int bin = 0; bin < spectrum.binCount; bin++) {
+            outputStreamPrintf(spectrumFile, "%.1f", bin * spectrum.sampleRate / spectrum.windowSize);
+
+            for (int i = 0; i < series->fieldCount; i++) {
+                outputStreamPrintf(spectrumFile, ",%.2f", spectrumDecibels(spectrum.density[(size_t) i * spectrum.binCount + bin] / series->windowCount));
+            }
+
+            outputStreamPrintf(spectrumFile, "\n");
+        }
+
+        outputStreamClose(spectrumFile, decodeContext->outputStats);
+
+        fprintf(stderr, "Spectrum of %d fields from %d windows of %d samples at %.1f Hz written to '%s'%s%s%s\n",
+            series->fieldCount, series->windowCount, spectrum.windowSize, spectrum.sampleRate, spectrumFilename ? spectrumFilename : "stdout",
+            spectrum.writeSpectrogram ? " (spectrogram in '" : "", spectrum.writeSpectrogram ? spectrum.spectrogramFilename : "",
+            spectrum.writeSpectrogram ? "')" : "");
+    }
+
+    free(spectrumFilename);
+}
+
+static void spectrumSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    (void) logIndex;
+
+    if (success && spectrum.series.fieldCount > 0) {
+        spectrumFinish(log);
+    } else {
+        // Whatever was written of the spectrogram is kept, like the other outputs of a log that fails to parse
+        formatPoolDestroy(spectrum.pool);
+        outputStreamClose(spectrum.spectrogramFile, decodeContext->outputStats);
+    }
+
+    uniformSeriesFree(&spectrum.series);
+    fftPlanDestroy(spectrum.plan);
+
+    free(spectrum.window);
+    free(spectrum.density);
+    free(spectrum.spectrogramFilename);
+
+    memset(&spectrum, 0, sizeof(spectrum));
+}
+
+static void spectrumSinkInit(const decodeSinkContext_t *context)
+{
+    decodeContext = context;
+}
+
+decodeSink_t spectrumSink = {
+    .name = "spectrum",
+    .init = spectrumSinkInit, .beginLog = spectrumSinkBeginLog,
+    .onMainFrame = spectrumSinkOnMainFrame,
+    .endLog = spectrumSinkEndLog
+};
+
+void spectrumSinkConfigure(const char *fieldPatterns, int windowSize)
+{
+    spectrumFieldPatterns = fieldPatterns;
+    spectrumWindowSize = windowSize;
+}
@@ -0,0 +1,11 @@
+#ifndef SPECTRUM_H_
+#define SPECTRUM_H_
+
+#include "decodesink.h"
+
+// The "spectrum" sink, which writes the spectra and spectrograms of the noisy fields
+extern decodeSink_t spectrumSink;
+
+void spectrumSinkConfigure(const char *fieldPatterns, int windowSize);
+
+#endif
@@ -1,3 +1,5 @@
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "stats.h"
@@ -21,7 +23,9 @@ void seriesStats_init(seriesStats_t *stats)
 
 void seriesStats_append(seriesStats_t *stats, double val)
 {
-    if (stats->count == 0) {
+    stats->count++;
+
+    if (stats->count == 1) {
         stats->m = val;
         stats->s = 0.0;
     } else {
@@ -30,8 +34,33 @@ void seriesStats_append(seriesStats_t *stats, double val)
         stats->m = oldM + (val - oldM) / stats->count;
         stats->s = stats->s + (val - oldM) * (val - stats->m);
     }
+}
 
-    stats->count++;
+/**
+ * Add all the values summarised by `other` to `stats`, as if they had been appended one by one (e.g. to combine the
+ * statistics of separately processed parts of a log).
+ *
+ * Uses the pairwise update from "Updating Formulae and a Pairwise Algorithm for Computing Sample Variances" by Chan,
+ * Golub and LeVeque.
+ */
+void seriesStats_merge(seriesStats_t *stats, const seriesStats_t *other)
+{
+    int count = stats->count + other->count;
+    double delta;
+
+    if (other->count == 0)
+        return;
+
+    if (stats->count == 0) {
+        *stats = *other;
+        return;
+    }
+
+    delta = other->m - stats->m;
+
+    stats->m += delta * other->count / count;
+    stats->s += other->s + delta * delta * ((double) stats->count * other->count / count);
+    stats->count = count;
 }
 
 double seriesStats_getMean(seriesStats_t *stats)
@@ -48,3 +77,305 @@ double seriesStats_getStandardDeviation(seriesStats_t *stats)
 {
     return sqrt(seriesStats_getVariance(stats));
 }
+
+/*
+ * Quantile sketches, using the merging t-digest from "Computing Extremely Accurate Quantiles Using t-Digests" by Ted
+ * Dunning and Otmar Ertl.
+ *
+ * The distribution is summarised by a sorted list of centroids (a mean and a weight for a cluster of neighbouring
+ * values). The size that a centroid may grow to is limited by the "k1" scale function, which keeps the centroids near
+ * the tails small, so extreme quantiles like the 99.9th percentile stay accurate. New values are collected in a
+ * buffer, which is sorted and merged into the centroids in a single pass whenever it fills up.
+ */
+
+#ifndef M_PI
+    #define M_PI 3.14159265358979323846
+#endif
+
+// How many values (in multiples of the compression) are buffered before they're merged into the centroids
+#define QUANTILE_SKETCH_BUFFER_FACTOR 5
+
+void quantileSketch_init(quantileSketch_t *sketch, double compression)
+{
+    memset(sketch, 0, sizeof(*sketch));
+
+    sketch->compression = compression;
+
+    // The k1 scale function never allows more than about `compression` centroids
+    sketch->centroidCapacity = (int) ceil(compression) + 10;
+    sketch->bufferCapacity = (int) ceil(compression) * QUANTILE_SKETCH_BUFFER_FACTOR;
+
+    sketch->centroids = malloc(sketch->centroidCapacity * sizeof(*sketch->centroids));
+    sketch->buffer = malloc(sketch->bufferCapacity * sizeof(*sketch->buffer));
+    sketch->merged = malloc((sketch->centroidCapacity + sketch->bufferCapacity) * sizeof(*sketch->merged));
+
+    quantileSketch_reset(sketch);
+}
+
+void quantileSketch_reset(quantileSketch_t *sketch)
+{
+    sketch->centroidCount = 0;
+    sketch->centroidWeight = 0;
+    sketch->bufferCount = 0;
+    sketch->min = INFINITY;
+    sketch->max = -INFINITY;
+}
+
+void quantileSketch_free(quantileSketch_t *sketch)
+{
+    free(sketch->centroids);
+    free(sketch->buffer);
+    free(sketch->merged);
+
+    sketch->centroids = sketch->buffer = sketch->merged = NULL;
+}
+
+static void sortCentroids(quantileCentroid_t *centroids, int count)
+{
+    // Quicksort, finishing off short partitions with an insertion sort
+    while (count > 16) {
+        double pivot = centroids[count / 2].mean;
+        int i = 0, j = count - 1;
+
+        while (i <= j) {
+            while (centroids[i].mean < pivot)
+                i++;
+            while (centroids[j].mean > pivot)
+                j--;
+
+            if (i <= j) {
+                quantileCentroid_t temp = centroids[i];
+
+                centroids[i] = centroids[j];
+                centroids[j] = temp;
+                i++;
+                j--;
+            }
+        }
+
+        // Recurse into the smaller side and loop on the larger one, to bound the recursion depth
+        if (j + 1 < count - i) {
+            sortCentroids(centroids, j + 1);
+            centroids += i;
+            count -= i;
+        } else {
+            sortCentroids(centroids + i, count - i);
+            count = j + 1;
+        }
+    }
+
+    for (int i = 1; i < count; i++) {
+        quantileCentroid_t item = centroids[i];
+        int j = i - 1;
+
+        while (j >= 0 && centroids[j].mean > item.mean) {
+            centroids[j + 1] = centroids[j];
+            j--;
+        }
+
+        centroids[j + 1] = item;
+    }
+}
+
+/**
+ * Get the largest quantile that a centroid which begins at quantile `q` may extend to.
+ */
+static double quantileSketch_limit(quantileSketch_t *sketch, double q)
+{
+    // k1(q) = compression / (2 pi) * asin(2q - 1), and we allow each centroid to span 1 unit of k
+    double k = sketch->compression / (2 * M_PI) * asin(2 * q - 1) + 1;
+
+    if (k >= sketch->compression / 4)
+        return 1.0;
+
+    return (sin(k * 2 * M_PI / sketch->compression) + 1) / 2;
+}
+
+/**
+ * Merge the buffered values into the centroids.
+ */
+static void quantileSketch_flush(quantileSketch_t *sketch)
+{
+    int mergedCount = 0, i = 0, j = 0;
+    double totalWeight, weightSoFar, weightLimit;
+    quantileCentroid_t current;
+
+    if (sketch->bufferCount == 0)
+        return;
+
+    sortCentroids(sketch->buffer, sketch->bufferCount);
+
+    totalWeight = sketch->centroidWeight;
+
+    // Both lists are sorted, so we can combine them in order in one pass
+    while (i < sketch->centroidCount || j < sketch->bufferCount) {
+        if (j == sketch->bufferCount || (i < sketch->centroidCount && sketch->centroids[i].mean <= sketch->buffer[j].mean)) {
+            sketch->merged[mergedCount++] = sketch->centroids[i++];
+        } else {
+            totalWeight += sketch->buffer[j].weight;
+            sketch->merged[mergedCount++] = sketch->buffer[j++];
+        }
+    }
+
+    // Now greedily combine neighbours as long as they stay within the size limit
+    sketch->centroidCount = 0;
+
+    current = sketch->merged[0];
+    weightSoFar = 0;
+    weightLimit = totalWeight * quantileSketch_limit(sketch, 0);
+
+    for (i = 1; i < mergedCount; i++) {
+        quantileCentroid_t *next = &sketch->merged[i];
+
+        if (weightSoFar + current.weight + next->weight <= weightLimit) {
+            current.weight += next->weight;
+            current.mean += (next->mean - current.mean) * next->weight / current.weight;
+        } else {
+            weightSoFar += current.weight;
+            sketch->centroids[sketch->centroidCount++] = current;
+
+            weightLimit = totalWeight * quantileSketch_limit(sketch, weightSoFar / totalWeight);
+            current = *next;
+        }
+    }
+
+    sketch->centroids[sketch->centroidCount++] = current;
+    sketch->centroidWeight = totalWeight;
+    sketch->bufferCount = 0;
+}
+
+static void quantileSketch_appendCentroid(quantileSketch_t *sketch, double mean, double weight)
+{
+    if (sketch->bufferCount == sketch->bufferCapacity) {
+        quantileSketch_flush(sketch);
+    }
+
+    sketch->buffer[sketch->bufferCount].mean = mean;
+    sketch->buffer[sketch->bufferCount].weight = weight;
+    sketch->bufferCount++;
+}
+
+void quantileSketch_append(quantileSketch_t *sketch, double val)
+{
+    if (val < sketch->min)
+        sketch->min = val;
+    if (val > sketch->max)
+        sketch->max = val;
+
+    // Series like the looptime repeat the same value over and over, which can share one entry in the buffer
+    if (sketch->bufferCount > 0 && sketch->buffer[sketch->bufferCount - 1].mean == val) {
+        sketch->buffer[sketch->bufferCount - 1].weight++;
+        return;
+    }
+
+    quantileSketch_appendCentroid(sketch, val, 1);
+}
+
+/**
+ * Add all the values summarised by the `other` sketch to `sketch` (e.g. to combine sketches of different parts of a
+ * log).
+ */
+void quantileSketch_merge(quantileSketch_t *sketch, quantileSketch_t *other)
+{
+    const quantileCentroid_t *centroids;
+    int count = quantileSketch_getCentroids(other, &centroids);
+
+    if (other->min < sketch->min)
+        sketch->min = other->min;
+    if (other->max > sketch->max)
+        sketch->max = other->max;
+
+    for (int i = 0; i < count; i++) {
+        quantileSketch_appendCentroid(sketch, centroids[i].mean, centroids[i].weight);
+    }
+}
+
+double quantileSketch_getCount(quantileSketch_t *sketch)
+{
+    quantileSketch_flush(sketch);
+
+    return sketch->centroidWeight;
+}
+
+/**
+ * Get the sketch's centroids (in order of their means), for saving the sketch. Returns the number of centroids.
+ */
+int quantileSketch_getCentroids(quantileSketch_t *sketch, const quantileCentroid_t **centroids)
+{
+    quantileSketch_flush(sketch);
+
+    *centroids = sketch->centroids;
+
+    return sketch->centroidCount;
+}
+
+/**
+ * Estimate the value at the given quantile (0-1) of the series, interpolating between the centroids. Returns NAN if
+ * the series is empty.
+ */
+double quantileSketch_getQuantile(quantileSketch_t *sketch, double q)
+{
+    quantileCentroid_t *centroids;
+    int count;
+    double totalWeight, index, weightSoFar;
+
+    quantileSketch_flush(sketch);
+
+    centroids = sketch->centroids;
+    count = sketch->centroidCount;
+    totalWeight = sketch->centroidWeight;
+
+    if (count == 0)
+        return NAN;
+
+    if (q <= 0)
+        return sketch->min;
+
+    if (q >= 1)
+        return sketch->max;
+
+    if (count == 1)
+        return centroids[0].mean;
+
+    index = q * totalWeight;
+
+    // Between the minimum and the center of the first centroid
+    if (index < centroids[0].weight / 2) {
+        if (centroids[0].weight <= 1)
+            return sketch->min;
+
+        return sketch->min + (centroids[0].mean - sketch->min) * index / (centroids[0].weight / 2);
+    }
+
+    weightSoFar = centroids[0].weight / 2;
+
+    for (int i = 0; i < count - 1; i++) {
+        double delta = (centroids[i].weight + centroids[i + 1].weight) / 2;
+
+        if (weightSoFar + delta > index) {
+            // A centroid with a single value in it sits exactly at that value
+            double leftUnit = centroids[i].weight == 1 ? 0.5 : 0;
+            double rightUnit = centroids[i + 1].weight == 1 ? 0.5 : 0;
+            double z1, z2;
+
+            if (leftUnit > 0 && index - weightSoFar < leftUnit)
+                return centroids[i].mean;
+            if (rightUnit > 0 && weightSoFar + delta - index <= rightUnit)
+                return centroids[i + 1].mean;
+
+            z1 = index - weightSoFar - leftUnit;
+            z2 = weightSoFar + delta - index - rightUnit;
+
+            return (centroids[i].mean * z2 + centroids[i + 1].mean * z1) / (z1 + z2);
+        }
+
+        weightSoFar += delta;
+    }
+
+    // Between the center of the last centroid and the maximum
+    if (centroids[count - 1].weight <= 1)
+        return sketch->max;
+
+    return centroids[count - 1].mean + (sketch->max - centroids[count - 1].mean)
+        * (index - weightSoFar) / (centroids[count - 1].weight / 2);
+}
@@ -9,9 +9,50 @@ typedef struct seriesStats_t {
 void seriesStats_init(seriesStats_t *stats);
 
 void seriesStats_append(seriesStats_t *stats, double val);
+void seriesStats_merge(seriesStats_t *stats, const seriesStats_t *other);
 int seriesStats_getCount(seriesStats_t *stats);
 double seriesStats_getMean(seriesStats_t *stats);
 double seriesStats_getVariance(seriesStats_t *stats);
 double seriesStats_getStandardDeviation(seriesStats_t *stats);
 
+typedef struct quantileCentroid_t {
+    double mean, weight;
+} quantileCentroid_t;
+
+/**
+ * A streaming estimate of the distribution of a series (a "merging t-digest"), which can answer quantile queries like
+ * the median or 99.9th percentile in a fixed amount of memory. Two sketches can be merged to get the sketch of the
+ * combined series.
+ */
+typedef struct quantileSketch_t {
+    double compression;
+
+    // Sorted by mean
+    quantileCentroid_t *centroids;
+    int centroidCount, centroidCapacity;
+    double centroidWeight;
+
+    // Values that haven't been merged into the centroids yet
+    quantileCentroid_t *buffer;
+    int bufferCount, bufferCapacity;
+
+    // Scratch space for merging the buffer with the centroids
+    quantileCentroid_t *merged;
+
+    double min, max;
+} quantileSketch_t;
+
+#define QUANTILE_SKETCH_DEFAULT_COMPRESSION 200
+
+void quantileSketch_init(quantileSketch_t *sketch, double compression);
+void quantileSketch_reset(quantileSketch_t *sketch);
+void quantileSketch_free(quantileSketch_t *sketch);
+
+void quantileSketch_append(quantileSketch_t *sketch, double val);
+void quantileSketch_merge(quantileSketch_t *sketch, quantileSketch_t *other);
+
+double quantileSketch_getCount(quantileSketch_t *sketch);
+double quantileSketch_getQuantile(quantileSketch_t *sketch, double q);
+int quantileSketch_getCentroids(quantileSketch_t *sketch, const quantileCentroid_t **centroids);
+
 #endif
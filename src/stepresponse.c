@@ -0,0 +1,460 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+//For msvcrt to define M_PI:
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "stepresponse.h"
+#include "formatpool.h"
+#include "fft.h"
+#include "resample.h"
+
+/*
+ * "step-response" sink: the average response of the gyro on each axis to a unit step of the stick command, for PID
+ * tuning.
+ *
+ * The rcCommand and gyroADC fields of the roll, pitch and yaw axes are resampled onto a uniform time grid, which is cut
+ * into overlapping Hann windows. For each window where the sticks moved, the axis's impulse response is estimated from
+ * the spectra of its input (rcCommand) and output (gyroADC) by Wiener deconvolution, and its running sum gives the
+ * window's step response. The step responses are averaged over the windows of the whole log, then scaled so that the
+ * steady state is 1, since the log doesn't tell us how rcCommand maps onto a rotation rate.
+ *
+ * The windows are gathered into blocks as the frames arrive, which are deconvolved in parallel by the --threads workers,
+ * so only the blocks in flight are kept in memory.
+ */
+
+#define STEP_RESPONSE_AXES 3
+#define STEP_RESPONSE_WINDOWS_PER_BLOCK 8
+// Windows are at least this long, and begin every 1/STEP_RESPONSE_WINDOW_OVERLAP of a window
+#define STEP_RESPONSE_WINDOW_MS 1000
+#define STEP_RESPONSE_WINDOW_OVERLAP 8
+// The length of the step response to compute
+#define STEP_RESPONSE_LENGTH_MS 500
+// The response is the average of its last STEP_RESPONSE_STEADY_FRACTION once it has settled
+#define STEP_RESPONSE_STEADY_FRACTION 0.4
+// Windows where the stick command moves over a smaller range than this don't say much about the response
+#define STEP_RESPONSE_MIN_INPUT_RANGE 20
+// The noise-to-signal ratio assumed by the Wiener deconvolution, relative to the window's mean input power
+#define STEP_RESPONSE_NOISE_RATIO 0.01
+// The impulse response is low-pass filtered with a raised cosine from this frequency up to twice it
+#define STEP_RESPONSE_CUTOFF_HZ 50
+
+/**
+ * A block of windows to deconvolve. In memory it's followed by the sum of its windows' step responses (in rows of
+ * responseLength for each axis), and then by the windows' samples (a row of windowSize for each field of each window).
+ */
+typedef struct stepResponseBlock_t {
+    int windowCount;
+    // The number of windows that were used for each axis
+    int windows[STEP_RESPONSE_AXES];
+} stepResponseBlock_t;
+
+typedef struct stepResponseState_t {
+    uniformSeries_t series;
+
+    int windowSize;
+    double sampleRate;
+
+    fftPlan_t *plan;
+    float *window;
+    // The low-pass mask applied to the estimated transfer function (one value per bin)
+    float *mask;
+    int responseLength;
+
+    formatPool_t *pool;
+    // The block being filled with windows, if any
+    stepResponseBlock_t *block;
+
+    // The sum of the step responses of every window so far (in rows of responseLength), and the number of windows
+    // that were used for each axis
+    double *response;
+    int windows[STEP_RESPONSE_AXES];
+} stepResponseState_t;
+
+static stepResponseState_t stepResponse;
+
+static const decodeSinkContext_t *decodeContext;
+
+static double* stepResponseBlockResponse(stepResponseBlock_t *block)
+{
+    return (double *) (block + 1);
+}
+
+static float* stepResponseBlockSamples(stepResponseBlock_t *block)
+{
+    return (float *) (stepResponseBlockResponse(block) + (size_t) STEP_RESPONSE_AXES * stepResponse.responseLength);
+}
+
+/**
+ * Estimate the step responses of the axes for a block of windows (called from the worker threads), adding them to the
+ * block's sum.
+ */
+static void deconvolveStepResponseBlock(void *context, void *data, outputStream_t *output)
+{
+    stepResponseBlock_t *block = (stepResponseBlock_t *) data;
+    int windowSize = stepResponse.windowSize, binCount = windowSize / 2 + 1;
+    int responseLength = stepResponse.responseLength;
+    double *blockResponse = stepResponseBlockResponse(block);
+    float *re = malloc(windowSize * sizeof(*re)), *im = malloc(windowSize * sizeof(*im));
+    float *inputRe = malloc(binCount * sizeof(float)), *inputIm = malloc(binCount * sizeof(float));
+    float *outputRe = malloc(binCount * sizeof(float)), *outputIm = malloc(binCount * sizeof(float));
+
+    (void) context;
+    (void) output;
+
+    memset(blockResponse, 0, (size_t) STEP_RESPONSE_AXES * responseLength * sizeof(*blockResponse));
+    memset(block->windows, 0, sizeof(block->windows));
+
+    for (int window = 0; window < block->windowCount; window++) {
+        const float *windowSamples = stepResponseBlockSamples(block) + (size_t) window * STEP_RESPONSE_AXES * 2 * windowSize;
+
+        for (int axis = 0; axis < STEP_RESPONSE_AXES; axis++) {
+            const float *input = windowSamples + (size_t) axis * 2 * windowSize;
+            const float *outputSamples = input + windowSize;
+            float inputMin = input[0], inputMax = input[0];
+            double inputMean = 0, outputMean = 0, inputPower = 0, regularisation, offset = 0, step = 0;
+
+            for (int i = 0; i < windowSize; i++) {
+                inputMin = input[i] < inputMin ? input[i] : inputMin;
+                inputMax = input[i] > inputMax ? input[i] : inputMax;
+                inputMean += input[i];
+                outputMean += outputSamples[i];
+            }
+
+            if (inputMax - inputMin < STEP_RESPONSE_MIN_INPUT_RANGE)
+                continue;
+
+            inputMean /= windowSize;
+            outputMean /= windowSize;
+
+            // Transform the input and output together, as the real and imaginary parts of one complex sequence
+            for (int i = 0; i < windowSize; i++) {
+                re[i] = (float) (input[i] - inputMean) * stepResponse.window[i];
+                im[i] = (float) (outputSamples[i] - outputMean) * stepResponse.window[i];
+            }
+
+            fftRealPairTransform(stepResponse.plan, re, im, inputRe, inputIm, outputRe, outputIm);
+
+            for (int bin = 0; bin < binCount; bin++) {
+                inputPower += (double) inputRe[bin] * inputRe[bin] + (double) inputIm[bin] * inputIm[bin];
+            }
+
+            regularisation = STEP_RESPONSE_NOISE_RATIO * inputPower / binCount;
+
+            // H = Y X* / (|X|^2 + noise), filled out to the whole (conjugate-symmetric) spectrum of the real impulse response
+            for (int bin = 0; bin < binCount; bin++) {
+                double scale = stepResponse.mask[bin]
+                    / ((double) inputRe[bin] * inputRe[bin] + (double) inputIm[bin] * inputIm[bin] + regularisation);
+
+                re[bin] = (float) (((double) outputRe[bin] * inputRe[bin] + (double) outputIm[bin] * inputIm[bin]) * scale);
+                im[bin] = (float) (((double) outputIm[bin] * inputRe[bin] - (double) outputRe[bin] * inputIm[bin]) * scale);
+            }
+
+            for (int bin = binCount; bin < windowSize; bin++) {
+                re[bin] = re[windowSize - bin];
+                im[bin] = -im[windowSize - bin];
+            }
+
+            fftInverseTransform(stepResponse.plan, re, im);
+
+            /*
+             * The bins near DC are poorly determined (the windows have their means removed), which spreads an offset
+             * over the whole impulse response. The true response has died away by responseLength, so measure the offset
+             * over the rest of the window and take it out.
+             */
+            for (int i = responseLength; i < windowSize; i++) {
+                offset += re[i];
+            }
+
+            offset /= windowSize - responseLength;
+
+            for (int i = 0; i < responseLength; i++) {
+                step += re[i] - offset;
+                blockResponse[axis * responseLength + i] += step;
+            }
+
+            block->windows[axis]++;
+        }
+    }
+
+    free(re);
+    free(im);
+    free(inputRe);
+    free(inputIm);
+    free(outputRe);
+    free(outputIm);
+}
+
+/**
+ * Add a deconvolved block's responses to the total. The blocks come here in order, so the total is the same for any
+ * number of threads.
+ */
+static void collectStepResponseBlock(void *context, void *data)
+{
+    stepResponseBlock_t *block = (stepResponseBlock_t *) data;
+    double *blockResponse = stepResponseBlockResponse(block);
+
+    (void) context;
+
+    for (int axis = 0; axis < STEP_RESPONSE_AXES; axis++) {
+        stepResponse.windows[axis] += block->windows[axis];
+    }
+
+    for (size_t i = 0; i < (size_t) STEP_RESPONSE_AXES * stepResponse.responseLength; i++) {
+        stepResponse.response[i] += blockResponse[i];
+    }
+}
+
+/**
+ * The grid's interval is known, so choose the window for it and start the workers.
+ */
+static void stepResponseStart(void *context, double sampleInterval, int *windowSize, int *windowStep)
+{
+    flightLog_t *log = (flightLog_t *) context;
+    int binCount, responseLength;
+    size_t blockSize;
+
+    stepResponse.windowSize = 4;
+
+    // The shortest power-of-two window which covers STEP_RESPONSE_WINDOW_MS
+    while (stepResponse.windowSize * sampleInterval < STEP_RESPONSE_WINDOW_MS * 1000.0) {
+        stepResponse.windowSize *= 2;
+    }
+
+    stepResponse.sampleRate = 1000000.0 / sampleInterval;
+    binCount = stepResponse.windowSize / 2 + 1;
+    responseLength = (int) (STEP_RESPONSE_LENGTH_MS / 1000.0 * stepResponse.sampleRate);
+    responseLength = responseLength < 1 ? 1 : responseLength > stepResponse.windowSize / 2 ? stepResponse.windowSize / 2 : responseLength;
+
+    stepResponse.plan = fftPlanCreate(stepResponse.windowSize);
+    stepResponse.window = malloc(stepResponse.windowSize * sizeof(*stepResponse.window));
+    stepResponse.mask = malloc(binCount * sizeof(*stepResponse.mask));
+    stepResponse.responseLength = responseLength;
+    stepResponse.response = calloc((size_t) STEP_RESPONSE_AXES * responseLength, sizeof(*stepResponse.response));
+
+    for (int i = 0; i < stepResponse.windowSize; i++) {
+        stepResponse.window[i] = (float) (0.5 - 0.5 * cos(2 * M_PI * i / stepResponse.windowSize));
+    }
+
+    for (int bin = 0; bin < binCount; bin++) {
+        double frequency = bin * stepResponse.sampleRate / stepResponse.windowSize;
+
+        if (frequency <= STEP_RESPONSE_CUTOFF_HZ) {
+            stepResponse.mask[bin] = 1;
+        } else if (frequency >= STEP_RESPONSE_CUTOFF_HZ * 2) {
+            stepResponse.mask[bin] = 0;
+        } else {
+            stepResponse.mask[bin] = (float) (0.5 + 0.5 * cos(M_PI * (frequency - STEP_RESPONSE_CUTOFF_HZ) / STEP_RESPONSE_CUTOFF_HZ));
+        }
+    }
+
+    blockSize = sizeof(stepResponseBlock_t)
+        + (size_t) STEP_RESPONSE_AXES * responseLength * sizeof(double)
+        + (size_t) STEP_RESPONSE_WINDOWS_PER_BLOCK * STEP_RESPONSE_AXES * 2 * stepResponse.windowSize * sizeof(float);
+
+    // The blocks don't write anything, they only add up their responses
+    stepResponse.pool = formatPoolCreate(decodeContext->threads, blockSize, deconvolveStepResponseBlock,
+        collectStepResponseBlock, log, NULL);
+
+    *windowSize = stepResponse.windowSize;
+    *windowStep = stepResponse.windowSize / STEP_RESPONSE_WINDOW_OVERLAP;
+}
+
+static void stepResponseAddWindow(void *context, const float *samples, int64_t time)
+{
+    size_t windowLength = (size_t) STEP_RESPONSE_AXES * 2 * stepResponse.windowSize;
+
+    (void) context;
+    (void) time;
+
+    if (!stepResponse.block) {
+        stepResponse.block = (stepResponseBlock_t *) formatPoolAcquire(stepResponse.pool);
+        stepResponse.block->windowCount = 0;
+    }
+
+    memcpy(stepResponseBlockSamples(stepResponse.block) + stepResponse.block->windowCount * windowLength, samples,
+        windowLength * sizeof(*samples));
+    stepResponse.block->windowCount++;
+
+    if (stepResponse.block->windowCount == STEP_RESPONSE_WINDOWS_PER_BLOCK) {
+        formatPoolSubmit(stepResponse.pool);
+        stepResponse.block = NULL;
+    }
+}
+
+static void stepResponseSinkBeginLog(flightLog_t *log)
+{
+    int fields[STEP_RESPONSE_AXES * 2];
+
+    // Each axis is a pair of fields in the series, the input and then the output
+    for (int axis = 0; axis < STEP_RESPONSE_AXES; axis++) {
+        fields[axis * 2] = log->mainFieldIndexes.rcCommand[axis];
+        fields[axis * 2 + 1] = log->mainFieldIndexes.gyroADC[axis];
+
+        if (fields[axis * 2] == -1 || fields[axis * 2 + 1] == -1) {
+            fprintf(stderr, "Log doesn't have the rcCommand and gyroADC fields of every axis, so no step response will be computed\n");
+            return;
+        }
+    }
+
+    uniformSeriesInit(&stepResponse.series, fields, STEP_RESPONSE_AXES * 2, stepResponseStart, stepResponseAddWindow, log);
+}
+
+static void stepResponseSinkOnMainFrame(flightLog_t *log, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset, int frameSize)
+{
+    (void) log;
+    (void) frameType;
+    (void) frameOffset;
+    (void) frameSize;
+
+    if (frameValid && stepResponse.series.fieldCount > 0) {
+        uniformSeriesAddFrame(&stepResponse.series, frame);
+    }
+}
+
+/**
+ * Deconvolve the windows that are still waiting, and write the step responses averaged over all of them.
+ */
+static void stepResponseFinish(void)
+{
+    static const char *axisNames[STEP_RESPONSE_AXES] = {"roll", "pitch", "yaw"};
+
+    uniformSeries_t *series = &stepResponse.series;
+    int responseLength;
+    double *response;
+    char *filename = NULL;
+    outputStream_t *file;
+
+    uniformSeriesFinish(series);
+
+    if (!(series->sampleInterval > 0)) {
+        fprintf(stderr, "Log is too short to compute a step response\n");
+        return;
+    }
+
+    if (stepResponse.block) {
+        formatPoolSubmit(stepResponse.pool);
+        stepResponse.block = NULL;
+    }
+
+    formatPoolDestroy(stepResponse.pool);
+    stepResponse.pool = NULL;
+
+    if (series->windowCount == 0) {
+        fprintf(stderr, "Log is too short to compute a step response with a window of %d frames\n", stepResponse.windowSize);
+        return;
+    }
+
+    responseLength = stepResponse.responseLength;
+    response = stepResponse.response;
+
+    for (int axis = 0; axis < STEP_RESPONSE_AXES; axis++) {
+        double *axisResponse = response + axis * responseLength;
+        int steadyStart = (int) (responseLength * (1 - STEP_RESPONSE_STEADY_FRACTION));
+        double steady = 0;
+
+        for (int i = steadyStart; i < responseLength; i++) {
+            steady += axisResponse[i];
+        }
+
+        steady /= responseLength - steadyStart;
+
+        // An axis without a usable response is left as zeros
+        for (int i = 0; i < responseLength; i++) {
+            axisResponse[i] = stepResponse.windows[axis] > 0 && steady != 0 ? axisResponse[i] / steady : 0;
+        }
+    }
+
+    if (decodeContext->toStdout) {
+        file = outputStreamCreate(stdout, false, decodeContext->compressionLevel);
+    } else {
+        filename = createOutputFilename(".step.csv", true);
+        file = outputStreamOpen(filename, decodeContext->compressionLevel);
+
+        if (!file) {
+            fprintf(stderr, "Failed to create step response file %s\n", filename);
+        }
+    }
+
+    if (file) {
+        outputStreamPrintf(file, "time (ms),%s,%s,%s\n", axisNames[0], axisNames[1], axisNames[2]);
+
+        for (int i = 0; i < responseLength; i++) {
+            outputStreamPrintf(file, "%.3f", i * series->sampleInterval / 1000);
+
+            for (int axis = 0; axis < STEP_RESPONSE_AXES; axis++) {
+                outputStreamPrintf(file, ",%.4f", response[axis * responseLength + i]);
+            }
+
+            outputStreamPrintf(file, "\n");
+        }
+
+        outputStreamClose(file, decodeContext->outputStats);
+
+        fprintf(stderr, "Step response from %d windows of %d samples at %.1f Hz written to '%s'\n",
+            series->windowCount, stepResponse.windowSize, stepResponse.sampleRate, filename ? filename : "stdout");
+    }
+
+    for (int axis = 0; axis < STEP_RESPONSE_AXES; axis++) {
+        double *axisResponse = response + axis * responseLength;
+        int peak = 0, rise = -1;
+
+        if (stepResponse.windows[axis] == 0) {
+            fprintf(stderr, "  %-5s no windows with enough stick movement\n", axisNames[axis]);
+            continue;
+        }
+
+        for (int i = 0; i < responseLength; i++) {
+            if (axisResponse[i] > axisResponse[peak]) {
+                peak = i;
+            }
+            if (rise == -1 && axisResponse[i] >= 0.9) {
+                rise = i;
+            }
+        }
+
+        fprintf(stderr, "  %-5s peak %.2f at %.1f ms, 90%% after %.1f ms, from %d windows\n", axisNames[axis],
+            axisResponse[peak], peak * series->sampleInterval / 1000, rise * series->sampleInterval / 1000, stepResponse.windows[axis]);
+    }
+
+    free(filename);
+}
+
+static void stepResponseSinkEndLog(flightLog_t *log, int logIndex, bool success)
+{
+    (void) log;
+    (void) logIndex;
+
+    if (success && stepResponse.series.fieldCount > 0) {
+        stepResponseFinish();
+    }
+
+    // Wait for any windows still being deconvolved (when the log failed to parse) before freeing what they use
+    formatPoolDestroy(stepResponse.pool);
+
+    uniformSeriesFree(&stepResponse.series);
+    fftPlanDestroy(stepResponse.plan);
+
+    free(stepResponse.window);
+    free(stepResponse.mask);
+    free(stepResponse.response);
+
+    memset(&stepResponse, 0, sizeof(stepResponse));
+}
+
+static void stepResponseSinkInit(const decodeSinkContext_t *context)
+{
+    decodeContext = context;
+}
+
+decodeSink_t stepResponseSink = {
+    .name = "step-response",
+    .init = stepResponseSinkInit, .beginLog = stepResponseSinkBeginLog,
+    .onMainFrame = stepResponseSinkOnMainFrame,
+    .endLog = stepResponseSinkEndLog
+};
@@ -0,0 +1,9 @@
+#ifndef STEPRESPONSE_H_
+#define STEPRESPONSE_H_
+
+#include "decodesink.h"
+
+// The "step-response" sink, which writes each axis's average response to a step of the stick command
+extern decodeSink_t stepResponseSink;
+
+#endif
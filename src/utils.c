@@ -1,4 +1,6 @@
 #include "utils.h"
+#include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 
 /**
@@ -64,3 +66,54 @@ void extractBaseNamePrefix(const char *filename, const char *logNameEnd, bool ha
         if (outBaseNamePrefixLen) *outBaseNamePrefixLen = logNameEnd - filename;
     }
 }
+
+/**
+ * Build the name of a file that lives alongside a log and belongs to one of the logs inside it, like
+ * "LOG00001.01.bbcache" for the first log in "LOG00001.TXT" with the extension "bbcache".
+ * @param logFilename The name of the log file
+ * @param logIndex The index of the log within the file
+ * @param extension The extension for the new file (without a leading '.')
+ * @return The new filename, which the caller must free
+ */
+char *logSidecarFilename(const char *logFilename, int logIndex, const char *extension)
+{
+    const char *separator = findLastPathSeparator(logFilename);
+    const char *logExtension = strrchr(separator ? separator : logFilename, '.');
+    int baseLen = logExtension ? (int) (logExtension - logFilename) : (int) strlen(logFilename);
+    int filenameLen = baseLen + strlen(".00.") + strlen(extension) + 1;
+    char *filename = malloc(filenameLen);
+
+    snprintf(filename, filenameLen, "%.*s.%02d.%s", baseLen, logFilename, logIndex + 1, extension);
+
+    return filename;
+}
+
+/**
+ * A quick (non-cryptographic) hash of a block of bytes, to notice when a file has been changed.
+ */
+uint64_t hashBytes(const char *data, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    // FNV-1a, but consuming 8 bytes at a time
+    while (length >= sizeof(uint64_t)) {
+        uint64_t word;
+
+        memcpy(&word, data, sizeof(word));
+
+        hash = (hash ^ word) * 1099511628211ULL;
+        hash ^= hash >> 32;
+
+        data += sizeof(word);
+        length -= sizeof(word);
+    }
+
+    while (length > 0) {
+        hash = (hash ^ (uint8_t) *data) * 1099511628211ULL;
+
+        data++;
+        length--;
+    }
+
+    return hash;
+}
@@ -1,6 +1,7 @@
 #ifndef UTILS_H_
 #define UTILS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -26,4 +27,21 @@ void extractBaseNamePrefix(const char *filename, const char *logNameEnd, bool ha
                           const char **outBaseNamePrefix, int *outBaseNamePrefixLen,
                           const char **outOutputPrefix, int *outOutputPrefixLen);
 
+/**
+ * Build the name of a file that lives alongside a log, for the log with the given index inside it
+ * @param logFilename The name of the log file
+ * @param logIndex The index of the log within the file
+ * @param extension The extension for the new file, without a leading '.' (e.g. "bbcache")
+ * @return The new filename (like "LOG00001.01.bbcache"), which the caller must free
+ */
+char *logSidecarFilename(const char *logFilename, int logIndex, const char *extension);
+
+/**
+ * A quick non-cryptographic hash of a block of bytes
+ * @param data The bytes to hash
+ * @param length The number of bytes
+ * @return The hash
+ */
+uint64_t hashBytes(const char *data, size_t length);
+
 #endif
@@ -0,0 +1,185 @@
+/**
+ * Streams rendered video frames as uncompressed video (YUV4MPEG2 or raw RGBA) to a file, pipe or FIFO, so that a video
+ * encoder can read them directly instead of going through a PNG for every frame.
+ *
+ * Frames may be rendered out of order by several threads at once, so they're put back in order through a ring of
+ * slots, with frame n going into slot (n % slotCount). A renderer must wait for room in the ring before it picks its
+ * next frame number, so frame n can't be started until frame (n - slotCount) has been written out. That keeps each
+ * slot to one frame at a time and caps the number of frames in memory. Each renderer converts its frame into its slot
+ * itself, so that the writer only has to copy the bytes out.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "videostream.h"
+
+static const char Y4M_FRAME_HEADER[] = "FRAME\n";
+
+/*
+ * Cairo's ARGB32 pixels have their colour premultiplied by alpha, which is the same as being composited over black.
+ * That's what we want for YUV (which has no alpha), using the BT.601 limited-range coefficients.
+ */
+static void convertRowToYUV444(const uint32_t *argb, int width, uint8_t *y, uint8_t *u, uint8_t *v)
+{
+    for (int x = 0; x < width; x++) {
+        int32_t r = (argb[x] >> 16) & 0xFF;
+        int32_t g = (argb[x] >> 8) & 0xFF;
+        int32_t b = argb[x] & 0xFF;
+
+        y[x] = (uint8_t) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        u[x] = (uint8_t) (((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        v[x] = (uint8_t) (((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+}
+
+/*
+ * Raw RGBA has straight (not premultiplied) alpha, so that the video can be used as an overlay.
+ */
+static void convertRowToRGBA(const uint32_t *argb, int width, uint8_t *rgba)
+{
+    for (int x = 0; x < width; x++) {
+        uint32_t a = argb[x] >> 24;
+
+        if (a == 0) {
+            rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0;
+        } else {
+            rgba[0] = (uint8_t) ((((argb[x] >> 16) & 0xFF) * 255 + a / 2) / a);
+            rgba[1] = (uint8_t) ((((argb[x] >> 8) & 0xFF) * 255 + a / 2) / a);
+            rgba[2] = (uint8_t) (((argb[x] & 0xFF) * 255 + a / 2) / a);
+            rgba[3] = (uint8_t) a;
+        }
+
+        rgba += 4;
+    }
+}
+
+/**
+ * Convert an image of native-endian premultiplied ARGB32 pixels (as drawn by Cairo) into a frame of the given
+ * format, including its frame header.
+ */
+void videoStreamConvertFrame(VideoStreamFormat format, const uint8_t *argb, int stride, int width, int height, uint8_t *frame)
+{
+    size_t planeSize = (size_t) width * height;
+
+    switch (format) {
+        case VIDEO_STREAM_FORMAT_Y4M:
+            memcpy(frame, Y4M_FRAME_HEADER, strlen(Y4M_FRAME_HEADER));
+            frame += strlen(Y4M_FRAME_HEADER);
+
+            for (int row = 0; row < height; row++) {
+                size_t offset = (size_t) row * width;
+
+                convertRowToYUV444((const uint32_t *) (argb + (size_t) row * stride), width,
+                    frame + offset, frame + planeSize + offset, frame + planeSize * 2 + offset);
+            }
+        break;
+        case VIDEO_STREAM_FORMAT_RAW_RGBA:
+            for (int row = 0; row < height; row++) {
+                convertRowToRGBA((const uint32_t *) (argb + (size_t) row * stride), width, frame + (size_t) row * width * 4);
+            }
+        break;
+    }
+}
+
+/**
+ * Begin a video stream to the given file, with room for framesInFlight frames to be waiting to be written. The Y4M
+ * header is written immediately.
+ */
+videoStream_t* videoStreamCreate(FILE *file, VideoStreamFormat format, int width, int height, int fps, int framesInFlight)
+{
+    videoStream_t *stream = (videoStream_t *) calloc(1, sizeof(*stream));
+
+    stream->file = file;
+    stream->format = format;
+    stream->width = width;
+    stream->height = height;
+
+    switch (format) {
+        case VIDEO_STREAM_FORMAT_Y4M:
+            stream->frameSize = strlen(Y4M_FRAME_HEADER) + (size_t) width * height * 3;
+
+            fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+        break;
+        case VIDEO_STREAM_FORMAT_RAW_RGBA:
+            stream->frameSize = (size_t) width * height * 4;
+        break;
+    }
+
+    stream->slotCount = framesInFlight;
+    stream->slots = (videoStreamSlot_t *) calloc(stream->slotCount, sizeof(*stream->slots));
+
+    for (int i = 0; i < stream->slotCount; i++) {
+        stream->slots[i].frame = malloc(stream->frameSize);
+
+        semaphore_create(&stream->slots[i].ready, 0);
+    }
+
+    semaphore_create(&stream->room, stream->slotCount);
+
+    return stream;
+}
+
+/**
+ * Wait until there's room in the stream for another frame, then take the next frame number. Frame numbers must be
+ * handed out in increasing order after this returns. Each wait uses up the room for a frame, so a renderer that then
+ * finds that there are no frames left to take can just stop. There must be at least as many slots as renderers for
+ * them all to be able to do that at the end.
+ */
+void videoStreamWaitForRoom(videoStream_t *stream)
+{
+    semaphore_wait(&stream->room);
+}
+
+/**
+ * Convert the image for the frame with the given number (counting from zero) into the stream. This can be called from
+ * any number of threads at once.
+ */
+void videoStreamSubmitFrame(videoStream_t *stream, uint32_t frameNumber, const uint8_t *argb, int stride)
+{
+    videoStreamSlot_t *slot = &stream->slots[frameNumber % stream->slotCount];
+
+    videoStreamConvertFrame(stream->format, argb, stride, stream->width, stream->height, slot->frame);
+
+    semaphore_signal(&slot->ready);
+}
+
+/**
+ * Write out the first frameCount frames in order as they're submitted. Call this from one thread while the frames are
+ * being submitted from others.
+ */
+void videoStreamWriteFrames(videoStream_t *stream, uint32_t frameCount)
+{
+    for (uint32_t frameNumber = 0; frameNumber < frameCount; frameNumber++) {
+        videoStreamSlot_t *slot = &stream->slots[frameNumber % stream->slotCount];
+
+        semaphore_wait(&slot->ready);
+
+        if (fwrite(slot->frame, 1, stream->frameSize, stream->file) != stream->frameSize) {
+            fprintf(stderr, "Failed to write video frame %u: %s\n", frameNumber, strerror(errno));
+            exit(-1);
+        }
+
+        semaphore_signal(&stream->room);
+    }
+
+    fflush(stream->file);
+}
+
+void videoStreamDestroy(videoStream_t *stream)
+{
+    if (!stream)
+        return;
+
+    for (int i = 0; i < stream->slotCount; i++) {
+        free(stream->slots[i].frame);
+
+        semaphore_destroy(&stream->slots[i].ready);
+    }
+
+    semaphore_destroy(&stream->room);
+
+    free(stream->slots);
+    free(stream);
+}
@@ -0,0 +1,44 @@
+#ifndef VIDEOSTREAM_H_
+#define VIDEOSTREAM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "platform.h"
+
+typedef enum VideoStreamFormat {
+    VIDEO_STREAM_FORMAT_Y4M = 0,
+    VIDEO_STREAM_FORMAT_RAW_RGBA
+} VideoStreamFormat;
+
+typedef struct videoStreamSlot_t {
+    uint8_t *frame;
+
+    // Signalled when the slot's frame is ready to be written
+    semaphore_t ready;
+} videoStreamSlot_t;
+
+typedef struct videoStream_t {
+    FILE *file;
+    VideoStreamFormat format;
+    int width, height;
+
+    size_t frameSize;
+
+    int slotCount;
+    videoStreamSlot_t *slots;
+
+    // Counts the slots that are free for more frames to be started
+    semaphore_t room;
+} videoStream_t;
+
+videoStream_t* videoStreamCreate(FILE *file, VideoStreamFormat format, int width, int height, int fps, int framesInFlight);
+void videoStreamDestroy(videoStream_t *stream);
+
+void videoStreamConvertFrame(VideoStreamFormat format, const uint8_t *argb, int stride, int width, int height, uint8_t *frame);
+
+void videoStreamWaitForRoom(videoStream_t *stream);
+void videoStreamSubmitFrame(videoStream_t *stream, uint32_t frameNumber, const uint8_t *argb, int stride);
+void videoStreamWriteFrames(videoStream_t *stream, uint32_t frameCount);
+
+#endif
@@ -0,0 +1,69 @@
+/**
+ * A fixed-size first-in first-out queue of pointers which any number of threads can add to and take from at once,
+ * waiting while it's full or empty. It's meant for handing out objects that are recycled between threads, like the
+ * renderer's frame surfaces, so the queue never allocates anything after it's created.
+ */
+#include <stdlib.h>
+
+#include "workqueue.h"
+
+workQueue_t* workQueueCreate(int capacity)
+{
+    workQueue_t *queue = (workQueue_t *) calloc(1, sizeof(*queue));
+
+    queue->entries = (void **) calloc(capacity, sizeof(*queue->entries));
+    queue->capacity = capacity;
+
+    semaphore_create(&queue->waiting, 0);
+    semaphore_create(&queue->space, capacity);
+    semaphore_create(&queue->lock, 1);
+
+    return queue;
+}
+
+void workQueueDestroy(workQueue_t *queue)
+{
+    if (!queue)
+        return;
+
+    semaphore_destroy(&queue->waiting);
+    semaphore_destroy(&queue->space);
+    semaphore_destroy(&queue->lock);
+
+    free(queue->entries);
+    free(queue);
+}
+
+/**
+ * Add the entry to the back of the queue, waiting for there to be room for it first.
+ */
+void workQueuePush(workQueue_t *queue, void *entry)
+{
+    semaphore_wait(&queue->space);
+    semaphore_wait(&queue->lock);
+
+    queue->entries[queue->tail] = entry;
+    queue->tail = (queue->tail + 1) % queue->capacity;
+
+    semaphore_signal(&queue->lock);
+    semaphore_signal(&queue->waiting);
+}
+
+/**
+ * Take the entry from the front of the queue, waiting for one to be added if it's empty.
+ */
+void* workQueuePop(workQueue_t *queue)
+{
+    void *entry;
+
+    semaphore_wait(&queue->waiting);
+    semaphore_wait(&queue->lock);
+
+    entry = queue->entries[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+
+    semaphore_signal(&queue->lock);
+    semaphore_signal(&queue->space);
+
+    return entry;
+}
@@ -0,0 +1,27 @@
+#ifndef WORKQUEUE_H_
+#define WORKQUEUE_H_
+
+#include <stdint.h>
+
+#include "platform.h"
+
+typedef struct workQueue_t {
+    void **entries;
+    int capacity;
+
+    uint32_t head, tail;
+
+    // Count the entries waiting to be taken, and the free spaces for more
+    semaphore_t waiting, space;
+
+    // Held while an entry is added or taken
+    semaphore_t lock;
+} workQueue_t;
+
+workQueue_t* workQueueCreate(int capacity);
+void workQueueDestroy(workQueue_t *queue);
+
+void workQueuePush(workQueue_t *queue, void *entry);
+void* workQueuePop(workQueue_t *queue);
+
+#endif
@@ -0,0 +1,326 @@
+/**
+ * Zone maps: a small ".bbzones" file stored next to a log which holds the range of every main field over each block
+ * of about ZONE_MAP_FRAMES_PER_BLOCK frames, along with the byte range of each block in the log.
+ *
+ * A query over the log can use the zone map to rule out every block whose ranges show that it can't contain a
+ * matching frame, and then decode only the remaining blocks. Since every block begins with an intraframe, a block can
+ * be decoded on its own without decoding any of the frames that came before it.
+ *
+ * The zone map is keyed by the size and modification time of the log file along with a hash of the log's headers.
+ * Unlike the decode cache, the log's frames aren't hashed, since reading the whole log to check the key would defeat
+ * the purpose.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+#include "utils.h"
+#include "zonemap.h"
+
+#define ZONE_MAP_MAGIC "BBZONES"
+#define ZONE_MAP_VERSION 1
+
+typedef struct zoneMapHeader_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t logIndex;
+
+    int64_t fileSize;
+    int64_t fileModified;
+    uint64_t headerHash;
+
+    uint32_t fieldCount;
+    uint32_t blockCount;
+} zoneMapHeader_t;
+
+/**
+ * Build the name of the zone map file for the given log, like "LOG00001.01.bbzones" for the first log in
+ * "LOG00001.TXT". The caller must free the result.
+ */
+char* zoneMapFilename(const char *logFilename, int logIndex)
+{
+    return logSidecarFilename(logFilename, logIndex, "bbzones");
+}
+
+zoneMap_t* zoneMapCreate(int fieldCount)
+{
+    zoneMap_t *map = (zoneMap_t *) calloc(1, sizeof(*map));
+
+    map->fieldCount = fieldCount;
+
+    return map;
+}
+
+void zoneMapDestroy(zoneMap_t *map)
+{
+    if (!map)
+        return;
+
+    free(map->ranges);
+    free(map->frameCount);
+    free(map->min);
+    free(map->max);
+    free(map);
+}
+
+static void zoneMapSetBlockCapacity(zoneMap_t *map, int capacity)
+{
+    map->blockCapacity = capacity;
+
+    map->ranges = (flightLogDataRange_t *) realloc(map->ranges, capacity * sizeof(*map->ranges));
+    map->frameCount = (uint32_t *) realloc(map->frameCount, capacity * sizeof(*map->frameCount));
+    map->min = (int64_t *) realloc(map->min, (size_t) capacity * map->fieldCount * sizeof(*map->min));
+    map->max = (int64_t *) realloc(map->max, (size_t) capacity * map->fieldCount * sizeof(*map->max));
+}
+
+/**
+ * Add a main frame (as delivered to the parser's onFrameReady callback) to the zone map that's being built.
+ */
+void zoneMapAddMainFrame(zoneMap_t *map, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset)
+{
+    int block;
+    int64_t *min, *max;
+
+    if (!frameValid || !frame)
+        return;
+
+    if (frameType == 'I'
+            && (map->blockCount == 0 || map->frameCount[map->blockCount - 1] >= ZONE_MAP_FRAMES_PER_BLOCK)) {
+        // Begin a new block at the frame marker of this intraframe
+        int64_t blockStart = frameOffset - 1;
+
+        if (map->blockCount == map->blockCapacity) {
+            zoneMapSetBlockCapacity(map, map->blockCapacity ? map->blockCapacity * 2 : 64);
+        }
+
+        if (map->blockCount > 0) {
+            map->ranges[map->blockCount - 1].end = blockStart;
+        }
+
+        block = map->blockCount++;
+
+        map->ranges[block].start = blockStart;
+        map->ranges[block].end = blockStart;
+        // The frame's time is its logged 32-bit time plus the rollover count, so we can recover the count from it
+        map->ranges[block].timeRolloverAccumulator = frame[FLIGHT_LOG_FIELD_INDEX_TIME] - (uint32_t) frame[FLIGHT_LOG_FIELD_INDEX_TIME];
+        map->frameCount[block] = 0;
+    }
+
+    if (map->blockCount == 0)
+        return;
+
+    block = map->blockCount - 1;
+    min = map->min + (size_t) block * map->fieldCount;
+    max = map->max + (size_t) block * map->fieldCount;
+
+    if (map->frameCount[block] == 0) {
+        memcpy(min, frame, map->fieldCount * sizeof(*min));
+        memcpy(max, frame, map->fieldCount * sizeof(*max));
+    } else {
+        for (int i = 0; i < map->fieldCount; i++) {
+            if (frame[i] < min[i])
+                min[i] = frame[i];
+            if (frame[i] > max[i])
+                max[i] = frame[i];
+        }
+    }
+
+    map->frameCount[block]++;
+}
+
+/**
+ * Call once the whole log has been added to the zone map, to close off the last block at the end of the log.
+ */
+void zoneMapFinish(zoneMap_t *map, flightLog_t *log, int logIndex)
+{
+    if (map->blockCount > 0) {
+        map->ranges[map->blockCount - 1].end = log->logBegin[logIndex + 1] - log->private->stream->data;
+    }
+}
+
+static void zoneMapMakeKey(flightLog_t *log, int logIndex, int fieldCount, zoneMapHeader_t *header)
+{
+    fileMapping_t *mapping = &log->private->stream->mapping;
+
+    memset(header, 0, sizeof(*header));
+
+    memcpy(header->magic, ZONE_MAP_MAGIC, sizeof(ZONE_MAP_MAGIC));
+    header->version = ZONE_MAP_VERSION;
+    header->logIndex = logIndex;
+    header->fileSize = mapping->stats.st_size;
+    header->fileModified = mapping->stats.st_mtime;
+    header->headerHash = hashBytes(log->logBegin[logIndex], log->logHeaderEnd[logIndex] - log->logBegin[logIndex]);
+    header->fieldCount = fieldCount;
+}
+
+/**
+ * Write the zone map for the log with the given index to `filename`. The file is written under a temporary name and
+ * renamed into place at the end, so a reader never sees a partially written zone map.
+ */
+bool zoneMapSave(const zoneMap_t *map, flightLog_t *log, int logIndex, const char *filename)
+{
+    int tempFilenameLen = strlen(filename) + strlen(".tmp") + 1;
+    char *tempFilename = malloc(tempFilenameLen);
+    size_t valueCount = (size_t) map->blockCount * map->fieldCount;
+    zoneMapHeader_t header;
+    bool success;
+    FILE *file;
+
+    snprintf(tempFilename, tempFilenameLen, "%s.tmp", filename);
+
+    file = fopen(tempFilename, "wb");
+
+    if (!file) {
+        free(tempFilename);
+        return false;
+    }
+
+    zoneMapMakeKey(log, logIndex, map->fieldCount, &header);
+    header.blockCount = map->blockCount;
+
+    success = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(map->ranges, sizeof(*map->ranges), map->blockCount, file) == (size_t) map->blockCount
+        && fwrite(map->frameCount, sizeof(*map->frameCount), map->blockCount, file) == (size_t) map->blockCount
+        && fwrite(map->min, sizeof(*map->min), valueCount, file) == valueCount
+        && fwrite(map->max, sizeof(*map->max), valueCount, file) == valueCount;
+
+    success = fclose(file) == 0 && success;
+
+    if (success) {
+        // Windows won't rename over an existing file
+        remove(filename);
+        success = rename(tempFilename, filename) == 0;
+    }
+
+    if (!success) {
+        remove(tempFilename);
+    }
+
+    free(tempFilename);
+
+    return success;
+}
+
+/**
+ * Load the zone map for the log with the given index, whose headers must have already been parsed (e.g. with
+ * flightLogParseHeaders()).
+ *
+ * Returns NULL if the file doesn't exist or doesn't belong to the current version of the log.
+ */
+zoneMap_t* zoneMapLoad(flightLog_t *log, int logIndex, const char *filename)
+{
+    int fieldCount = log->frameDefs['I'].fieldCount;
+    int64_t logStart = log->logHeaderEnd[logIndex] - log->private->stream->data;
+    int64_t logEnd = log->logBegin[logIndex + 1] - log->private->stream->data;
+    zoneMapHeader_t header, expected;
+    zoneMap_t *map = NULL;
+    size_t valueCount;
+    FILE *file;
+
+    file = fopen(filename, "rb");
+
+    if (!file)
+        return NULL;
+
+    zoneMapMakeKey(log, logIndex, fieldCount, &expected);
+
+    if (fread(&header, sizeof(header), 1, file) != 1
+            || memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != expected.version
+            || header.logIndex != expected.logIndex
+            || header.fileSize != expected.fileSize
+            || header.fileModified != expected.fileModified
+            || header.headerHash != expected.headerHash
+            || header.fieldCount != expected.fieldCount
+            || header.blockCount > (uint32_t) (logEnd - logStart)) {
+        goto fail;
+    }
+
+    map = zoneMapCreate(fieldCount);
+
+    if (header.blockCount > 0) {
+        zoneMapSetBlockCapacity(map, header.blockCount);
+    }
+    map->blockCount = header.blockCount;
+
+    valueCount = (size_t) map->blockCount * fieldCount;
+
+    if (fread(map->ranges, sizeof(*map->ranges), map->blockCount, file) != (size_t) map->blockCount
+            || fread(map->frameCount, sizeof(*map->frameCount), map->blockCount, file) != (size_t) map->blockCount
+            || fread(map->min, sizeof(*map->min), valueCount, file) != valueCount
+            || fread(map->max, sizeof(*map->max), valueCount, file) != valueCount) {
+        goto fail;
+    }
+
+    // Make sure that the blocks won't send the parser outside of the log
+    for (int i = 0; i < map->blockCount; i++) {
+        if (map->ranges[i].start < logStart || map->ranges[i].end > logEnd || map->ranges[i].start > map->ranges[i].end)
+            goto fail;
+    }
+
+    fclose(file);
+
+    return map;
+
+fail:
+    zoneMapDestroy(map);
+    fclose(file);
+
+    return NULL;
+}
+
+/**
+ * Check if the given main frame satisfies the condition.
+ */
+bool zoneMapConditionMatches(const zoneMapCondition_t *condition, const int64_t *frame)
+{
+    int64_t value = frame[condition->fieldIndex];
+
+    switch (condition->comparison) {
+        case ZONE_MAP_COMPARE_LT:
+            return value < condition->value;
+        case ZONE_MAP_COMPARE_LE:
+            return value <= condition->value;
+        case ZONE_MAP_COMPARE_GT:
+            return value > condition->value;
+        case ZONE_MAP_COMPARE_GE:
+            return value >= condition->value;
+        case ZONE_MAP_COMPARE_EQ:
+            return value == condition->value;
+        case ZONE_MAP_COMPARE_NE:
+            return value != condition->value;
+    }
+
+    return false;
+}
+
+/**
+ * Check if the given block could contain a frame which satisfies the condition (i.e. return false only if the block
+ * definitely doesn't contain one).
+ */
+bool zoneMapBlockMayMatch(const zoneMap_t *map, int block, const zoneMapCondition_t *condition)
+{
+    int64_t min = map->min[(size_t) block * map->fieldCount + condition->fieldIndex];
+    int64_t max = map->max[(size_t) block * map->fieldCount + condition->fieldIndex];
+
+    if (map->frameCount[block] == 0)
+        return false;
+
+    switch (condition->comparison) {
+        case ZONE_MAP_COMPARE_LT:
+            return min < condition->value;
+        case ZONE_MAP_COMPARE_LE:
+            return min <= condition->value;
+        case ZONE_MAP_COMPARE_GT:
+            return max > condition->value;
+        case ZONE_MAP_COMPARE_GE:
+            return max >= condition->value;
+        case ZONE_MAP_COMPARE_EQ:
+            return min <= condition->value && condition->value <= max;
+        case ZONE_MAP_COMPARE_NE:
+            return min != condition->value || max != condition->value;
+    }
+
+    return true;
+}
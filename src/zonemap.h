@@ -0,0 +1,59 @@
+#ifndef ZONEMAP_H_
+#define ZONEMAP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "parser.h"
+
+// A new block is started at the first intraframe after this many main frames have been added to the current block
+#define ZONE_MAP_FRAMES_PER_BLOCK 4096
+
+/**
+ * Block-level statistics for the main frames of a log: the log's data section is divided into blocks of about
+ * ZONE_MAP_FRAMES_PER_BLOCK frames that each begin at an intraframe, and each block records the range and count of
+ * every main field within it.
+ *
+ * Each block's range can be handed to flightLogParseRange() to decode just that block.
+ */
+typedef struct zoneMap_t {
+    int fieldCount;
+    int blockCount, blockCapacity;
+
+    flightLogDataRange_t *ranges;
+    uint32_t *frameCount; // Number of valid main frames in each block
+
+    // blockCount rows of fieldCount values
+    int64_t *min, *max;
+} zoneMap_t;
+
+typedef enum {
+    ZONE_MAP_COMPARE_LT,
+    ZONE_MAP_COMPARE_LE,
+    ZONE_MAP_COMPARE_GT,
+    ZONE_MAP_COMPARE_GE,
+    ZONE_MAP_COMPARE_EQ,
+    ZONE_MAP_COMPARE_NE
+} zoneMapComparison_e;
+
+// A comparison between a main field and a constant
+typedef struct zoneMapCondition_t {
+    int fieldIndex;
+    zoneMapComparison_e comparison;
+    int64_t value;
+} zoneMapCondition_t;
+
+char* zoneMapFilename(const char *logFilename, int logIndex);
+
+zoneMap_t* zoneMapCreate(int fieldCount);
+void zoneMapAddMainFrame(zoneMap_t *map, bool frameValid, int64_t *frame, uint8_t frameType, int frameOffset);
+void zoneMapFinish(zoneMap_t *map, flightLog_t *log, int logIndex);
+void zoneMapDestroy(zoneMap_t *map);
+
+bool zoneMapSave(const zoneMap_t *map, flightLog_t *log, int logIndex, const char *filename);
+zoneMap_t* zoneMapLoad(flightLog_t *log, int logIndex, const char *filename);
+
+bool zoneMapConditionMatches(const zoneMapCondition_t *condition, const int64_t *frame);
+bool zoneMapBlockMayMatch(const zoneMap_t *map, int block, const zoneMapCondition_t *condition);
+
+#endif
@@ -0,0 +1,101 @@
+/**
+ * The cost per video frame of finding the frames that renderAnimation() needs (the start and center of the graph
+ * window), for logs of increasing length. Scanning from the first frame (as the renderer used to) grows with the length
+ * of the log, while the binary search and the cursor should stay flat.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/datapoints.h"
+
+#define LOOP_TIME 125
+#define FPS 30
+#define WINDOW_WIDTH 1000000
+// The scan is too slow to run over every video frame of a long log, so only time this many
+#define SCAN_SAMPLES 200
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int scanFrameAtTime(datapoints_t *points, int64_t time)
+{
+	int lastGoodFrame = -1;
+
+	for (int i = 0; i < points->frameCount; i++) {
+		int64_t frameTime;
+
+		datapointsGetTimeAtIndex(points, i, &frameTime);
+
+		if (time < frameTime) {
+			return lastGoodFrame;
+		}
+		lastGoodFrame = i;
+	}
+
+	return lastGoodFrame;
+}
+
+int main(void)
+{
+	char *fieldNames[] = {"Test"};
+	int64_t checksum = 0;
+
+	printf("%10s %12s %14s %14s %14s\n", "frames", "video frames", "scan (ns)", "search (ns)", "cursor (ns)");
+
+	for (int frameCount = 10000; frameCount <= 10000000; frameCount *= 10) {
+		datapoints_t *points = datapointsCreate(1, fieldNames);
+		datapointsCursor_t startCursor, centerCursor;
+		int64_t logDuration = (int64_t) frameCount * LOOP_TIME, value = 0;
+		int videoFrames = (int) (logDuration * FPS / 1000000);
+		double start, scan, search, cursor;
+
+		for (int i = 0; i < frameCount; i++) {
+			datapointsAddFrame(points, (int64_t) i * LOOP_TIME, &value);
+		}
+
+		start = now();
+		for (int i = 0; i < SCAN_SAMPLES; i++) {
+			int64_t centerTime = (int64_t) i * videoFrames / SCAN_SAMPLES * 1000000 / FPS;
+
+			checksum += scanFrameAtTime(points, centerTime - WINDOW_WIDTH / 2 - 1) + scanFrameAtTime(points, centerTime);
+		}
+		scan = (now() - start) / SCAN_SAMPLES;
+
+		start = now();
+		for (int i = 0; i < videoFrames; i++) {
+			int64_t centerTime = (int64_t) i * 1000000 / FPS;
+
+			checksum += datapointsFindFrameAtTime(points, centerTime - WINDOW_WIDTH / 2 - 1) + datapointsFindFrameAtTime(points, centerTime);
+		}
+		search = (now() - start) / videoFrames;
+
+		datapointsCursorInit(&startCursor, points);
+		datapointsCursorInit(&centerCursor, points);
+
+		start = now();
+		for (int i = 0; i < videoFrames; i++) {
+			int64_t centerTime = (int64_t) i * 1000000 / FPS;
+
+			checksum += datapointsCursorSeek(&startCursor, centerTime - WINDOW_WIDTH / 2 - 1) + datapointsCursorSeek(&centerCursor, centerTime);
+		}
+		cursor = (now() - start) / videoFrames;
+
+		printf("%10d %12d %14.1f %14.1f %14.1f\n", frameCount, videoFrames, scan * 1e9, search * 1e9, cursor * 1e9);
+
+		datapointsDestroy(points);
+	}
+
+	// Keep the results live
+	printf("(checksum %lld)\n", (long long) checksum);
+
+	return 0;
+}
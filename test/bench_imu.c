@@ -0,0 +1,92 @@
+/**
+ * Throughput of the IMU simulation, one frame at a time and in column batches.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "../src/imu.h"
+
+#define FRAME_COUNT 2000000
+#define ACC_1G 2048
+#define GYRO_SCALE ((float) (2000.0 / 32768 * 3.14159265358979323846 / 180 * 0.000001))
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	uint32_t *time = malloc(FRAME_COUNT * sizeof(*time));
+	int16_t *gyro[3], *acc[3], *mag[3];
+	attitude_t *attitudes = malloc(FRAME_COUNT * sizeof(*attitudes));
+	imuSensorColumns_t columns;
+	imuState_t state;
+	double start, checksum = 0;
+
+	for (int axis = 0; axis < 3; axis++) {
+		gyro[axis] = malloc(FRAME_COUNT * sizeof(int16_t));
+		acc[axis] = malloc(FRAME_COUNT * sizeof(int16_t));
+		mag[axis] = malloc(FRAME_COUNT * sizeof(int16_t));
+
+		columns.gyroADC[axis] = gyro[axis];
+		columns.accSmooth[axis] = acc[axis];
+		columns.magADC[axis] = mag[axis];
+	}
+	columns.time = time;
+
+	for (int i = 0; i < FRAME_COUNT; i++) {
+		time[i] = 1000000 + i * 125;
+
+		for (int axis = 0; axis < 3; axis++) {
+			gyro[axis][i] = (int16_t) (4000 * sin(i * 0.001 * (axis + 1)) + rand() % 200 - 100);
+			acc[axis][i] = (int16_t) (axis == 2 ? ACC_1G : 0) + rand() % 100 - 50;
+			mag[axis][i] = (int16_t) (300 * cos(i * 0.0001 + axis * 2));
+		}
+	}
+
+	for (int withMag = 1; withMag >= 0; withMag--) {
+		double single, batch;
+
+		imuStateInit(&state);
+		start = now();
+
+		for (int i = 0; i < FRAME_COUNT; i++) {
+			int16_t frameGyro[3] = {gyro[0][i], gyro[1][i], gyro[2][i]};
+			int16_t frameAcc[3] = {acc[0][i], acc[1][i], acc[2][i]};
+			int16_t frameMag[3] = {mag[0][i], mag[1][i], mag[2][i]};
+
+			imuUpdateAttitude(&state, frameGyro, frameAcc, withMag ? frameMag : NULL, time[i], ACC_1G, GYRO_SCALE, &attitudes[i]);
+		}
+
+		single = now() - start;
+		checksum += attitudes[FRAME_COUNT - 1].heading;
+
+		for (int axis = 0; axis < 3; axis++) {
+			columns.magADC[axis] = withMag ? mag[axis] : NULL;
+		}
+
+		imuStateInit(&state);
+		start = now();
+
+		imuUpdateAttitudeBatch(&state, &columns, FRAME_COUNT, ACC_1G, GYRO_SCALE, attitudes);
+
+		batch = now() - start;
+		checksum += attitudes[FRAME_COUNT - 1].heading;
+
+		printf("%s magnetometer: %.1f Mframes/s one frame at a time, %.1f Mframes/s in batches\n", withMag ? "With" : "Without",
+			FRAME_COUNT / single / 1e6, FRAME_COUNT / batch / 1e6);
+	}
+
+	// Keep the results live
+	printf("(checksum %.3f)\n", checksum);
+
+	return 0;
+}
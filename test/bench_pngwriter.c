@@ -0,0 +1,166 @@
+/**
+ * Frames per second and bytes per frame of Cairo's PNG writer, and of pngwriter with various settings.
+ *
+ * Pass the PNGs of some frames rendered by blackbox_render to benchmark with those, otherwise a synthetic frame that
+ * looks roughly like an overlay (mostly transparent, with some translucent panels and graph lines) is used.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include <cairo.h>
+
+#include "../src/platform.h"
+#include "../src/pngwriter.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+// Each setting is timed for at least this many frames and this long
+#define MIN_FRAMES 10
+#define MIN_SECONDS 1.0
+
+typedef struct benchSetting_t {
+	const char *name;
+	pngWriterOptions_t options;
+} benchSetting_t;
+
+static const benchSetting_t SETTINGS[] = {
+	{"store, no filter",       {0, PNG_STRATEGY_DEFAULT, PNG_FILTER_NONE, 1}},
+	{"level 1, no filter",     {1, PNG_STRATEGY_DEFAULT, PNG_FILTER_NONE, 1}},
+	{"level 1, sub",           {1, PNG_STRATEGY_DEFAULT, PNG_FILTER_SUB, 1}},
+	{"level 1, up",            {1, PNG_STRATEGY_DEFAULT, PNG_FILTER_UP, 1}},
+	{"rle, up",                {1, PNG_STRATEGY_RLE, PNG_FILTER_UP, 1}},
+	{"level 6, up",            {6, PNG_STRATEGY_DEFAULT, PNG_FILTER_UP, 1}},
+	{"level 1, up, 4 stripes", {1, PNG_STRATEGY_DEFAULT, PNG_FILTER_UP, 4}},
+	{"level 6, up, 4 stripes", {6, PNG_STRATEGY_DEFAULT, PNG_FILTER_UP, 4}},
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fillRect(uint32_t *pixels, int x0, int y0, int x1, int y1, uint32_t argb)
+{
+	for (int y = y0; y < y1; y++)
+		for (int x = x0; x < x1; x++)
+			pixels[y * WIDTH + x] = argb;
+}
+
+static cairo_surface_t* createSyntheticFrame(void)
+{
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, WIDTH, HEIGHT);
+	uint32_t *pixels;
+
+	cairo_surface_flush(surface);
+	pixels = (uint32_t *) cairo_image_surface_get_data(surface);
+
+	// Premultiplied translucent grey panels for the PID table, sticks and accelerometer readings
+	fillRect(pixels, 1400, 40, 1880, 400, 0xCC262626);
+	fillRect(pixels, 700, 700, 1220, 1000, 0xCC262626);
+	fillRect(pixels, 20, 900, 600, 1060, 0x80131313);
+
+	// Graph lines, with an antialiased-looking fringe
+	for (int line = 0; line < 8; line++) {
+		uint32_t colour = 0xFF000000 | ((line * 0x3F5A7B) & 0xFFFFFF);
+
+		for (int x = 0; x < WIDTH; x++) {
+			int y = 300 + line * 40 + (int) (60 * sin(x * (0.01 + line * 0.003)) + 20 * sin(x * 0.17 * (line + 1)));
+
+			pixels[y * WIDTH + x] = colour;
+			pixels[(y + 1) * WIDTH + x] = colour;
+			pixels[(y - 1) * WIDTH + x] = 0x80000000 | ((colour >> 1) & 0x7F7F7F);
+			pixels[(y + 2) * WIDTH + x] = 0x80000000 | ((colour >> 1) & 0x7F7F7F);
+		}
+	}
+
+	cairo_surface_mark_dirty(surface);
+
+	return surface;
+}
+
+static cairo_status_t countBytes(void *closure, const unsigned char *data, unsigned int length)
+{
+	(void) data;
+
+	*(size_t *) closure += length;
+
+	return CAIRO_STATUS_SUCCESS;
+}
+
+static void report(const char *name, int frames, double seconds, size_t bytes)
+{
+	printf("%-24s %10.1f %14.0f\n", name, frames / seconds, (double) bytes / frames);
+}
+
+int main(int argc, char **argv)
+{
+	int frameCount = argc > 1 ? argc - 1 : 1;
+	cairo_surface_t **frames = malloc(frameCount * sizeof(*frames));
+	FILE *file = tmpfile();
+
+	platform_init();
+
+	for (int i = 0; i < frameCount; i++) {
+		frames[i] = argc > 1 ? cairo_image_surface_create_from_png(argv[i + 1]) : createSyntheticFrame();
+
+		if (cairo_surface_status(frames[i]) != CAIRO_STATUS_SUCCESS) {
+			fprintf(stderr, "Failed to read %s\n", argv[i + 1]);
+			return -1;
+		}
+	}
+
+	printf("%-24s %10s %14s\n", "writer", "frames/s", "bytes/frame");
+
+	{
+		int written = 0;
+		size_t bytes = 0;
+		double start = now();
+
+		while (written < MIN_FRAMES || now() - start < MIN_SECONDS) {
+			cairo_surface_write_to_png_stream(frames[written % frameCount], countBytes, &bytes);
+			written++;
+		}
+
+		report("cairo", written, now() - start, bytes);
+	}
+
+	for (unsigned i = 0; i < sizeof(SETTINGS) / sizeof(SETTINGS[0]); i++) {
+		pngWriter_t *writer = pngWriterCreate(&SETTINGS[i].options, cairo_image_surface_get_width(frames[0]),
+			cairo_image_surface_get_height(frames[0]));
+		int written = 0;
+		size_t bytes = 0;
+		double start = now();
+
+		while (written < MIN_FRAMES || now() - start < MIN_SECONDS) {
+			cairo_surface_t *frame = frames[written % frameCount];
+
+			rewind(file);
+
+			cairo_surface_flush(frame);
+			pngWriterWriteARGB32(writer, file, cairo_image_surface_get_data(frame), cairo_image_surface_get_width(frame),
+				cairo_image_surface_get_height(frame), cairo_image_surface_get_stride(frame));
+
+			bytes += ftell(file);
+			written++;
+		}
+
+		report(SETTINGS[i].name, written, now() - start, bytes);
+
+		pngWriterDestroy(writer);
+	}
+
+	for (int i = 0; i < frameCount; i++)
+		cairo_surface_destroy(frames[i]);
+	free(frames);
+	fclose(file);
+
+	return 0;
+}
@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# Decode a log to CSV on its own, then again with the GPS-merged CSV written alongside it, and check that the CSV comes
+# out the same. The IMU and current meter simulations are switched on, since the merged CSV has always fed them
+# different frame times, so this catches one output changing what another writes.
+#
+# Usage: check_merged_csv.sh <log file> [extra blackbox_decode options...]
+#
+# Set DECODE to the blackbox_decode binary to test (default ../obj/blackbox_decode).
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 <log file> [extra blackbox_decode options...]" >&2
+	exit 2
+fi
+
+DECODE=${DECODE:-$(dirname "$0")/../obj/blackbox_decode}
+LOG=$1
+shift
+
+OUTPUT=$(mktemp -d) || exit 2
+trap 'rm -rf "$OUTPUT"' EXIT
+
+mkdir "$OUTPUT/alone" "$OUTPUT/merged"
+cp "$LOG" "$OUTPUT/alone/log.bbl" && cp "$LOG" "$OUTPUT/merged/log.bbl" || exit 2
+
+SIMULATE="--simulate-imu --simulate-current-meter"
+
+"$DECODE" $SIMULATE --emit csv "$@" "$OUTPUT/alone/log.bbl" 2> /dev/null || exit 2
+"$DECODE" $SIMULATE --emit csv,merged-csv "$@" "$OUTPUT/merged/log.bbl" 2> /dev/null || exit 2
+
+files=0
+differing=0
+
+for csv in "$OUTPUT"/alone/*.csv; do
+	[ -e "$csv" ] || continue
+
+	name=$(basename "$csv")
+	files=$((files + 1))
+
+	if ! cmp -s "$csv" "$OUTPUT/merged/$name"; then
+		echo "$name differs when the merged CSV is also written"
+		differing=$((differing + 1))
+	fi
+done
+
+if [ "$files" -eq 0 ]; then
+	echo "No CSV files were written" >&2
+	exit 2
+fi
+
+echo "$files CSV files written, $differing differ when the merged CSV is also written"
+
+[ "$differing" -eq 0 ]
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Render a log with a single worker thread and then with several, and check that every frame comes out the same. The
+# workers each scroll their own copy of the graphs along between the frames they happen to be handed, so this catches
+# any difference between scrolled graphs and graphs plotted afresh.
+#
+# Usage: check_render_threads.sh <log file> [threads] [extra blackbox_render options...]
+#
+# Set RENDER to the blackbox_render binary to test (default ../obj/blackbox_render).
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 <log file> [threads] [extra blackbox_render options...]" >&2
+	exit 2
+fi
+
+RENDER=${RENDER:-$(dirname "$0")/../obj/blackbox_render}
+LOG=$1
+THREADS=${2:-4}
+shift
+[ $# -gt 0 ] && shift
+
+if [ ! -x "$RENDER" ]; then
+	echo "$RENDER hasn't been built (it needs cairo)" >&2
+	exit 2
+fi
+
+OUTPUT=$(mktemp -d) || exit 2
+trap 'rm -rf "$OUTPUT"' EXIT
+
+mkdir "$OUTPUT/single" "$OUTPUT/multi"
+
+"$RENDER" --threads 1 --prefix "$OUTPUT/single/frame" "$@" "$LOG" > /dev/null || exit 2
+"$RENDER" --threads "$THREADS" --prefix "$OUTPUT/multi/frame" "$@" "$LOG" > /dev/null || exit 2
+
+frames=0
+differing=0
+
+for frame in "$OUTPUT"/single/*.png; do
+	[ -e "$frame" ] || continue
+
+	name=$(basename "$frame")
+	frames=$((frames + 1))
+
+	if ! cmp -s "$frame" "$OUTPUT/multi/$name"; then
+		echo "$name differs between 1 and $THREADS threads"
+		differing=$((differing + 1))
+	fi
+done
+
+if [ "$frames" -eq 0 ]; then
+	echo "No frames were rendered" >&2
+	exit 2
+fi
+
+echo "$frames frames rendered, $differing differ between 1 and $THREADS threads"
+
+[ "$differing" -eq 0 ]
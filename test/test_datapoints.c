@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 
 #include "../src/datapoints.h"
@@ -10,11 +11,11 @@
 int main(void)
 {
 	char *fieldNames[] = {"Test"};
-	int32_t val;
+	int64_t val;
 
 	//First some basic tests about locating frames
 	{
-		datapoints_t *points = datapointsCreate(1, fieldNames, 2);
+		datapoints_t *points = datapointsCreate(1, fieldNames);
 
 		val = 42;
 		datapointsAddFrame(points, 3, &val);
@@ -31,13 +32,181 @@ int main(void)
 		datapointsDestroy(points);
 	}
 
+	//Searching frames with repeated times, and moving a cursor forwards and backwards through them
+	{
+		int64_t times[] = {10, 20, 20, 20, 35, 50, 50, 90};
+		int count = sizeof(times) / sizeof(times[0]);
+		datapoints_t *points = datapointsCreate(1, fieldNames);
+		datapointsCursor_t cursor;
+
+		for (int i = 0; i < count; i++) {
+			val = i;
+			datapointsAddFrame(points, times[i], &val);
+		}
+
+		assert(points->timeSorted);
+		assert(datapointsFindFrameAtTime(points, 9) == -1);
+		assert(datapointsFindFrameAtTime(points, 10) == 0);
+		assert(datapointsFindFrameAtTime(points, 20) == 3);
+		assert(datapointsFindFrameAtTime(points, 49) == 4);
+		assert(datapointsFindFrameAtTime(points, 50) == 6);
+		assert(datapointsFindFrameAtTime(points, 1000) == 7);
+
+		datapointsCursorInit(&cursor, points);
+
+		assert(datapointsCursorSeek(&cursor, 5) == -1);
+		assert(datapointsCursorSeek(&cursor, 20) == 3);
+		assert(datapointsCursorSeek(&cursor, 20) == 3);
+		assert(datapointsCursorSeek(&cursor, 89) == 6);
+		assert(datapointsCursorSeek(&cursor, 15) == 0);
+		assert(datapointsCursorSeek(&cursor, 90) == 7);
+		assert(datapointsCursorSeek(&cursor, 95) == 7);
+
+		datapointsDestroy(points);
+	}
+
+	//The cursor gives the same answers as a search, for steps of every size
+	{
+		int count = 10000;
+		datapoints_t *points = datapointsCreate(1, fieldNames);
+		datapointsCursor_t cursor;
+		int64_t time = 0;
+
+		for (int i = 0; i < count; i++) {
+			val = i;
+			time += rand() % 3 == 0 ? 0 : rand() % 200;
+			datapointsAddFrame(points, time, &val);
+		}
+
+		datapointsCursorInit(&cursor, points);
+
+		for (int64_t seek = -100; seek < time + 100; seek += rand() % (1 << (rand() % 16))) {
+			assert(datapointsCursorSeek(&cursor, seek) == datapointsFindFrameAtTime(points, seek));
+		}
+
+		datapointsDestroy(points);
+	}
+
+	//Times that go backwards can't be searched for, but we still find the frame before the first later one
+	{
+		int64_t times[] = {10, 20, 15, 30};
+		datapoints_t *points = datapointsCreate(1, fieldNames);
+		datapointsCursor_t cursor;
+
+		for (int i = 0; i < 4; i++) {
+			val = i;
+			datapointsAddFrame(points, times[i], &val);
+		}
+
+		assert(!points->timeSorted);
+		assert(datapointsFindFrameAtTime(points, 17) == 0);
+		assert(datapointsFindFrameAtTime(points, 25) == 2);
+
+		datapointsCursorInit(&cursor, points);
+		assert(datapointsCursorSeek(&cursor, 25) == 2);
+
+		datapointsDestroy(points);
+	}
+
+	//Each level of a pyramid holds the range of its buckets of frames, and notes which buckets have gaps
+	{
+		int count = 1000;
+		datapoints_t *points = datapointsCreate(1, fieldNames);
+		datapointsPyramid_t *pyramid;
+
+		for (int i = 0; i < count; i++) {
+			val = rand() % 2001 - 1000;
+			datapointsAddFrame(points, i * 100 + (i > 500 ? 1000000 : 0), &val);
+
+			if (i == 500)
+				datapointsAddGap(points);
+		}
+
+		pyramid = datapointsPyramidCreate(points, 0);
+
+		// The long gap doesn't count towards the frame interval
+		assert(pyramid->frameInterval == 100);
+		assert(pyramid->levelCount == 8);
+
+		for (int l = 0; l < pyramid->levelCount; l++) {
+			datapointsPyramidLevel_t *level = &pyramid->levels[l];
+
+			assert(level->bucketFrames == DATAPOINTS_PYRAMID_BASE_FRAMES << l);
+			assert(level->bucketCount == (count + level->bucketFrames - 1) / level->bucketFrames);
+
+			for (int bucket = 0; bucket < level->bucketCount; bucket++) {
+				int start = bucket * level->bucketFrames;
+				int64_t min = INT64_MAX, max = INT64_MIN;
+
+				for (int i = start; i < start + level->bucketFrames && i < count; i++) {
+					datapointsGetFieldAtIndex(points, i, 0, &val);
+					min = val < min ? val : min;
+					max = val > max ? val : max;
+				}
+
+				assert(level->min[bucket] == min);
+				assert(level->max[bucket] == max);
+				assert(level->hasGap[bucket] == (start <= 500 && 500 < start + level->bucketFrames));
+			}
+		}
+
+		assert(datapointsPyramidChooseLevel(pyramid, 399) == -1);
+		assert(datapointsPyramidChooseLevel(pyramid, 400) == 0);
+		assert(datapointsPyramidChooseLevel(pyramid, 5000) == 3);
+		assert(datapointsPyramidChooseLevel(pyramid, 1e9) == pyramid->levelCount - 1);
+
+		datapointsPyramidDestroy(pyramid);
+		datapointsDestroy(points);
+	}
+
+	//Values of every size read back the same across several chunks, including after they're changed
+	{
+		char *names[] = {"Constant", "Small", "Wide", "Huge"};
+		int count = DATAPOINTS_CHUNK_FRAMES * 2 + 100;
+		datapoints_t *points = datapointsCreate(4, names);
+		int64_t frame[4];
+
+		for (int i = 0; i < count; i++) {
+			frame[0] = 1500;
+			// Stays within a byte until the end of the first chunk
+			frame[1] = i < DATAPOINTS_CHUNK_FRAMES ? i % 200 - 100 : -i;
+			frame[2] = (int64_t) (i % 7) << (i % 40);
+			frame[3] = i % 2 ? INT64_MAX - i : INT64_MIN + i;
+			datapointsAddFrame(points, i, frame);
+		}
+
+		assert(points->frameCount == count);
+		assert(points->chunks[0]->columns[0].width == 0);
+		assert(points->chunks[0]->columns[1].width == 1);
+		assert(points->chunks[1]->columns[1].width == 2);
+		assert(points->chunks[0]->columns[3].width == 8);
+
+		datapointsSetFieldAtIndex(points, 5, 0, -1000000);
+		assert(points->chunks[0]->columns[0].width == 4);
+
+		for (int i = 0; i < count; i++) {
+			int64_t time;
+
+			assert(datapointsGetFrameAtIndex(points, i, &time, frame));
+			assert(time == i);
+			assert(frame[0] == (i == 5 ? -1000000 : 1500));
+			assert(frame[1] == (i < DATAPOINTS_CHUNK_FRAMES ? i % 200 - 100 : -i));
+			assert(frame[2] == (int64_t) (i % 7) << (i % 40));
+			assert(frame[3] == (i % 2 ? INT64_MAX - i : INT64_MIN + i));
+		}
+
+		assert(!datapointsGetFieldAtIndex(points, count, 0, &val));
+
+		datapointsDestroy(points);
+	}
+
 	//Test smoothing partitioning by making every value its own partition
 	{
 		datapoints_t *points;
 
 		int exampleVals[NUM_EXAMPLE_VALS] = {3, 7, 1, 28, 105, -1, 8, 13};
 
-		points = datapointsCreate(1, fieldNames, NUM_EXAMPLE_VALS + 3 /* Make it a little bigger than we'll fill to test that too */);
+		points = datapointsCreate(1, fieldNames);
 
 		for (int i = 0; i < NUM_EXAMPLE_VALS; i++) {
 			val = exampleVals[i];
@@ -63,7 +232,7 @@ int main(void)
 		int gaps[NUM_EXAMPLE_VALS] =        {0, 1, 1,  1,   0,  0,  0,  0};
 		int smoothed[NUM_EXAMPLE_VALS] =    {5, 5, 1, 28,  37, 31, 31,  6};
 
-		points = datapointsCreate(1, fieldNames, NUM_EXAMPLE_VALS);
+		points = datapointsCreate(1, fieldNames);
 
 		for (int i = 0; i < NUM_EXAMPLE_VALS; i++) {
 			val = exampleVals[i];
@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "../src/expression.h"
+
+static const char *fieldNames[] = {"loopIteration", "time", "motor[0]", "motor[1]", "gyroADC[2]"};
+#define FIELD_COUNT ((int) (sizeof(fieldNames) / sizeof(fieldNames[0])))
+
+static int64_t evaluate(const char *text, const int64_t *frame)
+{
+	char error[256];
+	expression_t *expression = expressionCompile(text, fieldNames, FIELD_COUNT, error, sizeof(error));
+	int64_t result;
+
+	if (!expression) {
+		fprintf(stderr, "%s: %s\n", text, error);
+		assert(0);
+	}
+
+	result = expressionEvaluate(expression, frame);
+
+	expressionDestroy(expression);
+
+	return result;
+}
+
+static int compiles(const char *text)
+{
+	expression_t *expression = expressionCompile(text, fieldNames, FIELD_COUNT, NULL, 0);
+
+	expressionDestroy(expression);
+
+	return expression != NULL;
+}
+
+int main(void)
+{
+	int64_t frame[] = {100, 2000000, 1950, 1200, -1600};
+
+	// Arithmetic and precedence
+	assert(evaluate("1 + 2 * 3", frame) == 7);
+	assert(evaluate("(1 + 2) * 3", frame) == 9);
+	assert(evaluate("-7 / 2", frame) == -3);
+	assert(evaluate("7 % 4", frame) == 3);
+	assert(evaluate("5 / 0", frame) == 0);
+	assert(evaluate("0x10", frame) == 16);
+	assert(evaluate("9223372036854775807", frame) == INT64_MAX);
+
+	// Fields, in both orders around a comparison
+	assert(evaluate("motor[0]", frame) == 1950);
+	assert(evaluate("motor[0] > 1900", frame) == 1);
+	assert(evaluate("1900 < motor[0]", frame) == 1);
+	assert(evaluate("motor[1] >= 1200", frame) == 1);
+	assert(evaluate("motor[1] != 1200", frame) == 0);
+	assert(evaluate("motor[0] - motor[1]", frame) == 750);
+
+	// Functions
+	assert(evaluate("abs(gyroADC[2])", frame) == 1600);
+	assert(evaluate("min(motor[0], motor[1])", frame) == 1200);
+	assert(evaluate("max(motor[0], motor[1]) == motor[0]", frame) == 1);
+
+	// Logical operators give 0 or 1 and short-circuit
+	assert(evaluate("motor[0] > 1900 || abs(gyroADC[2]) > 1500", frame) == 1);
+	assert(evaluate("motor[0] > 2000 || abs(gyroADC[2]) > 1500", frame) == 1);
+	assert(evaluate("motor[0] > 2000 || abs(gyroADC[2]) > 1700", frame) == 0);
+	assert(evaluate("motor[0] > 1900 && motor[1] > 1300", frame) == 0);
+	assert(evaluate("motor[0] && motor[1]", frame) == 1);
+	assert(evaluate("loopIteration > 50 && (motor[1] < 1000 || time > 1000000)", frame) == 1);
+	assert(evaluate("!(motor[0] > 1900)", frame) == 0);
+	assert(evaluate("1 / 0 || 0 && 1 / 0", frame) == 0);
+
+	// Errors
+	assert(!compiles(""));
+	assert(!compiles("motor[2] > 1"));
+	assert(!compiles("motor[0] >"));
+	assert(!compiles("(motor[0] > 1"));
+	assert(!compiles("motor[0] > 1)"));
+	assert(!compiles("sqrt(motor[0])"));
+	assert(!compiles("min(motor[0])"));
+	assert(!compiles("12ab"));
+	assert(!compiles("motor[0] > 9223372036854775808"));
+	assert(!compiles("0x10000000000000000"));
+
+	printf("Done\n");
+
+	return 0;
+}
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+#include "../src/fft.h"
+
+#ifndef M_PI
+	#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * Check the power spectra of a pair of random real sequences against a direct evaluation of the DFT.
+ */
+static void checkRealPairPower(int size)
+{
+	fftPlan_t *plan = fftPlanCreate(size);
+	float *re = malloc(size * sizeof(*re)), *im = malloc(size * sizeof(*im));
+	float *a = malloc(size * sizeof(*a)), *b = malloc(size * sizeof(*b));
+	float *powerA = malloc((size / 2 + 1) * sizeof(*powerA)), *powerB = malloc((size / 2 + 1) * sizeof(*powerB));
+
+	assert(plan && fftPlanGetSize(plan) == size);
+
+	for (int i = 0; i < size; i++) {
+		a[i] = re[i] = rand() / (float) RAND_MAX - 0.5f;
+		b[i] = im[i] = rand() / (float) RAND_MAX - 0.5f;
+	}
+
+	fftRealPairPower(plan, re, im, powerA, powerB);
+
+	for (int k = 0; k <= size / 2; k++) {
+		double aRe = 0, aIm = 0, bRe = 0, bIm = 0;
+
+		for (int t = 0; t < size; t++) {
+			double angle = -2 * M_PI * k * t / size;
+
+			aRe += a[t] * cos(angle);
+			aIm += a[t] * sin(angle);
+			bRe += b[t] * cos(angle);
+			bIm += b[t] * sin(angle);
+		}
+
+		assert(fabs(aRe * aRe + aIm * aIm - powerA[k]) < 1e-4 * (1 + aRe * aRe + aIm * aIm));
+		assert(fabs(bRe * bRe + bIm * bIm - powerB[k]) < 1e-4 * (1 + bRe * bRe + bIm * bIm));
+	}
+
+	fftPlanDestroy(plan);
+
+	free(re);
+	free(im);
+	free(a);
+	free(b);
+	free(powerA);
+	free(powerB);
+}
+
+/**
+ * Check that the inverse transform undoes the forward one, and that the spectra of a pair of real sequences are
+ * recovered from their combined transform.
+ */
+static void checkInverseAndRealPair(int size)
+{
+	fftPlan_t *plan = fftPlanCreate(size);
+	float *re = malloc(size * sizeof(*re)), *im = malloc(size * sizeof(*im));
+	float *a = malloc(size * sizeof(*a)), *b = malloc(size * sizeof(*b));
+	float *aRe = malloc((size / 2 + 1) * sizeof(*aRe)), *aIm = malloc((size / 2 + 1) * sizeof(*aIm));
+	float *bRe = malloc((size / 2 + 1) * sizeof(*bRe)), *bIm = malloc((size / 2 + 1) * sizeof(*bIm));
+
+	for (int i = 0; i < size; i++) {
+		a[i] = re[i] = rand() / (float) RAND_MAX - 0.5f;
+		b[i] = im[i] = rand() / (float) RAND_MAX - 0.5f;
+	}
+
+	fftTransform(plan, re, im);
+	fftInverseTransform(plan, re, im);
+
+	for (int i = 0; i < size; i++) {
+		assert(fabs(re[i] - a[i]) < 1e-5 && fabs(im[i] - b[i]) < 1e-5);
+	}
+
+	fftRealPairTransform(plan, re, im, aRe, aIm, bRe, bIm);
+
+	// Rebuild the full spectrum of the first sequence from its half (it's conjugate-symmetric) and transform it back
+	for (int k = 0; k < size; k++) {
+		int half = k <= size / 2 ? k : size - k;
+
+		re[k] = aRe[half];
+		im[k] = k <= size / 2 ? aIm[half] : -aIm[half];
+	}
+
+	fftInverseTransform(plan, re, im);
+
+	for (int i = 0; i < size; i++) {
+		assert(fabs(re[i] - a[i]) < 1e-5 && fabs(im[i]) < 1e-5);
+	}
+
+	for (int k = 0; k <= size / 2; k++) {
+		double expectedRe = 0, expectedIm = 0;
+
+		for (int t = 0; t < size; t++) {
+			double angle = -2 * M_PI * k * t / size;
+
+			expectedRe += b[t] * cos(angle);
+			expectedIm += b[t] * sin(angle);
+		}
+
+		assert(fabs(expectedRe - bRe[k]) < 1e-3 && fabs(expectedIm - bIm[k]) < 1e-3);
+	}
+
+	fftPlanDestroy(plan);
+
+	free(re);
+	free(im);
+	free(a);
+	free(b);
+	free(aRe);
+	free(aIm);
+	free(bRe);
+	free(bIm);
+}
+
+int main(void)
+{
+	assert(!fftSizeIsValid(0));
+	assert(!fftSizeIsValid(2));
+	assert(!fftSizeIsValid(1000));
+	assert(fftSizeIsValid(1024));
+	assert(fftPlanCreate(48) == NULL);
+
+	srand(1234);
+
+	for (int size = 4; size <= 2048; size *= 2) {
+		checkRealPairPower(size);
+		checkInverseAndRealPair(size);
+	}
+
+	printf("Done\n");
+
+	return 0;
+}
@@ -0,0 +1,231 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+#include "../src/imu.h"
+
+#ifndef M_PI
+	#define M_PI 3.14159265358979323846
+#endif
+
+#define FRAME_COUNT 200000
+#define ACC_1G 2048
+// 2000 deg/s full scale on a 16-bit gyro, in radians per microsecond
+#define GYRO_SCALE ((float) (2000.0 / 32768 * M_PI / 180 * 0.000001))
+
+/**
+ * The original attitude estimator (from Baseflight) in double precision, as the reference.
+ */
+typedef struct referenceIMU_t {
+	double estG[3], estM[3], estN[3];
+	uint32_t previousTime;
+} referenceIMU_t;
+
+static void referenceRotate(double *v, const double *delta)
+{
+	double cosx = cos(delta[0]), sinx = sin(delta[0]);
+	double cosy = cos(delta[1]), siny = sin(delta[1]);
+	double cosz = cos(delta[2]), sinz = sin(delta[2]);
+	double mat[3][3], x = v[0], y = v[1], z = v[2];
+
+	mat[0][0] = cosz * cosy;
+	mat[0][1] = -cosy * sinz;
+	mat[0][2] = siny;
+	mat[1][0] = sinz * cosx + cosz * sinx * siny;
+	mat[1][1] = cosz * cosx - sinz * sinx * siny;
+	mat[1][2] = -sinx * cosy;
+	mat[2][0] = sinz * sinx - cosz * cosx * siny;
+	mat[2][1] = cosz * sinx + sinz * cosx * siny;
+	mat[2][2] = cosy * cosx;
+
+	v[0] = x * mat[0][0] + y * mat[1][0] + z * mat[2][0];
+	v[1] = x * mat[0][1] + y * mat[1][1] + z * mat[2][1];
+	v[2] = x * mat[0][2] + y * mat[1][2] + z * mat[2][2];
+}
+
+static double referenceHeading(const double *v, double roll, double pitch)
+{
+	double xh = v[0] * cos(pitch) + v[1] * sin(roll) * sin(pitch) + v[2] * sin(pitch) * cos(roll);
+	double yh = v[1] * cos(roll) - v[2] * sin(roll);
+	double heading = atan2(yh, xh);
+
+	return heading < 0 ? heading + 2 * M_PI : heading;
+}
+
+static void referenceUpdate(referenceIMU_t *imu, const int16_t *gyro, const int16_t *acc, const int16_t *mag, uint32_t time,
+	double *roll, double *pitch, double *heading)
+{
+	uint32_t deltaTime = imu->previousTime == 0 ? 1 : time - imu->previousTime;
+	double delta[3];
+	int32_t accMag = 0;
+
+	imu->previousTime = time;
+
+	for (int axis = 0; axis < 3; axis++) {
+		delta[axis] = gyro[axis] * (deltaTime * (double) GYRO_SCALE);
+		accMag += (int32_t) acc[axis] * acc[axis];
+	}
+	accMag = accMag * 100 / (ACC_1G * ACC_1G);
+
+	referenceRotate(imu->estG, delta);
+
+	if (72 < (uint16_t) accMag && (uint16_t) accMag < 133) {
+		for (int axis = 0; axis < 3; axis++)
+			imu->estG[axis] = (imu->estG[axis] * 600 + acc[axis]) / 601;
+	}
+
+	*roll = atan2(imu->estG[1], imu->estG[2]);
+	*pitch = atan2(-imu->estG[0], sqrt(imu->estG[1] * imu->estG[1] + imu->estG[2] * imu->estG[2]));
+
+	if (mag) {
+		referenceRotate(imu->estM, delta);
+
+		for (int axis = 0; axis < 3; axis++)
+			imu->estM[axis] = (imu->estM[axis] * 250 + mag[axis]) / 251;
+
+		*heading = referenceHeading(imu->estM, *roll, *pitch);
+	} else {
+		double length;
+
+		referenceRotate(imu->estN, delta);
+
+		length = sqrt(imu->estN[0] * imu->estN[0] + imu->estN[1] * imu->estN[1] + imu->estN[2] * imu->estN[2]);
+
+		for (int axis = 0; axis < 3; axis++)
+			imu->estN[axis] /= length;
+
+		*heading = referenceHeading(imu->estN, *roll, *pitch);
+	}
+}
+
+static double angleError(double a, double b)
+{
+	double error = fabs(a - b);
+
+	return error > M_PI ? 2 * M_PI - error : error;
+}
+
+/**
+ * Simulate a flight with tumbling gyros, an accelerometer that's sometimes outside of the range the filter trusts, and
+ * an occasional gap in the log that's long enough to need the full sine/cosine instead of the small-angle series.
+ */
+static void makeFlight(uint32_t *time, int16_t *gyro[3], int16_t *acc[3], int16_t *mag[3], int count)
+{
+	uint32_t t = 1000000;
+
+	for (int i = 0; i < count; i++) {
+		double phase = i * 0.0005;
+
+		t += i % 5000 == 4999 ? 100000 : 125;
+		time[i] = t;
+
+		for (int axis = 0; axis < 3; axis++) {
+			gyro[axis][i] = (int16_t) (8000 * sin(phase * (axis + 1) + axis) + rand() % 200 - 100);
+			mag[axis][i] = (int16_t) (300 * cos(phase * 0.3 + axis * 2) + rand() % 20 - 10);
+		}
+
+		acc[0][i] = (int16_t) (ACC_1G * 0.3 * sin(phase * 0.7) + rand() % 100 - 50);
+		acc[1][i] = (int16_t) (ACC_1G * 0.3 * cos(phase * 0.9) + rand() % 100 - 50);
+		acc[2][i] = (int16_t) (ACC_1G * (i % 20000 < 2000 ? 1.8 : 0.95) + rand() % 100 - 50);
+	}
+}
+
+static void checkAgainstReference(bool withMag)
+{
+	uint32_t *time = malloc(FRAME_COUNT * sizeof(*time));
+	int16_t *gyro[3], *acc[3], *mag[3];
+	attitude_t *batch = malloc(FRAME_COUNT * sizeof(*batch)), single;
+	imuSensorColumns_t columns;
+	imuState_t singleState, batchState;
+	referenceIMU_t reference = {{0, 0, 0}, {1, 0, 0}, {1, 0, 0}, 0};
+	double maxError[3] = {0, 0, 0};
+
+	for (int axis = 0; axis < 3; axis++) {
+		gyro[axis] = malloc(FRAME_COUNT * sizeof(int16_t));
+		acc[axis] = malloc(FRAME_COUNT * sizeof(int16_t));
+		mag[axis] = malloc(FRAME_COUNT * sizeof(int16_t));
+
+		columns.gyroADC[axis] = gyro[axis];
+		columns.accSmooth[axis] = acc[axis];
+		columns.magADC[axis] = withMag ? mag[axis] : NULL;
+	}
+	columns.time = time;
+
+	makeFlight(time, gyro, acc, mag, FRAME_COUNT);
+
+	imuStateInit(&singleState);
+	imuStateInit(&batchState);
+
+	// Feed the batch in uneven pieces so that blocks start part-way through
+	for (int start = 0, length = 1; start < FRAME_COUNT; start += length, length = length * 3 % 1000 + 1) {
+		imuSensorColumns_t piece = columns;
+
+		if (length > FRAME_COUNT - start)
+			length = FRAME_COUNT - start;
+
+		piece.time += start;
+		for (int axis = 0; axis < 3; axis++) {
+			piece.gyroADC[axis] += start;
+			piece.accSmooth[axis] += start;
+			if (withMag)
+				piece.magADC[axis] += start;
+		}
+
+		imuUpdateAttitudeBatch(&batchState, &piece, length, ACC_1G, GYRO_SCALE, batch + start);
+	}
+
+	for (int i = 0; i < FRAME_COUNT; i++) {
+		int16_t frameGyro[3], frameAcc[3], frameMag[3];
+		double roll, pitch, heading;
+
+		for (int axis = 0; axis < 3; axis++) {
+			frameGyro[axis] = gyro[axis][i];
+			frameAcc[axis] = acc[axis][i];
+			frameMag[axis] = mag[axis][i];
+		}
+
+		imuUpdateAttitude(&singleState, frameGyro, frameAcc, withMag ? frameMag : NULL, time[i], ACC_1G, GYRO_SCALE, &single);
+		referenceUpdate(&reference, frameGyro, frameAcc, withMag ? frameMag : NULL, time[i], &roll, &pitch, &heading);
+
+		// The batch only differs from the single-frame update in how it rounds the sines and cosines of each rotation
+		assert(fabs(batch[i].roll - single.roll) < 1e-4);
+		assert(fabs(batch[i].pitch - single.pitch) < 1e-4);
+		assert(angleError(batch[i].heading, single.heading) < 1e-4);
+
+		if (angleError(single.roll, roll) > maxError[0])
+			maxError[0] = angleError(single.roll, roll);
+		if (angleError(single.pitch, pitch) > maxError[1])
+			maxError[1] = angleError(single.pitch, pitch);
+		if (angleError(single.heading, heading) > maxError[2])
+			maxError[2] = angleError(single.heading, heading);
+	}
+
+	printf("Max error against the reference %s magnetometer: roll %.2e, pitch %.2e, heading %.2e rad\n",
+		withMag ? "with" : "without", maxError[0], maxError[1], maxError[2]);
+
+	// About as close as the original single-precision code gets
+	assert(maxError[0] < 2e-3 && maxError[1] < 2e-3 && maxError[2] < 2e-3);
+
+	for (int axis = 0; axis < 3; axis++) {
+		free(gyro[axis]);
+		free(acc[axis]);
+		free(mag[axis]);
+	}
+	free(time);
+	free(batch);
+}
+
+int main(void)
+{
+	srand(1234);
+
+	checkAgainstReference(true);
+	checkAgainstReference(false);
+
+	printf("Done\n");
+
+	return 0;
+}
@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <zlib.h>
+
+#include "../src/platform.h"
+#include "../src/pngwriter.h"
+
+#define WIDTH 300
+#define HEIGHT 250
+// Leave some padding at the end of each row like Cairo might
+#define STRIDE (WIDTH * 4 + 16)
+
+static uint32_t readU32(const uint8_t *bytes)
+{
+	return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | bytes[3];
+}
+
+/**
+ * Decode the PNG in the file (which must be one that pngwriter could have written) into RGBA pixels.
+ */
+static void decodePNG(FILE *file, uint8_t *rgba)
+{
+	long fileSize;
+	uint8_t *png, *pos, *end, *idat, *raw;
+	size_t idatLength = 0;
+	uLongf rawLength = (uLongf) HEIGHT * (WIDTH * 4 + 1);
+	bool ended = false;
+
+	fseek(file, 0, SEEK_END);
+	fileSize = ftell(file);
+	rewind(file);
+
+	png = malloc(fileSize);
+	idat = malloc(fileSize);
+	raw = malloc(rawLength);
+
+	assert(fread(png, 1, fileSize, file) == (size_t) fileSize);
+	assert(memcmp(png, "\x89PNG\r\n\x1a\n", 8) == 0);
+
+	pos = png + 8;
+	end = png + fileSize;
+
+	while (pos < end) {
+		uint32_t length = readU32(pos);
+		const uint8_t *type = pos + 4, *data = pos + 8;
+
+		assert(!ended);
+		assert(data + length + 4 <= end);
+		assert(readU32(data + length) == crc32(0, type, length + 4));
+
+		if (memcmp(type, "IHDR", 4) == 0) {
+			assert(length == 13);
+			assert(readU32(data) == WIDTH && readU32(data + 4) == HEIGHT);
+			assert(memcmp(data + 8, "\x08\x06\x00\x00\x00", 5) == 0);
+		} else if (memcmp(type, "IDAT", 4) == 0) {
+			memcpy(idat + idatLength, data, length);
+			idatLength += length;
+		} else {
+			assert(memcmp(type, "IEND", 4) == 0);
+			ended = true;
+		}
+
+		pos += length + 12;
+	}
+	assert(ended);
+
+	// This checks the zlib header and the Adler-32 of the joined stripes too
+	assert(uncompress(raw, &rawLength, idat, idatLength) == Z_OK);
+	assert(rawLength == (uLongf) HEIGHT * (WIDTH * 4 + 1));
+
+	for (int row = 0; row < HEIGHT; row++) {
+		const uint8_t *filtered = raw + (size_t) row * (WIDTH * 4 + 1) + 1;
+		uint8_t *current = rgba + (size_t) row * WIDTH * 4, *previous = current - WIDTH * 4;
+
+		for (int i = 0; i < WIDTH * 4; i++) {
+			switch (filtered[-1]) {
+				case 0:
+					current[i] = filtered[i];
+				break;
+				case 1:
+					current[i] = filtered[i] + (i >= 4 ? current[i - 4] : 0);
+				break;
+				case 2:
+					current[i] = filtered[i] + (row > 0 ? previous[i] : 0);
+				break;
+				default:
+					assert(false);
+			}
+		}
+	}
+
+	free(png);
+	free(idat);
+	free(raw);
+}
+
+int main(void)
+{
+	uint8_t *image = malloc(STRIDE * HEIGHT);
+	uint8_t *expected = malloc(WIDTH * HEIGHT * 4), *decoded = malloc(WIDTH * HEIGHT * 4);
+	int levels[] = {0, 1, 6, 9};
+	int stripeCounts[] = {1, 2, 7, 1000};
+
+	platform_init();
+
+	// A transparent background with some flat opaque and translucent areas, and some noise
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			uint32_t a, r, g, b;
+			uint8_t *straight = expected + (y * WIDTH + x) * 4;
+
+			if (y % 50 < 10) {
+				a = 0;
+			} else if (x < 100) {
+				a = 255;
+			} else if (x < 200) {
+				a = 128;
+			} else {
+				a = rand() % 256;
+			}
+
+			r = rand() % (a + 1);
+			g = x % 256 * a / 255;
+			b = y % 256 * a / 255;
+
+			*(uint32_t *) (image + y * STRIDE + x * 4) = (a << 24) | (r << 16) | (g << 8) | b;
+
+			if (a == 0) {
+				memset(straight, 0, 4);
+			} else {
+				straight[0] = (r * 255 + a / 2) / a;
+				straight[1] = (g * 255 + a / 2) / a;
+				straight[2] = (b * 255 + a / 2) / a;
+				straight[3] = a;
+			}
+		}
+	}
+
+	for (PNGFilter filter = PNG_FILTER_NONE; filter <= PNG_FILTER_UP; filter++) {
+		for (PNGStrategy strategy = PNG_STRATEGY_DEFAULT; strategy <= PNG_STRATEGY_HUFFMAN; strategy++) {
+			for (unsigned i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+				for (unsigned j = 0; j < sizeof(stripeCounts) / sizeof(stripeCounts[0]); j++) {
+					pngWriterOptions_t options = {levels[i], strategy, filter, stripeCounts[j]};
+					pngWriter_t *writer = pngWriterCreate(&options, WIDTH, HEIGHT);
+					uint32_t allocationCount = pngWriterGetAllocationCount(writer);
+
+					// Write the image twice to check that the writer can be reused without allocating anything more
+					for (int k = 0; k < 2; k++) {
+						FILE *file = tmpfile();
+
+						assert(pngWriterWriteARGB32(writer, file, image, WIDTH, HEIGHT, STRIDE));
+
+						memset(decoded, 0, WIDTH * HEIGHT * 4);
+						decodePNG(file, decoded);
+						assert(memcmp(decoded, expected, WIDTH * HEIGHT * 4) == 0);
+
+						fclose(file);
+					}
+
+					assert(pngWriterGetAllocationCount(writer) == allocationCount);
+
+					pngWriterDestroy(writer);
+				}
+			}
+		}
+	}
+
+	free(image);
+	free(expected);
+	free(decoded);
+
+	printf("Done\n");
+
+	return 0;
+}
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+#include "../src/stats.h"
+
+#define VALUE_COUNT 200000
+#define CHUNK_COUNT 7
+
+static int compareDouble(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/**
+ * Check that the sketch's estimate of quantile q lies within `tolerance` (in units of quantile) of the exact answer.
+ */
+static void checkQuantile(quantileSketch_t *sketch, const double *sorted, int count, double q, double tolerance)
+{
+	double estimate = quantileSketch_getQuantile(sketch, q);
+	int low = (int) floor((q - tolerance) * count), high = (int) ceil((q + tolerance) * count);
+
+	if (low < 0)
+		low = 0;
+	if (high > count - 1)
+		high = count - 1;
+
+	if (!(estimate >= sorted[low] && estimate <= sorted[high])) {
+		fprintf(stderr, "q %g estimate %g, expected between %g and %g\n", q, estimate, sorted[low], sorted[high]);
+		assert(0);
+	}
+}
+
+static void checkSketch(quantileSketch_t *sketch, const double *sorted, int count)
+{
+	const quantileCentroid_t *centroids;
+
+	assert(quantileSketch_getCount(sketch) == count);
+	assert(quantileSketch_getCentroids(sketch, &centroids) <= QUANTILE_SKETCH_DEFAULT_COMPRESSION);
+
+	assert(quantileSketch_getQuantile(sketch, 0) == sorted[0]);
+	assert(quantileSketch_getQuantile(sketch, 1) == sorted[count - 1]);
+
+	checkQuantile(sketch, sorted, count, 0.001, 0.0002);
+	checkQuantile(sketch, sorted, count, 0.01, 0.001);
+	checkQuantile(sketch, sorted, count, 0.5, 0.005);
+	checkQuantile(sketch, sorted, count, 0.9, 0.003);
+	checkQuantile(sketch, sorted, count, 0.99, 0.001);
+	checkQuantile(sketch, sorted, count, 0.999, 0.0002);
+}
+
+static void testSeriesStats(const double *values)
+{
+	seriesStats_t whole, merged, chunk;
+
+	seriesStats_init(&whole);
+	seriesStats_init(&merged);
+
+	for (int i = 0; i < VALUE_COUNT; i++) {
+		seriesStats_append(&whole, values[i]);
+	}
+
+	// Merging the statistics of separate chunks must give the same result as appending everything to one
+	for (int c = 0; c < CHUNK_COUNT; c++) {
+		seriesStats_init(&chunk);
+
+		for (int i = c * VALUE_COUNT / CHUNK_COUNT; i < (c + 1) * VALUE_COUNT / CHUNK_COUNT; i++) {
+			seriesStats_append(&chunk, values[i]);
+		}
+
+		seriesStats_merge(&merged, &chunk);
+	}
+
+	// Merging nothing changes nothing
+	seriesStats_init(&chunk);
+	seriesStats_merge(&merged, &chunk);
+
+	assert(seriesStats_getCount(&merged) == VALUE_COUNT);
+	assert(fabs(seriesStats_getMean(&merged) - seriesStats_getMean(&whole)) < 1e-9 * fabs(seriesStats_getMean(&whole)));
+	assert(fabs(seriesStats_getVariance(&merged) - seriesStats_getVariance(&whole)) < 1e-9 * seriesStats_getVariance(&whole));
+}
+
+static void testQuantileSketch(const double *values, double *sorted)
+{
+	quantileSketch_t whole, merged, chunk;
+
+	for (int i = 0; i < VALUE_COUNT; i++) {
+		sorted[i] = values[i];
+	}
+
+	qsort(sorted, VALUE_COUNT, sizeof(*sorted), compareDouble);
+
+	quantileSketch_init(&whole, QUANTILE_SKETCH_DEFAULT_COMPRESSION);
+
+	for (int i = 0; i < VALUE_COUNT; i++) {
+		quantileSketch_append(&whole, values[i]);
+	}
+
+	checkSketch(&whole, sorted, VALUE_COUNT);
+
+	// Sketches of separate chunks of the series must merge to give the sketch of the whole series
+	quantileSketch_init(&merged, QUANTILE_SKETCH_DEFAULT_COMPRESSION);
+	quantileSketch_init(&chunk, QUANTILE_SKETCH_DEFAULT_COMPRESSION);
+
+	for (int c = 0; c < CHUNK_COUNT; c++) {
+		quantileSketch_reset(&chunk);
+
+		for (int i = c * VALUE_COUNT / CHUNK_COUNT; i < (c + 1) * VALUE_COUNT / CHUNK_COUNT; i++) {
+			quantileSketch_append(&chunk, values[i]);
+		}
+
+		quantileSketch_merge(&merged, &chunk);
+	}
+
+	checkSketch(&merged, sorted, VALUE_COUNT);
+
+	// Small series are exact
+	quantileSketch_reset(&whole);
+
+	quantileSketch_append(&whole, 3);
+	assert(quantileSketch_getQuantile(&whole, 0.5) == 3);
+
+	quantileSketch_append(&whole, 1);
+	quantileSketch_append(&whole, 2);
+	assert(quantileSketch_getQuantile(&whole, 0.5) == 2);
+
+	quantileSketch_reset(&whole);
+	assert(isnan(quantileSketch_getQuantile(&whole, 0.5)));
+
+	quantileSketch_free(&whole);
+	quantileSketch_free(&merged);
+	quantileSketch_free(&chunk);
+}
+
+int main(void)
+{
+	double *values = malloc(VALUE_COUNT * sizeof(*values));
+	double *sorted = malloc(VALUE_COUNT * sizeof(*sorted));
+
+	// A looptime-like distribution: mostly close to 125 with a long tail of late loops
+	srand(1234);
+
+	for (int i = 0; i < VALUE_COUNT; i++) {
+		double noise = (rand() / (double) RAND_MAX - 0.5) * 4;
+
+		values[i] = rand() % 100 == 0 ? 125 + rand() % 2000 : 125 + noise;
+	}
+
+	testSeriesStats(values);
+	testQuantileSketch(values, sorted);
+
+	free(values);
+	free(sorted);
+
+	printf("Done\n");
+
+	return 0;
+}
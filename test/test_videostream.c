@@ -0,0 +1,129 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../src/platform.h"
+#include "../src/videostream.h"
+
+#define WIDTH 4
+#define HEIGHT 2
+#define FRAME_COUNT 200
+#define THREADS 4
+
+static uint32_t argbPixel(uint32_t a, uint32_t r, uint32_t g, uint32_t b)
+{
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+static void checkConversion(void)
+{
+	// Premultiplied pixels: white, black, red, half-transparent green, transparent, half-transparent grey
+	uint32_t image[HEIGHT][WIDTH] = {
+		{argbPixel(255, 255, 255, 255), argbPixel(255, 0, 0, 0), argbPixel(255, 255, 0, 0), argbPixel(128, 0, 128, 0)},
+		{argbPixel(0, 0, 0, 0), argbPixel(128, 64, 64, 64), argbPixel(255, 0, 0, 255), argbPixel(255, 128, 128, 128)}
+	};
+	uint8_t rgba[WIDTH * HEIGHT * 4], yuv[6 + WIDTH * HEIGHT * 3];
+	uint8_t *y = yuv + 6, *u = y + WIDTH * HEIGHT, *v = u + WIDTH * HEIGHT;
+
+	videoStreamConvertFrame(VIDEO_STREAM_FORMAT_RAW_RGBA, (uint8_t *) image, WIDTH * 4, WIDTH, HEIGHT, rgba);
+
+	// Alpha is un-premultiplied
+	assert(memcmp(rgba + 0, "\xFF\xFF\xFF\xFF", 4) == 0);
+	assert(memcmp(rgba + 8, "\xFF\x00\x00\xFF", 4) == 0);
+	assert(memcmp(rgba + 12, "\x00\xFF\x00\x80", 4) == 0);
+	assert(memcmp(rgba + 16, "\x00\x00\x00\x00", 4) == 0);
+	assert(memcmp(rgba + 20, "\x80\x80\x80\x80", 4) == 0);
+
+	videoStreamConvertFrame(VIDEO_STREAM_FORMAT_Y4M, (uint8_t *) image, WIDTH * 4, WIDTH, HEIGHT, yuv);
+
+	assert(memcmp(yuv, "FRAME\n", 6) == 0);
+
+	// Limited-range BT.601, composited over black
+	assert(y[0] == 235 && u[0] == 128 && v[0] == 128);
+	assert(y[1] == 16 && u[1] == 128 && v[1] == 128);
+	assert(y[2] == 82 && u[2] == 90 && v[2] == 240);
+	assert(y[4] == 16 && u[4] == 128 && v[4] == 128);
+	assert(y[6] == 41 && u[6] == 240 && v[6] == 110);
+	assert(u[7] == 128 && v[7] == 128);
+}
+
+typedef struct submitter_t {
+	videoStream_t *stream;
+	volatile uint32_t *nextFrame;
+	semaphore_t *done;
+} submitter_t;
+
+static void* submitFrames(void *arg)
+{
+	submitter_t *submitter = (submitter_t *) arg;
+	uint32_t image[HEIGHT][WIDTH];
+
+	while (1) {
+		videoStreamWaitForRoom(submitter->stream);
+
+		uint32_t frameNumber = atomic_fetch_add_u32(submitter->nextFrame, 1);
+
+		if (frameNumber >= FRAME_COUNT)
+			break;
+
+		// Take a varying amount of time over each frame so they finish out of order
+		for (volatile int spin = rand() % 100000; spin > 0; spin--) {
+		}
+
+		for (int i = 0; i < WIDTH * HEIGHT; i++)
+			image[0][i] = argbPixel(255, frameNumber & 0xFF, frameNumber >> 8, i);
+
+		videoStreamSubmitFrame(submitter->stream, frameNumber, (uint8_t *) image, WIDTH * 4);
+	}
+
+	semaphore_signal(submitter->done);
+
+	return 0;
+}
+
+static void checkOrdering(void)
+{
+	FILE *file = tmpfile();
+	videoStream_t *stream = videoStreamCreate(file, VIDEO_STREAM_FORMAT_RAW_RGBA, WIDTH, HEIGHT, 30, THREADS * 2);
+	volatile uint32_t nextFrame = 0;
+	semaphore_t done;
+	submitter_t submitter = {stream, &nextFrame, &done};
+	uint8_t frame[WIDTH * HEIGHT * 4];
+
+	semaphore_create(&done, 0);
+
+	for (int i = 0; i < THREADS; i++)
+		thread_create_detached(submitFrames, &submitter);
+
+	videoStreamWriteFrames(stream, FRAME_COUNT);
+
+	for (int i = 0; i < THREADS; i++)
+		semaphore_wait(&done);
+
+	rewind(file);
+
+	for (int i = 0; i < FRAME_COUNT; i++) {
+		assert(fread(frame, 1, sizeof(frame), file) == sizeof(frame));
+		assert(frame[0] == (i & 0xFF) && frame[1] == i >> 8);
+	}
+	assert(fgetc(file) == EOF);
+
+	videoStreamDestroy(stream);
+	semaphore_destroy(&done);
+	fclose(file);
+}
+
+int main(void)
+{
+	platform_init();
+
+	checkConversion();
+	checkOrdering();
+
+	printf("Done\n");
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../src/platform.h"
+#include "../src/workqueue.h"
+
+#define CAPACITY 3
+#define ITEMS_PER_PRODUCER 5000
+#define PRODUCERS 3
+#define CONSUMERS 2
+
+typedef struct worker_t {
+	workQueue_t *queue;
+	int index;
+	uint32_t received[PRODUCERS * ITEMS_PER_PRODUCER];
+	semaphore_t *done;
+} worker_t;
+
+static void* produce(void *arg)
+{
+	worker_t *producer = (worker_t *) arg;
+
+	// Zero is the signal to stop, so don't send that
+	for (int i = 0; i < ITEMS_PER_PRODUCER; i++)
+		workQueuePush(producer->queue, (void *) (intptr_t) (producer->index * ITEMS_PER_PRODUCER + i + 1));
+
+	semaphore_signal(producer->done);
+
+	return 0;
+}
+
+static void* consume(void *arg)
+{
+	worker_t *consumer = (worker_t *) arg;
+	int lastFromProducer[PRODUCERS];
+	intptr_t item;
+
+	for (int i = 0; i < PRODUCERS; i++)
+		lastFromProducer[i] = -1;
+
+	while ((item = (intptr_t) workQueuePop(consumer->queue)) != 0) {
+		int producer = (int) ((item - 1) / ITEMS_PER_PRODUCER), sequence = (int) ((item - 1) % ITEMS_PER_PRODUCER);
+
+		// Items from each producer come out in the order they went in
+		assert(sequence > lastFromProducer[producer]);
+		lastFromProducer[producer] = sequence;
+
+		consumer->received[item - 1]++;
+	}
+
+	semaphore_signal(consumer->done);
+
+	return 0;
+}
+
+int main(void)
+{
+	workQueue_t *queue = workQueueCreate(CAPACITY);
+	worker_t *producers = calloc(PRODUCERS, sizeof(*producers)), *consumers = calloc(CONSUMERS, sizeof(*consumers));
+	semaphore_t producerDone, consumerDone;
+
+	platform_init();
+
+	// A single thread gets back what it put in, in order
+	for (int i = 1; i <= CAPACITY; i++)
+		workQueuePush(queue, (void *) (intptr_t) i);
+	for (int i = 1; i <= CAPACITY; i++)
+		assert(workQueuePop(queue) == (void *) (intptr_t) i);
+
+	semaphore_create(&producerDone, 0);
+	semaphore_create(&consumerDone, 0);
+
+	for (int i = 0; i < CONSUMERS; i++) {
+		consumers[i].queue = queue;
+		consumers[i].done = &consumerDone;
+		thread_create_detached(consume, &consumers[i]);
+	}
+
+	for (int i = 0; i < PRODUCERS; i++) {
+		producers[i].queue = queue;
+		producers[i].index = i;
+		producers[i].done = &producerDone;
+		thread_create_detached(produce, &producers[i]);
+	}
+
+	for (int i = 0; i < PRODUCERS; i++)
+		semaphore_wait(&producerDone);
+
+	for (int i = 0; i < CONSUMERS; i++)
+		workQueuePush(queue, NULL);
+
+	for (int i = 0; i < CONSUMERS; i++)
+		semaphore_wait(&consumerDone);
+
+	// Every item was received exactly once
+	for (int item = 0; item < PRODUCERS * ITEMS_PER_PRODUCER; item++) {
+		uint32_t count = 0;
+
+		for (int i = 0; i < CONSUMERS; i++)
+			count += consumers[i].received[item];
+
+		assert(count == 1);
+	}
+
+	semaphore_destroy(&producerDone);
+	semaphore_destroy(&consumerDone);
+	workQueueDestroy(queue);
+	free(producers);
+	free(consumers);
+
+	printf("Done\n");
+
+	return 0;
+}